@@ -136,6 +136,7 @@ void binpac::CompilerContext::_beginPass(const string& module, const string& nam
     pass.module = module;
     pass.time = ::util::currentTime();
     pass.name = name;
+    pass.max_rss = options().report_times.size() ? ::util::maxResidentSetSize() : 0;
     _hilti_context->passes().push_back(pass);
 }
 
@@ -172,6 +173,8 @@ void binpac::CompilerContext::_endPass()
                                    delta, indent, pass.name, pass.module) << std::endl;
     }
 
+    _hilti_context->recordPass("binpac", pass);
+
     _hilti_context->passes().pop_back();
 }
 
@@ -4,7 +4,9 @@
 
 #include <memory>
 
+#include <dlfcn.h>
 #include <glob.h>
+#include <sys/stat.h>
 
 extern "C" {
 #include <libbinpac/libbinpac++.h>
@@ -40,6 +42,9 @@ extern "C" {
 
 // LLVM includes.
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Module.h>
 
 // Plugin includes.
 #include "Plugin.h"
@@ -63,6 +68,9 @@ using namespace binpac;
 using std::shared_ptr;
 using std::string;
 
+// Name of the global that stores the input hash in precompiled libraries.
+static const char* LibraryHashSymbol = "__bro_hilti_library_hash";
+
 static string transportToString(TransportProto p)
 	{
 	switch ( p ) {
@@ -173,6 +181,16 @@ struct bro::hilti::Pac2EventInfo
 	accessor_list expr_accessors;                   // One HILTI function per expression to access the value.
 	};
 
+// A HILTI module queued for compilation into LLVM.
+struct PendingHiltiModule
+	{
+	shared_ptr<::hilti::Module> module;		// The module to compile.
+	std::list<llvm::Module*>::iterator slot;	// Its placeholder in PIMPL::llvm_modules.
+	shared_ptr<Pac2ModuleInfo> minfo;		// The BinPAC++ module to record the result with, or null.
+	bool update_cache = false;			// True to store the result in the cache under cache_key.
+	util::cache::FileCache::Key cache_key;
+	};
+
 // Implementation of the Manager class attributes.
 struct Manager::PIMPL
 	{
@@ -201,6 +219,9 @@ struct Manager::PIMPL
 	bool pac2_to_compiler;  // If compiling scripts, raise event hooks from BinPAC++ code directly.
 	unsigned int profile;	// True to enable run-time profiling.
 	unsigned int hilti_workers;	// Number of HILTI worker threads to spawn.
+	string save_library;	// Path to save a precompiled library to, set from BifConst::Hilti::save_library.
+	string load_library;	// Path to load a precompiled library from, set from BifConst::Hilti::load_library.
+	string library_hash;	// Hash of all inputs, to validate precompiled libraries.
 
 	std::list<string> import_paths;
 	Pac2AST* pac2_ast;
@@ -221,9 +242,13 @@ struct Manager::PIMPL
 	shared_ptr<::binpac::CompilerContext>        pac2_context = nullptr;
 
 	// All compiled LLVM modules. These will eventually be linked into
-	// the final code.
+	// the final code. Entries are null for modules still queued for
+	// compilation.
 	llvm_module_list llvm_modules;
 
+	// All HILTI modules queued for compilation into LLVM.
+	std::list<PendingHiltiModule> pending_modules;
+
 	// All HILTI modules (loaded and compiled, including
 	// intermediaries.). This is for debugging/printing only, they won't
 	// be used further.
@@ -236,6 +261,9 @@ struct Manager::PIMPL
 	// The execution engine used for JITing llvm_linked_module.
 	llvm::ExecutionEngine* llvm_execution_engine;
 
+	// The precompiled library used instead of the JIT, if any.
+	void* library_handle;
+
 	// Pointers to compiled script functions indxed by their unique ID.
 	std::vector<void *> native_functions;
 	};
@@ -323,6 +351,11 @@ bool Manager::InitPostScripts()
 	for ( auto t : ::util::strsplit(BifConst::Hilti::cg_debug->CheckString(), ":") )
 		cg_debug.insert(t);
 
+	std::set<string> jit_symbols;
+
+	for ( auto t : ::util::strsplit(BifConst::Hilti::jit_symbols->CheckString(), ":") )
+		jit_symbols.insert(t);
+
 	pimpl->compile_all = BifConst::Hilti::compile_all;
 	pimpl->compile_scripts = BifConst::Hilti::compile_scripts;
 	pimpl->profile = BifConst::Hilti::profile;
@@ -335,25 +368,48 @@ bool Manager::InitPostScripts()
 	pimpl->save_llvm = BifConst::Hilti::save_llvm;
 	pimpl->pac2_to_compiler = BifConst::Hilti::pac2_to_compiler;
 	pimpl->hilti_workers = BifConst::Hilti::hilti_workers;
+	pimpl->save_library = BifConst::Hilti::save_library->CheckString();
+	pimpl->load_library = BifConst::Hilti::load_library->CheckString();
 
 	pimpl->hilti_options->jit = true;
 	pimpl->hilti_options->debug = BifConst::Hilti::debug;
 	pimpl->hilti_options->optimize = BifConst::Hilti::optimize;
+	pimpl->hilti_options->tiered = BifConst::Hilti::tiered_jit;
+#ifdef BRO_PLUGIN_HILTI_RUNTIME_DEBUG
+	pimpl->hilti_options->runtime_debug = true;
+#endif
 	pimpl->hilti_options->profile = BifConst::Hilti::profile;
+	pimpl->hilti_options->profile_functions = BifConst::Hilti::profile_functions;
+	pimpl->hilti_options->pgo_instrument = BifConst::Hilti::pgo_instrument;
+	pimpl->hilti_options->pgo_profile = BifConst::Hilti::pgo_profile->CheckString();
+	pimpl->hilti_options->report_times = BifConst::Hilti::report_times->CheckString();
+	pimpl->hilti_options->jobs = BifConst::Hilti::compile_jobs;
 	pimpl->hilti_options->verify = ! BifConst::Hilti::no_verify;
 	pimpl->hilti_options->cg_debug = cg_debug;
+	pimpl->hilti_options->jit_symbols = jit_symbols;
 	pimpl->hilti_options->module_cache = BifConst::Hilti::use_cache ? ".cache" : "";
 
 	pimpl->pac2_options->jit = true;
 	pimpl->pac2_options->debug = BifConst::Hilti::debug;
 	pimpl->pac2_options->optimize = BifConst::Hilti::optimize;
+	pimpl->pac2_options->tiered = BifConst::Hilti::tiered_jit;
+#ifdef BRO_PLUGIN_HILTI_RUNTIME_DEBUG
+	pimpl->pac2_options->runtime_debug = true;
+#endif
 	pimpl->pac2_options->profile = BifConst::Hilti::profile;
+	pimpl->pac2_options->profile_functions = BifConst::Hilti::profile_functions;
+	pimpl->pac2_options->pgo_instrument = BifConst::Hilti::pgo_instrument;
+	pimpl->pac2_options->pgo_profile = BifConst::Hilti::pgo_profile->CheckString();
+	pimpl->pac2_options->report_times = BifConst::Hilti::report_times->CheckString();
+	pimpl->pac2_options->jobs = BifConst::Hilti::compile_jobs;
 	pimpl->pac2_options->verify = ! BifConst::Hilti::no_verify;
 	pimpl->pac2_options->cg_debug = cg_debug;
+	pimpl->pac2_options->jit_symbols = jit_symbols;
 	pimpl->pac2_options->module_cache = BifConst::Hilti::use_cache ? ".cache" : "";
 
 	pimpl->llvm_linked_module = nullptr;
 	pimpl->llvm_execution_engine = nullptr;
+	pimpl->library_handle = nullptr;
 
 	for ( auto a : pimpl->pac2_analyzers )
 		{
@@ -640,11 +696,40 @@ bool Manager::Compile()
 			}
 		}
 
+	if ( pimpl->save_library.size() || pimpl->load_library.size() )
+		{
+		if ( pimpl->compile_scripts )
+			{
+			reporter::error("precompiled libraries are not supported with Hilti::compile_scripts");
+			return false;
+			}
+
+		pimpl->library_hash = HashForLinkedModule();
+		}
+
+	// See if we can short-cut this all by loading a precompiled library.
+	if ( pimpl->load_library.size() )
+		{
+		auto handle = LoadLibrary(pimpl->load_library);
+
+		if ( handle )
+			{
+			auto result = RunLibrary(handle);
+			RegisterAnalyzers();
+			return result;
+			}
+		}
+
 	// See if we can short-cut this all by reusing our cache.
 	auto llvm_module = CheckCacheForLinkedModule();
 
 	if ( llvm_module )
+		{
+		if ( pimpl->save_library.size() && ! SaveLibrary(llvm_module, pimpl->save_library) )
+			return false;
+
 		return RunJIT(llvm_module);
+		}
 
 	// Create the pac2 hooks and accessor functions.
 	for ( auto ev : pimpl->pac2_events )
@@ -681,22 +766,22 @@ bool Manager::Compile()
 		if ( m->cached )
 			continue;
 
-		// Compile the *.pac2 module itself.
-        shared_ptr<::hilti::Module> hilti_module_out;
-		auto llvm_module = m->context->compile(m->module, &hilti_module_out);
+		// Compile the *.pac2 module itself into HILTI, leaving the
+		// HILTI module for later.
+		shared_ptr<::hilti::Module> hilti_module_out;
+		m->context->compile(m->module, &hilti_module_out, true);
 
-		if ( ! llvm_module )
+		if ( ! hilti_module_out )
 			return false;
 
-		if ( pimpl->save_hilti && hilti_module_out )
+		if ( pimpl->save_hilti )
 			{
 			ofstream out(::util::fmt("bro.pac2.%s.hlt", hilti_module_out->id()->name()));
 			pimpl->hilti_context->print(hilti_module_out, out);
 			out.close();
 			}
 
-		pimpl->llvm_modules.push_back(llvm_module);
-		m->llvm_modules.push_back(llvm_module);
+		QueueHiltiModule(hilti_module_out, m);
 
 		// Compile the generated hooks *.pac2 module.
 		if ( pimpl->dump_code_pre_finalize )
@@ -718,16 +803,13 @@ bool Manager::Compile()
 			pimpl->pac2_context->print(m->pac2_module, std::cerr);
 			}
 
-		llvm_module = pimpl->pac2_context->compile(m->pac2_module, &m->pac2_hilti_module);
+		pimpl->pac2_context->compile(m->pac2_module, &m->pac2_hilti_module, true);
 
-		if ( ! llvm_module )
+		if ( ! m->pac2_hilti_module )
 			return false;
 
-		pimpl->llvm_modules.push_back(llvm_module);
-		m->llvm_modules.push_back(llvm_module);
-
-		if ( m->pac2_hilti_module )
-			pimpl->hilti_modules.push_back(m->pac2_hilti_module);
+		pimpl->hilti_modules.push_back(m->pac2_hilti_module);
+		QueueHiltiModule(m->pac2_hilti_module, m);
 
 		if ( pimpl->save_pac2 )
 			{
@@ -778,8 +860,6 @@ bool Manager::Compile()
 
 	pimpl->hilti_modules.push_back(libbro);
 
-	llvm::Module* llvm_libbro = nullptr;
-
 	util::cache::FileCache::Key libbro_key;
 	libbro_key.scope = "bc";
 	libbro_key.name = "LibBro";
@@ -789,22 +869,9 @@ bool Manager::Compile()
 	auto lms = pimpl->hilti_context->checkCache(libbro_key);
 
 	if ( lms.size() )
-		llvm_libbro = lms.front();
-
+		pimpl->llvm_modules.push_back(lms.front());
 	else
-		{
-		llvm_libbro = pimpl->hilti_context->compile(libbro);
-
-		if ( ! llvm_libbro )
-			{
-			reporter::error("compiling LibBro library module failed");
-			return false;
-			}
-
-		pimpl->hilti_context->updateCache(libbro_key, llvm_libbro);
-		}
-
-	pimpl->llvm_modules.push_back(llvm_libbro);
+		QueueHiltiModule(libbro, nullptr, &libbro_key);
 
 	// Compile all the *.hlt modules.
 	for ( auto m : pimpl->pac2_modules )
@@ -834,18 +901,7 @@ bool Manager::Compile()
 		pimpl->hilti_context->importModule(std::make_shared<::hilti::ID>("LibBro"));
 		pimpl->hilti_context->finalize(hilti_module);
 
-		auto llvm_hilti_module = m->hilti_context->compile(hilti_module);
-
-		if ( ! llvm_hilti_module )
-			{
-			reporter::error("compiling LibBro library module failed");
-			return false;
-			}
-
-		pimpl->llvm_modules.push_back(llvm_hilti_module);
-		m->llvm_modules.push_back(llvm_hilti_module);
-
-		pimpl->hilti_context->updateCache(m->key, m->llvm_modules);
+		QueueHiltiModule(hilti_module, m);
 		}
 
 	if ( pimpl->save_hilti )
@@ -864,6 +920,9 @@ bool Manager::Compile()
 	if ( ! CompileHiltiModule(glue) )
 		return false;
 
+	if ( ! CompileQueuedHiltiModules() )
+		return false;
+
 	// Compile and link all the HILTI modules into LLVM. We use the
 	// BinPAC++ context here to make sure we gets its additional
 	// libraries linked.
@@ -887,13 +946,25 @@ bool Manager::Compile()
 
 	llvm_module->setModuleIdentifier("__bro_linked__");
 
-	pimpl->llvm_linked_module = llvm_module;
 	pimpl->hilti_context->updateCache(CacheKeyForLinkedModule(), llvm_module);
 
+	if ( pimpl->save_library.size() && ! SaveLibrary(llvm_module, pimpl->save_library) )
+		return false;
+
 	auto result = RunJIT(llvm_module);
 	PLUGIN_DBG_LOG(HiltiPlugin, "Done with compilation");
 
+	RegisterAnalyzers();
+	return result;
+	}
+
+bool Manager::WriteTimesReport()
+	{
+	return pimpl->hilti_context->writeTimesReport();
+	}
 
+void Manager::RegisterAnalyzers()
+	{
 	PLUGIN_DBG_LOG(HiltiPlugin, "Registering analyzers through events");
 
 	for ( auto a : pimpl->pac2_analyzers )
@@ -919,8 +990,6 @@ bool Manager::Compile()
 			mgr.QueueEvent(handler, vals);
 			}
 		}
-
-	return result;
 	}
 
 bool Manager::CompileBroScripts()
@@ -939,23 +1008,73 @@ bool Manager::CompileBroScripts()
 bool Manager::CompileHiltiModule(std::shared_ptr<::hilti::Module> m)
 	{
 	// TODO: Add caching.
-	auto lm = pimpl->hilti_context->compile(m);
+	QueueHiltiModule(m);
+	pimpl->hilti_modules.push_back(m);
+	return true;
+	}
+
+void Manager::QueueHiltiModule(shared_ptr<::hilti::Module> m, shared_ptr<Pac2ModuleInfo> minfo, const util::cache::FileCache::Key* cache_key)
+	{
+	PendingHiltiModule pending;
+	pending.module = m;
+	pending.slot = pimpl->llvm_modules.insert(pimpl->llvm_modules.end(), nullptr);
+	pending.minfo = minfo;
+
+	if ( cache_key )
+		{
+		pending.update_cache = true;
+		pending.cache_key = *cache_key;
+		}
+
+	pimpl->pending_modules.push_back(pending);
+	}
+
+bool Manager::CompileQueuedHiltiModules()
+	{
+	PLUGIN_DBG_LOG(HiltiPlugin, "Compiling %lu HILTI modules into LLVM", pimpl->pending_modules.size());
+
+	std::list<shared_ptr<::hilti::Module>> modules;
 
-	if ( ! lm )
+	for ( auto p : pimpl->pending_modules )
+		modules.push_back(p.module);
+
+	auto lms = pimpl->hilti_context->compile(modules);
+
+	if ( lms.size() != modules.size() )
 		{
-		reporter::error(::util::fmt("compiling script module %s failed", m->id()->name()));
+		reporter::error("compiling HILTI modules failed");
 		return false;
 		}
 
-	if ( pimpl->save_llvm )
+	auto lm = lms.begin();
+
+	for ( auto p : pimpl->pending_modules )
 		{
-		ofstream out(::util::fmt("bro.%s.ll", m->id()->name()));
-		pimpl->hilti_context->printBitcode(lm, out);
-		out.close();
+		*p.slot = *lm;
+
+		if ( p.minfo )
+			p.minfo->llvm_modules.push_back(*lm);
+
+		if ( p.update_cache )
+			pimpl->hilti_context->updateCache(p.cache_key, *lm);
+
+		if ( pimpl->save_llvm )
+			{
+			ofstream out(::util::fmt("bro.%s.ll", p.module->id()->name()));
+			pimpl->hilti_context->printBitcode(*lm, out);
+			out.close();
+			}
+
+		++lm;
 		}
 
-	pimpl->llvm_modules.push_back(lm);
-	pimpl->hilti_modules.push_back(m);
+	for ( auto m : pimpl->pac2_modules )
+		{
+		if ( ! m->cached )
+			pimpl->hilti_context->updateCache(m->key, m->llvm_modules);
+		}
+
+	pimpl->pending_modules.clear();
 	return true;
 	}
 
@@ -973,20 +1092,56 @@ bool Manager::RunJIT(llvm::Module* llvm_module)
 		return false;
 		}
 
+	pimpl->llvm_linked_module = llvm_module;
 	pimpl->llvm_execution_engine = ee;
 
 	PLUGIN_DBG_LOG(HiltiPlugin, "Initializing HILTI runtime");
 
+	ConfigureRuntime();
+	hlt_init_jit(hilti_context, llvm_module, ee);
+	binpac_init();
+	binpac_init_jit(hilti_context, llvm_module, ee);
+
+	return StartCompiledCode();
+	}
+
+bool Manager::RunLibrary(void* handle)
+	{
+	PLUGIN_DBG_LOG(HiltiPlugin, "Running precompiled library");
+
+	pimpl->library_handle = handle;
+
+	PLUGIN_DBG_LOG(HiltiPlugin, "Initializing HILTI runtime");
+
+	ConfigureRuntime();
+	hlt_init_library(handle);
+	binpac_init();
+	binpac_init_library(handle);
+
+	return StartCompiledCode();
+	}
+
+void Manager::ConfigureRuntime()
+	{
 	hlt_config cfg = *hlt_config_get();
 	cfg.fiber_stack_size = 5000 * 1024;
 	cfg.profiling = pimpl->profile;
 	cfg.num_workers = pimpl->hilti_workers;
 	hlt_config_set(&cfg);
+	}
 
-	hlt_init_jit(hilti_context, llvm_module, ee);
-	binpac_init();
-	binpac_init_jit(hilti_context, llvm_module, ee);
+void* Manager::NativeFunction(const string& symbol)
+	{
+	if ( pimpl->library_handle )
+		return dlsym(pimpl->library_handle, symbol.c_str());
 
+	return pimpl->hilti_context->nativeFunction(pimpl->llvm_linked_module,
+						    pimpl->llvm_execution_engine,
+						    symbol);
+	}
+
+bool Manager::StartCompiledCode()
+	{
 	PLUGIN_DBG_LOG(HiltiPlugin, "Retrieving binpac_parsers() function");
 
 #ifdef BRO_PLUGIN_HAVE_PROFILING
@@ -994,7 +1149,7 @@ bool Manager::RunJIT(llvm::Module* llvm_module)
 #endif
 
 	typedef hlt_list* (*binpac_parsers_func)(hlt_exception** excpt, hlt_execution_context* ctx);
-	auto binpac_parsers = (binpac_parsers_func)hilti_context->nativeFunction(llvm_module, ee, "binpac_parsers");
+	auto binpac_parsers = (binpac_parsers_func)NativeFunction("binpac_parsers");
 
 #ifdef BRO_PLUGIN_HAVE_PROFILING
 	profile_update(PROFILE_JIT_LAND, PROFILE_STOP);
@@ -1030,9 +1185,7 @@ bool Manager::RunJIT(llvm::Module* llvm_module)
 			auto symbol = i.first;
 			auto func = i.second;
 
-			auto native = pimpl->hilti_context->nativeFunction(pimpl->llvm_linked_module,
-									 pimpl->llvm_execution_engine,
-									 symbol);
+			auto native = NativeFunction(symbol);
 
 			auto id = func->GetUniqueFuncID();
 
@@ -1137,6 +1290,110 @@ llvm::Module* Manager::CheckCacheForLinkedModule()
 	return llvm_module;
 	}
 
+string Manager::HashForLinkedModule()
+	{
+	// Unlike the cache, we hash content rather than relying on
+	// modification times, so that a library remains valid when
+	// deployed to other systems along with its inputs.
+	util::cache::FileCache::Key key;
+	pimpl->pac2_context->options().toCacheKey(&key);
+
+	string data = ::util::fmt("hilti %s binpac++ %s options %s\n", ::hilti::version(), ::binpac::version(), key.options);
+
+	// The plugin itself is too large to hash on every startup; its size
+	// along with the versions above will have to do.
+	struct stat st;
+	auto plugin = HiltiPlugin.PluginPath();
+
+	if ( stat(plugin.c_str(), &st) == 0 )
+		data += ::util::fmt("plugin %lu\n", (unsigned long)st.st_size);
+
+	std::set<string> files;
+
+	for ( auto m : pimpl->pac2_modules )
+		{
+		if ( m->path != "-" )
+			files.insert(m->path);
+
+		for ( auto d : pimpl->pac2_context->dependencies(m->module) )
+			files.insert(d);
+		}
+
+	for ( auto f : pimpl->evt_files )
+		files.insert(f);
+
+	files.insert(pimpl->libbro_path);
+
+	for ( auto f : files )
+		{
+		std::ifstream in(f);
+
+		if ( ! in )
+			{
+			reporter::error(::util::fmt("cannot open %s for hashing", f));
+			return "";
+			}
+
+		data += ::util::fmt("file %s %s\n", ::util::basename(f), util::cache::hash(in));
+		}
+
+	// Code for events without handlers gets skipped unless
+	// compile_all is set.
+	for ( auto ev : pimpl->pac2_events )
+		data += ::util::fmt("event %s %d\n", ev->name, WantEvent(ev));
+
+	return util::cache::hash(data);
+	}
+
+void* Manager::LoadLibrary(const string& path)
+	{
+	PLUGIN_DBG_LOG(HiltiPlugin, "Loading precompiled library %s", path.c_str());
+
+	if ( pimpl->library_hash.empty() )
+		return nullptr;
+
+	auto handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+	if ( ! handle )
+		{
+		reporter::warning(::util::fmt("cannot load precompiled library, compiling instead (%s)", dlerror()));
+		return nullptr;
+		}
+
+	auto hash = (const char*)dlsym(handle, LibraryHashSymbol);
+
+	if ( ! hash || pimpl->library_hash != hash )
+		{
+		reporter::warning(::util::fmt("precompiled library %s does not match inputs, compiling instead", path));
+		dlclose(handle);
+		return nullptr;
+		}
+
+	return handle;
+	}
+
+bool Manager::SaveLibrary(llvm::Module* llvm_module, const string& path)
+	{
+	PLUGIN_DBG_LOG(HiltiPlugin, "Saving precompiled library %s", path.c_str());
+
+	if ( pimpl->library_hash.empty() )
+		return false;
+
+	if ( ! llvm_module->getNamedGlobal(LibraryHashSymbol) )
+		{
+		auto hash = llvm::ConstantDataArray::getString(llvm_module->getContext(), pimpl->library_hash);
+		new llvm::GlobalVariable(*llvm_module, hash->getType(), true, llvm::GlobalValue::ExternalLinkage, hash, LibraryHashSymbol);
+		}
+
+	if ( ! pimpl->hilti_context->writeSharedLibrary(llvm_module, path) )
+		{
+		reporter::error(::util::fmt("cannot write precompiled library %s", path));
+		return false;
+		}
+
+	return true;
+	}
+
 bool Manager::LoadPac2Module(const string& path)
 	{
 	std::ifstream in(path);
@@ -2854,8 +3111,7 @@ bool Manager::RuntimeRaiseEvent(Event* event)
 	// calls to speed it up, unless that method itself is already as fast
 	// as we would that get that way.
 
-	assert(pimpl->llvm_linked_module);
-	assert(pimpl->llvm_execution_engine);
+	assert(pimpl->llvm_execution_engine || pimpl->library_handle);
 
 	auto id = func->GetUniqueFuncID();
 
@@ -2871,9 +3127,7 @@ bool Manager::RuntimeRaiseEvent(Event* event)
 		// First try again to get it, it could be a custom user
 		// function that we haven't used yet.
 		auto symbol = pimpl->compiler->HiltiStubSymbol(func, nullptr, true);
-		native = pimpl->hilti_context->nativeFunction(pimpl->llvm_linked_module,
-							      pimpl->llvm_execution_engine,
-							      symbol);
+		native = NativeFunction(symbol);
 
 		if ( native )
 			pimpl->native_functions[id] = native;
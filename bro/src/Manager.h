@@ -157,6 +157,15 @@ public:
 	 */
 	bool Compile();
 
+	/**
+	 * Writes out the report on compilation times and memory requested
+	 * via Hilti::report_times, if any. This should be called only after
+	 * Compile().
+	 *
+	 * @return True if successful.
+	 */
+	bool WriteTimesReport();
+
 	/**
 	 * Dumps a debug summary to stderr. This should be called only after
 	 * Compile().
@@ -463,6 +472,42 @@ protected:
 	 */
 	bool RunJIT(llvm::Module* llvm_module);
 
+	/**
+	 * Executes the code of a precompiled library, as an alternative to
+	 * RunJIT().
+	 *
+	 * @param handle The library's handle as returned by LoadLibrary().
+	 */
+	bool RunLibrary(void* handle);
+
+	/**
+	 * Sets up the HILTI runtime configuration before initializing the
+	 * runtime.
+	 */
+	void ConfigureRuntime();
+
+	/**
+	 * Runs the initialization of the compiled code once the runtime is
+	 * up, no matter if it's JITed or coming from a precompiled library.
+	 */
+	bool StartCompiledCode();
+
+	/**
+	 * Returns a pointer to a compiled function, taking it from either the
+	 * JIT or a precompiled library, whichever is in use.
+	 *
+	 * @param symbol The name of the function.
+	 *
+	 * @return The function, or null if not found.
+	 */
+	void* NativeFunction(const std::string& symbol);
+
+	/**
+	 * Queues events telling Bro's analyzer manager which ports and MIME
+	 * types to associate with our analyzers.
+	 */
+	void RegisterAnalyzers();
+
 	/**
 	 * Returns the cache key to use for looking up / storing the final
 	 * linked module.
@@ -476,11 +521,67 @@ protected:
 	 */
 	llvm::Module* CheckCacheForLinkedModule();
 
+	/**
+	 * Returns a hash over all the inputs that determine the final linked
+	 * module. This is used to validate precompiled libraries. Returns an
+	 * empty string on error.
+	 */
+	std::string HashForLinkedModule();
+
+	/**
+	 * Loads a precompiled library previously written by SaveLibrary(),
+	 * if it matches the current inputs.
+	 *
+	 * @param path The path of the library.
+	 *
+	 * @return The library's handle, or null if it couldn't be loaded or
+	 * doesn't match, in which case a warning has been reported.
+	 */
+	void* LoadLibrary(const std::string& path);
+
+	/**
+	 * Compiles the final linked module ahead of time into a shared
+	 * library that future runs can load via LoadLibrary() instead of
+	 * compiling everything.
+	 *
+	 * @param llvm_module The linked module. Receives the hash of the
+	 * inputs, but remains usable with RunJIT() otherwise.
+	 *
+	 * @param path The path of the library to write.
+	 *
+	 * @return True if successful.
+	 */
+	bool SaveLibrary(llvm::Module* llvm_module, const std::string& path);
+
 	/**
 	 * XXX
 	 */
 	bool CompileHiltiModule(std::shared_ptr<::hilti::Module> m);
 
+	/**
+	 * Queues a HILTI module for compilation into LLVM by
+	 * CompileQueuedHiltiModules(), reserving its position among the
+	 * modules to link.
+	 *
+	 * @param m The module to compile. It must have been finalized.
+	 *
+	 * @param minfo If given, the compiled module will be recorded with
+	 * this BinPAC++ module for caching.
+	 *
+	 * @param cache_key If given, the compiled module will be stored in
+	 * the cache under this key.
+	 */
+	void QueueHiltiModule(shared_ptr<::hilti::Module> m, shared_ptr<Pac2ModuleInfo> minfo = nullptr, const util::cache::FileCache::Key* cache_key = nullptr);
+
+	/**
+	 * Compiles all modules queued by QueueHiltiModule() into LLVM, using
+	 * as many threads as Hilti::compile_jobs permits. Afterwards, updates
+	 * the cache for all BinPAC++ modules that weren't found in there.
+	 *
+	 * @return True if successful.
+	 */
+	bool CompileQueuedHiltiModules();
+
 	/**
 	 * XXX
 	 */
@@ -11,6 +11,10 @@
 #include "Event.h"
 #include "RuntimeInterface.h"
 
+extern "C" {
+#include <libhilti/pgo.h>
+}
+
 #ifdef BRO_PLUGIN_CHECK_LEAKS
 #include <google/heap-checker.h>
 static HeapLeakChecker* heap_checker = nullptr;
@@ -86,6 +90,9 @@ void plugin::Bro_Hilti::Plugin::InitPostScript()
 	if ( ! _manager->Compile() )
 		exit(1);
 
+	if ( ! _manager->WriteTimesReport() )
+		exit(1);
+
 #ifdef BRO_PLUGIN_CHECK_LEAKS
 	if ( getenv("HEAPCHECK") )
 	     heap_checker = new HeapLeakChecker("bro-hilti");
@@ -99,6 +106,10 @@ void plugin::Bro_Hilti::Plugin::InitPostScript()
 
 void plugin::Bro_Hilti::Plugin::Done()
 	{
+	// We don't shut down libhilti, so write out the PGO profile (if any)
+	// here.
+	hlt_pgo_dump();
+
 #ifdef BRO_PLUGIN_CHECK_LEAKS
 	if ( heap_checker )
 		{
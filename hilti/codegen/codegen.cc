@@ -12,12 +12,14 @@
 #include "unpacker.h"
 #include "packer.h"
 #include "field-builder.h"
+#include "dfa-compiler.h"
 #include "coercer.h"
 #include "stmt-builder.h"
 #include "type-builder.h"
 #include "abi.h"
 #include "debug-info-builder.h"
 #include "../passes/collector.h"
+#include "../passes/optimize-refcounts.h"
 #include "../builder/nodes.h"
 
 #include "libhilti/enum.h"
@@ -25,12 +27,13 @@
 using namespace hilti;
 using namespace codegen;
 
-CodeGen::CodeGen(CompilerContext* ctx, const path_list& libdirs)
+CodeGen::CodeGen(CompilerContext* ctx, const path_list& libdirs, llvm::LLVMContext* llvm_context)
     : _loader(new Loader(this)),
       _storer(new Storer(this)),
       _unpacker(new Unpacker(this)),
       _packer(new Packer(this)),
       _field_builder(new FieldBuilder(this)),
+      _dfa_compiler(new DFACompiler(this)),
       _stmt_builder(new StatementBuilder(this)),
       _coercer(new Coercer(this)),
       _type_builder(new TypeBuilder(this)),
@@ -39,6 +42,7 @@ CodeGen::CodeGen(CompilerContext* ctx, const path_list& libdirs)
 {
     _ctx = ctx;
     _libdirs = libdirs;
+    _llvm_context = llvm_context ? llvm_context : &llvm::getGlobalContext();
     setLoggerName("codegen");
 }
 
@@ -1798,6 +1802,8 @@ void CodeGen::llvmBuildExitBlock()
             auto str = llvmStringFromData(string("func/") + name);
             llvmProfilerStop(str);
         }
+
+        llvmFunctionProfilerLeave();
     }
 
     if ( phi ) {
@@ -1848,15 +1854,77 @@ void CodeGen::llvmAdaptStackForSafepoint(bool pre)
     if ( ! pre )
         llvmCreateStackmap();
 
+    auto stmt = _stmt_builder->currentStatement();
+    auto state = _functions.back().get();
+    auto& carried = state->carried;
+
+    // Only the first safepoint of a statement hands references over between
+    // statements. Any further ones adjust the counts by themselves as
+    // usual.
+    bool first = (stmt && state->carried_stmt != stmt);
+
+    if ( first && ! pre )
+        state->carried_stmt = stmt;
+
+    // Locals that the next statement protects again anyway keep their
+    // reference until then.
+    std::set<llvm::Value*> keep;
+
+    auto refcounts = hiltiModule()->refcounts();
+
+    if ( first && ! pre && refcounts && state->leave_func ) {
+        for ( auto v : refcounts->carried(stmt) )
+            keep.insert(llvmValueAddress(v->expression));
+    }
+
     for ( auto l : liveValues() ) {
         auto val = std::get<0>(l);
         auto type = std::get<1>(l);
         auto is_ptr = std::get<2>(l);
 
-        if ( pre )
+        if ( pre ) {
+            auto i = (first ? carried.find(val) : carried.end());
+
+            if ( i != carried.end() ) {
+                // Still referenced from before.
+                carried.erase(i);
+                continue;
+            }
+
             llvmCctor(val, type, is_ptr, "adapt-for-savepoint-pre");
-        else
+        }
+
+        else {
+            if ( keep.find(val) != keep.end() ) {
+                carried.insert(std::make_pair(val, std::make_tuple(type, stmt)));
+                continue;
+            }
+
             llvmDtor(val, type, is_ptr, "adapt-for-savepoint-post");
+        }
+    }
+}
+
+void CodeGen::llvmReleaseCarried(bool exception)
+{
+    auto stmt = _stmt_builder->currentStatement();
+    auto& carried = _functions.back()->carried;
+
+    for ( auto i = carried.begin(); i != carried.end(); ) {
+        auto type = std::get<0>(i->second);
+        auto from = std::get<1>(i->second);
+
+        if ( ! exception && from == stmt ) {
+            ++i;
+            continue;
+        }
+
+        llvmDtor(i->first, type, true, "release-carried");
+
+        if ( exception )
+            ++i;
+        else
+            i = carried.erase(i);
     }
 }
 
@@ -2430,6 +2498,7 @@ void CodeGen::llvmTriggerExceptionHandling(bool known_exception)
     llvmDebugPrint("hilti-flow", "exception raised");
 
     llvmBuildInstructionCleanup(false);
+    llvmReleaseCarried(true);
 
     // Sort catches from most specific to least specific.
     auto catches = _functions.back()->catches;
@@ -4122,6 +4191,16 @@ llvm::Value* CodeGen::llvmClassifierField(shared_ptr<Type> field_type, shared_pt
     return _field_builder->llvmClassifierField(field_type, src_type, src_val, l);
 }
 
+llvm::Function* CodeGen::llvmRegExpMatcher(const std::list<string>& patterns, int flags)
+{
+    return _dfa_compiler->llvmMatcher(patterns, flags);
+}
+
+llvm::GlobalVariable* CodeGen::llvmRegExpPrecompiled(const std::list<string>& patterns, int flags)
+{
+    return _dfa_compiler->llvmPrecompiled(patterns, flags);
+}
+
 llvm::Value* CodeGen::llvmClassifierField(llvm::Value* data, llvm::Value* len, llvm::Value* bits, const Location& l)
 {
     auto ft = llvmLibType("hlt.classifier.field");
@@ -4456,6 +4535,33 @@ void CodeGen::llvmProfilerUpdate(const string& tag, int64_t arg)
     llvmProfilerUpdate(ltag, larg);
 }
 
+void CodeGen::llvmFunctionProfilerEnter(const string& name)
+{
+    if ( ! options().profile_functions )
+        return;
+
+    // The runtime assigns the function its ID on first call and stores it
+    // in here.
+    auto site = llvmAddGlobal(string("fprof.") + name, llvmTypeInt(64));
+    auto frame = llvmAddTmp("fprof.frame", llvmLibType("hlt.fprof_frame"));
+
+    value_list args = { site, llvmConstAsciizPtr(name), frame };
+    llvmCallC("__hlt_fprof_enter", args, false, false);
+
+    _functions.back()->fprof_frame = frame;
+}
+
+void CodeGen::llvmFunctionProfilerLeave()
+{
+    auto frame = _functions.back()->fprof_frame;
+
+    if ( ! frame )
+        return;
+
+    value_list args = { frame };
+    llvmCallC("__hlt_fprof_leave", args, false, false);
+}
+
 string CodeGen::llvmGetModuleIdentifier(llvm::Module* module)
 {
     auto md = module->getNamedMetadata(symbols::MetaModuleName);
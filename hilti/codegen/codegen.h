@@ -83,6 +83,7 @@ class Storer;
 class Unpacker;
 class Packer;
 class FieldBuilder;
+class DFACompiler;
 class StatementBuilder;
 class TypeBuilder;
 class TypeInfoBuilder;
@@ -107,7 +108,10 @@ public:
    ///
    /// libdirs: Path where to find library modules that the code generator
    /// may need.
-   CodeGen(CompilerContext* ctx, const path_list& libdirs);
+   ///
+   /// llvm_context: The LLVM context to generate code in. If null, the
+   /// global LLVM context is used.
+   CodeGen(CompilerContext* ctx, const path_list& libdirs, llvm::LLVMContext* llvm_context = nullptr);
    virtual ~CodeGen();
 
    /// Returns the compiler context the code generator is used with.
@@ -137,7 +141,7 @@ public:
    llvm::Module* generateLLVM(shared_ptr<hilti::Module> hltmod);
 
    /// Returns the LLVM context to use with all LLVM calls.
-   llvm::LLVMContext& llvmContext() { return llvm::getGlobalContext(); }
+   llvm::LLVMContext& llvmContext() { return *_llvm_context; }
 
    /// Returns the LLVM data layout for the currently being built module.
    llvm::DataLayout* llvmDataLayout() { return _data_layout; }
@@ -1666,6 +1670,17 @@ public:
    /// XXX Ref/unref locals for get ref counts correct.
    void llvmAdaptStackForSafepoint(bool pre);
 
+   /// Releases references to live locals that llvmAdaptStackForSafepoint()
+   /// has kept beyond a safepoint because passes::OptimizeRefcounts
+   /// determined that the next statement will need them again.
+   ///
+   /// exception: If false, releases all references kept by previous
+   /// statements and forgets about them; the ones of the current statement
+   /// remain in place for its successor. If true, generates code releasing
+   /// all of them for leaving the current statement via an exception, but
+   /// keeps tracking them for the normal control flow.
+   void llvmReleaseCarried(bool exception);
+
    /// XXX Returns all values currently live with theior types.
    typedef std::tuple<llvm::Value*, shared_ptr<Type>, bool> live_value;
    typedef std::list<live_value> live_list;
@@ -2110,6 +2125,30 @@ public:
    /// the newly allocated object to the calling code.
    llvm::Value* llvmClassifierField(llvm::Value* data, llvm::Value* len, llvm::Value* bits = nullptr, const Location& l=Location::None);
 
+   /// Returns a function matching a constant regular expression natively,
+   /// without interpreting its DFA at run-time. See DFACompiler for more
+   /// information.
+   ///
+   /// patterns: The patterns of the regular expression.
+   ///
+   /// flags: The runtime's ``hlt_regexp_flags`` for the regular expression.
+   ///
+   /// Returns: The function, or null if the regular expression can't be
+   /// matched natively. In that case, the runtime will interpret the DFA.
+   llvm::Function* llvmRegExpMatcher(const std::list<string>& patterns, int flags);
+
+   /// Returns the precomputed DFAs of a constant regular expression, for
+   /// the runtime to load instead of building them. See DFACompiler for
+   /// more information.
+   ///
+   /// patterns: The patterns of the regular expression.
+   ///
+   /// flags: The runtime's ``hlt_regexp_flags`` for the regular expression.
+   ///
+   /// Returns: A global with the serialized DFAs as an array of bytes, or
+   /// null if they can't be precomputed.
+   llvm::GlobalVariable* llvmRegExpPrecompiled(const std::list<string>& patterns, int flags);
+
    /// Generates code equivalnt to a \a memcpy call.
    ///
    /// src: The source address.
@@ -2251,6 +2290,17 @@ public:
    /// arg: The argument for the update.
    void llvmProfilerUpdate(const string& tag, int64_t arg);
 
+   /// Records entering the current function for function-level profiling,
+   /// if enabled via Options::profile_functions. Must be matched by
+   /// llvmFunctionProfilerLeave() on all exit paths.
+   ///
+   /// name: The function's fully qualified name to report.
+   void llvmFunctionProfilerEnter(const string& name);
+
+   /// Records leaving the current function for function-level profiling,
+   /// if enabled via Options::profile_functions.
+   void llvmFunctionProfilerLeave();
+
    /// XXX
    void prepareCall(shared_ptr<Expression> func, shared_ptr<Expression> args, CodeGen::expr_list* call_params, bool before_call);
 
@@ -2392,6 +2442,7 @@ private:
    unique_ptr<Unpacker> _unpacker;
    unique_ptr<Packer> _packer;
    unique_ptr<FieldBuilder> _field_builder;
+   unique_ptr<DFACompiler> _dfa_compiler;
    unique_ptr<StatementBuilder> _stmt_builder;
    unique_ptr<Coercer> _coercer;
    unique_ptr<TypeBuilder>  _type_builder;
@@ -2401,6 +2452,7 @@ private:
 
    shared_ptr<hilti::Module> _hilti_module = nullptr;
    CompilerContext* _ctx = nullptr;
+   llvm::LLVMContext* _llvm_context = nullptr;
    llvm::Module* _libhilti = nullptr;
    llvm::Module* _module = nullptr;
    llvm::DataLayout* _data_layout = nullptr;
@@ -2417,6 +2469,7 @@ private:
    typedef std::map<string, std::tuple<llvm::Value*, shared_ptr<Type>, bool>> local_map;
    typedef std::multimap<shared_ptr<Statement>, std::tuple<llvm::Value*, bool, shared_ptr<Type>, bool, bool, string>> dtor_map;
    typedef std::multimap<shared_ptr<Statement>, std::tuple<shared_ptr<Expression>, string>> dtor_expr_map;
+   typedef std::map<llvm::Value*, std::tuple<shared_ptr<Type>, shared_ptr<Statement>>> carried_map;
    typedef std::list<std::pair<llvm::BasicBlock*, llvm::Value*>> exit_point_list;
 
    struct FunctionState {
@@ -2431,12 +2484,15 @@ private:
        exit_point_list exits;
        dtor_map dtors_after_ins;
        dtor_expr_map dtors_after_ins_exprs;
+       carried_map carried; // Live locals still referenced after a safepoint, with the statement that kept them.
+       shared_ptr<Statement> carried_stmt = nullptr; // Statement whose first safepoint has already been adapted.
        bool dtors_after_call; // If true, run dtors_after_ins for the current statement after next llvmCall().
        string next_comment;
        bool abort_on_excpt;
        bool is_init_func;
        llvm::Value* context;
        declaration::Function* leave_func = nullptr;
+       llvm::Value* fprof_frame = nullptr; // Set by llvmFunctionProfilerEnter().
        std::list<shared_ptr<Expression>> locals_cleared_on_excpt;
        handler_list catches;
        type::function::CallingConvention cc;
@@ -0,0 +1,317 @@
+
+#include <stddef.h>
+
+#include "../hilti.h"
+
+#include "dfa-compiler.h"
+#include "codegen.h"
+
+#include "libhilti/regexp.h"
+
+extern "C" {
+#include "libhilti/justrx/src/jrx.h"
+}
+
+using namespace hilti;
+using namespace codegen;
+
+// Largest DFA that we compile into native code.
+static const int MaxStates = 256;
+
+// Largest DFA that we precompute for the runtime.
+static const int MaxPrecompiledStates = 1024;
+
+DFACompiler::DFACompiler(CodeGen* cg)
+{
+    _cg = cg;
+}
+
+DFACompiler::~DFACompiler()
+{
+}
+
+// Returns a pointer to a field of a jrx_match_state.
+static llvm::Value* _msField(CodeGen* cg, llvm::IRBuilder<>* builder, llvm::Value* ms, size_t offset, llvm::Type* type)
+{
+    auto addr = builder->CreateConstGEP1_32(ms, offset);
+    return builder->CreateBitCast(addr, cg->llvmTypePtr(type));
+}
+
+// Generates a function that does the same as justrx' minimal matcher (i.e.,
+// _regexec_partial_min()) when matching with the given DFA. The DFA must
+// have all its states computed.
+static llvm::Function* _buildMatcher(CodeGen* cg, jrx_regex_t* re, bool first_match)
+{
+    auto& ctx = cg->llvmContext();
+    auto i8 = cg->llvmTypeInt(8);
+    auto i16 = cg->llvmTypeInt(16);
+    auto i32 = cg->llvmTypeInt(32);
+    auto i64 = cg->llvmTypeInt(64);
+    auto zero = cg->llvmConstInt(0, 32);
+
+    CodeGen::llvm_parameter_list params = {
+        std::make_pair("ms", cg->llvmTypePtr()),
+        std::make_pair("buffer", cg->llvmTypePtr()),
+        std::make_pair("len", i32),
+        std::make_pair("find_partial_matches", i32)
+    };
+
+    auto func = cg->llvmAddFunction("regexp_matcher", i32, params, true);
+    func->addFnAttr(llvm::Attribute::NoUnwind);
+
+    auto arg = func->arg_begin();
+    llvm::Value* ms = &*arg++;
+    llvm::Value* buffer = &*arg++;
+    llvm::Value* len = &*arg++;
+    llvm::Value* fpm = &*arg;
+
+    auto entry = llvm::BasicBlock::Create(ctx, "entry", func);
+    llvm::IRBuilder<> builder(entry);
+
+    // We keep the match state in locals while matching and write it back
+    // when leaving.
+    auto ms_offset = _msField(cg, &builder, ms, offsetof(jrx_match_state, offset), i32);
+    auto ms_state = _msField(cg, &builder, ms, offsetof(jrx_match_state, state), i32);
+    auto ms_previous = _msField(cg, &builder, ms, offsetof(jrx_match_state, previous), i32);
+    auto ms_acc = _msField(cg, &builder, ms, offsetof(jrx_match_state, acc), i16);
+    auto ms_consumed = _msField(cg, &builder, ms, offsetof(jrx_match_state, consumed), i32);
+
+    auto p = builder.CreateAlloca(cg->llvmTypePtr(), 0, "p");
+    auto offset = builder.CreateAlloca(i32, 0, "offset");
+    auto eo = builder.CreateAlloca(i32, 0, "eo");
+    auto acc = builder.CreateAlloca(i16, 0, "acc");
+    auto cur = builder.CreateAlloca(i32, 0, "cur");
+    auto previous = builder.CreateAlloca(i32, 0, "previous");
+
+    auto start = builder.CreateLoad(ms_offset);
+    builder.CreateStore(start, offset);
+    builder.CreateStore(start, eo);
+    builder.CreateStore(builder.CreateLoad(ms_acc), acc);
+    builder.CreateStore(builder.CreateLoad(ms_previous), previous);
+    builder.CreateStore(buffer, p);
+
+    auto end = builder.CreateGEP(buffer, builder.CreateZExt(len, i64));
+
+    auto leave = [&](llvm::Value* state, llvm::Value* off, llvm::Value* result) {
+        auto consumed = builder.CreateSub(builder.CreatePtrToInt(builder.CreateLoad(p), i64), builder.CreatePtrToInt(buffer, i64));
+        builder.CreateStore(builder.CreateTrunc(consumed, i32), ms_consumed);
+        builder.CreateStore(off, ms_offset);
+        builder.CreateStore(state, ms_state);
+        builder.CreateStore(builder.CreateLoad(previous), ms_previous);
+        builder.CreateStore(builder.CreateLoad(acc), ms_acc);
+        builder.CreateRet(result);
+    };
+
+    auto num_states = jrx_dfa_num_states(re);
+
+    std::vector<llvm::BasicBlock*> states;
+    std::vector<llvm::BasicBlock*> enters;
+
+    for ( int i = 0; i < num_states; i++ ) {
+        states.push_back(llvm::BasicBlock::Create(ctx, ::util::fmt("state_%d", i), func));
+        enters.push_back(llvm::BasicBlock::Create(ctx, ::util::fmt("enter_%d", i), func));
+    }
+
+    auto jammed = llvm::BasicBlock::Create(ctx, "jammed", func);
+
+    // Dispatch on the state we're resuming in.
+    auto dispatch = builder.CreateSwitch(builder.CreateLoad(ms_state), jammed, num_states);
+
+    for ( int i = 0; i < num_states; i++ )
+        dispatch->addCase(cg->llvmConstInt(i, 32), states[i]);
+
+    // The matcher has already jammed earlier.
+    builder.SetInsertPoint(jammed);
+    builder.CreateStore(zero, ms_consumed);
+    auto jacc = builder.CreateSExt(builder.CreateLoad(acc), i32);
+    auto jpositive = builder.CreateSelect(builder.CreateICmpSGT(jacc, zero), jacc, zero);
+    builder.CreateRet(builder.CreateSelect(builder.CreateICmpEQ(len, zero), jacc, jpositive));
+
+    for ( int i = 0; i < num_states; i++ ) {
+        auto aid = jrx_dfa_state_accept(re, i);
+        auto can_transition = jrx_dfa_state_can_transition(re, i);
+
+        auto read = llvm::BasicBlock::Create(ctx, ::util::fmt("read_%d", i), func);
+        auto exhausted = llvm::BasicBlock::Create(ctx, ::util::fmt("exhausted_%d", i), func);
+        auto nomatch = llvm::BasicBlock::Create(ctx, ::util::fmt("nomatch_%d", i), func);
+
+        // Check for end of input.
+        builder.SetInsertPoint(states[i]);
+        auto cp = builder.CreateLoad(p);
+        builder.CreateCondBr(builder.CreateICmpEQ(cp, end), exhausted, read);
+
+        // Branch to the successor state for the next byte. Note that the
+        // interpreter sees the input as signed chars, which we mimic when
+        // asking for the successors.
+        builder.SetInsertPoint(read);
+        auto byte = builder.CreateLoad(cp);
+        builder.CreateStore(builder.CreateConstGEP1_32(cp, 1), p);
+        builder.CreateStore(builder.CreateSExt(byte, i32), cur);
+
+        auto sw = builder.CreateSwitch(byte, nomatch);
+
+        for ( int c = 0; c < 256; c++ ) {
+            auto succ = jrx_dfa_state_successor(re, i, (jrx_char)(signed char)c);
+
+            if ( succ != JRX_DFA_NO_STATE )
+                sw->addCase(cg->llvmConstInt(c, 8), enters[succ]);
+        }
+
+        // No transition; done.
+        builder.SetInsertPoint(nomatch);
+
+        if ( aid ) {
+            // Accepting, jam the state.
+            builder.CreateStore(cg->llvmConstInt(aid, 16), acc);
+            leave(cg->llvmConstInt(JRX_DFA_NO_STATE, 32), builder.CreateLoad(offset), cg->llvmConstInt(aid, 32));
+        }
+
+        else {
+            auto nacc = builder.CreateSExt(builder.CreateLoad(acc), i32);
+            auto result = builder.CreateSelect(builder.CreateICmpSGT(nacc, zero), nacc, zero);
+            leave(cg->llvmConstInt(i, 32), builder.CreateLoad(eo), result);
+        }
+
+        // End of input. Report a partial match if more input could still
+        // change the result.
+        builder.SetInsertPoint(exhausted);
+        llvm::Value* result = builder.CreateSExt(builder.CreateLoad(acc), i32);
+
+        if ( can_transition ) {
+            auto partial = builder.CreateICmpEQ(fpm, zero);
+            result = builder.CreateSelect(partial, cg->llvmConstInt(-1, 32), result);
+        }
+
+        leave(cg->llvmConstInt(i, 32), builder.CreateLoad(eo), result);
+
+        // Transition into this state.
+        builder.SetInsertPoint(enters[i]);
+        auto noffset = builder.CreateAdd(builder.CreateLoad(offset), cg->llvmConstInt(1, 32));
+        builder.CreateStore(noffset, offset);
+        builder.CreateStore(builder.CreateLoad(cur), previous);
+
+        if ( aid ) {
+            builder.CreateStore(noffset, eo);
+            builder.CreateStore(cg->llvmConstInt(aid, 16), acc);
+
+            if ( first_match || ! can_transition ) {
+                leave(cg->llvmConstInt(i, 32), noffset, cg->llvmConstInt(aid, 32));
+                continue;
+            }
+        }
+
+        builder.CreateBr(states[i]);
+    }
+
+    return func;
+}
+
+// Returns the key for caching what we generate for a regexp.
+static string _cacheKey(const std::list<string>& patterns, int flags)
+{
+    string key = ::util::fmt("%d", flags);
+
+    for ( auto p : patterns )
+        key += ::util::fmt("|%d:%s", p.size(), p);
+
+    return key;
+}
+
+// Compiles the patterns into a regexp the same way as the runtime does.
+// Returns false if that fails, and leaves it to the runtime to report the
+// error then. The regexp must be freed in either case.
+static bool _compile(jrx_regex_t* re, const std::list<string>& patterns, int flags)
+{
+    // These must match what libhilti's regexp.c uses.
+    int cflags = REG_EXTENDED | REG_LAZY;
+
+    if ( flags & HLT_REGEXP_NOSUB )
+        cflags |= REG_NOSUB | REG_ANCHOR;
+
+    if ( flags & HLT_REGEXP_FIRST_MATCH )
+        cflags |= REG_FIRST_MATCH;
+
+    jrx_regset_init(re, -1, cflags);
+
+    for ( auto p : patterns ) {
+        for ( auto c : p ) {
+            // The runtime encodes patterns as ASCII.
+            if ( (unsigned char)c > 127 )
+                return false;
+        }
+
+        if ( jrx_regset_add(re, p.data(), p.size()) != REG_OK )
+            return false;
+    }
+
+    return jrx_regset_finalize(re) == REG_OK;
+}
+
+llvm::Function* DFACompiler::llvmMatcher(const std::list<string>& patterns, int flags)
+{
+    if ( ! (cg()->options().optimize && cg()->options().optimizing("regexps")) )
+        return nullptr;
+
+    if ( ! (flags & HLT_REGEXP_NOSUB) )
+        // Needs the standard matcher.
+        return nullptr;
+
+    auto key = _cacheKey(patterns, flags);
+    auto cached = cg()->lookupCachedValue("dfa-matcher", key);
+
+    if ( cached )
+        return llvm::cast<llvm::Function>(cached);
+
+    jrx_regex_t re;
+
+    bool ok = (_compile(&re, patterns, flags)
+               && jrx_regset_is_compilable(&re)
+               && jrx_regset_compute_states(&re, MaxStates) >= 0);
+
+    llvm::Function* func = nullptr;
+
+    if ( ok ) {
+        func = _buildMatcher(cg(), &re, (flags & HLT_REGEXP_FIRST_MATCH));
+        cg()->cacheValue("dfa-matcher", key, func);
+    }
+
+    jrx_regfree(&re);
+    return func;
+}
+
+llvm::GlobalVariable* DFACompiler::llvmPrecompiled(const std::list<string>& patterns, int flags)
+{
+    if ( ! (cg()->options().optimize && cg()->options().optimizing("regexps")) )
+        return nullptr;
+
+    auto key = _cacheKey(patterns, flags);
+    auto cached = cg()->lookupCachedValue("dfa-data", key);
+
+    if ( cached )
+        return llvm::cast<llvm::GlobalVariable>(cached);
+
+    jrx_regex_t re;
+    llvm::GlobalVariable* data = nullptr;
+
+    if ( _compile(&re, patterns, flags) ) {
+        // The runtime builds the reverse DFA as well where it can.
+        jrx_regset_reverse(&re);
+
+        size_t len = 0;
+        auto buf = (const uint8_t*)jrx_regset_serialize(&re, MaxPrecompiledStates, &len);
+
+        if ( buf ) {
+            std::vector<llvm::Constant*> bytes;
+
+            for ( size_t i = 0; i < len; i++ )
+                bytes.push_back(cg()->llvmConstInt(buf[i], 8));
+
+            data = cg()->llvmAddConst("regexp-dfas", cg()->llvmConstArray(cg()->llvmTypeInt(8), bytes));
+            cg()->cacheValue("dfa-data", key, data);
+            free((void*)buf);
+        }
+    }
+
+    jrx_regfree(&re);
+    return data;
+}
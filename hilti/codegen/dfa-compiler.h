@@ -0,0 +1,71 @@
+
+#ifndef HILTI_CODEGEN_DFA_COMPILER_H
+#define HILTI_CODEGEN_DFA_COMPILER_H
+
+#include "common.h"
+
+namespace hilti {
+namespace codegen {
+
+class CodeGen;
+
+/// Compiles the DFA of a constant regular expression into a native matcher
+/// function. The generated function replaces justrx' minimal matcher at
+/// run-time: rather than interpreting the DFA's transition tables, each
+/// state becomes a block of code dispatching directly on the next input
+/// byte.
+///
+/// The generated function has the signature of a ``jrx_native_matcher``. It
+/// must be passed to ``hlt::regexp_set_native_matcher`` before compiling
+/// the same patterns, with the same flags, into the runtime's regexp.
+///
+/// Independent of that, the compiler can also precompute the DFAs of any
+/// constant regular expression and embed them into the module as constant
+/// data. The runtime then loads them via ``hlt::regexp_set_precompiled``
+/// rather than building them at startup. As the data is part of the
+/// module, it gets cached along with it.
+class DFACompiler
+{
+public:
+   /// Constructor.
+   ///
+   /// cg: The code generator to use.
+   DFACompiler(CodeGen* cg);
+   ~DFACompiler();
+
+   /// Returns a native matcher for a set of patterns. Functions are cached
+   /// per module, so that the same patterns will share a single function.
+   ///
+   /// patterns: The patterns of the regular expression.
+   ///
+   /// flags: The runtime's ``hlt_regexp_flags`` for the regular expression.
+   ///
+   /// Returns: The function, or null if the expression can't be compiled
+   /// into native code. That's the case for regexps that capture
+   /// subexpressions or rely on assertions, and for DFAs with too many
+   /// states.
+   llvm::Function* llvmMatcher(const std::list<string>& patterns, int flags);
+
+   /// Returns a constant with the serialized DFAs for a set of patterns,
+   /// as produced by ``jrx_regset_serialize``. Constants are cached per
+   /// module, like the matcher functions.
+   ///
+   /// patterns: The patterns of the regular expression.
+   ///
+   /// flags: The runtime's ``hlt_regexp_flags`` for the regular expression.
+   ///
+   /// Returns: The global holding the data as an array of bytes, or null if
+   /// the DFAs have too many states.
+   llvm::GlobalVariable* llvmPrecompiled(const std::list<string>& patterns, int flags);
+
+   /// Returns the code generator passed to the constructor.
+   CodeGen* cg() const { return _cg; }
+
+private:
+   CodeGen* _cg;
+};
+
+}
+}
+
+#endif
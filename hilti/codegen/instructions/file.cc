@@ -21,6 +21,13 @@ void StatementBuilder::visit(statement::instruction::file::Close* i)
     cg()->llvmCall("hlt::file_close", args);
 }
 
+void StatementBuilder::visit(statement::instruction::file::Flush* i)
+{
+    CodeGen::expr_list args;
+    args.push_back(i->op1());
+    cg()->llvmCall("hlt::file_flush", args);
+}
+
 void StatementBuilder::visit(statement::instruction::file::Open* i)
 {
     shared_ptr<Expression> op3 = i->op3();
@@ -1,6 +1,8 @@
 
 // TODO: The linker code is getting pretty messing. This needs cleanup/refactoring.
 
+#include <functional>
+
 #include "linker.h"
 #include "util.h"
 #include "codegen.h"
@@ -247,35 +249,15 @@ llvm::Module* Linker::link(string output, const std::list<llvm::Module*>& module
 
     // Link in bitcode libraries.
 
-    for ( auto i : _bcs ) {
-        string err;
-
-#ifdef HAVE_LLVM_35
-        auto buffer = llvm::MemoryBuffer::getFile(i.c_str());
-
-        if ( ! buffer )
-            fatalError("reading bitcode failed", i);
-
-        auto bc = llvm::parseBitcodeFile(buffer.get().get(), llvm::getGlobalContext());
-
-        if ( ! bc )
-            fatalError("parsing bitcode failed", i, bc.getError().message());
-
-        linkInModule(&linker, *bc);
-
-#else
-        llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+    for ( auto i : _bcs )
+        linkInModule(&linker, loadBitcodeFile(i));
 
-        if ( llvm::MemoryBuffer::getFile(i.c_str(), buffer) )
-            fatalError("reading bitcode failed", i);
-
-        llvm::Module* bc = llvm::ParseBitcodeFile(buffer.get(), llvm::getGlobalContext(), &err);
-
-        if ( ! bc )
-            fatalError("parsing bitcode failed", i, err);
+    // Link in bitcode for inlining only.
 
+    for ( auto i : _inline_bcs ) {
+        auto bc = loadBitcodeFile(i);
+        prepareForInlining(bc);
         linkInModule(&linker, bc);
-#endif
     }
 
     // Link native library.
@@ -310,6 +292,138 @@ llvm::Module* Linker::link(string output, const std::list<llvm::Module*>& module
     return linker.getModule();
 }
 
+llvm::Module* Linker::loadBitcodeFile(const string& path)
+{
+#ifdef HAVE_LLVM_35
+    auto buffer = llvm::MemoryBuffer::getFile(path.c_str());
+
+    if ( ! buffer )
+        fatalError("reading bitcode failed", path);
+
+    auto bc = llvm::parseBitcodeFile(buffer.get().get(), llvm::getGlobalContext());
+
+    if ( ! bc )
+        fatalError("parsing bitcode failed", path, bc.getError().message());
+
+    return *bc;
+
+#else
+    string err;
+    llvm::OwningPtr<llvm::MemoryBuffer> buffer;
+
+    if ( llvm::MemoryBuffer::getFile(path.c_str(), buffer) )
+        fatalError("reading bitcode failed", path);
+
+    llvm::Module* bc = llvm::ParseBitcodeFile(buffer.get(), llvm::getGlobalContext(), &err);
+
+    if ( ! bc )
+        fatalError("parsing bitcode failed", path, err);
+
+    return bc;
+#endif
+}
+
+void Linker::prepareForInlining(llvm::Module* module)
+{
+    // A function can only be copied if it doesn't touch any internal state
+    // that is not constant, either directly or through an internal helper.
+    // Otherwise the copy would work on a separate instance of that state
+    // than the runtime library itself.
+    std::set<llvm::Function*> unsafe;
+    std::map<llvm::Function*, std::set<llvm::Function*>> helpers;
+    std::set<std::pair<llvm::Function*, llvm::GlobalVariable*>> scanned;
+
+    std::function<void (llvm::Function*, llvm::Value*)> scan = [&](llvm::Function* f, llvm::Value* v) {
+        if ( auto gv = llvm::dyn_cast<llvm::GlobalVariable>(v) ) {
+            if ( ! gv->hasLocalLinkage() )
+                return;
+
+            if ( ! gv->isConstant() ) {
+                unsafe.insert(f);
+                return;
+            }
+
+            // A constant may still point to mutable state, like a table
+            // of pointers.
+            if ( gv->hasInitializer() && scanned.insert(std::make_pair(f, gv)).second )
+                scan(f, gv->getInitializer());
+        }
+
+        else if ( auto callee = llvm::dyn_cast<llvm::Function>(v) ) {
+            if ( callee->hasLocalLinkage() )
+                helpers[f].insert(callee);
+        }
+
+        else if ( auto c = llvm::dyn_cast<llvm::Constant>(v) ) {
+            // Expressions and aggregates.
+            for ( auto op = c->op_begin(); op != c->op_end(); op++ )
+                scan(f, *op);
+        }
+    };
+
+    for ( auto f = module->begin(); f != module->end(); f++ ) {
+        for ( auto b = f->begin(); b != f->end(); b++ ) {
+            for ( auto i = b->begin(); i != b->end(); i++ ) {
+                for ( auto op = i->op_begin(); op != i->op_end(); op++ )
+                    scan(&*f, *op);
+            }
+        }
+    }
+
+    bool changed = true;
+
+    while ( changed ) {
+        changed = false;
+
+        for ( auto h : helpers ) {
+            if ( unsafe.find(h.first) != unsafe.end() )
+                continue;
+
+            for ( auto callee : h.second ) {
+                if ( unsafe.find(callee) != unsafe.end() ) {
+                    unsafe.insert(h.first);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    int copied = 0;
+
+    for ( auto f = module->begin(); f != module->end(); f++ ) {
+        if ( f->isDeclaration() || f->hasLocalLinkage() )
+            continue;
+
+        if ( unsafe.find(&*f) != unsafe.end() ) {
+            f->deleteBody();
+            continue;
+        }
+
+        // The body is for inlining only; any remaining calls go to the
+        // runtime library's own version.
+        f->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+        ++copied;
+    }
+
+    // Global state always stays with the runtime library.
+    for ( auto g = module->global_begin(); g != module->global_end(); g++ ) {
+        if ( g->isDeclaration() || g->hasLocalLinkage() )
+            continue;
+
+        g->setInitializer(nullptr);
+        g->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+
+    // The runtime library runs its own constructors already.
+    for ( auto name : { "llvm.global_ctors", "llvm.global_dtors" } ) {
+        if ( auto g = module->getNamedGlobal(name) )
+            g->eraseFromParent();
+    }
+
+    debug(1, ::util::fmt("module %s provides %d functions for inlining", CodeGen::llvmGetModuleIdentifier(module), copied));
+}
+
 bool Linker::isHiltiModule(llvm::Module* module)
 {
     string id = CodeGen::llvmGetModuleIdentifier(module);
@@ -47,6 +47,15 @@ public:
    /// path: The full path to the ``*.bc`` file.
    void addBitcodeFile(const string& path)  { _bcs.push_back(path); }
 
+   /// Adds an LLVM bitcode file whose functions are made available for
+   /// inlining when link() is called, without linking them in. Calls that
+   /// don't get inlined, as well as all global state, continue to resolve
+   /// to the native version of the same code, which must be available at
+   /// run-time. Functions that rely on internal mutable state are skipped.
+   ///
+   /// path: The full path to the ``*.bc`` file.
+   void addInlineBitcodeFile(const string& path)  { _inline_bcs.push_back(path); }
+
    /// Links a set of compiled HILTI modules together.
    ///
    /// output: The name of the output module.
@@ -72,6 +81,13 @@ private:
    void makeHooks(const std::list<string>& module_names, llvm::Module* module);
    void fatalError(const string& where, const string& file = "", const string& error = "");
 
+   // Turns a runtime bitcode module into one providing its functions for
+   // inlining only.
+   void prepareForInlining(llvm::Module* module);
+
+   // Aborts directly on error.
+   llvm::Module* loadBitcodeFile(const string& path);
+
    // These following three abort directly on error.
    void linkInModule(llvm::Linker* linker, llvm::Module* module);
    void linkInNativeLibrary(llvm::Linker* linker, const string& library);
@@ -81,6 +97,7 @@ private:
    path_list _paths;
    path_list _natives;
    path_list _bcs;
+   path_list _inline_bcs;
 };
 
 }
@@ -647,6 +647,26 @@ void Loader::visit(ctor::RegExp* c)
 
     auto patterns = c->patterns();
 
+    if ( auto matcher = cg()->llvmRegExpMatcher(patterns, flags) ) {
+        // We have compiled the DFA into native code; tell the runtime to use
+        // that. Must come before compiling the patterns.
+        auto ptr = cg()->builder()->CreateBitCast(matcher, cg()->llvmTypePtr());
+        CodeGen::expr_list args = { op1, builder::codegen::create(builder::caddr::type(), ptr) };
+        cg()->llvmCall("hlt::regexp_set_native_matcher", args);
+    }
+
+    if ( auto dfas = cg()->llvmRegExpPrecompiled(patterns, flags) ) {
+        // We have computed the DFAs already; tell the runtime to load them
+        // rather than building its own. Must come before compiling the
+        // patterns as well.
+        auto len = llvm::cast<llvm::ArrayType>(dfas->getType()->getElementType())->getNumElements();
+        auto ptr = cg()->builder()->CreateBitCast(dfas, cg()->llvmTypePtr());
+        CodeGen::expr_list args = { op1,
+                                    builder::codegen::create(builder::caddr::type(), ptr),
+                                    builder::integer::create(len) };
+        cg()->llvmCall("hlt::regexp_set_precompiled", args);
+    }
+
     if ( patterns.size() == 1 ) {
         // Just one pattern, we use regexp_compile().
         auto pattern = patterns.front();
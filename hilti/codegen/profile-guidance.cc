@@ -0,0 +1,359 @@
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <llvm/IR/MDBuilder.h>
+
+#include "profile-guidance.h"
+#include "util.h"
+#include "codegen.h"
+#include "../options.h"
+#include "../context.h"
+
+using namespace hilti;
+using namespace codegen;
+
+// Functions called at least this fraction of the most frequently called
+// one are considered hot and get an inline hint.
+static const uint64_t HotFraction = 100;
+
+ProfileGuidance::ProfileGuidance(CompilerContext* ctx) : ast::Logger("codegen::ProfileGuidance")
+{
+    _ctx = ctx;
+}
+
+CompilerContext* ProfileGuidance::context() const
+{
+    return _ctx;
+}
+
+const Options& ProfileGuidance::options() const
+{
+    return _ctx->options();
+}
+
+std::list<llvm::Function*> ProfileGuidance::functions(llvm::Module* module)
+{
+    std::list<llvm::Function*> funcs;
+
+    for ( auto f = module->begin(); f != module->end(); f++ ) {
+        // HILTI functions are the ones with fastcc; that leaves out the
+        // runtime library as well as the C stubs.
+        if ( f->isDeclaration() || f->getCallingConv() != llvm::CallingConv::Fast )
+            continue;
+
+        funcs.push_back(f);
+    }
+
+    return funcs;
+}
+
+ProfileGuidance::branch_list ProfileGuidance::branches(llvm::Function* func)
+{
+    branch_list branches;
+
+    for ( auto b = func->begin(); b != func->end(); b++ ) {
+        auto term = b->getTerminator();
+
+        if ( auto br = llvm::dyn_cast<llvm::BranchInst>(term) ) {
+            if ( br->isConditional() )
+                branches.push_back(br);
+        }
+
+        else if ( llvm::isa<llvm::SwitchInst>(term) )
+            branches.push_back(term);
+    }
+
+    return branches;
+}
+
+uint64_t ProfileGuidance::numCounters(const branch_list& branches)
+{
+    // One for the function's entry, plus one per branch target.
+    uint64_t n = 1;
+
+    for ( auto b : branches )
+        n += b->getNumSuccessors();
+
+    return n;
+}
+
+uint64_t ProfileGuidance::checksum(const branch_list& branches)
+{
+    // FNV-1a over the number of targets per branch.
+    uint64_t hash = 14695981039346656037ULL;
+
+    for ( auto b : branches ) {
+        hash ^= b->getNumSuccessors();
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+bool ProfileGuidance::instrument(llvm::Module* module)
+{
+    auto& ctx = module->getContext();
+    auto i8ptr = llvm::Type::getInt8PtrTy(ctx);
+    auto i64 = llvm::Type::getInt64Ty(ctx);
+
+    auto init = module->getFunction(symbols::FunctionModulesInit);
+
+    if ( ! init || init->isDeclaration() ) {
+        warning("no HILTI modules to instrument for PGO");
+        return true;
+    }
+
+    // Must match __hlt_pgo_function in libhilti/pgo.h.
+    std::vector<llvm::Type*> fields = { i8ptr, i64, i64, llvm::PointerType::get(i64, 0) };
+    auto desc_type = llvm::StructType::get(ctx, fields);
+
+    std::vector<llvm::Constant*> descs;
+
+    for ( auto f : functions(module) ) {
+        auto branches = ProfileGuidance::branches(f);
+        auto n = numCounters(branches);
+
+        auto ctype = llvm::ArrayType::get(i64, n);
+        auto counters = new llvm::GlobalVariable(*module, ctype, false, llvm::GlobalValue::InternalLinkage, llvm::ConstantAggregateZero::get(ctype), f->getName() + ".pgo.counters");
+
+        auto counter = [&](IRBuilder* builder, llvm::Value* idx) {
+            std::vector<llvm::Value*> gep = { llvm::ConstantInt::get(i64, 0), idx };
+            auto addr = builder->CreateGEP(counters, gep);
+            builder->CreateStore(builder->CreateAdd(builder->CreateLoad(addr), llvm::ConstantInt::get(i64, 1)), addr);
+        };
+
+        uint64_t base = 1;
+
+        for ( auto b : branches ) {
+            auto builder = util::newBuilder(ctx, b->getParent());
+            builder->SetInsertPoint(b); // Before the branch.
+
+            llvm::Value* idx = nullptr;
+
+            if ( auto br = llvm::dyn_cast<llvm::BranchInst>(b) )
+                idx = builder->CreateSelect(br->getCondition(), llvm::ConstantInt::get(i64, base), llvm::ConstantInt::get(i64, base + 1));
+
+            else {
+                auto sw = llvm::cast<llvm::SwitchInst>(b);
+                idx = llvm::ConstantInt::get(i64, base); // Default target is successor 0.
+
+                for ( auto c = sw->case_begin(); c != sw->case_end(); ++c ) {
+                    auto match = builder->CreateICmpEQ(sw->getCondition(), c.getCaseValue());
+                    idx = builder->CreateSelect(match, llvm::ConstantInt::get(i64, base + c.getSuccessorIndex()), idx);
+                }
+            }
+
+            counter(builder, idx);
+            base += b->getNumSuccessors();
+            delete builder;
+        }
+
+        auto builder = util::newBuilder(ctx, &f->getEntryBlock(), true);
+        counter(builder, llvm::ConstantInt::get(i64, 0));
+        delete builder;
+
+        auto str = llvm::ConstantDataArray::getString(ctx, f->getName());
+        auto name = new llvm::GlobalVariable(*module, str->getType(), true, llvm::GlobalValue::PrivateLinkage, str, f->getName() + ".pgo.name");
+
+        std::vector<llvm::Constant*> idx = { llvm::ConstantInt::get(i64, 0), llvm::ConstantInt::get(i64, 0) };
+
+        std::vector<llvm::Constant*> desc = {
+            llvm::ConstantExpr::getGetElementPtr(name, idx),
+            llvm::ConstantInt::get(i64, checksum(branches)),
+            llvm::ConstantInt::get(i64, n),
+            llvm::ConstantExpr::getGetElementPtr(counters, idx)
+        };
+
+        descs.push_back(llvm::ConstantStruct::get(desc_type, desc));
+    }
+
+    auto ttype = llvm::ArrayType::get(desc_type, descs.size());
+    auto table = new llvm::GlobalVariable(*module, ttype, true, llvm::GlobalValue::InternalLinkage, llvm::ConstantArray::get(ttype, descs), "__hlt_pgo_functions");
+
+    // Register the counters with the runtime before any HILTI code runs.
+    // This may execute multiple times, which the runtime ignores.
+    auto reg = module->getOrInsertFunction("__hlt_pgo_register", llvm::Type::getVoidTy(ctx), llvm::PointerType::get(desc_type, 0), i64, nullptr);
+
+    std::vector<llvm::Constant*> idx = { llvm::ConstantInt::get(i64, 0), llvm::ConstantInt::get(i64, 0) };
+    std::vector<llvm::Value*> args = { llvm::ConstantExpr::getGetElementPtr(table, idx), llvm::ConstantInt::get(i64, descs.size()) };
+
+    auto builder = util::newBuilder(ctx, &init->getEntryBlock(), true);
+    util::checkedCreateCall(builder, "ProfileGuidance", reg, args);
+    delete builder;
+
+    if ( options().cgDebugging("pgo") )
+        std::cerr << ::util::fmt("PGO: instrumented %d functions in %s", descs.size(), module->getModuleIdentifier()) << std::endl;
+
+    return true;
+}
+
+bool ProfileGuidance::readProfile(const string& path, profile_map* profile)
+{
+    std::ifstream in(path);
+
+    if ( ! in ) {
+        error(::util::fmt("cannot open PGO profile %s", path));
+        return false;
+    }
+
+    string line;
+    int lineno = 0;
+
+    while ( std::getline(in, line) ) {
+        ++lineno;
+
+        if ( line.empty() || line[0] == '#' )
+            continue;
+
+        std::istringstream fields(line);
+
+        string name;
+        uint64_t sum;
+        uint64_t n;
+
+        if ( ! (fields >> name >> sum >> n) ) {
+            error(::util::fmt("%s:%d: malformed PGO profile entry", path, lineno));
+            return false;
+        }
+
+        std::vector<uint64_t> counters(n);
+
+        for ( auto& c : counters ) {
+            if ( ! (fields >> c) ) {
+                error(::util::fmt("%s:%d: malformed PGO profile entry", path, lineno));
+                return false;
+            }
+        }
+
+        auto i = profile->find(name);
+
+        if ( i == profile->end() ) {
+            Counts counts;
+            counts.checksum = sum;
+            counts.counters = counters;
+            profile->insert(std::make_pair(name, counts));
+            continue;
+        }
+
+        // Sum up the runs. If they disagree, one is stale; we then ignore
+        // the function altogether.
+        if ( i->second.checksum != sum || i->second.counters.size() != n ) {
+            i->second.counters.clear();
+            continue;
+        }
+
+        for ( uint64_t j = 0; j < n; j++ )
+            i->second.counters[j] += counters[j];
+    }
+
+    return true;
+}
+
+bool ProfileGuidance::annotate(llvm::Module* module, const string& path)
+{
+    profile_map profile;
+
+    if ( ! readProfile(path, &profile) )
+        return false;
+
+    uint64_t max_calls = 0;
+
+    for ( auto& p : profile ) {
+        if ( p.second.counters.size() )
+            max_calls = std::max(max_calls, p.second.counters[0]);
+    }
+
+    int annotated = 0;
+    int mismatched = 0;
+    int missing = 0;
+
+    for ( auto f : functions(module) ) {
+        auto p = profile.find(f->getName().str());
+
+        if ( p == profile.end() ) {
+            ++missing;
+            continue;
+        }
+
+        auto branches = ProfileGuidance::branches(f);
+
+        if ( p->second.checksum != checksum(branches) || p->second.counters.size() != numCounters(branches) ) {
+            if ( options().cgDebugging("pgo") )
+                std::cerr << ::util::fmt("PGO: profile does not match %s", f->getName().str()) << std::endl;
+
+            ++mismatched;
+            continue;
+        }
+
+        annotateFunction(f, p->second, std::max(max_calls / HotFraction, (uint64_t)1));
+        ++annotated;
+    }
+
+    if ( mismatched )
+        warning(::util::fmt("PGO profile %s does not match %d functions; was the code compiled with different options?", path, mismatched));
+
+    if ( options().cgDebugging("pgo") )
+        std::cerr << ::util::fmt("PGO: annotated %d functions in %s, %d without profile", annotated, module->getModuleIdentifier(), missing) << std::endl;
+
+    return true;
+}
+
+void ProfileGuidance::annotateFunction(llvm::Function* func, const Counts& counts, uint64_t hot)
+{
+    auto calls = counts.counters[0];
+
+    if ( calls == 0 ) {
+        // Never ran, so keep it out of the way.
+#ifdef HAVE_LLVM_33
+        func->addFnAttr(llvm::Attribute::OptimizeForSize);
+#else
+        func->addFnAttr(llvm::Attribute::Cold);
+#endif
+        return;
+    }
+
+    if ( calls >= hot && ! func->hasFnAttribute(llvm::Attribute::NoInline) )
+        func->addFnAttr(llvm::Attribute::InlineHint);
+
+    llvm::MDBuilder mdb(func->getContext());
+    uint64_t base = 1;
+
+    for ( auto b : branches(func) ) {
+        auto n = b->getNumSuccessors();
+        auto first = counts.counters.begin() + base;
+        auto last = first + n;
+        base += n;
+
+        auto max = *std::max_element(first, last);
+
+        // If never reached, keep any static hints.
+        if ( max == 0 )
+            continue;
+
+        // Weights are 32-bit; scale down if needed. We add one so that no
+        // target looks entirely impossible.
+        uint64_t scale = (max / UINT32_MAX) + 1;
+
+        std::vector<uint32_t> weights;
+
+        for ( auto c = first; c != last; c++ )
+            weights.push_back((*c / scale) + 1);
+
+        b->setMetadata(llvm::LLVMContext::MD_prof, mdb.createBranchWeights(weights));
+
+        // The measured weights supersede any llvm.expect hint, which LLVM
+        // would otherwise turn into weights of its own later.
+        auto br = llvm::dyn_cast<llvm::BranchInst>(b);
+
+        if ( ! br )
+            continue;
+
+        auto call = llvm::dyn_cast<llvm::CallInst>(br->getCondition());
+        auto callee = call ? call->getCalledFunction() : nullptr;
+
+        if ( callee && callee->getIntrinsicID() == llvm::Intrinsic::expect )
+            br->setCondition(call->getArgOperand(0));
+    }
+}
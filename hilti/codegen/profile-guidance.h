@@ -0,0 +1,95 @@
+
+#ifndef HILTI_CODEGEN_PROFILE_GUIDANCE_H
+#define HILTI_CODEGEN_PROFILE_GUIDANCE_H
+
+#include <map>
+#include <vector>
+
+#include "common.h"
+
+namespace hilti {
+
+class CompilerContext;
+class Options;
+
+namespace codegen {
+
+/// Profile-guided optimization for HILTI functions. This works in two
+/// steps. First, instrument() adds counters for function entries and for
+/// the outcomes of all conditional branches to the final linked module;
+/// the runtime writes them out at termination (see \c libhilti/pgo.h).
+/// Later, annotate() reads such a profile back in when compiling the same
+/// code again, and turns it into branch weights and function attributes
+/// for LLVM's optimizer to act upon.
+///
+/// Both steps identify branches by their position inside a function's
+/// unoptimized LLVM code. Hence the code needs to be compiled with the same
+/// options both times, except for the PGO ones; functions that don't match
+/// their profile are left alone.
+class ProfileGuidance : public ast::Logger {
+public:
+   /// Constructor.
+   ///
+   /// ctx: The compiler context to use.
+   ProfileGuidance(CompilerContext* ctx);
+
+   /// Returns the compiler context the code generator is used with.
+   CompilerContext* context() const;
+
+   /// Returns the options in effecty for code generation. This is a
+   /// convienience method that just forwards to the current context.
+   const Options& options() const;
+
+   /// Instruments all HILTI functions of a module with profiling counters.
+   /// The module must be the final one returned by
+   /// CompilerContext::linkModules(), before optimization.
+   ///
+   /// module: The module to instrument.
+   ///
+   /// Returns: True if successful.
+   bool instrument(llvm::Module* module);
+
+   /// Annotates all HILTI functions of a module with the information
+   /// recorded in a profile. The module must be the final one returned by
+   /// CompilerContext::linkModules(), before optimization.
+   ///
+   /// module: The module to annotate.
+   ///
+   /// path: The profile to read. It may contain the concatenated output of
+   /// multiple runs, which will then be summed up.
+   ///
+   /// Returns: True if successful.
+   bool annotate(llvm::Module* module, const string& path);
+
+private:
+   struct Counts {
+       uint64_t checksum = 0;
+       std::vector<uint64_t> counters;
+   };
+
+   typedef std::vector<llvm::TerminatorInst*> branch_list;
+   typedef std::map<string, Counts> profile_map;
+
+   bool readProfile(const string& path, profile_map* profile);
+   void annotateFunction(llvm::Function* func, const Counts& counts, uint64_t hot);
+
+   // Returns the functions to instrument.
+   std::list<llvm::Function*> functions(llvm::Module* module);
+
+   // Returns the branches to count, in the order of their counters.
+   branch_list branches(llvm::Function* func);
+
+   // Returns the number of counters needed for a function.
+   uint64_t numCounters(const branch_list& branches);
+
+   // Returns a value identifying the function's branch layout.
+   uint64_t checksum(const branch_list& branches);
+
+   CompilerContext* _ctx;
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,146 @@
+
+#include <unistd.h>
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Program.h>
+
+#include "shared-library.h"
+#include "util.h"
+#include "../options.h"
+#include "../context.h"
+#include "hilti/autogen/hilti-config.h"
+
+using namespace hilti;
+using namespace codegen;
+
+SharedLibraryBuilder::SharedLibraryBuilder(CompilerContext* ctx) : ast::Logger("codegen::SharedLibraryBuilder")
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    _ctx = ctx;
+}
+
+CompilerContext* SharedLibraryBuilder::context() const
+{
+    return _ctx;
+}
+
+const Options& SharedLibraryBuilder::options() const
+{
+    return _ctx->options();
+}
+
+bool SharedLibraryBuilder::build(llvm::Module* module, const string& path)
+{
+    auto object = ::util::fmt("%s.%d.o", path, getpid());
+
+    if ( ! emitObject(module, object) ) {
+        unlink(object.c_str());
+        return false;
+    }
+
+    auto result = linkObject(object, path);
+    unlink(object.c_str());
+    return result;
+}
+
+bool SharedLibraryBuilder::emitObject(llvm::Module* module, const string& path)
+{
+    auto triple = module->getTargetTriple();
+    assert(triple.size());
+
+    std::string err;
+    auto target = llvm::TargetRegistry::lookupTarget(triple, err);
+
+    if ( ! target ) {
+        error(::util::fmt("shared library: cannot determine target, %s", err));
+        return false;
+    }
+
+    auto opt_level = options().optimize ? llvm::CodeGenOpt::Default : llvm::CodeGenOpt::None;
+
+    // Same setup as for the JIT, except that we need position-independent code.
+    llvm::TargetOptions to;
+    to.UseSoftFloat = false;
+    to.FloatABIType = llvm::FloatABI::Default;
+    to.GuaranteedTailCallOpt = options().optimize;
+
+    std::unique_ptr<llvm::TargetMachine> tm(target->createTargetMachine(triple, llvm::sys::getHostCPUName(), "" /* CPU features */, to, llvm::Reloc::PIC_, llvm::CodeModel::Default, opt_level));
+
+    if ( ! tm ) {
+        error(::util::fmt("shared library: cannot create target machine for %s", triple));
+        return false;
+    }
+
+#if defined(HAVE_LLVM_35)
+    llvm::raw_fd_ostream out(path.c_str(), err, llvm::sys::fs::F_None);
+#elif defined(HAVE_LLVM_34)
+    llvm::raw_fd_ostream out(path.c_str(), err, llvm::sys::fs::F_Binary);
+#else
+    llvm::raw_fd_ostream out(path.c_str(), err, llvm::raw_fd_ostream::F_Binary);
+#endif
+
+    if ( err.size() ) {
+        error(::util::fmt("shared library: cannot open %s, %s", path, err));
+        return false;
+    }
+
+    llvm::formatted_raw_ostream fout(out);
+    llvm::PassManager passes;
+
+#ifdef HAVE_LLVM_35
+    passes.add(new llvm::DataLayoutPass(module));
+#else
+    passes.add(new llvm::DataLayout(module));
+#endif
+
+    tm->addAnalysisPasses(passes);
+
+    // Sic. This returns true on error ...
+    if ( tm->addPassesToEmitFile(passes, fout, llvm::TargetMachine::CGFT_ObjectFile) ) {
+        error(::util::fmt("shared library: target %s cannot emit object files", triple));
+        return false;
+    }
+
+    passes.run(*module);
+    return true;
+}
+
+bool SharedLibraryBuilder::linkObject(const string& object, const string& path)
+{
+    auto cc = configuration().path_clang;
+
+    std::list<string> args = { cc, "-shared", "-o", path, object };
+
+#ifdef __linux__
+    // Like with the JIT, references between the library's own functions
+    // (including its copy of the runtime library) resolve internally.
+    args.push_back("-Wl,-Bsymbolic");
+#endif
+
+#ifdef __APPLE__
+    // Functions provided by the host application resolve at load time.
+    args.push_back("-undefined");
+    args.push_back("dynamic_lookup");
+#endif
+
+    if ( options().cgDebugging("context" ) )
+        std::cerr << ::util::fmt("Linking shared library: %s", ::util::strjoin(args, " ")) << std::endl;
+
+    std::vector<const char*> argv;
+
+    for ( auto& a : args )
+        argv.push_back(a.c_str());
+
+    argv.push_back(nullptr);
+
+    string errmsg;
+    auto rc = llvm::sys::ExecuteAndWait(cc, argv.data(), nullptr, nullptr, 0, 0, &errmsg);
+
+    if ( rc != 0 ) {
+        error(::util::fmt("shared library: linking %s failed%s", path, errmsg.size() ? ", " + errmsg : string("")));
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,55 @@
+
+#ifndef HILTI_CODEGEN_SHARED_LIBRARY_H
+#define HILTI_CODEGEN_SHARED_LIBRARY_H
+
+#include "common.h"
+
+namespace hilti {
+
+class CompilerContext;
+class Options;
+
+namespace codegen {
+
+/// Compiles a final linked LLVM module ahead of time into a native shared
+/// library. A host application can later ``dlopen()`` the library instead
+/// of JITing the module; it then retrieves the same functions via
+/// ``dlsym()`` that it would otherwise get from
+/// CompilerContext::nativeFunction().
+class SharedLibraryBuilder : public ast::Logger {
+public:
+   /// Constructor.
+   ///
+   /// ctx: The compiler context to use.
+   SharedLibraryBuilder(CompilerContext* ctx);
+
+   /// Returns the compiler context the code generator is used with.
+   CompilerContext* context() const;
+
+   /// Returns the options in effecty for code generation. This is a
+   /// convienience method that just forwards to the current context.
+   const Options& options() const;
+
+   /// Compiles a module into a shared library. The module must be the
+   /// final one returned by CompilerContext::linkModules(). Code is
+   /// generated for the host CPU.
+   ///
+   /// module: The module to compile.
+   ///
+   /// path: The path of the library to write.
+   ///
+   /// Returns: True if successful.
+   bool build(llvm::Module* module, const string& path);
+
+private:
+   bool emitObject(llvm::Module* module, const string& path);
+   bool linkObject(const string& object, const string& path);
+
+   CompilerContext* _ctx;
+};
+
+}
+
+}
+
+#endif
@@ -79,6 +79,11 @@ void StatementBuilder::postAccept(shared_ptr<ast::NodeBase> node)
     // earlier already themselves, in which case this becomes a noop. That's
     // usually the case for terminators.
     cg()->llvmBuildInstructionCleanup();
+
+    // Release whatever the previous statement kept referenced but we
+    // didn't take over.
+    cg()->llvmReleaseCarried(false);
+
     _stmts.pop_back();
 }
 
@@ -299,6 +304,8 @@ void StatementBuilder::visit(declaration::Function* f)
     if ( cg()->options().profile >= 1 )
         cg()->llvmProfilerStart(string("func/") + name);
 
+    cg()->llvmFunctionProfilerEnter(name);
+
     // Create shadow locals for non-const parameters so that we can modify
     // them.
     for ( auto p : ftype->parameters() ) {
@@ -1,8 +1,12 @@
 
+#include <atomic>
 #include <fstream>
+#include <thread>
 #include <util/util.h>
 
 #include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
 #include "hilti-intern.h"
 #include "parser/driver.h"
@@ -10,12 +14,15 @@
 #include "jit/jit.h"
 #include "options.h"
 #include "codegen/optimizer.h"
+#include "codegen/profile-guidance.h"
+#include "codegen/shared-library.h"
 
 using namespace hilti;
 using namespace hilti::passes;
 
 CompilerContext::CompilerContext(std::shared_ptr<Options> options)
 {
+    _start_time = ::util::currentTime();
     setOptions(options);
 }
 
@@ -170,6 +177,7 @@ void CompilerContext::_beginPass(const string& module, const string& name)
     pass.module = module;
     pass.time = ::util::currentTime();
     pass.name = name;
+    pass.max_rss = options().report_times.size() ? ::util::maxResidentSetSize() : 0;
     _passes.push_back(pass);
 }
 
@@ -207,9 +215,122 @@ void CompilerContext::_endPass()
                                    delta, indent, pass.name, pass.module) << std::endl;
     }
 
+    recordPass("hilti", pass);
+
     _passes.pop_back();
 }
 
+void CompilerContext::recordPass(const string& component, const PassInfo& pass)
+{
+    if ( options().report_times.empty() )
+        return;
+
+    auto max_rss = ::util::maxResidentSetSize();
+
+    PassRecord r;
+    r.component = component;
+    r.name = pass.name;
+    r.module = pass.module;
+    r.depth = _passes.size();
+    r.start = pass.time - _start_time;
+    r.time = ::util::currentTime() - pass.time;
+    r.max_rss = max_rss;
+    r.max_rss_growth = max_rss - std::min(pass.max_rss, max_rss);
+    _pass_records.push_back(r);
+}
+
+void CompilerContext::recordCacheLookup(const string& kind, const string& name, bool hit)
+{
+    if ( options().report_times.empty() )
+        return;
+
+    CacheRecord r;
+    r.kind = kind;
+    r.name = name;
+    r.hit = hit;
+    r.start = ::util::currentTime() - _start_time;
+    _cache_records.push_back(r);
+}
+
+static string _jsonString(const string& s)
+{
+    string r = "\"";
+
+    for ( auto c : s ) {
+        switch ( c ) {
+         case '"':
+            r += "\\\"";
+            break;
+
+         case '\\':
+            r += "\\\\";
+            break;
+
+         default:
+            if ( (unsigned char)c < 0x20 )
+                r += util::fmt("\\u%04x", (int)c);
+            else
+                r += c;
+        }
+    }
+
+    return r + "\"";
+}
+
+bool CompilerContext::writeTimesReport()
+{
+    auto path = options().report_times;
+
+    if ( path.empty() )
+        return true;
+
+    std::ofstream file;
+
+    if ( path != "-" ) {
+        file.open(path, std::ios::out | std::ios::trunc);
+
+        if ( ! file.is_open() ) {
+            error(util::fmt("cannot open %s for writing the times report", path));
+            return false;
+        }
+    }
+
+    std::ostream& out = (path != "-" ? file : std::cerr);
+
+    out << "{" << std::endl;
+    out << util::fmt("  \"time\": %.6f,", util::currentTime() - _start_time) << std::endl;
+    out << util::fmt("  \"max_rss_kb\": %d,", util::maxResidentSetSize()) << std::endl;
+    out << "  \"passes\": [";
+
+    bool first = true;
+
+    for ( auto& r : _pass_records ) {
+        out << (first ? "" : ",") << std::endl;
+        out << util::fmt("    { \"component\": %s, \"pass\": %s, \"module\": %s, \"depth\": %d, "
+                         "\"start\": %.6f, \"time\": %.6f, \"max_rss_kb\": %d, \"max_rss_growth_kb\": %d }",
+                         _jsonString(r.component), _jsonString(r.name), _jsonString(r.module), r.depth,
+                         r.start, r.time, r.max_rss, r.max_rss_growth);
+        first = false;
+    }
+
+    out << std::endl << "  ]," << std::endl;
+    out << "  \"cache\": [";
+
+    first = true;
+
+    for ( auto& r : _cache_records ) {
+        out << (first ? "" : ",") << std::endl;
+        out << util::fmt("    { \"kind\": %s, \"name\": %s, \"hit\": %s, \"start\": %.6f }",
+                         _jsonString(r.kind), _jsonString(r.name), (r.hit ? "true" : "false"), r.start);
+        first = false;
+    }
+
+    out << std::endl << "  ]" << std::endl;
+    out << "}" << std::endl;
+
+    return true;
+}
+
 bool CompilerContext::_finalizeModule(shared_ptr<Module> module, bool verify)
 {
     if ( options().cgDebugging("context" ) )
@@ -359,6 +480,18 @@ bool CompilerContext::_finalizeModule(shared_ptr<Module> module, bool verify)
 
     _endPass();
 
+    if ( options().optimize ) {
+        auto refcounts = std::make_shared<passes::OptimizeRefcounts>(this, cfg, liveness);
+
+        module->setPasses(cfg, liveness, refcounts);
+
+        _beginPass(module, *refcounts);
+
+        if ( ! refcounts->run(module) )
+            return false;
+
+        _endPass();
+    }
 
     return true;
 }
@@ -542,6 +675,8 @@ std::list<llvm::Module*> CompilerContext::checkCache(const ::util::cache::FileCa
     if ( options().cgDebugging("cache") && ! outputs.size() )
         std::cerr << util::fmt("No cached module for %s.%s", key.name, key.scope) << std::endl;
 
+    recordCacheLookup("module", util::fmt("%s.%s", key.name, key.scope), outputs.size());
+
     return outputs;
 }
 
@@ -593,10 +728,10 @@ void CompilerContext::toCacheKey(const llvm::Module* module, ::util::cache::File
     llvm::raw_string_ostream llvm_out(out);
     llvm::WriteBitcodeToFile(module, llvm_out);
 
-    // We take the size as hash. That's not ideal but (1) the output of
-    // neither bitcode nor assemly writer is stable, (2) writing the whole
-    // module is also pretty slow.
-    auto hash = util::cache::hash(llvm_out.str().size());
+    // We hash the full bitcode. Writing it out isn't free, but the size
+    // alone isn't safe to go by when the key guards native code, and a
+    // match saves us much more time than this takes.
+    auto hash = util::cache::hash(llvm_out.str());
     key->hashes.insert(hash);
 }
 
@@ -642,6 +777,131 @@ llvm::Module* CompilerContext::compile(shared_ptr<Module> module)
     return compiled;
 }
 
+std::list<llvm::Module*> CompilerContext::compile(const std::list<shared_ptr<Module>>& modules)
+{
+    std::list<llvm::Module*> compiled;
+
+    unsigned int jobs = options().jobs;
+
+    if ( ! jobs )
+        jobs = std::max(std::thread::hardware_concurrency(), 1u);
+
+    jobs = std::min(jobs, (unsigned int)modules.size());
+
+#ifndef HAVE_LLVM_35
+    if ( jobs > 1 && ! llvm::llvm_start_multithreaded() )
+        jobs = 1;
+#else
+    if ( ! llvm::llvm_is_multithreaded() )
+        jobs = 1;
+#endif
+
+    if ( jobs <= 1 ) {
+        for ( auto m : modules ) {
+            auto llvm_module = compile(m);
+
+            if ( ! llvm_module )
+                return std::list<llvm::Module*>();
+
+            compiled.push_back(llvm_module);
+        }
+
+        return compiled;
+    }
+
+    if ( options().cgDebugging("context" ) )
+        std::cerr << util::fmt("Compiling %d modules with %d threads ...", modules.size(), jobs) << std::endl;
+
+    // We can't move modules across LLVM contexts directly, so each thread
+    // hands back its modules as bitcode. The passes of individual modules
+    // don't get tracked as they would overlap.
+    _beginPass(util::fmt("%d modules", modules.size()), "CodeGen");
+
+    std::vector<shared_ptr<Module>> inputs(modules.begin(), modules.end());
+    std::vector<string> outputs(inputs.size());
+    std::vector<string> names(inputs.size());
+    std::vector<char> ok(inputs.size(), false); // Not vector<bool>, threads write concurrently.
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        while ( true ) {
+            size_t i = next++;
+
+            if ( i >= inputs.size() )
+                break;
+
+            llvm::LLVMContext llvm_context;
+
+            codegen::CodeGen cg(this, inputs[i]->compilerContext()->options().libdirs_hlt, &llvm_context);
+            auto llvm_module = cg.generateLLVM(inputs[i]);
+
+            if ( ! llvm_module )
+                continue;
+
+            llvm::raw_string_ostream out(outputs[i]);
+            llvm::WriteBitcodeToFile(llvm_module, out);
+            out.flush();
+
+            names[i] = llvm_module->getModuleIdentifier();
+            ok[i] = true;
+
+            delete llvm_module;
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for ( unsigned int i = 0; i < jobs; i++ )
+        threads.push_back(std::thread(worker));
+
+    for ( auto& t : threads )
+        t.join();
+
+    _endPass();
+
+    for ( size_t i = 0; i < inputs.size(); i++ ) {
+        if ( ! ok[i] ) {
+            for ( auto m : compiled )
+                delete m;
+
+            return std::list<llvm::Module*>();
+        }
+
+        auto llvm_module = _loadBitcode(outputs[i], names[i]);
+
+        if ( ! llvm_module )
+            internalError(util::fmt("cannot load bitcode generated for module %s", inputs[i]->id()->pathAsString()));
+
+        compiled.push_back(llvm_module);
+    }
+
+    return compiled;
+}
+
+llvm::Module* CompilerContext::_loadBitcode(const string& data, const string& name)
+{
+    std::unique_ptr<llvm::MemoryBuffer> mb(llvm::MemoryBuffer::getMemBuffer(data, name, false));
+
+#ifdef HAVE_LLVM_35
+    auto mod = llvm::parseBitcodeFile(mb.get(), llvm::getGlobalContext());
+
+    if ( ! mod )
+        return nullptr;
+
+    mod.get()->setModuleIdentifier(name);
+    return mod.get();
+#else
+    string err;
+    auto mod = llvm::ParseBitcodeFile(mb.get(), llvm::getGlobalContext(), &err);
+
+    if ( ! mod )
+        return nullptr;
+
+    mod->setModuleIdentifier(name);
+    return mod;
+#endif
+}
+
 bool CompilerContext::print(shared_ptr<Module> module, std::ostream& out, bool cfg)
 {
     passes::Printer printer(out, false, cfg);
@@ -733,6 +993,18 @@ llvm::Module* CompilerContext::linkModules(string output, std::list<llvm::Module
 #endif
     }
 
+    else if ( options().optimize && ! options().debug ) {
+        // The runtime library gets linked in natively later, but we can
+        // still give LLVM its hot functions to inline. They must come from
+        // the same variant that will be linked.
+        auto rlbca = options().runtime_debug ? configuration().runtime_library_inline_bca_dbg : configuration().runtime_library_inline_bca;
+
+        if ( options().cgDebugging("context" ) )
+            std::cerr << "Linker: adding bitcode runtime library for inlining " << rlbca << std::endl;
+
+        linker.addInlineBitcodeFile(rlbca);
+    }
+
     if ( add_sharedlibs ) {
         for ( auto d : configuration().runtime_shared_libraries )
             dylds.push_back(d);
@@ -775,6 +1047,20 @@ llvm::Module* CompilerContext::linkModules(string output, std::list<llvm::Module
 
     _endPass();
 
+    if ( options().pgo_profile.size() || options().pgo_instrument ) {
+        codegen::ProfileGuidance pgo(this);
+
+        _beginPass(output, pgo);
+
+        if ( options().pgo_profile.size() && ! pgo.annotate(linked, options().pgo_profile) )
+            return nullptr;
+
+        if ( options().pgo_instrument && ! pgo.instrument(linked) )
+            return nullptr;
+
+        _endPass();
+    }
+
     if ( ! _optimize(linked, true) )
         return nullptr;
 
@@ -786,6 +1072,12 @@ bool CompilerContext::_optimize(llvm::Module* module, bool is_linked)
     if ( ! options().optimize )
         return true;
 
+#ifndef HAVE_LLVM_33
+    // With a tiered JIT, we optimize only hot functions later on.
+    if ( options().jit && options().tiered && is_linked )
+        return true;
+#endif
+
     if ( options().cgDebugging("context" ) )
         std::cerr << "Optimizing final linked module ... " << std::endl;
 
@@ -823,6 +1115,26 @@ llvm::ExecutionEngine* CompilerContext::jitModule(llvm::Module* module)
     return ee;
 }
 
+bool CompilerContext::writeSharedLibrary(llvm::Module* module, const string& path)
+{
+    if ( options().cgDebugging("context" ) )
+        std::cerr << util::fmt("Compiling module %s into shared library %s ...", module->getModuleIdentifier(), path) << std::endl;
+
+    // Code generation may modify the module, so we work on a copy.
+    std::unique_ptr<llvm::Module> copy(llvm::CloneModule(module));
+
+    codegen::SharedLibraryBuilder builder(this);
+
+    _beginPass(module->getModuleIdentifier(), builder);
+
+    if ( ! builder.build(copy.get(), path) )
+        return false;
+
+    _endPass();
+
+    return true;
+}
+
 void* CompilerContext::nativeFunction(llvm::Module* module, llvm::ExecutionEngine* ee, const string& function)
 {
     if ( options().cgDebugging("context" ) )
@@ -124,6 +124,21 @@ public:
     /// ownership to the caller.
     llvm::Module* compile(shared_ptr<Module> module);
 
+    /// Compiles a set of ASTs into LLVM modules. This is a variant of
+    /// compile() that, with Options::jobs allowing for more than one
+    /// thread, generates code for the modules in parallel, each inside an
+    /// LLVM context of its own. The results then get moved over into the
+    /// global LLVM context, in the order of the input, so that linking
+    /// remains deterministic.
+    ///
+    /// modules: The modules to compile. They must all have passed through
+    /// finalize(), and must not be modified while this is running.
+    ///
+    /// Returns: The compiled LLVM modules, in the same order as  modules;
+    /// or an empty list if errors are encountered. Passes ownership to the
+    /// caller.
+    std::list<llvm::Module*> compile(const std::list<shared_ptr<Module>>& modules);
+
     /// Compiles an AST into a LLVM module. This is a variant of compile()
     /// that takes a prepopulated cache key under which the compiled module
     /// will be stored if caching is enabled. However, this version will
@@ -216,6 +231,20 @@ public:
     /// engine to the caller.
     llvm::ExecutionEngine* jitModule(llvm::Module* module);
 
+    /// Compiles an LLVM module returned by linkModules() ahead of time into
+    /// a native shared library for the host CPU. A host application can
+    /// then load the library with ``dlopen()`` instead of JITing the
+    /// module, and retrieve the functions it would otherwise get from
+    /// nativeFunction() with ``dlsym()``.
+    ///
+    /// module: The module. It's not modified, and may still be passed to
+    /// jitModule() afterwards.
+    ///
+    /// path: The path of the library to write.
+    ///
+    /// Returns: True if successful.
+    bool writeSharedLibrary(llvm::Module* module, const string& path);
+
     /// Returns a pointer to a compiled, native function after a module has
     /// beed JITed. This must only be called after jitModule().
     ///
@@ -298,13 +327,31 @@ public:
     void toCacheKey(shared_ptr<Module> module, ::util::cache::FileCache::Key* key);
 
     /// Augments the cache key with values suitable to check if an LLVM
-    /// module has changed.
+    /// module has changed. This hashes the module's bitcode.
     ///
     /// module: The module to update the key for.
     ///
     /// key: The key to update.
     void toCacheKey(const llvm::Module* module, ::util::cache::FileCache::Key* key);
 
+    /// Records the outcome of a cache lookup for the report requested via
+    /// Options::report_times. This is a no-op if no report is requested.
+    ///
+    /// kind: The kind of cache entry, e.g., \c module for compiled LLVM
+    /// modules, or \c native for JITed code.
+    ///
+    /// name: A name to identify the entry.
+    ///
+    /// hit: True if the lookup found an entry.
+    void recordCacheLookup(const string& kind, const string& name, bool hit);
+
+    /// Writes out the report requested via Options::report_times, covering
+    /// all passes and cache lookups recorded by the context so far. The
+    /// report is in JSON.
+    ///
+    /// Returns: False if the report could not be written.
+    bool writeTimesReport();
+
     /// Returns a list of path names that this module depends on.
     ///
     /// \todo This is actually not yet implemented and always returns an
@@ -330,6 +377,15 @@ private:
     /// Returns: True if successful.
     bool _optimize(llvm::Module* module, bool is_linked);
 
+    /// Reads an LLVM module from bitcode into the global LLVM context.
+    ///
+    /// data: The bitcode.
+    ///
+    /// name: The identifier to give to the module.
+    ///
+    /// Returns: The module, or null if the bitcode couldn't be parsed.
+    llvm::Module* _loadBitcode(const string& data, const string& name);
+
     // Backend for finalize().
     bool _finalize(shared_ptr<Module> module, bool verify);
 
@@ -376,12 +432,45 @@ public:
         string module;
         double time;
         string name;
+        uint64_t max_rss;
     };
 
     typedef std::list<PassInfo> pass_list;
 
+    /// Records a completed pass for the report requested via
+    /// Options::report_times. This is a no-op if no report is requested.
+    ///
+    /// component: The component running the pass, i.e., \c hilti or \c
+    /// binpac.
+    ///
+    /// pass: The pass, as pushed onto passes() when it began. It must still
+    /// be on there.
+    void recordPass(const string& component, const PassInfo& pass);
+
 private:
+    // Entries for the report requested via Options::report_times.
+    struct PassRecord {
+        string component;
+        string name;
+        string module;
+        int depth;
+        double start;       // Relative to the context's creation.
+        double time;        // Wall time.
+        uint64_t max_rss;   // Peak RSS at the end, in KB.
+        uint64_t max_rss_growth; // Increase of peak RSS during the pass.
+    };
+
+    struct CacheRecord {
+        string kind;
+        string name;
+        bool hit;
+        double start;
+    };
+
     pass_list _passes;
+    std::list<PassRecord> _pass_records;
+    std::list<CacheRecord> _cache_records;
+    double _start_time;
 
 public:
     pass_list& passes() { return _passes; }
@@ -52,7 +52,9 @@ iBegin(file, Open, "file.open")
         Opens a file *op1* for writing. *op2* is the path of the file. If not
         absolute, it is interpreted relative to the current directory. *op3*
         is tuple consisting of (1) the file type, either
-        ~~Hilti::FileType::Text or ~~Hilti::FileType::Binary; (2) the file
+        ~~Hilti::FileType::Text or ~~Hilti::FileType::Binary, or
+        ~~Hilti::FileType::TextGzip or ~~Hilti::FileType::BinaryGzip for
+        writing the same as gzip-compressed output; (2) the file
         open mode, either ~~Hilti::FileMode::Create or
         ~~Hilti::FileMode::Append; and (3) a string giveing the output
         character set for writing out strings. If *op3* is not given, the
@@ -63,6 +65,20 @@ iBegin(file, Open, "file.open")
 
 iEnd
 
+iBegin(file, Flush, "file.flush")
+    iOp1(optype::refFile, false)
+
+    iValidate {
+    }
+
+    iDoc(R"(    
+        Writes out everything written to file *op1* so far. For compressed
+        files, this completes the current gzip member, so that tools reading
+        the file see all data up to this point.
+    )")
+
+iEnd
+
 iBegin(file, WriteString, "file.write")
     iOp1(optype::refFile, false)
     iOp2(optype::string, true)
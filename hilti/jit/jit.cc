@@ -15,50 +15,256 @@
 
 #ifndef HAVE_LLVM_33
 #include <llvm/ExecutionEngine/JITMemoryManager.h>
+#include <llvm/ExecutionEngine/ObjectImage.h>
+#include <llvm/Object/ObjectFile.h>
+#endif
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #endif
 
 #include "jit.h"
 #include "../options.h"
 #include "../codegen/common.h"
+#include "../codegen/optimizer.h"
 
 extern void* __hlt_internal_global_globals;
 
 using namespace hilti;
 using namespace hilti::jit;
 
-class HiltiJITEventListener : public llvm::JITEventListener
+// Announces JITed functions to external tools, as selected by
+// Options::jit_symbols. The output files are per process and shared by all
+// instances.
+class hilti::jit::EventListener : public llvm::JITEventListener
 {
 public:
-    HiltiJITEventListener();
-    virtual ~HiltiJITEventListener();
+    EventListener(const Options& options);
+    virtual ~EventListener();
 
+#ifdef HAVE_LLVM_33
     void NotifyFunctionEmitted(const llvm::Function &, void *, size_t, const EmittedFunctionDetails &) override;
+#else
+    void NotifyObjectEmitted(const llvm::ObjectImage& obj) override;
+#endif
 
 private:
-    FILE* _mapping;
+    void registerFunction(const string& name, uint64_t addr, uint64_t size);
+    void writePerfMap(const string& name, uint64_t addr, uint64_t size);
+    void writeJitDump(const string& name, uint64_t addr, uint64_t size);
+
+    bool _perf_map;
+    bool _jitdump;
+
+    static std::mutex _lock;
+    static FILE* _perf_map_file;
+    static FILE* _jitdump_file;
+    static uint64_t _jitdump_index;
+};
+
+std::mutex hilti::jit::EventListener::_lock;
+FILE* hilti::jit::EventListener::_perf_map_file = nullptr;
+FILE* hilti::jit::EventListener::_jitdump_file = nullptr;
+uint64_t hilti::jit::EventListener::_jitdump_index = 0;
+
+#ifdef __linux__
+
+// The jitdump format as documented in perf's jitdump-specification.txt.
+
+static const uint32_t JITDUMP_MAGIC = 0x4A695444;
+static const uint32_t JITDUMP_VERSION = 1;
+static const uint32_t JITDUMP_CODE_LOAD = 0;
+
+struct JitDumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
 };
 
+struct JitDumpCodeLoad {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    // Followed by the null-terminated name and the code.
+};
 
-HiltiJITEventListener::HiltiJITEventListener()
+// perf matches the timestamps against those of its samples, which need to
+// be recorded with "perf record -k mono".
+static uint64_t jitdumpTimestamp()
 {
-    _mapping = fopen(".functions.map", "w");
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    if ( ! _mapping )
-        fprintf(stderr, "HILTI jit warning: cannot open function mappings file\n");
+#endif
+
+hilti::jit::EventListener::EventListener(const Options& options)
+{
+    _perf_map = options.jitSymbols("perf-map");
+    _jitdump = options.jitSymbols("jitdump");
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if ( _perf_map && ! _perf_map_file ) {
+        auto fname = ::util::fmt("/tmp/perf-%d.map", getpid());
+        _perf_map_file = fopen(fname.c_str(), "a");
+
+        if ( ! _perf_map_file )
+            fprintf(stderr, "HILTI jit warning: cannot open %s\n", fname.c_str());
+    }
+
+#ifdef __linux__
+    if ( _jitdump && ! _jitdump_file ) {
+        auto fname = ::util::fmt("/tmp/jit-%d.dump", getpid());
+        _jitdump_file = fopen(fname.c_str(), "w+");
+
+        if ( ! _jitdump_file ) {
+            fprintf(stderr, "HILTI jit warning: cannot open %s\n", fname.c_str());
+            return;
+        }
+
+        // perf finds the file by looking for an executable mapping of it.
+        auto marker = mmap(0, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(_jitdump_file), 0);
+
+        if ( marker == MAP_FAILED )
+            fprintf(stderr, "HILTI jit warning: cannot map %s, perf won't find it\n", fname.c_str());
+
+        JitDumpHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = JITDUMP_MAGIC;
+        hdr.version = JITDUMP_VERSION;
+        hdr.total_size = sizeof(hdr);
+#if defined(__x86_64__)
+        hdr.elf_mach = EM_X86_64;
+#elif defined(__i386__)
+        hdr.elf_mach = EM_386;
+#elif defined(__aarch64__)
+        hdr.elf_mach = EM_AARCH64;
+#endif
+        hdr.pid = getpid();
+        hdr.timestamp = jitdumpTimestamp();
+
+        fwrite(&hdr, sizeof(hdr), 1, _jitdump_file);
+        fflush(_jitdump_file);
+    }
+#else
+    if ( _jitdump )
+        fprintf(stderr, "HILTI jit warning: jitdump is only supported on Linux\n");
+#endif
 }
 
-HiltiJITEventListener::~HiltiJITEventListener()
+hilti::jit::EventListener::~EventListener()
 {
-    if ( _mapping )
-        fclose(_mapping);
+    // We keep the files open for other instances, and for the rest of
+    // the process's lifetime.
 }
 
-void HiltiJITEventListener::NotifyFunctionEmitted(const llvm::Function& f, void *ptr, size_t size, const EmittedFunctionDetails& d)
+void hilti::jit::EventListener::writePerfMap(const string& name, uint64_t addr, uint64_t size)
 {
-    fprintf(_mapping, "%s %p %p %lu\n", f.getName().str().c_str(), ptr, (char *)ptr + size - 1, size);
-    fflush(_mapping);
+    if ( ! _perf_map_file )
+        return;
+
+    fprintf(_perf_map_file, "%" PRIx64 " %" PRIx64 " %s\n", addr, size, name.c_str());
+    fflush(_perf_map_file);
+}
+
+void hilti::jit::EventListener::writeJitDump(const string& name, uint64_t addr, uint64_t size)
+{
+#ifdef __linux__
+    if ( ! _jitdump_file )
+        return;
+
+    JitDumpCodeLoad rec;
+    rec.id = JITDUMP_CODE_LOAD;
+    rec.total_size = sizeof(rec) + name.size() + 1 + size;
+    rec.timestamp = jitdumpTimestamp();
+    rec.pid = getpid();
+    rec.tid = syscall(SYS_gettid);
+    rec.vma = addr;
+    rec.code_addr = addr;
+    rec.code_size = size;
+    rec.code_index = _jitdump_index++;
+
+    fwrite(&rec, sizeof(rec), 1, _jitdump_file);
+    fwrite(name.c_str(), name.size() + 1, 1, _jitdump_file);
+    fwrite(reinterpret_cast<const void*>(addr), size, 1, _jitdump_file);
+    fflush(_jitdump_file);
+#endif
+}
+
+void hilti::jit::EventListener::registerFunction(const string& name, uint64_t addr, uint64_t size)
+{
+    if ( ! size )
+        return;
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if ( _perf_map )
+        writePerfMap(name, addr, size);
+
+    if ( _jitdump )
+        writeJitDump(name, addr, size);
+}
+
+#ifdef HAVE_LLVM_33
+
+void hilti::jit::EventListener::NotifyFunctionEmitted(const llvm::Function& f, void *ptr, size_t size, const EmittedFunctionDetails& d)
+{
+    registerFunction(f.getName().str(), reinterpret_cast<uint64_t>(ptr), size);
+}
+
+#else
+
+void hilti::jit::EventListener::NotifyObjectEmitted(const llvm::ObjectImage& obj)
+{
+#ifdef HAVE_LLVM_34
+    llvm::error_code ec;
+    for ( auto i = obj.begin_symbols(); i != obj.end_symbols(); i.increment(ec) ) {
+#else
+    for ( auto i = obj.begin_symbols(); i != obj.end_symbols(); ++i ) {
+#endif
+        llvm::object::SymbolRef::Type type;
+        llvm::StringRef name;
+        uint64_t addr;
+        uint64_t size;
+
+        if ( i->getType(type) || type != llvm::object::SymbolRef::ST_Function )
+            continue;
+
+        if ( i->getName(name) || i->getAddress(addr) || i->getSize(size) )
+            continue;
+
+        registerFunction(name.str(), addr, size);
+    }
 }
 
+#endif
+
 // This is a proxy class that forwards most method calls directly to LLVM's
 // DefaultJITMemoryManager. This is necessary because that class is not
 // exposed for reasons I don't understand.
@@ -149,8 +355,17 @@ void* MemoryManager::lookupFunctionInTable(const std::string& name)
     return nullptr;
 }
 
+#ifndef HAVE_LLVM_33
+static void tierUp(uint64_t idx);
+#endif
+
 uint64_t MemoryManager::getSymbolAddress(const std::string &Name)
 {
+#ifndef HAVE_LLVM_33
+    if ( Name == "__hlt_jit_tier_up" )
+        return (uint64_t)&tierUp;
+#endif
+
     return _mm->getSymbolAddress(Name);
 }
 
@@ -182,6 +397,10 @@ public:
     llvm::MemoryBuffer* getObject(const llvm::Module *module) override;
 
 private:
+    // Augments the key with everything besides the IR that affects the
+    // generated machine code.
+    void targetToCacheKey(::util::cache::FileCache::Key* key);
+
     CompilerContext* _ctx;
     const llvm::Module* _key_module;
     ::util::cache::FileCache::Key _key;
@@ -205,12 +424,24 @@ void hilti::jit::ObjectCache::notifyObjectCompiled(const llvm::Module *module, c
     // module changes between the getObject() call and this method, so that
     // if we hash it now, we won't get matching results.
 
-    assert(_key_module == module);
+    if ( _key_module != module ) {
+        if ( _ctx->options().cgDebugging("cache" ) )
+            std::cerr << util::fmt("No key for compiled module %s, not caching", module->getModuleIdentifier()) << std::endl;
 
-    if ( _key_module != module )
-        abort();
+        return;
+    }
 
     _ctx->fileCache()->store(_key, obj->getBufferStart(), obj->getBufferSize());
+    _key_module = nullptr;
+}
+
+void hilti::jit::ObjectCache::targetToCacheKey(::util::cache::FileCache::Key* key)
+{
+    // Must match the target setup in JIT::jitModule(). The CPU determines
+    // the instruction set we generate code for.
+    key->hashes.insert(util::fmt("llvm-%d.%d", LLVM_VERSION_MAJOR, LLVM_VERSION_MINOR));
+    key->hashes.insert(util::fmt("triple-%s", llvm::sys::getProcessTriple()));
+    key->hashes.insert(util::fmt("cpu-%s", llvm::sys::getHostCPUName().str()));
 }
 
 llvm::MemoryBuffer* hilti::jit::ObjectCache::getObject(const llvm::Module *module)
@@ -223,6 +454,7 @@ llvm::MemoryBuffer* hilti::jit::ObjectCache::getObject(const llvm::Module *modul
     key.name = module->getModuleIdentifier();
     _ctx->toCacheKey(module, &key);
     _ctx->options().toCacheKey(&key);
+    targetToCacheKey(&key);
 
     _key_module = module;
     _key = key;
@@ -230,6 +462,8 @@ llvm::MemoryBuffer* hilti::jit::ObjectCache::getObject(const llvm::Module *modul
     auto lms = _ctx->fileCache()->lookup(key);
     assert(lms.size() <= 1);
 
+    _ctx->recordCacheLookup("native", module->getModuleIdentifier(), lms.size());
+
     if ( lms.size() ) {
         if ( _ctx->options().cgDebugging("cache" ) )
             std::cerr << util::fmt("Reusing cached compiled module for %s.a", module->getModuleIdentifier()) << std::endl;
@@ -243,6 +477,422 @@ llvm::MemoryBuffer* hilti::jit::ObjectCache::getObject(const llvm::Module *modul
     return nullptr;
 }
 
+// Returns the target options to JIT with.
+static llvm::TargetOptions targetOptions(const Options& options)
+{
+    llvm::TargetOptions to;
+#ifdef HAVE_LLVM_33
+    to.JITExceptionHandling = false;
+#endif
+    to.JITEmitDebugInfo = true;
+    to.JITEmitDebugInfoToDisk = false;
+    to.UseSoftFloat = false;
+    to.FloatABIType = llvm::FloatABI::Default;
+    to.GuaranteedTailCallOpt = options.optimize;
+    // to.PrintMachineCode = true;
+    // to.EnableSegmentedStacks = true; // Leads to "varargs not supported".
+    return to;
+}
+
+#ifndef HAVE_LLVM_33
+
+// The number of calls after which a function counts as hot.
+static const uint64_t HotThreshold = 10000;
+
+// How long to wait for further functions to turn hot before optimizing
+// a batch.
+static const unsigned int BatchDelay = 100; // msecs
+
+// Implements the tiered JIT (see Options::tiered). We instrument the
+// unoptimized code so that each HILTI function counts its calls and, once
+// hot, reports itself through __hlt_jit_tier_up(). A background thread
+// then compiles optimized versions of all newly hot functions, each time
+// into an engine of its own that links against the unoptimized code's
+// globals and functions. Each function has a slot with the address of
+// its current version; on entry, the unoptimized version forwards to the
+// slot's target if that's been updated.
+class hilti::jit::Tiering : public llvm::JITEventListener, public ast::Logger
+{
+public:
+    Tiering(CompilerContext* ctx, EventListener* listener);
+    virtual ~Tiering();
+
+    // Prepares a linked module for the unoptimized tier. Must be called
+    // before JITing it, with this instance registered as listener for
+    // its engine.
+    void instrument(llvm::Module* module);
+
+    // Records that a function has turned hot.
+    void hot(uint64_t idx);
+
+    // Returns the address of a symbol of the unoptimized code, or zero if
+    // not known.
+    uint64_t symbolAddress(const std::string& name);
+
+    // Overridden from llvm::JITEventListener.
+    void NotifyObjectEmitted(const llvm::ObjectImage& obj) override;
+
+    // The instance that __hlt_jit_tier_up() reports to. We support only
+    // one tiered module per process.
+    static Tiering* active;
+
+private:
+    void run();
+    void optimize(const std::list<uint64_t>& batch);
+
+    struct HotFunction {
+        string name;
+        bool queued;
+    };
+
+    CompilerContext* _ctx;
+    EventListener* _listener;
+    string _bitcode;
+    std::vector<HotFunction> _functions;
+    std::map<string, uint64_t> _symbols;
+    std::list<uint64_t> _queue;
+    std::mutex _lock;
+    std::condition_variable _cond;
+    std::thread _thread;
+    bool _stop = false;
+};
+
+hilti::jit::Tiering* hilti::jit::Tiering::active = nullptr;
+
+static void tierUp(uint64_t idx)
+{
+    if ( Tiering::active )
+        Tiering::active->hot(idx);
+}
+
+// Memory manager for the optimized code, resolving references to the
+// unoptimized code's symbols.
+class TieringMemoryManager : public llvm::SectionMemoryManager
+{
+public:
+    TieringMemoryManager(Tiering* tiering) { _tiering = tiering; }
+
+    uint64_t getSymbolAddress(const std::string& name) override {
+        if ( auto addr = _tiering->symbolAddress(name) )
+            return addr;
+
+        return llvm::SectionMemoryManager::getSymbolAddress(name);
+    }
+
+private:
+    Tiering* _tiering;
+};
+
+hilti::jit::Tiering::Tiering(CompilerContext* ctx, EventListener* listener) : ast::Logger("jit::Tiering")
+{
+    _ctx = ctx;
+    _listener = listener;
+
+#ifndef HAVE_LLVM_35
+    llvm::llvm_start_multithreaded();
+#endif
+
+    active = this;
+}
+
+hilti::jit::Tiering::~Tiering()
+{
+    if ( active == this )
+        active = nullptr;
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+
+    _cond.notify_one();
+
+    if ( _thread.joinable() )
+        _thread.join();
+
+    // We don't delete the engines we created: their code may still be
+    // executing.
+}
+
+void hilti::jit::Tiering::instrument(llvm::Module* module)
+{
+    // Give everything with local linkage a global symbol, so that the
+    // optimized code can link against it.
+    auto externalize = [] (llvm::GlobalValue* gv) {
+        if ( ! gv->hasLocalLinkage() || gv->getName().startswith("llvm.") )
+            return;
+
+        if ( ! gv->hasName() )
+            gv->setName("__hlt_tiered");
+
+        gv->setLinkage(llvm::GlobalValue::ExternalLinkage);
+        gv->setVisibility(llvm::GlobalValue::HiddenVisibility);
+    };
+
+    for ( auto g = module->global_begin(); g != module->global_end(); g++ )
+        externalize(g);
+
+    for ( auto f = module->begin(); f != module->end(); f++ ) {
+        if ( ! f->isDeclaration() )
+            externalize(f);
+    }
+
+    // Keep a copy for building the optimized versions from.
+    llvm::raw_string_ostream out(_bitcode);
+    llvm::WriteBitcodeToFile(module, out);
+    out.flush();
+
+    auto& ctx = module->getContext();
+    auto i64 = llvm::Type::getInt64Ty(ctx);
+    auto tier_up = module->getOrInsertFunction("__hlt_jit_tier_up", llvm::Type::getVoidTy(ctx), i64, nullptr);
+
+    std::list<llvm::Function*> funcs;
+
+    for ( auto f = module->begin(); f != module->end(); f++ ) {
+        // HILTI functions are the ones with fastcc.
+        if ( f->isDeclaration() || f->isVarArg() || f->getCallingConv() != llvm::CallingConv::Fast )
+            continue;
+
+        funcs.push_back(f);
+    }
+
+    for ( auto f : funcs ) {
+        auto idx = _functions.size();
+        _functions.push_back(HotFunction{f->getName().str(), false});
+
+        auto slot = new llvm::GlobalVariable(*module, f->getType(), false, llvm::GlobalValue::ExternalLinkage, f, f->getName() + ".tier.slot");
+        slot->setVisibility(llvm::GlobalValue::HiddenVisibility);
+
+        auto calls = new llvm::GlobalVariable(*module, i64, false, llvm::GlobalValue::InternalLinkage, llvm::ConstantInt::get(i64, 0), f->getName() + ".tier.calls");
+
+        auto body = &f->getEntryBlock();
+        auto check = llvm::BasicBlock::Create(ctx, "tier.check", f, body);
+        auto forward = llvm::BasicBlock::Create(ctx, "tier.forward", f, body);
+        auto count = llvm::BasicBlock::Create(ctx, "tier.count", f, body);
+        auto report = llvm::BasicBlock::Create(ctx, "tier.hot", f, body);
+
+        llvm::IRBuilder<> builder(check);
+
+        // Pairs with the release store installing the optimized version.
+        auto target = builder.CreateLoad(slot);
+        target->setAtomic(llvm::Acquire);
+        target->setAlignment(sizeof(void*));
+
+        builder.CreateCondBr(builder.CreateICmpEQ(target, f), count, forward);
+
+        builder.SetInsertPoint(forward);
+
+        std::vector<llvm::Value*> args;
+
+        for ( auto a = f->arg_begin(); a != f->arg_end(); a++ )
+            args.push_back(a);
+
+        // Note that the calling convention must be the same for both
+        // tiers, including GuaranteedTailCallOpt.
+        auto call = builder.CreateCall(target, args);
+        call->setCallingConv(f->getCallingConv());
+        call->setAttributes(f->getAttributes());
+        call->setTailCall();
+
+        if ( f->getReturnType()->isVoidTy() )
+            builder.CreateRetVoid();
+        else
+            builder.CreateRet(call);
+
+        // All threads share the counter. Concurrent increments may step
+        // over the threshold, hence the comparison; hot() ignores repeated
+        // reports.
+        builder.SetInsertPoint(count);
+        auto old = builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, calls, llvm::ConstantInt::get(i64, 1), llvm::Monotonic);
+        auto n = builder.CreateAdd(old, llvm::ConstantInt::get(i64, 1));
+        builder.CreateCondBr(builder.CreateICmpUGE(n, llvm::ConstantInt::get(i64, HotThreshold)), report, body);
+
+        // Start counting anew so that we don't report on every call until
+        // the optimized version is in place.
+        builder.SetInsertPoint(report);
+        auto reset = builder.CreateStore(llvm::ConstantInt::get(i64, 0), calls);
+        reset->setAtomic(llvm::Monotonic);
+        reset->setAlignment(8);
+        builder.CreateCall(tier_up, llvm::ConstantInt::get(i64, idx));
+        builder.CreateBr(body);
+    }
+
+    if ( _ctx->options().cgDebugging("tiering") )
+        std::cerr << util::fmt("Tiering: instrumented %d functions in %s", _functions.size(), module->getModuleIdentifier()) << std::endl;
+}
+
+void hilti::jit::Tiering::hot(uint64_t idx)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if ( idx >= _functions.size() || _functions[idx].queued )
+        return;
+
+    _functions[idx].queued = true;
+    _queue.push_back(idx);
+
+    if ( ! _thread.joinable() )
+        _thread = std::thread(&Tiering::run, this);
+
+    _cond.notify_one();
+}
+
+uint64_t hilti::jit::Tiering::symbolAddress(const std::string& name)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    auto i = _symbols.find(name);
+    return i != _symbols.end() ? i->second : 0;
+}
+
+void hilti::jit::Tiering::NotifyObjectEmitted(const llvm::ObjectImage& obj)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+#ifdef HAVE_LLVM_34
+    llvm::error_code ec;
+    for ( auto i = obj.begin_symbols(); i != obj.end_symbols(); i.increment(ec) ) {
+#else
+    for ( auto i = obj.begin_symbols(); i != obj.end_symbols(); ++i ) {
+#endif
+        llvm::StringRef name;
+        uint64_t addr;
+
+        if ( i->getName(name) || i->getAddress(addr) || ! addr )
+            continue;
+
+        _symbols[name.str()] = addr;
+    }
+}
+
+void hilti::jit::Tiering::run()
+{
+    while ( true ) {
+        {
+            std::unique_lock<std::mutex> lock(_lock);
+            _cond.wait(lock, [&] { return _stop || _queue.size(); });
+
+            if ( _stop )
+                return;
+        }
+
+        // Give other functions a chance to turn hot as well, so that we
+        // can optimize them in one go.
+        std::this_thread::sleep_for(std::chrono::milliseconds(BatchDelay));
+
+        std::list<uint64_t> batch;
+
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+
+            if ( _stop )
+                return;
+
+            batch.swap(_queue);
+        }
+
+        optimize(batch);
+    }
+}
+
+void hilti::jit::Tiering::optimize(const std::list<uint64_t>& batch)
+{
+    auto debug = _ctx->options().cgDebugging("tiering");
+
+    std::set<string> names;
+
+    for ( auto idx : batch )
+        names.insert(_functions[idx].name);
+
+    if ( debug )
+        std::cerr << util::fmt("Tiering: optimizing %s", util::strjoin(names, ", ")) << std::endl;
+
+    // Each batch gets a context of its own; that's never deleted either.
+    auto ctx = new llvm::LLVMContext();
+    std::unique_ptr<llvm::MemoryBuffer> mb(llvm::MemoryBuffer::getMemBuffer(_bitcode, "", false));
+
+#ifdef HAVE_LLVM_35
+    auto result = llvm::parseBitcodeFile(mb.get(), *ctx);
+    auto module = result ? result.get() : nullptr;
+#else
+    string err;
+    auto module = llvm::ParseBitcodeFile(mb.get(), *ctx, &err);
+#endif
+
+    if ( ! module ) {
+        error("tiering: cannot load module copy");
+        return;
+    }
+
+    // Keep just the hot functions. Everything else remains available
+    // for inlining and constant folding, but links against the
+    // unoptimized code's instances.
+    for ( auto f = module->begin(); f != module->end(); f++ ) {
+        if ( ! f->isDeclaration() && ! names.count(f->getName().str()) )
+            f->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+    }
+
+    std::list<llvm::GlobalVariable*> appending;
+
+    for ( auto g = module->global_begin(); g != module->global_end(); g++ ) {
+        if ( g->hasAppendingLinkage() )
+            appending.push_back(g);
+
+        else if ( ! g->isDeclaration() )
+            g->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+    }
+
+    // Static constructors and the like have run already.
+    for ( auto g : appending )
+        g->eraseFromParent();
+
+    codegen::Optimizer optimizer(_ctx);
+
+    if ( ! optimizer.optimize(module, false) ) {
+        error("tiering: optimizing failed");
+        delete module;
+        return;
+    }
+
+    string errormsg;
+
+    llvm::EngineBuilder builder(module);
+    builder.setEngineKind(llvm::EngineKind::JIT);
+    builder.setUseMCJIT(true);
+    builder.setMCJITMemoryManager(new TieringMemoryManager(this));
+    builder.setErrorStr(&errormsg);
+    builder.setOptLevel(llvm::CodeGenOpt::Default);
+    builder.setMCPU(llvm::sys::getHostCPUName());
+    builder.setTargetOptions(targetOptions(_ctx->options()));
+
+    auto ee = builder.create();
+
+    if ( ! ee ) {
+        error(util::fmt("tiering: LLVM jit error: %s", errormsg));
+        return;
+    }
+
+    ee->DisableLazyCompilation(true);
+    ee->RegisterJITEventListener(_listener);
+
+    for ( auto idx : batch ) {
+        auto name = _functions[idx].name;
+        auto addr = ee->getFunctionAddress(name);
+        auto slot = symbolAddress(name + ".tier.slot");
+
+        if ( ! (addr && slot) ) {
+            error(util::fmt("tiering: cannot install optimized version of %s", name));
+            continue;
+        }
+
+        __atomic_store_n((void**)slot, (void*)addr, __ATOMIC_RELEASE);
+
+        if ( debug )
+            std::cerr << util::fmt("Tiering: %s now at %p", name, (void*)addr) << std::endl;
+    }
+}
+
+#endif
+
 JIT::JIT(CompilerContext* ctx)
 {
     LLVMLinkInMCJIT();
@@ -253,10 +903,14 @@ JIT::JIT(CompilerContext* ctx)
     _ctx = ctx;
     _mm = new MemoryManager(llvm::JITMemoryManager::CreateDefaultMemManager());
     _cache = new ObjectCache(ctx);
+    _listener = new EventListener(ctx->options());
 }
 
 JIT::~JIT()
 {
+#ifndef HAVE_LLVM_33
+    delete _tiering;
+#endif
 }
 
 llvm::ExecutionEngine* JIT::jitModule(llvm::Module* module)
@@ -268,7 +922,20 @@ llvm::ExecutionEngine* JIT::jitModule(llvm::Module* module)
 #endif
 
     auto opt = _ctx->options().optimize;
-    auto opt_level = opt ? llvm::CodeGenOpt::Default : llvm::CodeGenOpt::None;
+
+#ifndef HAVE_LLVM_33
+    if ( opt && _ctx->options().tiered ) {
+        if ( _tiering ) {
+            error("jit: only one tiered module supported");
+            return nullptr;
+        }
+
+        _tiering = new Tiering(_ctx, _listener);
+        _tiering->instrument(module);
+    }
+#endif
+
+    auto opt_level = (opt && ! _tiering) ? llvm::CodeGenOpt::Default : llvm::CodeGenOpt::None;
 
     string errormsg;
 
@@ -288,18 +955,7 @@ llvm::ExecutionEngine* JIT::jitModule(llvm::Module* module)
     builder.setMArch("");
     builder.setMCPU(llvm::sys::getHostCPUName());
 
-    llvm::TargetOptions Options;
-#ifdef HAVE_LLVM_33
-    Options.JITExceptionHandling = false;
-#endif
-    Options.JITEmitDebugInfo = true;
-    Options.JITEmitDebugInfoToDisk = false;
-    Options.UseSoftFloat = false;
-    Options.FloatABIType = llvm::FloatABI::Default;
-    Options.GuaranteedTailCallOpt = opt;
-    // Options.PrintMachineCode = true;
-    // Options.EnableSegmentedStacks = true; // Leads to "varargs not supported".
-    builder.setTargetOptions(Options);
+    builder.setTargetOptions(targetOptions(_ctx->options()));
 
     auto ee = builder.create();
     if ( ! ee ) {
@@ -312,7 +968,17 @@ llvm::ExecutionEngine* JIT::jitModule(llvm::Module* module)
     ee->setObjectCache(_cache);
 
     ee->RegisterJITEventListener(llvm::JITEventListener::createOProfileJITEventListener());
-    ee->RegisterJITEventListener(new HiltiJITEventListener());
+    ee->RegisterJITEventListener(_listener);
+
+#ifndef HAVE_LLVM_33
+    if ( _tiering )
+        ee->RegisterJITEventListener(_tiering);
+#endif
+
+#ifdef HAVE_LLVM_35
+    if ( _ctx->options().jitSymbols("gdb") )
+        ee->RegisterJITEventListener(llvm::JITEventListener::createGDBRegistrationListener());
+#endif
 
     return ee;
 }
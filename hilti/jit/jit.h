@@ -15,8 +15,10 @@ namespace hilti {
 
 namespace jit {
 
+class EventListener;
 class MemoryManager;
 class ObjectCache;
+class Tiering;
 
 // Central JIT engine.
 class JIT : public ast::Logger
@@ -66,6 +68,8 @@ private:
     CompilerContext* _ctx;
     MemoryManager* _mm;
     ObjectCache* _cache;
+    EventListener* _listener;
+    Tiering* _tiering = nullptr;
 };
 
 }
@@ -1,4 +1,8 @@
 
+#include <dlfcn.h>
+
+#include <functional>
+
 #include "libhilti-jit.h"
 #include "../context.h"
 
@@ -46,22 +50,24 @@ extern "C" {
 
 static struct __hlt_linker_functions _funcs;
 
-void hlt_init_jit(std::shared_ptr<hilti::CompilerContext> ctx, llvm::Module* module, llvm::ExecutionEngine* ee)
+typedef std::function<void* (const char*)> symbol_lookup;
+
+static void _hlt_init(symbol_lookup lookup)
 {
-    auto f = ctx->nativeFunction(module, ee, "__hlt_init_from_state");
+    auto f = lookup("__hlt_init_from_state");
     auto hlt_init_from_state = (void (*)(__hlt_global_state*))f;
     assert(hlt_init_from_state);
 
-    f = ctx->nativeFunction(module, ee, "__hlt_modules_init");
+    f = lookup("__hlt_modules_init");
     auto modules_init = (void (*)(void*))f;
 
-    f = ctx->nativeFunction(module, ee, "__hlt_globals_init");
+    f = lookup("__hlt_globals_init");
     auto globals_init = (void (*)(void*))f;
 
-    f = ctx->nativeFunction(module, ee, "__hlt_globals_dtor");
+    f = lookup("__hlt_globals_dtor");
     auto globals_dtor = (void (*)(void*))f;
 
-    f = ctx->nativeFunction(module, ee, "__hlt_globals_size");
+    f = lookup("__hlt_globals_size");
     auto globals_size = (int64_t (*)())f;
 
     _funcs.__hlt_modules_init = modules_init;
@@ -75,12 +81,32 @@ void hlt_init_jit(std::shared_ptr<hilti::CompilerContext> ctx, llvm::Module* mod
     hlt_init();
 }
 
-void binpac_init_jit(std::shared_ptr<hilti::CompilerContext> ctx, llvm::Module* module, llvm::ExecutionEngine* ee)
+static void _binpac_init(symbol_lookup lookup)
 {
-    auto f = ctx->nativeFunction(module, ee, "__binpac_init_from_state");
+    auto f = lookup("__binpac_init_from_state");
     auto binpac_init_from_state = (void (*)(__binpac_globals*))f;
 
     if ( binpac_init_from_state && __binpac_globals_get() )
         (*binpac_init_from_state)(__binpac_globals_get());
 }
 
+void hlt_init_jit(std::shared_ptr<hilti::CompilerContext> ctx, llvm::Module* module, llvm::ExecutionEngine* ee)
+{
+    _hlt_init([&](const char* name) { return ctx->nativeFunction(module, ee, name); });
+}
+
+void binpac_init_jit(std::shared_ptr<hilti::CompilerContext> ctx, llvm::Module* module, llvm::ExecutionEngine* ee)
+{
+    _binpac_init([&](const char* name) { return ctx->nativeFunction(module, ee, name); });
+}
+
+void hlt_init_library(void* handle)
+{
+    _hlt_init([&](const char* name) { return dlsym(handle, name); });
+}
+
+void binpac_init_library(void* handle)
+{
+    _binpac_init([&](const char* name) { return dlsym(handle, name); });
+}
+
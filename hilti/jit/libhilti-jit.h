@@ -41,4 +41,13 @@ namespace llvm {
 extern void hlt_init_jit(std::shared_ptr<hilti::CompilerContext> ctx, llvm::Module* module, llvm::ExecutionEngine* ee);
 extern void binpac_init_jit(std::shared_ptr<hilti::CompilerContext> ctx, llvm::Module* module, llvm::ExecutionEngine* ee);
 
+/// Initializes the HILTI run-time library for code that was compiled ahead
+/// of time by CompilerContext::writeSharedLibrary(). This must be called
+/// instead of \a hlt_init_jit() when using such a library instead of the
+/// JIT, and it likewise comes with \a binpac_init_library().
+///
+/// handle: The library's handle as returned by ``dlopen()``.
+extern void hlt_init_library(void* handle);
+extern void binpac_init_library(void* handle);
+
 #endif
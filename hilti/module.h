@@ -15,6 +15,7 @@ namespace hilti {
 namespace passes {
     class CFG;
     class Liveness;
+    class OptimizeRefcounts;
 }
 
 class CompilerContext;
@@ -51,6 +52,11 @@ public:
     /// null if the pass has not yet been run by the CompilerContext.
     shared_ptr<passes::Liveness> liveness() const;
 
+    /// Returns the module's reference count optimization information. Note
+    /// that this will return null if the pass has not been run by the
+    /// CompilerContext, which it does only when optimizing.
+    shared_ptr<passes::OptimizeRefcounts> refcounts() const;
+
     ACCEPT_VISITOR_ROOT();
 
 protected:
@@ -58,12 +64,13 @@ protected:
 
     /// Sets control- and data flow passes that have run on the module.
     /// Normally only called from the CompilerContext.
-    void setPasses(shared_ptr<passes::CFG> cfg, shared_ptr<passes::Liveness> liveness);
+    void setPasses(shared_ptr<passes::CFG> cfg, shared_ptr<passes::Liveness> liveness, shared_ptr<passes::OptimizeRefcounts> refcounts = nullptr);
 
 private:
     shared_ptr<CompilerContext> _context;
     shared_ptr<passes::CFG> _cfg = nullptr;
     shared_ptr<passes::Liveness> _liveness = nullptr;
+    shared_ptr<passes::OptimizeRefcounts> _refcounts = nullptr;
 };
 
 }
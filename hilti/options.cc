@@ -27,12 +27,22 @@ bool Options::cgDebugging(const string& label) const
 
 Options::string_set Options::cgDebugLabels() const
 {
-    return { "codegen", "linker", "parser", "scanner", "scopes", "context", "dump-ast", "print-ast", "visitors", "cache", "time", "liveness" };
+    return { "codegen", "linker", "parser", "scanner", "scopes", "context", "dump-ast", "print-ast", "visitors", "cache", "time", "liveness", "tiering", "pgo" };
+}
+
+bool Options::jitSymbols(const string& label) const
+{
+    return jit_symbols.find(label) != jit_symbols.end();
+}
+
+Options::string_set Options::jitSymbolLabels() const
+{
+    return { "perf-map", "jitdump", "gdb" };
 }
 
 Options::string_set Options::optimizationLabels() const
 {
-    return string_set();
+    return { "regexps" };
 }
 
 void Options::toCacheKey(::util::cache::FileCache::Key* key) const
@@ -40,11 +50,18 @@ void Options::toCacheKey(::util::cache::FileCache::Key* key) const
     key->options += (debug ? "D" : "d");
     key->options += (optimize ? "O" : "o");
     key->options += (profile ? ::util::fmt("P%d", profile) : "p");
+    key->options += (profile_functions ? "F" : "f");
+    key->options += (tiered ? "T" : "t");
+    key->options += (runtime_debug ? "R" : "r");
+    key->options += (pgo_instrument ? "G" : "g");
     key->options += (verify ? "V" : "v");
 
     for ( auto d : libdirs_hlt )
         key->dirs.insert(d);
 
+    if ( pgo_profile.size() )
+        key->files.insert(pgo_profile);
+
     for ( auto o : optimizations )
         key->hashes.insert(o);
 }
@@ -38,15 +38,50 @@ public:
     /// included. Enabling profiling has a significant performance impact.
     unsigned int profile = 0;
 
+    /// If true, instrument all functions with counters for calls and
+    /// cycles, which the runtime aggregates per function and per caller
+    /// (see \c libhilti/fprof.h). This is much cheaper than \a profile.
+    bool profile_functions = false;
+
+    /// If true, instrument all functions with counters for calls and
+    /// branch outcomes, which the runtime writes out as a profile at
+    /// termination (see \c libhilti/pgo.h). Passing that profile back in
+    /// through \a pgo_profile then guides optimization.
+    bool pgo_instrument = false;
+
+    /// If set, the path to a profile recorded by code compiled with \a
+    /// pgo_instrument. The code generator turns it into branch weights and
+    /// inlining hints for the optimizer. The code must otherwise be
+    /// compiled with the same options as when recording the profile.
+    string pgo_profile;
+
     /// If true, all generated code is verified for correctness. Disabling
     /// this is primarily for debugging purposes.
     bool verify = true;
 
+    /// The number of threads CompilerContext::compile() may use for
+    /// generating code for a set of modules in parallel. Zero means one per
+    /// CPU core. By default, modules are compiled sequentially.
+    unsigned int jobs = 1;
+
     /// If true, prepare code for JITing. This must be set if the code will
     /// be run through JIT. This will be checked for by jitModule(), which
     /// aborts if it's not set.
     bool jit = false;
 
+    /// If true along with \a jit and \a optimize, the JIT starts out with
+    /// unoptimized code, counts calls per function, and recompiles hot
+    /// functions with full optimization on a background thread. This
+    /// trades some initial throughput for much faster startup. Requires
+    /// LLVM 3.4 or newer; ignored otherwise.
+    bool tiered = false;
+
+    /// If true, the compiled code will be linked natively with the debug
+    /// version of the runtime library even though \a debug is not set. With
+    /// \a optimize, the linker then offers the runtime's debug build for
+    /// inlining, as the copies must behave the same as the linked code.
+    bool runtime_debug = false;
+
     /// List of directories to search for imports and other \c *.hlt library
     /// files. The current directory will always be tried first. By default,
     /// this set is set to the current directory plus the installation-wide
@@ -67,6 +102,17 @@ public:
     /// is disabled.
     string module_cache;
 
+    /// If set, CompilerContext::writeTimesReport() writes a JSON report of
+    /// the wall time and peak memory of each compilation pass (including
+    /// the LLVM-level ones, linking, and JITing) and of all cache lookups
+    /// to this file. "-" means stderr.
+    string report_times;
+
+    /// A set of labels specifying how the JIT announces the functions it
+    /// compiles to external tools. jitSymbolLabels() returns a list of valid
+    /// labels. By default, this set is empty.
+    string_set jit_symbols;
+
     /// Returns true if the given label is enabled in \a optimization. This
     /// is just a convinience method.
     bool optimizing(const string& label) const;
@@ -81,6 +127,17 @@ public:
     /// Returns all available debugging options for the code generator.
     virtual string_set cgDebugLabels() const;
 
+    /// Returns true if the given label is enabled in \a jit_symbols. This is
+    /// just a convinience method.
+    bool jitSymbols(const string& label) const;
+
+    /// Returns all available labels for \a jit_symbols: \c perf-map writes
+    /// \c /tmp/perf-<pid>.map for perf to pick up symbols directly; \c
+    /// jitdump writes \c /tmp/jit-<pid>.dump, including the code, for use
+    /// with <tt>perf inject --jit</tt>; and \c gdb registers the compiled
+    /// objects with GDB's JIT interface (LLVM 3.5 only).
+    virtual string_set jitSymbolLabels() const;
+
     /// Initialized the cache key with option-specific values.
     virtual void toCacheKey(::util::cache::FileCache::Key* key) const;
 
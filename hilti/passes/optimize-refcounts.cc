@@ -0,0 +1,102 @@
+
+#include "hilti/hilti-intern.h"
+#include "hilti/options.h"
+
+#include "optimize-refcounts.h"
+
+using namespace hilti::passes;
+
+OptimizeRefcounts::OptimizeRefcounts(CompilerContext* context, shared_ptr<CFG> cfg, shared_ptr<Liveness> liveness)
+    : Pass<>("hilti::OptimizeRefcounts")
+{
+    _context = context;
+    _cfg = cfg;
+    _liveness = liveness;
+}
+
+OptimizeRefcounts::~OptimizeRefcounts()
+{
+}
+
+bool OptimizeRefcounts::run(shared_ptr<Node> module)
+{
+    for ( auto s : _cfg->depthFirstOrder() )
+        processStatement(s);
+
+    return (errors() == 0);
+}
+
+OptimizeRefcounts::variable_set OptimizeRefcounts::carried(shared_ptr<Statement> stmt) const
+{
+    auto i = _carried.find(stmt);
+    return i != _carried.end() ? i->second : variable_set();
+}
+
+OptimizeRefcounts::variable_set OptimizeRefcounts::liveAcross(shared_ptr<Statement> stmt) const
+{
+    // Same as what the code generator protects at a safepoint.
+    auto ln = _liveness->liveness(stmt);
+
+    variable_set live;
+
+    for ( auto v : *ln.in ) {
+        if ( ln.dead->find(v) == ln.dead->end() && ! v->expression->hoisted() )
+            live.insert(v);
+    }
+
+    return live;
+}
+
+// Returns true for statements that the code generator turns into a single
+// call with at most one safepoint on a straight-line path. Other
+// instructions may reach their safepoint zero or multiple times, such as
+// blocking ones that yield in a loop.
+static bool _isPlainCall(shared_ptr<Statement> stmt)
+{
+    return ast::isA<statement::instruction::flow::CallVoid>(stmt) ||
+           ast::isA<statement::instruction::flow::CallResult>(stmt);
+}
+
+void OptimizeRefcounts::processStatement(shared_ptr<Statement> stmt)
+{
+    if ( ! _isPlainCall(stmt) )
+        return;
+
+    // We need a successor that is guaranteed to execute right after this
+    // statement, and reachable only from here. Anything else, like exception
+    // edges inside a try block, makes us give up.
+    auto succs = _cfg->successors(stmt);
+
+    if ( succs.size() != 1 )
+        return;
+
+    auto next = *succs.begin();
+
+    if ( next != stmt->successor() )
+        return;
+
+    // The code generator releases anything not taken over at the end of the
+    // successor, so that must be a call too.
+    if ( ! _isPlainCall(next) )
+        return;
+
+    auto fi = stmt->flowInfo();
+    auto changed = util::set_union(util::set_union(fi.defined, fi.cleared), fi.modified);
+
+    auto next_live = liveAcross(next);
+
+    variable_set carried;
+
+    for ( auto v : liveAcross(stmt) ) {
+        if ( changed.find(v) != changed.end() )
+            continue;
+
+        if ( next_live.find(v) == next_live.end() )
+            continue;
+
+        carried.insert(v);
+    }
+
+    if ( carried.size() )
+        _carried[stmt] = carried;
+}
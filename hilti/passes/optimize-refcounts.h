@@ -0,0 +1,75 @@
+
+#ifndef HILTI_PASSES_OPTIMIZE_REFCOUNTS_H
+#define HILTI_PASSES_OPTIMIZE_REFCOUNTS_H
+
+#include <unordered_map>
+
+#include "../pass.h"
+
+namespace hilti {
+
+class CompilerContext;
+
+namespace passes {
+
+class CFG;
+class Liveness;
+
+/// Determines where code generation can skip reference count adjustments.
+/// Around every call that may trigger a memory safepoint, the code
+/// generator takes an extra reference to all live locals and releases it
+/// afterwards. For two consecutive calls that both keep a local live across
+/// them, the release at the end of the first and the new reference at the
+/// beginning of the second cancel out. This pass computes for each
+/// statement the locals for which the code generator may carry its
+/// reference over to the next statement instead.
+///
+/// This pass doesn't modify the AST; it's used by the code generator.
+class OptimizeRefcounts : public Pass<>
+{
+public:
+    /// Constructor.
+    ///
+    /// context: The compiler context to use.
+    ///
+    /// cfg: The control flow graph for the module, which must have been
+    /// computed already.
+    ///
+    /// liveness: The liveness information for the module, which must have
+    /// been computed already.
+    OptimizeRefcounts(CompilerContext* context, shared_ptr<CFG> cfg, shared_ptr<Liveness> liveness);
+    virtual ~OptimizeRefcounts();
+
+    /// Computes the locals to carry over for all statements of the module.
+    ///
+    /// Returns: True if no error occured.
+    bool run(shared_ptr<Node> module) override;
+
+    typedef Statement::variable_set variable_set;
+
+    /// Returns the locals that remain referenced after the first safepoint
+    /// of a statement, up to that of its successor.
+    ///
+    /// Must only be called after run() has executed.
+    variable_set carried(shared_ptr<Statement> stmt) const;
+
+protected:
+    void processStatement(shared_ptr<Statement> stmt);
+
+    // Returns all variables that are live throughout a statement.
+    variable_set liveAcross(shared_ptr<Statement> stmt) const;
+
+private:
+    CompilerContext* _context;
+    shared_ptr<CFG> _cfg;
+    shared_ptr<Liveness> _liveness;
+
+    typedef std::unordered_map<shared_ptr<Statement>, variable_set> carried_map;
+    carried_map _carried;
+};
+
+}
+
+}
+
+#endif
@@ -16,5 +16,6 @@
 #include "liveness.h"
 #include "optimize-ctors.h"
 #include "optimize-peephole.h"
+#include "optimize-refcounts.h"
 
 #endif
@@ -56,7 +56,7 @@ struct __hlt_bytes_hoisted {
 
 typedef struct __hlt_bytes_object __hlt_bytes_object;
 
-static hlt_iterator_bytes GenericEndPos = { 0, 0 };
+static const hlt_iterator_bytes GenericEndPos = { 0, 0 };
 
 static hlt_bytes* _hlt_bytes_new(const int8_t* data, hlt_bytes_size len, hlt_bytes_size reserve, hlt_execution_context* ctx);
 static void __add_chunk(hlt_bytes* tail, hlt_bytes* c, hlt_execution_context* ctx);
@@ -540,6 +540,11 @@ hlt_bytes* hlt_bytes_new_from_data_copy(const int8_t* data, hlt_bytes_size len,
     return _hlt_bytes_new(data, len, 0, ctx);
 }
 
+hlt_bytes* __hlt_bytes_new_from_data_copy_ref(const int8_t* data, hlt_bytes_size len, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    return _hlt_bytes_new_ref(data, len, 0, ctx);
+}
+
 void* hlt_bytes_clone_alloc(const hlt_type_info* ti, void* srcp, __hlt_clone_state* cstate, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     hlt_bytes* src = *(hlt_bytes**)srcp;
@@ -97,6 +97,20 @@ extern hlt_bytes* hlt_bytes_new_from_data(int8_t* data, hlt_bytes_size len, hlt_
 /// Returns: The new bytes object.
 extern hlt_bytes* hlt_bytes_new_from_data_copy(const int8_t* data, hlt_bytes_size len, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Like hlt_bytes_new_from_data_copy(), but returns the new object with
+/// reference count +1, with ownership passed to the caller. The object
+/// doesn't enter the current thread's null buffer, so that it can be passed
+/// on to another thread.
+///
+/// data: Pointer to the raw bytes. The function does not take ownership.
+///
+/// len: Number of raw byes starting at *data*.
+///
+/// \hlt_c
+///
+/// Returns: The new bytes object.
+extern hlt_bytes* __hlt_bytes_new_from_data_copy_ref(const int8_t* data, hlt_bytes_size len, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Returns the number of individual bytes stored in a bytes object.
 ///
 /// b: The bytes object.
@@ -30,7 +30,10 @@ static void execute_cmd(__hlt_cmd *cmd, hlt_execution_context* ctx)
 
     switch ( cmd->type ) {
       case __HLT_CMD_FILE:
-        __hlt_file_cmd_internal(cmd, ctx);
+        if ( __hlt_file_cmd_internal(cmd, ctx) )
+            // Buffered for later, the file code will free it.
+            return;
+
         break;
 
       default:
@@ -55,10 +58,18 @@ static void* _manager(void *arg)
     // remaining elements processed.
     while ( ! hlt_thread_queue_terminated(__hlt_globals()->cmd_queue) ) {
 
-        __hlt_cmd* cmd = hlt_thread_queue_read(__hlt_globals()->cmd_queue, 0);
+        __hlt_cmd* cmd = hlt_thread_queue_read(__hlt_globals()->cmd_queue, -1);
+
+        if ( ! cmd ) {
+            // Nothing to do right now, so write out what we have buffered
+            // before blocking.
+            __hlt_files_flush(ctx);
 
-        if ( ! cmd )
-            continue;
+            cmd = hlt_thread_queue_read(__hlt_globals()->cmd_queue, 0);
+
+            if ( ! cmd )
+                continue;
+        }
 
         execute_cmd(cmd, ctx);
         hlt_memory_safepoint(ctx);
@@ -106,8 +117,11 @@ void __hlt_cmd_worker_terminating(int worker)
 
 void __hlt_cmd_queue_done()
 {
-    if ( ! hlt_is_multi_threaded() )
+    if ( ! hlt_is_multi_threaded() ) {
+        // There's no manager thread to finish the files for us.
+        __hlt_files_done();
         return;
+    }
 
     DBG_LOG(DBG_STREAM_QUEUE, "waiting for command queue manager to terminate");
 
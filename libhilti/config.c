@@ -1,4 +1,5 @@
 
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,6 +23,15 @@ hlt_config* __hlt_default_config()
 
     const char* profile = getenv("HILTI_PROFILE");
 
+    const char* counters = getenv("HILTI_PROFILE_COUNTERS");
+    if ( ! counters ) {
+#ifdef __linux__
+        counters = "perf";
+#else
+        counters = "papi";
+#endif
+    }
+
     // Set defaults.
     cfg->num_workers = 2;
     cfg->time_idle = 0.1;
@@ -32,9 +42,19 @@ hlt_config* __hlt_default_config()
     cfg->debug_out = "hlt-debug.log";
     cfg->debug_streams = dbg;
     cfg->profiling = (profile && *profile);
+    cfg->profiling_aggregate = (profile && strcmp(profile, "aggregate") == 0);
+    cfg->profiling_flush_interval = 10.0;
+    cfg->profiling_counters = counters;
+    cfg->profiling_functions_out = "hlt-functions.prof";
+    cfg->profiling_functions_signal = SIGUSR2;
+    cfg->pgo_profile_out = "hlt-pgo.prof";
     cfg->vid_schedule_min = 1;
     cfg->vid_schedule_max = 101;
     cfg->core_affinity = "DEFAULT";
+    cfg->regexp_cache_size = 16 * 1024 * 1024;
+    cfg->file_buffer_size = 64 * 1024;
+    cfg->file_flush_interval = 0.5;
+    cfg->file_gzip_level = 6;
 
     return cfg;
 }
@@ -39,6 +39,38 @@ struct __hlt_config
     /// 1 if profiling is enabled, 0 otherwise. Default is off.
     int8_t profiling;
 
+    /// 1 if profiling aggregates each tag's start/stop intervals in memory,
+    /// writing out only periodic summaries instead of a record for each
+    /// operation. Default is off; setting ``HILTI_PROFILE`` to
+    /// ``aggregate`` turns it on.
+    int8_t profiling_aggregate;
+
+    /// With aggregated profiling, the number of seconds between writing out
+    /// summaries. Default is 10.
+    double profiling_flush_interval;
+
+    /// Where profiling gets hardware counters from: ``perf`` for Linux'
+    /// perf_event_open(), ``papi`` for PAPI if compiled in, or ``none``.
+    /// If the source turns out unavailable, for example because the kernel
+    /// doesn't permit access, the counters remain zero. Default is ``perf``
+    /// on Linux and ``papi`` otherwise; the environment variable
+    /// ``HILTI_PROFILE_COUNTERS`` overrides it.
+    const char* profiling_counters;
+
+    /// File where function-level profiling writes its totals, for code
+    /// compiled with function instrumentation. Default is
+    /// ``hlt-functions.prof``.
+    const char* profiling_functions_out;
+
+    /// Signal that makes function-level profiling write out its current
+    /// totals, in addition to doing so at termination. Zero for none.
+    /// Default is SIGUSR2.
+    int profiling_functions_signal;
+
+    /// File where code compiled with PGO instrumentation writes its
+    /// profile at termination. Default is ``hlt-pgo.prof``.
+    const char* pgo_profile_out;
+
     /// The smallest virtual thread number to use when hashing a thread
     /// context into the set of virtual threads. Default is 1.
     hlt_vthread_id vid_schedule_min;
@@ -54,6 +86,27 @@ struct __hlt_config
     /// itself.
     const char* core_affinity;
 
+    /// Approximate number of bytes each regular expression may use for
+    /// lazily computed DFA states. Once exceeded, the states get discarded
+    /// and recomputed on demand. Zero for no limit. Default is 16MB. Doesn't
+    /// apply to regexps shared across threads.
+    uint64_t regexp_cache_size;
+
+    /// Number of bytes the command queue may buffer per file before writing
+    /// them out, coalescing multiple writes into one system call. Zero
+    /// disables buffering. Default is 64KB. Doesn't apply when not running
+    /// threaded.
+    uint64_t file_buffer_size;
+
+    /// Maximum number of seconds the command queue may keep writes buffered
+    /// while it remains busy. When it runs idle, it writes out everything
+    /// right away. Default is 0.5.
+    double file_flush_interval;
+
+    /// The zlib compression level, between 1 and 9, for files of type
+    /// ``Hilti::FileType::TextGzip`` and ``Hilti::FileType::BinaryGzip``.
+    /// Default is 6.
+    int file_gzip_level;
 };
 
 /// Returns the current configuration. The returned value cannot be directly
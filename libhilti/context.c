@@ -56,7 +56,7 @@ void hlt_execution_context_delete(hlt_execution_context* ctx)
         hlt_fiber_delete(ctx->fiber, ctx);
 
     if ( ctx->pstate )
-        __hlt_profiler_state_delete(ctx->pstate);
+        __hlt_profiler_state_delete(ctx->pstate, ctx);
 
     if ( ctx->tcontext ) {
         GC_DTOR_GENERIC(&ctx->tcontext, ctx->tcontext_type, ctx);
@@ -0,0 +1,453 @@
+
+#include <string.h>
+
+#include "dispatcher.h"
+#include "callable.h"
+#include "context.h"
+#include "globals.h"
+#include "config.h"
+#include "hutil.h"
+#include "clone.h"
+#include "module/module.h"
+#include "autogen/hilti-hlt.h"
+
+// Enough to cover IPv4 headers with options, plus the ports.
+#define MAX_HEADER_SIZE 64
+
+// With in-order delivery, we stop reading once a busy slot has this many
+// batches worth of packets pending.
+#define MAX_BACKLOG_BATCHES 16
+
+// In-order state shared between a dispatcher and its jobs, which may
+// outlive it.
+typedef struct {
+    int64_t ref_cnt;  // One for the dispatcher, plus one per job in flight.
+    int8_t busy[];    // Per slot, true while a job is in flight.
+} __hlt_dispatch_slots;
+
+// Packets collected for a slot but not scheduled yet.
+typedef struct {
+    hlt_packet* pkts; // The packets, ref'ed.
+    int64_t num;      // Number of packets stored in *pkts*.
+    int64_t size;     // Number of packets *pkts* has space for.
+} __hlt_dispatch_backlog;
+
+struct __hlt_iosrc_dispatcher {
+    hlt_iosrc* src;                   // The source to read from, ref'ed.
+    hlt_callable* func;               // The packet callback, ref'ed.
+    int64_t batch_size;               // Maximum number of packets to read at a time.
+    hlt_packet* pkts;                 // Buffer of *batch_size* packets for reading.
+    hlt_vthread_id vid_min;           // The virtual thread corresponding to slot zero.
+    int64_t num_slots;                // The number of virtual threads we distribute across.
+    __hlt_dispatch_backlog* backlogs; // Per slot, the packets pending.
+    __hlt_dispatch_slots* slots;      // In-order state, or null if not delivering in-order.
+    int8_t exhausted;                 // True once the source has run dry.
+};
+
+// A job processing a batch of packets on a virtual thread. It's a callable
+// that the thread manager runs just like the ones that ``thread.schedule``
+// binds.
+typedef struct {
+    __hlt_gchdr __gch;                // Header for garbage collection.
+    __hlt_callable_func* __func;      // Pointer to the set of function for the callable.
+    hlt_callable* func;               // The job's own copy of the packet callback, ref'ed.
+    __hlt_dispatch_slots* slots;      // The dispatcher's in-order state, or null.
+    int64_t slot;                     // The slot the job is for.
+    hlt_packet* pkts;                 // The packets, ref'ed until processed.
+    int64_t num;                      // The number of packets.
+    int64_t next;                     // The index of the next packet to process.
+} __hlt_dispatch_job;
+
+static void _slots_unref(__hlt_dispatch_slots* slots)
+{
+    if ( __atomic_sub_fetch(&slots->ref_cnt, 1, __ATOMIC_SEQ_CST) == 0 )
+        hlt_free(slots);
+}
+
+static void _job_run(hlt_callable* c, void* target, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    __hlt_dispatch_job* job = (__hlt_dispatch_job*)c;
+
+    while ( job->next < job->num ) {
+        hlt_packet* pkt = &job->pkts[job->next++];
+        HLT_CALLABLE_RUN(job->func, 0, Hilti_CallbackPacket, &pkt->t, &pkt->data, excpt, ctx);
+        GC_CLEAR(pkt->data, hlt_bytes, ctx);
+
+        if ( hlt_check_exception(excpt) )
+            // Leave it to the thread manager.
+            return;
+    }
+}
+
+static void _job_dtor(hlt_callable* c, hlt_execution_context* ctx)
+{
+    __hlt_dispatch_job* job = (__hlt_dispatch_job*)c;
+
+    // Packets left if processing raised an exception.
+    for ( int64_t i = job->next; i < job->num; i++ )
+        GC_DTOR(job->pkts[i].data, hlt_bytes, ctx);
+
+    hlt_free(job->pkts);
+    GC_DTOR(job->func, hlt_callable, ctx);
+
+    if ( job->slots ) {
+        __atomic_store_n(&job->slots->busy[job->slot], 0, __ATOMIC_RELEASE);
+        _slots_unref(job->slots);
+    }
+}
+
+static __hlt_callable_func _job_func = {
+    0,
+    _job_run,
+    _job_dtor,
+    0,
+    sizeof(__hlt_dispatch_job)
+};
+
+// Returns a hash of a packet's flow that's the same for both directions.
+// Packets we can't parse all hash to zero.
+static hlt_hash _flow_hash(const int8_t* data, int64_t len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* src = 0;
+    const uint8_t* dst = 0;
+    const uint8_t* ports = 0;
+    int8_t alen = 0;
+    uint8_t proto = 0;
+
+    if ( len < 1 )
+        return 0;
+
+    switch ( p[0] >> 4 ) {
+     case 4: {
+        int hlen = (p[0] & 0x0f) * 4;
+
+        if ( len < 20 || hlen < 20 )
+            return 0;
+
+        proto = p[9];
+        src = p + 12;
+        dst = p + 16;
+        alen = 4;
+
+        // Only the first fragment carries the ports, so ignore them for
+        // all fragments.
+        int8_t fragment = ((p[6] << 8 | p[7]) & 0x3fff) != 0;
+
+        if ( ! fragment && len >= hlen + 4 )
+            ports = p + hlen;
+
+        break;
+     }
+
+     case 6:
+        if ( len < 40 )
+            return 0;
+
+        // We don't follow extension headers.
+        proto = p[6];
+        src = p + 8;
+        dst = p + 24;
+        alen = 16;
+
+        if ( len >= 44 )
+            ports = p + 40;
+
+        break;
+
+     default:
+        return 0;
+    }
+
+    // TCP, UDP, and SCTP.
+    if ( proto != 6 && proto != 17 && proto != 132 )
+        ports = 0;
+
+    // Each endpoint is its address followed by its port.
+    uint8_t a[18];
+    uint8_t b[18];
+
+    memcpy(a, src, alen);
+    memcpy(b, dst, alen);
+    memset(a + alen, 0, 2);
+    memset(b + alen, 0, 2);
+
+    if ( ports ) {
+        memcpy(a + alen, ports, 2);
+        memcpy(b + alen, ports + 2, 2);
+    }
+
+    // Order the endpoints to make the hash symmetric.
+    int n = alen + 2;
+    int8_t swap = memcmp(a, b, n) > 0;
+
+    hlt_hash h = hlt_hash_bytes((const int8_t*)&proto, 1, 0);
+    h = hlt_hash_bytes((const int8_t*)(swap ? b : a), n, h);
+    h = hlt_hash_bytes((const int8_t*)(swap ? a : b), n, h);
+    return h;
+}
+
+// Returns the flow hash for a packet's data.
+static hlt_hash _packet_hash(hlt_bytes* data, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    int8_t hdr[MAX_HEADER_SIZE];
+    int64_t len = hlt_bytes_len(data, excpt, ctx);
+
+    if ( len > MAX_HEADER_SIZE )
+        len = MAX_HEADER_SIZE;
+
+    hlt_iterator_bytes begin = hlt_bytes_begin(data, excpt, ctx);
+    hlt_iterator_bytes end = hlt_iterator_bytes_incr_by(begin, len, excpt, ctx);
+    hlt_bytes_sub_raw(hdr, sizeof(hdr), begin, end, excpt, ctx);
+
+    return _flow_hash(hdr, len);
+}
+
+// Takes ownership of the packet's data.
+static void _backlog_add(__hlt_dispatch_backlog* backlog, hlt_packet* pkt)
+{
+    if ( backlog->num == backlog->size ) {
+        int64_t size = backlog->size ? backlog->size * 2 : 16;
+        backlog->pkts = hlt_realloc(backlog->pkts, size * sizeof(hlt_packet), backlog->size * sizeof(hlt_packet));
+        backlog->size = size;
+    }
+
+    backlog->pkts[backlog->num++] = *pkt;
+}
+
+// Schedules the packets pending for all slots that are ready to take them.
+// Returns the number of slots still having packets pending.
+static int64_t _schedule_backlogs(hlt_iosrc_dispatcher* d, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    hlt_thread_mgr* mgr = hlt_global_thread_mgr();
+    int64_t pending = 0;
+    int8_t scheduled = 0;
+
+    for ( int64_t i = 0; i < d->num_slots; i++ ) {
+        __hlt_dispatch_backlog* backlog = &d->backlogs[i];
+
+        if ( ! backlog->num )
+            continue;
+
+        if ( d->slots && __atomic_load_n(&d->slots->busy[i], __ATOMIC_ACQUIRE) ) {
+            ++pending;
+            continue;
+        }
+
+        hlt_vthread_id vid = d->vid_min + i;
+
+        // We pass the job at +1 to the target thread, along with the
+        // packets that we already hold at +1.
+        __hlt_dispatch_job* job = GC_NEW_CUSTOM_SIZE_REF(hlt_callable, sizeof(__hlt_dispatch_job), ctx);
+        job->__func = &_job_func;
+        job->slot = i;
+        job->pkts = backlog->pkts;
+        job->num = backlog->num;
+        job->next = 0;
+        hlt_clone_for_thread(&job->func, &hlt_type_info_hlt_callable, &d->func, vid, excpt, ctx);
+
+        if ( d->slots ) {
+            d->slots->busy[i] = 1;
+            __atomic_add_fetch(&d->slots->ref_cnt, 1, __ATOMIC_SEQ_CST);
+            job->slots = d->slots;
+        }
+
+        else
+            job->slots = 0;
+
+        backlog->pkts = 0;
+        backlog->num = backlog->size = 0;
+
+        __hlt_thread_mgr_schedule(mgr, vid, (hlt_callable*)job, excpt, ctx);
+        scheduled = 1;
+
+        if ( hlt_check_exception(excpt) )
+            return pending;
+    }
+
+    if ( scheduled ) {
+        // Pass the jobs on right away rather than waiting for the queues
+        // to fill up.
+        int writer = ctx->worker ? ctx->worker->id : 0;
+
+        for ( int i = 0; i < mgr->num_workers; i++ )
+            hlt_thread_queue_flush(mgr->workers[i]->jobs, writer);
+    }
+
+    return pending;
+}
+
+hlt_iosrc_dispatcher* hlt_iosrc_dispatcher_new(hlt_iosrc* src, hlt_callable* func, int8_t in_order, int64_t batch_size, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( ! hlt_is_multi_threaded() ) {
+        hlt_set_exception(excpt, &hlt_exception_no_threading, 0, ctx);
+        return 0;
+    }
+
+    if ( batch_size <= 0 ) {
+        hlt_set_exception(excpt, &hlt_exception_value_error, 0, ctx);
+        return 0;
+    }
+
+    const hlt_config* cfg = hlt_config_get();
+
+    hlt_iosrc_dispatcher* d = hlt_malloc(sizeof(hlt_iosrc_dispatcher));
+    d->src = src;
+    d->func = func;
+    d->batch_size = batch_size;
+    d->pkts = hlt_malloc(batch_size * sizeof(hlt_packet));
+    d->vid_min = cfg->vid_schedule_min;
+    d->num_slots = cfg->vid_schedule_max - cfg->vid_schedule_min + 1;
+    d->exhausted = 0;
+
+    if ( d->num_slots <= 0 )
+        d->num_slots = 1;
+
+    d->backlogs = hlt_calloc(d->num_slots, sizeof(__hlt_dispatch_backlog));
+
+    if ( in_order ) {
+        d->slots = hlt_malloc(sizeof(__hlt_dispatch_slots) + d->num_slots);
+        d->slots->ref_cnt = 1;
+        memset(d->slots->busy, 0, d->num_slots);
+    }
+
+    else
+        d->slots = 0;
+
+    GC_CCTOR(d->src, hlt_iosrc, ctx);
+    GC_CCTOR(d->func, hlt_callable, ctx);
+
+    return d;
+}
+
+void hlt_iosrc_dispatcher_delete(hlt_iosrc_dispatcher* d, hlt_execution_context* ctx)
+{
+    for ( int64_t i = 0; i < d->num_slots; i++ ) {
+        __hlt_dispatch_backlog* backlog = &d->backlogs[i];
+
+        for ( int64_t j = 0; j < backlog->num; j++ )
+            GC_DTOR(backlog->pkts[j].data, hlt_bytes, ctx);
+
+        hlt_free(backlog->pkts);
+    }
+
+    if ( d->slots )
+        _slots_unref(d->slots);
+
+    GC_DTOR(d->src, hlt_iosrc, ctx);
+    GC_DTOR(d->func, hlt_callable, ctx);
+
+    hlt_free(d->backlogs);
+    hlt_free(d->pkts);
+    hlt_free(d);
+}
+
+// Returns true if a slot has too many packets pending to read more.
+static int8_t _backlogs_full(hlt_iosrc_dispatcher* d)
+{
+    if ( ! d->slots )
+        // Without in-order delivery, backlogs never outlive a run.
+        return 0;
+
+    for ( int64_t i = 0; i < d->num_slots; i++ ) {
+        if ( d->backlogs[i].num >= MAX_BACKLOG_BATCHES * d->batch_size )
+            return 1;
+    }
+
+    return 0;
+}
+
+int64_t hlt_iosrc_dispatcher_run(hlt_iosrc_dispatcher* d, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    // Get the older packets out first.
+    _schedule_backlogs(d, excpt, ctx);
+
+    if ( hlt_check_exception(excpt) )
+        return 0;
+
+    if ( _backlogs_full(d) ) {
+        // Let the slow slot catch up first.
+        hlt_set_exception(excpt, &hlt_exception_would_block, 0, ctx);
+        return 0;
+    }
+
+    hlt_exception* read_excpt = 0;
+    int64_t n = 0;
+
+    if ( ! d->exhausted ) {
+        n = __hlt_iosrc_read_batch_ref(d->src, 0, d->pkts, d->batch_size, &read_excpt, ctx);
+
+        if ( ! (n || read_excpt) )
+            d->exhausted = 1;
+    }
+
+    for ( int64_t i = 0; i < n; i++ ) {
+        hlt_packet* pkt = &d->pkts[i];
+        hlt_hash h = _packet_hash(pkt->data, excpt, ctx);
+
+        if ( hlt_check_exception(excpt) ) {
+            // We can't place the rest, so drop them.
+            for ( int64_t j = i; j < n; j++ )
+                GC_DTOR(d->pkts[j].data, hlt_bytes, ctx);
+
+            if ( read_excpt )
+                GC_DTOR(read_excpt, hlt_exception, ctx);
+
+            return n;
+        }
+
+        _backlog_add(&d->backlogs[h % d->num_slots], pkt);
+    }
+
+    int64_t pending = _schedule_backlogs(d, excpt, ctx);
+
+    if ( read_excpt ) {
+        if ( hlt_check_exception(excpt) ) {
+            GC_DTOR(read_excpt, hlt_exception, ctx);
+        }
+
+        else
+            *excpt = read_excpt;
+
+        return n;
+    }
+
+    if ( hlt_check_exception(excpt) )
+        return n;
+
+    if ( d->exhausted && pending )
+        // Need to wait for jobs in flight.
+        hlt_set_exception(excpt, &hlt_exception_would_block, 0, ctx);
+
+    return n;
+}
+
+void hilti_dispatch_packets(const hlt_type_info* type, void* obj, hlt_callable* func, int8_t in_order, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( type->type != HLT_TYPE_IOSOURCE ) {
+        hlt_set_exception(excpt, &hlt_exception_value_error, 0, ctx);
+        return;
+    }
+
+    hlt_iosrc* src = *(hlt_iosrc**)obj;
+
+    hlt_iosrc_dispatcher* d = hlt_iosrc_dispatcher_new(src, func, in_order, 64, excpt, ctx);
+
+    if ( hlt_check_exception(excpt) )
+        return;
+
+    while ( 1 ) {
+        int64_t n = hlt_iosrc_dispatcher_run(d, excpt, ctx);
+
+        if ( *excpt && __hlt_exception_match(*excpt, &hlt_exception_would_block) ) {
+            GC_CLEAR(*excpt, hlt_exception, ctx);
+            hilti_sleep(0.001, excpt, ctx);
+            continue;
+        }
+
+        if ( hlt_check_exception(excpt) || ! n )
+            break;
+    }
+
+    hlt_iosrc_dispatcher_delete(d, ctx);
+}
@@ -0,0 +1,66 @@
+///
+/// Distributes packets read from an IOSource across virtual threads.
+///
+/// The dispatcher hashes each packet's flow, as identified by its IP 5-tuple,
+/// into the range of virtual threads given by ``config.vid_schedule_min``
+/// and ``config.vid_schedule_max``. The hash is symmetric, so both
+/// directions of a flow end up on the same thread. Each thread gets its
+/// share of a batch as a single job, which then runs a callback for each of
+/// its packets in capture order.
+
+#ifndef LIBHILTI_DISPATCHER_H
+#define LIBHILTI_DISPATCHER_H
+
+#include "types.h"
+#include "iosrc.h"
+
+typedef struct __hlt_iosrc_dispatcher hlt_iosrc_dispatcher;
+
+/// Creates a new dispatcher.
+///
+/// src: The packet source to read from. The source's link layer headers
+/// are stripped, so that the callback receives IP packets.
+///
+/// func: The callback to run for each packet, of type
+/// ``Hilti::CallbackPacket``. It receives the packet's timestamp and data.
+///
+/// in_order: If true, a virtual thread doesn't start on a new job before
+/// finishing its previous one, even if processing a packet yields in
+/// between. That way, each flow's packets are processed strictly in
+/// capture order. If false, jobs may interleave once they yield.
+///
+/// batch_size: The maximum number of packets to read from *src* at a time.
+///
+/// excpt: &
+///
+/// Returns: The new dispatcher.
+///
+/// Raises: NoThreading - If the runtime isn't configured for threading.
+/// Raises: ValueError - If *batch_size* isn't positive.
+extern hlt_iosrc_dispatcher* hlt_iosrc_dispatcher_new(hlt_iosrc* src, hlt_callable* func, int8_t in_order, int64_t batch_size, hlt_exception** excpt, hlt_execution_context* ctx);
+
+/// Deletes a dispatcher. Jobs already scheduled remain unaffected, but
+/// packets still held back for in-order delivery are discarded.
+///
+/// d: The dispatcher.
+extern void hlt_iosrc_dispatcher_delete(hlt_iosrc_dispatcher* d, hlt_execution_context* ctx);
+
+/// Reads the next batch of packets from the dispatcher's source and
+/// schedules them to their virtual threads.
+///
+/// d: The dispatcher.
+///
+/// excpt: &
+///
+/// Returns: The number of packets read. Once the source is exhausted and
+/// all packets have been scheduled, returns zero.
+///
+/// Raises: WouldBlock - If no new packets are currently available, if the
+/// source is exhausted but packets are still held back for in-order
+/// delivery, or if a virtual thread has fallen too far behind with
+/// in-order delivery to read more for now; calling again later will
+/// continue.
+/// Raises: IOError - As with ~~hlt_iosrc_read_batch.
+extern int64_t hlt_iosrc_dispatcher_run(hlt_iosrc_dispatcher* d, hlt_exception** excpt, hlt_execution_context* ctx);
+
+#endif
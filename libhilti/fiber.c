@@ -12,6 +12,7 @@
 #include "context.h"
 #include "threading.h"
 #include "globals.h"
+#include "fprof.h"
 
 #include "3rdparty/libtask/taskimpl.h"
 
@@ -28,6 +29,8 @@ struct __hlt_fiber {
     hlt_execution_context* context;
     hlt_fiber_func run;
     struct __hlt_fiber* next; // If a member of fiber tool, subsequent fiber or null.
+    __hlt_fprof_frame* fprof_top; // Innermost function profiling frame when yielded.
+    uint64_t fprof_yielded;       // Time of yielding for function profiling.
 };
 
 struct __hlt_fiber_pool {
@@ -217,6 +220,8 @@ hlt_fiber* hlt_fiber_create(hlt_fiber_func func, hlt_execution_context* fctx, vo
     fiber->run = func;
     fiber->context = fctx;
     fiber->cookie = p;
+    fiber->fprof_top = 0;
+    fiber->fprof_yielded = 0;
 
     return fiber;
 }
@@ -294,6 +299,9 @@ int8_t hlt_fiber_start(hlt_fiber* fiber, hlt_execution_context* ctx)
 
     __hlt_context_set_fiber(fiber->context, fiber);
 
+    // Switch over to the fiber's own function profiling frames.
+    __hlt_fprof_frame* fprof_caller = __hlt_fprof_resume(fiber->fprof_top, fiber->fprof_yielded);
+
     if ( ! _setjmp(fiber->parent) ) {
         fiber->state = RUNNING;
 
@@ -305,6 +313,8 @@ int8_t hlt_fiber_start(hlt_fiber* fiber, hlt_execution_context* ctx)
         abort();
     }
 
+    fiber->fprof_top = __hlt_fprof_suspend(fprof_caller, &fiber->fprof_yielded);
+
     switch ( fiber->state ) {
      case YIELDED:
         __hlt_memory_safepoint(fiber->context, "fiber_start/yield");
@@ -5,12 +5,31 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/uio.h>
+#include <zlib.h>
 
 #include "file.h"
 #include "memory_.h"
 #include "globals.h"
+#include "config.h"
 #include "autogen/hilti-hlt.h"
 
+// The maximum number of writes we coalesce into a single writev().
+#define MAX_PENDING 128
+
+// The size of an escaped unprintable character in a text file: "\xNN",
+// plus the null byte that hlt_util_uitoa_n() terminates the digits with.
+#define ESCAPE_SIZE 5
+
+// The size of the output buffer for compressed files. We write compressed
+// data out only once it fills up, or when finishing a gzip member.
+#define GZIP_BUFFER_SIZE (256 * 1024)
+
+struct __hlt_cmd_file;
+struct __hlt_file_info;
+
+static void _gzip_done(struct __hlt_file_info* info);
+
 // This struct describes one currently open file. We memory-manage this ourselves.
 struct __hlt_file_info {
     hlt_string path;    // The path of the file.
@@ -20,6 +39,17 @@ struct __hlt_file_info {
 
     struct __hlt_file_info* next; // We keep them in a list.
     struct __hlt_file_info* prev;
+
+    // Writes buffered for coalescing. Only the command queue thread accesses these.
+    struct __hlt_cmd_file** pending; // The write commands not written out yet.
+    int num_pending;                 // The number of commands in *pending*.
+    size_t pending_bytes;            // The number of bytes the commands in *pending* carry.
+    hlt_time pending_since;          // When the oldest command in *pending* was buffered.
+    struct __hlt_file_info* next_dirty; // Next file with pending writes.
+
+    // State for compressed files. Only the command queue thread accesses these.
+    z_stream* zstream;   // The deflate state, or null if the file isn't compressed.
+    Bytef* zbuf;         // The output buffer of size GZIP_BUFFER_SIZE.
 };
 
 // A HILTI file object. This is one reference-counted.
@@ -32,16 +62,18 @@ struct __hlt_file {
     int8_t open;           // 1 if open, 0 if closed.
 };
 
-// A single write command inserted into the command queue.
+// A single command inserted into the command queue. We allocate write
+// commands with their data following the struct.
 typedef struct __hlt_cmd_file {
     __hlt_cmd cmd;             // The common header for all commands.
     __hlt_file_info* info;     // The file to write to.
-    int type;                  // 1 for writing data; 1 if it's a close command; and 2 for a change in parameters.
-    char* data;                // Bytes to write.
-    int len;                   // Number of bytes to write.
+    int type;                  // 1 for opening the file; 2 for writing data; 3 if it's a close command; and 4 for a flush.
+
+    hlt_enum param_type;       // For type 1: The type.
+    hlt_enum param_mode;       // For type 1: The mode.
 
-    hlt_enum param_type;       // For type 0: The type.
-    hlt_enum param_mode;       // For type 0: The mode.
+    int len;                   // For type 2: Number of bytes to write.
+    char data[];               // For type 2: Bytes to write.
 } __hlt_cmd_file;
 
 void hlt_file_dtor(hlt_type_info* ti, hlt_file* f, hlt_execution_context* ctx)
@@ -85,10 +117,14 @@ void __hlt_files_init()
 
 void __hlt_files_done()
 {
+    __hlt_files_flush(hlt_global_execution_context());
+
     __hlt_file_info* info = __hlt_globals()->files;
 
     while ( info ) {
+        _gzip_done(info);
         close(info->fd);
+        hlt_free(info->pending);
 
         GC_DTOR(info->path, hlt_string, hlt_global_execution_context());
 
@@ -177,6 +213,13 @@ void hlt_file_open(hlt_file* file, hlt_string path, hlt_enum type, hlt_enum mode
     info->error = 0;
     info->prev = 0;
     info->next = __hlt_globals()->files;
+    info->pending = 0;
+    info->num_pending = 0;
+    info->pending_bytes = 0;
+    info->pending_since = 0;
+    info->next_dirty = 0;
+    info->zstream = 0;
+    info->zbuf = 0;
 
     GC_CCTOR(info->path, hlt_string, ctx);
 
@@ -224,6 +267,21 @@ void hlt_file_close(hlt_file* file, hlt_exception** excpt, hlt_execution_context
     GC_CLEAR(file->path, hlt_string, ctx);
 }
 
+void hlt_file_flush(hlt_file* file, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( ! file->open ) {
+        hlt_string err = hlt_string_from_asciiz("file not open", excpt, ctx);
+        hlt_set_exception(excpt, &hlt_exception_io_error, err, ctx);
+        return;
+    }
+
+    __hlt_cmd_file* cmd = hlt_malloc(sizeof(__hlt_cmd_file));
+    __hlt_cmdqueue_init_cmd((__hlt_cmd*) cmd, __HLT_CMD_FILE);
+    cmd->info = file->info;
+    cmd->type = 4; // Flush.
+    __hlt_cmdqueue_push((__hlt_cmd*) cmd, excpt, ctx);
+}
+
 hlt_string hlt_file_name(hlt_file* file, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     return file->path;
@@ -238,34 +296,54 @@ void hlt_file_write_string(hlt_file* file, hlt_string str, hlt_exception** excpt
     hlt_file_write_bytes(file, b, excpt, ctx);
 }
 
-static void _add_to_cmd_data(__hlt_cmd_file* cmd, const int8_t* data, int len)
+// Returns true if a word contains any byte that we need to escape in a text
+// file, i.e., anything outside of 0x20-0x7e.
+static inline int _has_unprintable(uint64_t w)
 {
-    int old_len = cmd->len;
-    cmd->len += len;
-    cmd->data = hlt_realloc(cmd->data, cmd->len, old_len);
-    memcpy(cmd->data + old_len, data, len);
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+
+    uint64_t below = (w - ones * 0x20) & ~w;          // Bytes < 0x20, or >= 0x80.
+    uint64_t above = (w + ones * (0x7f - 0x7e)) | w;  // Bytes > 0x7e.
+    return ((below | above) & highs) != 0;
 }
 
-void hlt_file_write_bytes(hlt_file* file, hlt_bytes* data, hlt_exception** excpt, hlt_execution_context* ctx)
+static inline int _is_unprintable(int8_t c)
 {
-    if ( ! file->open ) {
-        hlt_string err = hlt_string_from_asciiz("file not open", excpt, ctx);
-        hlt_set_exception(excpt, &hlt_exception_io_error, err, ctx);
-        return;
+    return (uint8_t)c < 0x20 || (uint8_t)c > 0x7e;
+}
+
+// Returns the first character in [s, e) that we need to escape in a text
+// file, or e if there's none. Checks eight bytes at a time.
+static const int8_t* _find_unprintable(const int8_t* s, const int8_t* e)
+{
+    while ( e - s >= 8 ) {
+        uint64_t w;
+        memcpy(&w, s, 8);
+
+        if ( _has_unprintable(w) )
+            break;
+
+        s += 8;
     }
 
-    __hlt_cmd_file* cmd = hlt_malloc(sizeof(__hlt_cmd_file));
-    __hlt_cmdqueue_init_cmd((__hlt_cmd*) cmd, __HLT_CMD_FILE);
-    cmd->info = file->info;
-    cmd->type = 2; // Write.
-    cmd->data = 0;
-    cmd->len = 0;
+    while ( s < e && ! _is_unprintable(*s) )
+        ++s;
 
+    return s;
+}
+
+// Iterates over the bytes' blocks, either just counting how much output
+// they produce (if *dst* is null), or writing that into *dst*. Returns the
+// number of bytes produced.
+static int _copy_data(int8_t* dst, hlt_bytes* data, int8_t text, hlt_exception** excpt, hlt_execution_context* ctx)
+{
     hlt_bytes_block block;
     hlt_iterator_bytes start = hlt_bytes_begin(data, excpt, ctx);
     hlt_iterator_bytes end = hlt_bytes_end(data, excpt, ctx);
     void* cookie = 0;
-    int8_t buf[5] = { '\\', 'x', 'X', 'X', '0' };
+    int8_t buf[ESCAPE_SIZE] = { '\\', 'x', 'X', 'X', '0' };
+    int len = 0;
 
     while ( 1 ) {
         cookie = hlt_bytes_iterate_raw(&block, cookie, start, end, excpt, ctx);
@@ -273,26 +351,28 @@ void hlt_file_write_bytes(hlt_file* file, hlt_bytes* data, hlt_exception** excpt
         if ( block.start == block.end )
             break;
 
-        int8_t text = hlt_enum_equal(file->type, Hilti_FileType_Text, excpt, ctx);
-
         if ( text ) {
             // Need to escape unprintable characters. FIXME: We don't honor
             // the charset here yet, just encode everything that is not
-            // representable in our current locale.
+            // printable ASCII.
             const int8_t* s = block.start;
-            const int8_t* e = s;
 
             while ( s < block.end ) {
-                while ( e < block.end && isprint(*e) )
-                    ++e;
+                const int8_t* e = _find_unprintable(s, block.end);
 
-                if ( e != s )
-                    _add_to_cmd_data(cmd, s, e - s);
+                if ( dst )
+                    memcpy(dst + len, s, e - s);
+
+                len += (e - s);
 
                 if ( e < block.end ) {
                     // Unprintable character.
-                    int n = hlt_util_uitoa_n(*e, (char*)buf + 2, 3, 16, 1);
-                    _add_to_cmd_data(cmd, buf, n + 2);
+                    if ( dst ) {
+                        hlt_util_uitoa_n(*e, (char*)buf + 2, 3, 16, 1);
+                        memcpy(dst + len, buf, ESCAPE_SIZE);
+                    }
+
+                    len += ESCAPE_SIZE;
                     ++e;
                 }
 
@@ -300,24 +380,271 @@ void hlt_file_write_bytes(hlt_file* file, hlt_bytes* data, hlt_exception** excpt
             }
         }
 
-        else if ( hlt_enum_equal(file->type, Hilti_FileType_Binary, excpt, ctx) )
+        else {
             // Just write data directly.
-            _add_to_cmd_data(cmd, block.start, block.end - block.start);
+            if ( dst )
+                memcpy(dst + len, block.start, block.end - block.start);
 
-        else
-            fatal_error("unknown file type");
+            len += (block.end - block.start);
+        }
 
         if ( ! cookie )
             break;
     }
 
-    if ( hlt_enum_equal(file->type, Hilti_FileType_Text, excpt, ctx) )
-        _add_to_cmd_data(cmd, (int8_t*)"\n", 1);
+    if ( text ) {
+        if ( dst )
+            dst[len] = '\n';
+
+        ++len;
+    }
+
+    return len;
+}
+
+void hlt_file_write_bytes(hlt_file* file, hlt_bytes* data, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( ! file->open ) {
+        hlt_string err = hlt_string_from_asciiz("file not open", excpt, ctx);
+        hlt_set_exception(excpt, &hlt_exception_io_error, err, ctx);
+        return;
+    }
+
+    int8_t text = hlt_enum_equal(file->type, Hilti_FileType_Text, excpt, ctx) ||
+                  hlt_enum_equal(file->type, Hilti_FileType_TextGzip, excpt, ctx);
+
+    int8_t binary = hlt_enum_equal(file->type, Hilti_FileType_Binary, excpt, ctx) ||
+                    hlt_enum_equal(file->type, Hilti_FileType_BinaryGzip, excpt, ctx);
+
+    if ( ! (text || binary) )
+        fatal_error("unknown file type");
+
+    // Size the command first so that we need just a single allocation.
+    int len = _copy_data(0, data, text, excpt, ctx);
+
+    __hlt_cmd_file* cmd = hlt_malloc(sizeof(__hlt_cmd_file) + len);
+    __hlt_cmdqueue_init_cmd((__hlt_cmd*) cmd, __HLT_CMD_FILE);
+    cmd->info = file->info;
+    cmd->type = 2; // Write.
+    cmd->len = _copy_data((int8_t*)cmd->data, data, text, excpt, ctx);
 
     __hlt_cmdqueue_push((__hlt_cmd*) cmd, excpt, ctx);
 }
 
-void __hlt_file_cmd_internal(__hlt_cmd* c, hlt_execution_context* ctx)
+// Writes out the compressed data accumulated in a file's output buffer.
+static void _gzip_write_out(__hlt_file_info* info)
+{
+    z_stream* zs = info->zstream;
+    int len = GZIP_BUFFER_SIZE - zs->avail_out;
+
+    if ( len && ! info->error && ! __hlt_safe_write(info->fd, (const char*)info->zbuf, len) )
+        info->error = 1;
+
+    zs->next_out = info->zbuf;
+    zs->avail_out = GZIP_BUFFER_SIZE;
+}
+
+// Feeds data into a file's compressor. With Z_FINISH, completes the current
+// gzip member and starts a new one.
+static void _gzip_deflate(__hlt_file_info* info, const char* data, int len, int flush)
+{
+    z_stream* zs = info->zstream;
+
+    zs->next_in = (Bytef*)data;
+    zs->avail_in = len;
+
+    while ( 1 ) {
+        int rc = deflate(zs, flush);
+
+        if ( rc == Z_STREAM_ERROR ) {
+            info->error = 1;
+            return;
+        }
+
+        if ( zs->avail_out == 0 || rc == Z_STREAM_END )
+            _gzip_write_out(info);
+
+        if ( rc == Z_STREAM_END ) {
+            deflateReset(zs);
+            return;
+        }
+
+        if ( flush != Z_FINISH && zs->avail_in == 0 && zs->avail_out != 0 )
+            return;
+    }
+}
+
+// Completes a compressed file's current gzip member, if it has any data.
+static void _gzip_finish(__hlt_file_info* info)
+{
+    if ( ! info->zstream || info->zstream->total_in == 0 )
+        return;
+
+    _gzip_deflate(info, 0, 0, Z_FINISH);
+}
+
+static void _gzip_init(__hlt_file_info* info, hlt_execution_context* ctx)
+{
+    // A window size of 15 plus 16 gives us gzip headers.
+    info->zstream = hlt_malloc(sizeof(z_stream));
+    info->zstream->zalloc = Z_NULL;
+    info->zstream->zfree = Z_NULL;
+    info->zstream->opaque = Z_NULL;
+
+    if ( deflateInit2(info->zstream, hlt_config_get()->file_gzip_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK ) {
+        hlt_free(info->zstream);
+        info->zstream = 0;
+        info->error = 1;
+        return;
+    }
+
+    info->zbuf = hlt_malloc(GZIP_BUFFER_SIZE);
+    info->zstream->next_out = info->zbuf;
+    info->zstream->avail_out = GZIP_BUFFER_SIZE;
+}
+
+static void _gzip_done(__hlt_file_info* info)
+{
+    if ( ! info->zstream )
+        return;
+
+    _gzip_finish(info);
+    deflateEnd(info->zstream);
+    hlt_free(info->zstream);
+    hlt_free(info->zbuf);
+    info->zstream = 0;
+    info->zbuf = 0;
+}
+
+// Writes data out to a file, compressing it if requested.
+static void _write_data(__hlt_file_info* info, const char* data, int len)
+{
+    if ( info->zstream ) {
+        _gzip_deflate(info, data, len, Z_NO_FLUSH);
+        return;
+    }
+
+    if ( ! __hlt_safe_write(info->fd, data, len) )
+        info->error = 1;
+}
+
+// Writes out all the data of a vector, restarting on EINTR and partial
+// writes. Returns false on error.
+static int8_t _safe_writev(int fd, struct iovec* iov, int cnt)
+{
+    while ( cnt ) {
+        ssize_t n = writev(fd, iov, cnt);
+
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+
+            return 0;
+        }
+
+        while ( cnt && n >= iov->iov_len ) {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+
+        if ( cnt ) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 1;
+}
+
+// Writes out a file's pending writes.
+static void _flush_pending(__hlt_file_info* info)
+{
+    if ( ! info->num_pending )
+        return;
+
+    if ( ! info->error && info->fd >= 0 && info->zstream ) {
+        // Compress it all in one go.
+        for ( int i = 0; i < info->num_pending && ! info->error; i++ )
+            _gzip_deflate(info, info->pending[i]->data, info->pending[i]->len, Z_NO_FLUSH);
+    }
+
+    else if ( ! info->error && info->fd >= 0 ) {
+        struct iovec iov[MAX_PENDING];
+
+        for ( int i = 0; i < info->num_pending; i++ ) {
+            iov[i].iov_base = info->pending[i]->data;
+            iov[i].iov_len = info->pending[i]->len;
+        }
+
+        if ( ! _safe_writev(info->fd, iov, info->num_pending) )
+            info->error = 1;
+    }
+
+    for ( int i = 0; i < info->num_pending; i++ )
+        hlt_free(info->pending[i]);
+
+    info->num_pending = 0;
+    info->pending_bytes = 0;
+
+    // Remove from the dirty list.
+    __hlt_file_info** prev = &__hlt_globals()->files_dirty;
+
+    while ( *prev != info )
+        prev = &(*prev)->next_dirty;
+
+    *prev = info->next_dirty;
+    info->next_dirty = 0;
+}
+
+void __hlt_files_flush(hlt_execution_context* ctx)
+{
+    while ( __hlt_globals()->files_dirty )
+        _flush_pending(__hlt_globals()->files_dirty);
+}
+
+// Buffers a write command for coalescing with subsequent ones. Returns
+// false if we don't buffer it, in which case the caller needs to write it
+// out directly.
+static int8_t _buffer_write(__hlt_cmd_file* cmd, hlt_execution_context* ctx)
+{
+    const hlt_config* cfg = hlt_config_get();
+    __hlt_file_info* info = cmd->info;
+
+    if ( ! hlt_is_multi_threaded() || ! cfg->file_buffer_size )
+        // There's nobody to flush the buffers when idle.
+        return 0;
+
+    if ( info->pending_bytes + cmd->len > cfg->file_buffer_size )
+        // Make room first.
+        _flush_pending(info);
+
+    if ( cmd->len > cfg->file_buffer_size )
+        // Too large to buffer.
+        return 0;
+
+    hlt_exception* excpt = 0;
+    hlt_time now = hlt_time_wall(&excpt, ctx);
+
+    if ( ! info->num_pending ) {
+        if ( ! info->pending )
+            info->pending = hlt_malloc(MAX_PENDING * sizeof(__hlt_cmd_file*));
+
+        info->pending_since = now;
+        info->next_dirty = __hlt_globals()->files_dirty;
+        __hlt_globals()->files_dirty = info;
+    }
+
+    info->pending[info->num_pending++] = cmd;
+    info->pending_bytes += cmd->len;
+
+    if ( info->num_pending == MAX_PENDING || (now - info->pending_since) >= cfg->file_flush_interval * 1e9 )
+        _flush_pending(info);
+
+    return 1;
+}
+
+int8_t __hlt_file_cmd_internal(__hlt_cmd* c, hlt_execution_context* ctx)
 {
     __hlt_cmd_file* cmd = (__hlt_cmd_file*) c;
 
@@ -326,7 +653,7 @@ void __hlt_file_cmd_internal(__hlt_cmd* c, hlt_execution_context* ctx)
 
      case 1: {
          if ( cmd->info->error )
-             return;
+             return 0;
 
          // Open command.
          int s = 0;
@@ -352,82 +679,104 @@ void __hlt_file_cmd_internal(__hlt_cmd* c, hlt_execution_context* ctx)
                  cmd->info->error = 1;
                  // TODO: We don't have a good way to report errors unfortunately.
                  release_lock(s);
-                 return;
+                 return 0;
              }
 
              cmd->info->fd = fd;
+
+             if ( hlt_enum_equal(cmd->param_type, Hilti_FileType_TextGzip, &excpt, ctx) ||
+                  hlt_enum_equal(cmd->param_type, Hilti_FileType_BinaryGzip, &excpt, ctx) )
+                 _gzip_init(cmd->info, ctx);
          }
 
          release_lock(s);
          break;
+     }
 
-      case 2: {
-          // Write comment.
+     case 2: {
+         // Write command.
 
-          if ( cmd->info->fd < 0 )
-              return;
+         if ( cmd->info->fd < 0 )
+             return 0;
 
-          if ( cmd->info->error )
-              return;
+         if ( cmd->info->error )
+             return 0;
 
-          if ( cmd->len ) {
-              if ( ! __hlt_safe_write(cmd->info->fd, cmd->data, cmd->len) )
-                  cmd->info->error = 1;
+         if ( ! cmd->len )
+             return 0;
 
-              hlt_free(cmd->data);
-          }
+         if ( _buffer_write(cmd, ctx) )
+             // We keep the command until flushing.
+             return 1;
 
-          break;
-      }
+         _write_data(cmd->info, cmd->data, cmd->len);
+         break;
+     }
 
-      case 3: {
-          // Close command.
+     case 4: {
+         // Flush command.
 
-          if ( cmd->info->fd < 0 )
-              return;
+         if ( cmd->info->fd < 0 )
+             return 0;
 
-          int s = 0;
-          acqire_lock(&s);
+         _flush_pending(cmd->info);
+         _gzip_finish(cmd->info);
+         break;
+     }
 
-          assert(cmd->info->writers);
+     case 3: {
+         // Close command.
 
-          if ( --cmd->info->writers == 0 ) {
-              close(cmd->info->fd);
+         if ( cmd->info->fd < 0 )
+             return 0;
 
-              // Delete from list.
-              __hlt_file_info* cur;
-              for ( cur = __hlt_globals()->files; cur; cur = cur->next ) {
-                  if ( cur != cmd->info )
-                      continue;
+         _flush_pending(cmd->info);
 
-                  if ( cur->prev )
-                      cur->prev->next = cur->next;
-                  else
-                      __hlt_globals()->files = cur->next;
+         int s = 0;
+         acqire_lock(&s);
 
-                  if ( cur->next )
-                      cur->next->prev = cur->prev;
+         assert(cmd->info->writers);
 
-                  break;
-              }
+         if ( --cmd->info->writers == 0 ) {
+             _gzip_done(cmd->info);
+             close(cmd->info->fd);
 
-              if ( ! cur )
-                  fatal_error("file to close not found");
+             // Delete from list.
+             __hlt_file_info* cur;
+             for ( cur = __hlt_globals()->files; cur; cur = cur->next ) {
+                 if ( cur != cmd->info )
+                     continue;
 
-              GC_DTOR(cmd->info->path, hlt_string, hlt_global_execution_context());
-              hlt_free(cmd->info);
+                 if ( cur->prev )
+                     cur->prev->next = cur->next;
+                 else
+                     __hlt_globals()->files = cur->next;
 
-              cmd->info = 0;
-          }
+                 if ( cur->next )
+                     cur->next->prev = cur->prev;
 
-          release_lock(s);
-          break;
-      }
+                 break;
+             }
+
+             if ( ! cur )
+                 fatal_error("file to close not found");
+
+             GC_DTOR(cmd->info->path, hlt_string, hlt_global_execution_context());
+             hlt_free(cmd->info->pending);
+             hlt_free(cmd->info);
+
+             cmd->info = 0;
+         }
 
-      default:
-         fatal_error("unknown data type in write");
+         release_lock(s);
+         break;
      }
+
+     default:
+        fatal_error("unknown data type in write");
     }
+
+    return 0;
 }
 
 hlt_string hlt_file_to_string(const hlt_type_info* type, const void* obj, int32_t options, __hlt_pointer_stack* seen, hlt_exception** excpt, hlt_execution_context* ctx)
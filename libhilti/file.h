@@ -58,7 +58,10 @@ hlt_file* hlt_file_new(hlt_exception** excpt, hlt_execution_context* ctx);
 ///
 /// file: The file to open.
 ///
-/// type: ``Hilti_FileType_Text`` or ``Hilti_FileType_Binary``
+/// type: ``Hilti_FileType_Text`` or ``Hilti_FileType_Binary``; or
+/// ``Hilti_FileType_TextGzip`` or ``Hilti_FileType_BinaryGzip`` for the
+/// same written out as a gzip-compressed stream. The command queue thread
+/// does the compression, in large blocks.
 ///
 /// mode: ``Hilti_FileMode_Create`` or ``Hilti_FileMode_Append``
 ///
@@ -87,6 +90,19 @@ void hlt_file_open(hlt_file* file, hlt_string path, hlt_enum type, hlt_enum mode
 /// won't be closed; further writes to them are fine.
 void hlt_file_close(hlt_file* file, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Writes out everything written to a file so far. For compressed files,
+/// this completes the current gzip member, so that the file then consists
+/// of a sequence of complete members that tools like gunzip can read. The
+/// flush happens asynchronously in the command queue thread.
+///
+/// file: The file to flush.
+///
+/// excpt: &
+///
+/// Note: Each flush of a compressed file costs some compression ratio, so
+/// it's best done at natural boundaries only, like before rotating a log.
+void hlt_file_flush(hlt_file* file, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Writes a string into a file. The string will be encoded according to the
 /// charset given when the file was opened. If the file was opened in text
 /// mode, the string will be automatically terminated by a newline.
@@ -137,7 +153,13 @@ typedef struct __hlt_cmd_write __hlt_cmd_write;
 
 // Internal function to perform the actual write from the queue manager. This
 // function is not thread-safe and must be called only from a single thread.
-void __hlt_file_cmd_internal(__hlt_cmd* c, hlt_execution_context* ctx);
+// Returns true if it has kept the command for buffering, in which case it
+// takes over ownership; otherwise the caller needs to free it.
+int8_t __hlt_file_cmd_internal(__hlt_cmd* c, hlt_execution_context* ctx);
+
+// Internal function to write out all buffered data. This function is not
+// thread-safe and must be called only from the command queue thread.
+void __hlt_files_flush(hlt_execution_context* ctx);
 
 /// @}
 
@@ -0,0 +1,434 @@
+// Function-level profiling.
+//
+// Each instrumented function has a global "site" that receives a unique ID
+// on first call. On entry, the generated code hands us a frame living on its
+// stack, which we link to the frame of the caller; on exit we add the
+// elapsed cycles to the function's totals, and to those of the
+// caller/callee pair.
+//
+// All totals are kept per native thread, so that the hot path doesn't need
+// any locking. To be able to read them from another thread while they keep
+// changing, the per-thread memory never moves: the totals are allocated in
+// chunks of FPROF_CHUNK_SIZE functions that we don't release until
+// termination, and the list of callers for each function only ever grows at
+// its head. We don't synchronize the counter updates themselves though, so
+// a dump may see them slightly inconsistent with each other.
+//
+// Fibers get their own chain of frames, which we switch in and out along
+// with the fiber. The outermost function running inside a fiber has no
+// caller for our purposes, as the fiber may be resumed from a different
+// context than it was started in. Cycles passing while a fiber is suspended
+// don't count.
+//
+// Cycles come from the time stamp counter where available, and are
+// nanoseconds otherwise.
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fprof.h"
+#include "globals.h"
+#include "config.h"
+#include "debug.h"
+#include "hutil.h"
+#include "memory_.h"
+
+#define FPROF_CHUNK_SIZE 1024
+#define FPROF_MAX_CHUNKS 1024
+
+// The totals for one caller of a function.
+typedef struct __hlt_fprof_caller {
+    uint64_t id;                       // The caller's ID; zero for none.
+    uint64_t calls;                    // Number of calls.
+    uint64_t cycles;                   // Total cycles spent in the callee.
+    struct __hlt_fprof_caller* next;
+} __hlt_fprof_caller;
+
+// The totals for one function.
+typedef struct {
+    uint64_t calls;                    // Number of calls.
+    uint64_t cycles;                   // Total cycles, including callees.
+    uint64_t self;                     // Total cycles, excluding callees.
+    __hlt_fprof_caller* callers;       // Totals per caller.
+} __hlt_fprof_func;
+
+// The totals of one native thread.
+typedef struct __hlt_fprof_thread {
+    __hlt_fprof_func* chunks[FPROF_MAX_CHUNKS];
+    struct __hlt_fprof_thread* next;
+} __hlt_fprof_thread;
+
+// These are inherently per native thread and hence not part of the global
+// state.
+static __thread __hlt_fprof_thread* fprof_thread = 0;
+static __thread __hlt_fprof_frame* fprof_top = 0;
+
+static void fatal_error(const char* msg)
+{
+    fprintf(stderr, "libhilti fprof: %s\n", msg);
+    exit(1);
+}
+
+static inline void acquire_lock()
+{
+    if ( pthread_mutex_lock(&__hlt_globals()->fprof_lock) != 0 )
+        fatal_error("cannot lock mutex");
+}
+
+static inline void release_lock()
+{
+    if ( pthread_mutex_unlock(&__hlt_globals()->fprof_lock) != 0 )
+        fatal_error("cannot unlock mutex");
+}
+
+static inline uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static void signal_handler(int sig)
+{
+    // We write the dump from the next function exit.
+    __hlt_globals()->fprof_dump_requested = 1;
+}
+
+static uint64_t register_site(uint64_t* site, const char* name)
+{
+    __hlt_global_state* globals = __hlt_globals();
+
+    acquire_lock();
+
+    uint64_t id = *site;
+
+    if ( ! id ) {
+        if ( globals->fprof_num_sites == globals->fprof_max_sites ) {
+            globals->fprof_max_sites = globals->fprof_max_sites ? globals->fprof_max_sites * 2 : 64;
+            globals->fprof_sites = hlt_realloc(globals->fprof_sites, globals->fprof_max_sites * sizeof(char*), globals->fprof_num_sites * sizeof(char*));
+        }
+
+        if ( globals->fprof_num_sites >= FPROF_CHUNK_SIZE * FPROF_MAX_CHUNKS - 1 )
+            fatal_error("too many functions");
+
+        // We copy the name as the code may go away before we get to write
+        // out the totals.
+        globals->fprof_sites[globals->fprof_num_sites++] = strdup(name);
+        id = globals->fprof_num_sites; // IDs start at 1.
+
+        __atomic_store_n(site, id, __ATOMIC_RELEASE);
+
+        if ( id == 1 ) {
+            int sig = hlt_config_get()->profiling_functions_signal;
+
+            if ( sig )
+                signal(sig, signal_handler);
+        }
+    }
+
+    release_lock();
+
+    DBG_LOG("hilti-fprof", "function %s has ID %" PRIu64, name, id);
+
+    return id;
+}
+
+static __hlt_fprof_thread* init_thread()
+{
+    __hlt_fprof_thread* t = hlt_malloc(sizeof(__hlt_fprof_thread));
+
+    acquire_lock();
+    t->next = __hlt_globals()->fprof_threads;
+    __hlt_globals()->fprof_threads = t;
+    release_lock();
+
+    fprof_thread = t;
+    return t;
+}
+
+static inline __hlt_fprof_func* get_func(__hlt_fprof_thread* t, uint64_t id)
+{
+    __hlt_fprof_func* chunk = t->chunks[id / FPROF_CHUNK_SIZE];
+
+    if ( __builtin_expect(! chunk, 0) ) {
+        chunk = hlt_malloc(FPROF_CHUNK_SIZE * sizeof(__hlt_fprof_func));
+        __atomic_store_n(&t->chunks[id / FPROF_CHUNK_SIZE], chunk, __ATOMIC_RELEASE);
+    }
+
+    return &chunk[id % FPROF_CHUNK_SIZE];
+}
+
+static inline __hlt_fprof_caller* get_caller(__hlt_fprof_func* f, uint64_t id)
+{
+    for ( __hlt_fprof_caller* c = f->callers; c; c = c->next ) {
+        if ( c->id == id )
+            return c;
+    }
+
+    __hlt_fprof_caller* c = hlt_malloc(sizeof(__hlt_fprof_caller));
+    c->id = id;
+    c->calls = 0;
+    c->cycles = 0;
+    c->next = f->callers;
+    __atomic_store_n(&f->callers, c, __ATOMIC_RELEASE);
+    return c;
+}
+
+void __hlt_fprof_enter(uint64_t* site, const char* name, __hlt_fprof_frame* frame)
+{
+    uint64_t id = __atomic_load_n(site, __ATOMIC_ACQUIRE);
+
+    if ( __builtin_expect(! id, 0) )
+        id = register_site(site, name);
+
+    frame->id = id;
+    frame->children = 0;
+    frame->parent = fprof_top;
+    frame->start = cycles();
+
+    fprof_top = frame;
+}
+
+void __hlt_fprof_leave(__hlt_fprof_frame* frame)
+{
+    uint64_t elapsed = cycles() - frame->start;
+
+    __hlt_fprof_thread* t = fprof_thread;
+
+    if ( __builtin_expect(! t, 0) )
+        t = init_thread();
+
+    __hlt_fprof_func* f = get_func(t, frame->id);
+    f->calls++;
+    f->cycles += elapsed;
+    f->self += (elapsed > frame->children ? elapsed - frame->children : 0);
+
+    __hlt_fprof_frame* parent = frame->parent;
+    __hlt_fprof_caller* c = get_caller(f, parent ? parent->id : 0);
+    c->calls++;
+    c->cycles += elapsed;
+
+    if ( parent )
+        parent->children += elapsed;
+
+    fprof_top = parent;
+
+    __hlt_global_state* globals = __hlt_globals();
+
+    if ( __builtin_expect(globals->fprof_dump_requested, 0) ) {
+        globals->fprof_dump_requested = 0;
+        hlt_fprof_dump();
+    }
+}
+
+__hlt_fprof_frame* __hlt_fprof_resume(__hlt_fprof_frame* top, uint64_t yielded)
+{
+    if ( top ) {
+        uint64_t suspended = cycles() - yielded;
+
+        for ( __hlt_fprof_frame* f = top; f; f = f->parent )
+            f->start += suspended;
+    }
+
+    __hlt_fprof_frame* caller = fprof_top;
+    fprof_top = top;
+    return caller;
+}
+
+__hlt_fprof_frame* __hlt_fprof_suspend(__hlt_fprof_frame* caller, uint64_t* yielded)
+{
+    __hlt_fprof_frame* top = fprof_top;
+    fprof_top = caller;
+
+    if ( top )
+        *yielded = cycles();
+
+    return top;
+}
+
+static int cmp_self(const void* a, const void* b)
+{
+    const __hlt_fprof_func* fa = *(const __hlt_fprof_func**)a;
+    const __hlt_fprof_func* fb = *(const __hlt_fprof_func**)b;
+
+    if ( fa->self != fb->self )
+        return fa->self < fb->self ? 1 : -1;
+
+    return fa < fb ? -1 : (fa > fb);
+}
+
+// Merges the per-thread totals. Must be called with the lock held. Returns
+// an array indexed by function ID, with each function's callers merged
+// into a newly allocated list.
+static __hlt_fprof_func* merge(uint64_t num_sites, uint64_t* num_threads)
+{
+    __hlt_fprof_func* merged = hlt_malloc((num_sites + 1) * sizeof(__hlt_fprof_func));
+
+    *num_threads = 0;
+
+    for ( __hlt_fprof_thread* t = __hlt_globals()->fprof_threads; t; t = t->next ) {
+        ++(*num_threads);
+
+        for ( uint64_t id = 1; id <= num_sites; id++ ) {
+            __hlt_fprof_func* chunk = __atomic_load_n(&t->chunks[id / FPROF_CHUNK_SIZE], __ATOMIC_ACQUIRE);
+
+            if ( ! chunk )
+                continue;
+
+            __hlt_fprof_func* f = &chunk[id % FPROF_CHUNK_SIZE];
+            __hlt_fprof_func* m = &merged[id];
+
+            m->calls += f->calls;
+            m->cycles += f->cycles;
+            m->self += f->self;
+
+            for ( __hlt_fprof_caller* c = __atomic_load_n(&f->callers, __ATOMIC_ACQUIRE); c; c = c->next ) {
+                __hlt_fprof_caller* mc = get_caller(m, c->id);
+                mc->calls += c->calls;
+                mc->cycles += c->cycles;
+            }
+        }
+    }
+
+    return merged;
+}
+
+static void free_callers(__hlt_fprof_caller* c)
+{
+    while ( c ) {
+        __hlt_fprof_caller* next = c->next;
+        hlt_free(c);
+        c = next;
+    }
+}
+
+void hlt_fprof_dump()
+{
+    __hlt_global_state* globals = __hlt_globals();
+
+    acquire_lock();
+
+    uint64_t num_sites = globals->fprof_num_sites;
+
+    if ( ! num_sites ) {
+        release_lock();
+        return;
+    }
+
+    const char* fname = hlt_config_get()->profiling_functions_out;
+    FILE* out = fopen(fname, "w");
+
+    if ( ! out ) {
+        fprintf(stderr, "libhilti fprof: cannot open %s\n", fname);
+        release_lock();
+        return;
+    }
+
+    uint64_t num_threads;
+    __hlt_fprof_func* merged = merge(num_sites, &num_threads);
+
+    __hlt_fprof_func** sorted = hlt_malloc(num_sites * sizeof(__hlt_fprof_func*));
+
+    for ( uint64_t id = 1; id <= num_sites; id++ )
+        sorted[id - 1] = &merged[id];
+
+    qsort(sorted, num_sites, sizeof(__hlt_fprof_func*), cmp_self);
+
+    fprintf(out, "# HILTI function profile, %" PRIu64 " function(s), %" PRIu64 " thread(s)\n", num_sites, num_threads);
+    fprintf(out, "#\n");
+    fprintf(out, "# %10s %16s %16s  %s\n", "calls", "cycles", "self", "function");
+
+    for ( uint64_t i = 0; i < num_sites; i++ ) {
+        __hlt_fprof_func* m = sorted[i];
+
+        if ( ! m->calls )
+            continue;
+
+        fprintf(out, "%12" PRIu64 " %16" PRIu64 " %16" PRIu64 "  %s\n", m->calls, m->cycles, m->self, globals->fprof_sites[m - merged - 1]);
+    }
+
+    fprintf(out, "#\n");
+    fprintf(out, "# %10s %16s  %s\n", "calls", "cycles", "caller -> callee");
+
+    for ( uint64_t i = 0; i < num_sites; i++ ) {
+        __hlt_fprof_func* m = sorted[i];
+
+        for ( __hlt_fprof_caller* c = m->callers; c; c = c->next ) {
+            const char* caller = c->id ? globals->fprof_sites[c->id - 1] : "<root>";
+            fprintf(out, "%12" PRIu64 " %16" PRIu64 "  %s -> %s\n", c->calls, c->cycles, caller, globals->fprof_sites[m - merged - 1]);
+        }
+    }
+
+    fclose(out);
+
+    for ( uint64_t id = 1; id <= num_sites; id++ )
+        free_callers(merged[id].callers);
+
+    hlt_free(sorted);
+    hlt_free(merged);
+
+    release_lock();
+
+    DBG_LOG("hilti-fprof", "wrote function profile to %s", fname);
+}
+
+void __hlt_fprof_init()
+{
+    if ( pthread_mutex_init(&__hlt_globals()->fprof_lock, 0) != 0 )
+        fatal_error("cannot init mutex");
+}
+
+void __hlt_fprof_done()
+{
+    __hlt_global_state* globals = __hlt_globals();
+
+    hlt_fprof_dump();
+
+    if ( globals->fprof_num_sites ) {
+        int sig = hlt_config_get()->profiling_functions_signal;
+
+        if ( sig )
+            signal(sig, SIG_DFL);
+    }
+
+    __hlt_fprof_thread* t = globals->fprof_threads;
+
+    while ( t ) {
+        for ( int i = 0; i < FPROF_MAX_CHUNKS; i++ ) {
+            __hlt_fprof_func* chunk = t->chunks[i];
+
+            if ( ! chunk )
+                continue;
+
+            for ( int j = 0; j < FPROF_CHUNK_SIZE; j++ )
+                free_callers(chunk[j].callers);
+
+            hlt_free(chunk);
+        }
+
+        __hlt_fprof_thread* next = t->next;
+        hlt_free(t);
+        t = next;
+    }
+
+    for ( uint64_t i = 0; i < globals->fprof_num_sites; i++ )
+        free((char*)globals->fprof_sites[i]);
+
+    hlt_free(globals->fprof_sites);
+
+    globals->fprof_threads = 0;
+    globals->fprof_sites = 0;
+    globals->fprof_num_sites = 0;
+    globals->fprof_max_sites = 0;
+    fprof_thread = 0;
+
+    if ( pthread_mutex_destroy(&globals->fprof_lock) != 0 )
+        fatal_error("cannot destroy mutex");
+}
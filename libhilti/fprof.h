@@ -0,0 +1,73 @@
+///
+/// Run-time support for function-level profiling.
+///
+/// When compiled with Options::profile_functions, the code generator
+/// instruments every HILTI function by calling __hlt_fprof_enter() on entry
+/// and __hlt_fprof_leave() on exit. We count calls and cycles per function
+/// and per caller/callee pair, aggregated per native thread, and write the
+/// merged totals to config.profiling_functions_out at exit, or whenever
+/// config.profiling_functions_signal arrives.
+///
+
+#ifndef LIBHILTI_FPROF_H
+#define LIBHILTI_FPROF_H
+
+#include <stdint.h>
+
+/// The state of one active function invocation. The generated code
+/// allocates this on the function's stack; it's opaque to it. When changing
+/// this, adapt ``hlt.fprof_frame`` in ``libhilti.ll``.
+typedef struct __hlt_fprof_frame {
+    uint64_t id;                       /// The function's ID.
+    uint64_t start;                    /// Cycles at entry.
+    uint64_t children;                 /// Cycles spent in callees so far.
+    struct __hlt_fprof_frame* parent;  /// The caller's frame, or null for the outermost one.
+} __hlt_fprof_frame;
+
+/// Records entering an instrumented function.
+///
+/// site: A per-function global initialized to zero. On first call, this
+/// assigns the function a unique ID and stores it there.
+///
+/// name: The function's name, used to register it on first call.
+///
+/// frame: Uninitialized stack space for the invocation's state.
+extern void __hlt_fprof_enter(uint64_t* site, const char* name, __hlt_fprof_frame* frame);
+
+/// Records leaving an instrumented function.
+///
+/// frame: The frame previously passed to __hlt_fprof_enter().
+extern void __hlt_fprof_leave(__hlt_fprof_frame* frame);
+
+/// Switches the current thread's chain of frames over to those of a fiber
+/// that's being started or resumed. Must be matched by a call to
+/// __hlt_fprof_suspend() once the fiber yields or finishes.
+///
+/// top: The fiber's innermost frame when it last yielded, or null if none.
+///
+/// yielded: The time when the fiber last yielded, as stored by
+/// __hlt_fprof_suspend(). Cycles passing while suspended don't count
+/// towards the fiber's frames.
+///
+/// Returns: The caller's innermost frame, to pass to __hlt_fprof_suspend().
+extern __hlt_fprof_frame* __hlt_fprof_resume(__hlt_fprof_frame* top, uint64_t yielded);
+
+/// Switches the current thread's chain of frames back to the caller of a
+/// fiber that has yielded or finished.
+///
+/// caller: The frame returned by the corresponding __hlt_fprof_resume().
+///
+/// yielded: Receives the current time, to pass into the next
+/// __hlt_fprof_resume().
+///
+/// Returns: The fiber's innermost frame.
+extern __hlt_fprof_frame* __hlt_fprof_suspend(__hlt_fprof_frame* caller, uint64_t* yielded);
+
+/// Writes out the current totals of all threads. The totals keep
+/// accumulating afterwards.
+extern void hlt_fprof_dump();
+
+extern void __hlt_fprof_init();
+extern void __hlt_fprof_done();
+
+#endif
@@ -5,6 +5,8 @@
 #include "context.h"
 #include "globals.h"
 #include "config.h"
+#include "fprof.h"
+#include "pgo.h"
 
 static __hlt_global_state  our_globals;
 static __hlt_global_state* globals = 0;
@@ -30,6 +32,8 @@ void __hlt_global_state_init(int init)
     __hlt_hooks_init();
     __hlt_threading_init();
     __hlt_profiler_init();
+    __hlt_fprof_init();
+    __hlt_pgo_init();
     __hlt_stackmap_init();
 
     globals_initialized = 1;
@@ -42,6 +46,8 @@ void __hlt_global_state_done()
     __hlt_stackmap_done();
     __hlt_threading_done(&excpt);
     __hlt_profiler_done(); // Must come after threading is done.
+    __hlt_fprof_done(); // Ditto.
+    __hlt_pgo_done(); // Ditto.
 
     if ( excpt ) {
         hlt_exception_print_uncaught(excpt, globals->context);
@@ -6,6 +6,7 @@
 #define LIBHILTI_GLOBALS_H
 
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 
 #include "hook.h"
@@ -51,11 +52,26 @@ struct __hlt_global_state {
     // file.c
     __hlt_file_info* files;
     pthread_mutex_t files_lock; // Lock to protect access to files.
+    __hlt_file_info* files_dirty; // Files with writes buffered; accessed only by the command queue.
 
     // profile.c
     int8_t profiling_enabled;
     int8_t papi_available;
     int papi_set;
+    int8_t profiler_counters;  // Where hardware counters come from (COUNTERS_* in profiler.c).
+    pthread_key_t perf_key;    // Per-thread counters for perf_event_open().
+
+    // fprof.c
+    pthread_mutex_t fprof_lock;          // Lock to protect access to the following.
+    const char** fprof_sites;            // Names of instrumented functions, indexed by ID - 1.
+    uint64_t fprof_num_sites;            // Number of entries in fprof_sites.
+    uint64_t fprof_max_sites;            // Number of entries allocated for fprof_sites.
+    struct __hlt_fprof_thread* fprof_threads; // Per-thread totals.
+    volatile sig_atomic_t fprof_dump_requested; // Set by the signal handler; accessed without lock.
+
+    // pgo.c
+    pthread_mutex_t pgo_lock;            // Lock to protect access to the following.
+    struct __hlt_pgo_table* pgo_tables;  // Registered sets of instrumented functions.
 
     // timer.c
     _Atomic(uint_fast64_t) global_time;
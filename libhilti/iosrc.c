@@ -1,9 +1,47 @@
 
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <pcap.h>
 
 #include "iosrc.h"
+#include "hutil.h"
 #include "autogen/hilti-hlt.h"
 
+// A trace file in the classic PCAP format that we map into memory. Reading
+// packets from there saves libpcap's per-packet call and it copying the data
+// into its own buffer first.
+struct __hlt_iosrc_trace {
+    const uint8_t* data; // The mapped file.
+    size_t size;         // The size of the file.
+    size_t pos;          // The offset of the next packet's record.
+    int8_t swapped;      // True if the file's byte order differs from ours.
+    int8_t nsecs;        // True if timestamps have nanosecond resolution.
+    int datalink;        // The link layer's DLT_* type.
+};
+
+// The header preceding each packet in a classic PCAP file.
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t caplen;
+    uint32_t len;
+} __hlt_pcap_record;
+
+// State passed to our pcap_dispatch() callback.
+typedef struct {
+    hlt_iosrc* src;
+    int8_t keep_link_layer;
+    int8_t ref;
+    hlt_packet* pkts;
+    int64_t num;
+    hlt_exception** excpt;
+    hlt_execution_context* ctx;
+} __hlt_dispatch_cookie;
+
 typedef struct  {
     hlt_iosrc* src;
     hlt_time t;
@@ -76,11 +114,182 @@ static void _strip_link_layer(hlt_iosrc* src, const char** pkt, int* caplen, int
     *caplen -= hdr_size;
 }
 
-void hlt_iosrc_dtor(hlt_type_info* ti, hlt_iosrc* c, hlt_execution_context* ctx)
+// Maps a trace file into memory if it's in the classic PCAP format. Returns
+// null if not, in which case the caller leaves it to libpcap.
+static struct __hlt_iosrc_trace* _trace_open(const char* fname)
+{
+    int fd = open(fname, O_RDONLY);
+
+    if ( fd < 0 )
+        return 0;
+
+    struct stat st;
+
+    if ( fstat(fd, &st) < 0 || ! S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(struct pcap_file_header) ) {
+        close(fd);
+        return 0;
+    }
+
+    void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if ( data == MAP_FAILED )
+        return 0;
+
+    struct pcap_file_header hdr;
+    memcpy(&hdr, data, sizeof(hdr));
+
+    int8_t swapped = 0;
+    int8_t nsecs = 0;
+
+    switch ( hdr.magic ) {
+     case 0xa1b2c3d4:
+        break;
+
+     case 0xa1b23c4d:
+        nsecs = 1;
+        break;
+
+     case 0xd4c3b2a1:
+        swapped = 1;
+        break;
+
+     case 0x4d3cb2a1:
+        swapped = nsecs = 1;
+        break;
+
+     default:
+        // Another format, such as pcapng.
+        munmap(data, st.st_size);
+        return 0;
+    }
+
+    uint16_t major = swapped ? hlt_flip16(hdr.version_major) : hdr.version_major;
+    uint32_t linktype = swapped ? hlt_flip32(hdr.linktype) : hdr.linktype;
+
+    if ( major != 2 ) {
+        munmap(data, st.st_size);
+        return 0;
+    }
+
+    // The upper bits may carry further information about the link layer.
+    linktype &= 0x03ffffff;
+
+    // Except for raw IP, the link types we support have the same value as
+    // their DLT_* constant.
+    if ( linktype == 101 )
+        linktype = DLT_RAW;
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    struct __hlt_iosrc_trace* trace = hlt_malloc(sizeof(struct __hlt_iosrc_trace));
+    trace->data = (const uint8_t*)data;
+    trace->size = st.st_size;
+    trace->pos = sizeof(struct pcap_file_header);
+    trace->swapped = swapped;
+    trace->nsecs = nsecs;
+    trace->datalink = linktype;
+
+    return trace;
+}
+
+static void _trace_close(struct __hlt_iosrc_trace* trace)
+{
+    munmap((void*)trace->data, trace->size);
+    hlt_free(trace);
+}
+
+// Releases the source's resources; further reads will fail.
+static void _close(hlt_iosrc* src)
+{
+    if ( src->handle )
+        pcap_close(src->handle);
+
+    if ( src->trace )
+        _trace_close(src->trace);
+
+    src->handle = 0;
+    src->trace = 0;
+}
+
+// Turns a captured packet into what we return to the caller. If *ref* is
+// true, the packet's data is returned at +1. Returns false if that fails,
+// with an exception set.
+static int _make_packet(hlt_iosrc* src, uint64_t secs, uint64_t nsecs, const u_char* data, int caplen, int datalink,
+                        int8_t keep_link_layer, int8_t ref, hlt_packet* pkt, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( ! keep_link_layer ) {
+        _strip_link_layer(src, (const char**)&data, &caplen, datalink, excpt, ctx);
+        if ( hlt_check_exception(excpt) )
+            return 0;
+    }
+
+    // We need to copy it to make sure it remains valid.
+    hlt_bytes* b = ref ? __hlt_bytes_new_from_data_copy_ref((const int8_t*)data, caplen, excpt, ctx)
+                       : hlt_bytes_new_from_data_copy((const int8_t*)data, caplen, excpt, ctx);
+    if ( hlt_check_exception(excpt) )
+        return 0;
+
+    pkt->t = hlt_time_value(secs, nsecs);
+    pkt->data = b;
+    return 1;
+}
+
+// Reads the next packet from a mapped trace file. Returns false if there's
+// none left, or if that fails with an exception set.
+static int _trace_next(hlt_iosrc* src, int8_t keep_link_layer, int8_t ref, hlt_packet* pkt, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    struct __hlt_iosrc_trace* trace = src->trace;
+
+    if ( trace->pos == trace->size )
+        // No more packets.
+        return 0;
+
+    __hlt_pcap_record rec;
+
+    if ( trace->size - trace->pos < sizeof(rec) )
+        goto truncated;
+
+    memcpy(&rec, trace->data + trace->pos, sizeof(rec));
+
+    if ( trace->swapped ) {
+        rec.ts_sec = hlt_flip32(rec.ts_sec);
+        rec.ts_frac = hlt_flip32(rec.ts_frac);
+        rec.caplen = hlt_flip32(rec.caplen);
+    }
+
+    if ( rec.caplen > trace->size - trace->pos - sizeof(rec) )
+        goto truncated;
+
+    const u_char* data = trace->data + trace->pos + sizeof(rec);
+    trace->pos += sizeof(rec) + rec.caplen;
+
+    uint64_t nsecs = trace->nsecs ? rec.ts_frac : (uint64_t)rec.ts_frac * 1000;
+    return _make_packet(src, rec.ts_sec, nsecs, data, rec.caplen, trace->datalink, keep_link_layer, ref, pkt, excpt, ctx);
+
+truncated:
+    _raise_error(src, "truncated trace file", excpt, ctx);
+    _close(src);
+    return 0;
+}
+
+static void _dispatch_packet(u_char* user, const struct pcap_pkthdr* hdr, const u_char* data)
 {
-    if ( c->handle )
-        pcap_close(c->handle);
+    __hlt_dispatch_cookie* cookie = (__hlt_dispatch_cookie*)user;
+    hlt_iosrc* src = cookie->src;
+
+    if ( ! _make_packet(src, hdr->ts.tv_sec, hdr->ts.tv_usec * 1000, data, hdr->caplen, pcap_datalink(src->handle),
+                        cookie->keep_link_layer, cookie->ref, &cookie->pkts[cookie->num], cookie->excpt, cookie->ctx) ) {
+        pcap_breakloop(src->handle);
+        return;
+    }
+
+    ++cookie->num;
+}
 
+void hlt_iosrc_dtor(hlt_type_info* ti, hlt_iosrc* c, hlt_execution_context* ctx)
+{
+    _close(c);
     GC_CLEAR(c->iface, hlt_string, ctx);
 }
 
@@ -105,6 +314,7 @@ hlt_iosrc* hlt_iosrc_new_live(hlt_string interface, hlt_exception** excpt, hlt_e
     hlt_iosrc* src = GC_NEW(hlt_iosrc, ctx);
     src->type = Hilti_IOSrc_PcapLive;
     src->iface = hlt_string_copy(interface, excpt, ctx);
+    src->trace = 0;
     GC_CCTOR(src->iface, hlt_string, ctx);
 
     char* iface = hlt_string_to_native(interface, excpt, ctx);
@@ -150,12 +360,20 @@ hlt_iosrc* hlt_iosrc_new_offline(hlt_string interface, hlt_exception** excpt, hl
     hlt_iosrc* src = GC_NEW(hlt_iosrc, ctx);
     src->type = Hilti_IOSrc_PcapOffline;
     src->iface = hlt_string_copy(interface, excpt, ctx);
+    src->trace = 0;
     GC_CCTOR(src->iface, hlt_string, ctx);
 
     char* iface = hlt_string_to_native(interface, excpt, ctx);
     if ( hlt_check_exception(excpt) )
         return 0;
 
+    src->trace = _trace_open(iface);
+
+    if ( src->trace ) {
+        hlt_free(iface);
+        return src;
+    }
+
     char errbuf[PCAP_ERRBUF_SIZE];
     pcap_t *p = pcap_open_offline(iface, errbuf);
 
@@ -174,34 +392,26 @@ hlt_packet hlt_iosrc_read_try(hlt_iosrc* src, int8_t keep_link_layer, hlt_except
 {
     hlt_packet result = { 0.0, NULL };
 
-    if ( ! src->handle ) {
+    if ( ! (src->handle || src->trace) ) {
         _raise_error(src, "already closed", excpt, ctx);
         return result;
     }
 
+    if ( src->trace ) {
+        // Leaves the result's data null once exhausted.
+        _trace_next(src, keep_link_layer, 0, &result, excpt, ctx);
+        return result;
+    }
+
     struct pcap_pkthdr* hdr;
     const u_char* data;
 
     int rc = pcap_next_ex(src->handle, &hdr, &data);
-    int caplen = hdr->caplen;
 
     if ( rc > 0 ) {
         // Got a packet.
-        if ( ! keep_link_layer ) {
-            _strip_link_layer(src, (const char**)&data, &caplen, pcap_datalink(src->handle), excpt, ctx);
-            if ( hlt_check_exception(excpt) )
-                return result;
-        }
-
-        // We need to copy it to make sure it remains valid.
-        hlt_bytes* pkt = hlt_bytes_new_from_data_copy((const int8_t*)data, caplen, excpt, ctx);
-        if ( hlt_check_exception(excpt) )
-            return result;
-
-        // Build the result tuple.
-        result.t = hlt_time_value(hdr->ts.tv_sec, hdr->ts.tv_usec * 1000);
-        result.data = pkt;
-
+        _make_packet(src, hdr->ts.tv_sec, hdr->ts.tv_usec * 1000, data, hdr->caplen, pcap_datalink(src->handle),
+                     keep_link_layer, 0, &result, excpt, ctx);
         return result;
     }
 
@@ -213,8 +423,7 @@ hlt_packet hlt_iosrc_read_try(hlt_iosrc* src, int8_t keep_link_layer, hlt_except
     if ( rc < 0 ) {
         // Error.
         _raise_error(src, 0, excpt, ctx);
-        pcap_close(src->handle);
-        src->handle = 0;
+        _close(src);
         return result;
     }
 
@@ -226,9 +435,62 @@ hlt_packet hlt_iosrc_read_try(hlt_iosrc* src, int8_t keep_link_layer, hlt_except
     return result;
 }
 
+static int64_t _read_batch(hlt_iosrc* src, int8_t keep_link_layer, int8_t ref, hlt_packet* pkts, int64_t max, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( ! (src->handle || src->trace) ) {
+        _raise_error(src, "already closed", excpt, ctx);
+        return 0;
+    }
+
+    if ( max <= 0 ) {
+        hlt_set_exception(excpt, &hlt_exception_value_error, 0, ctx);
+        return 0;
+    }
+
+    if ( src->trace ) {
+        int64_t n = 0;
+
+        while ( n < max && _trace_next(src, keep_link_layer, ref, &pkts[n], excpt, ctx) )
+            ++n;
+
+        return n;
+    }
+
+    __hlt_dispatch_cookie cookie = { src, keep_link_layer, ref, pkts, 0, excpt, ctx };
+
+    int rc = pcap_dispatch(src->handle, max, _dispatch_packet, (u_char*)&cookie);
+
+    if ( hlt_check_exception(excpt) )
+        return cookie.num;
+
+    if ( rc == -1 ) {
+        // Error.
+        _raise_error(src, 0, excpt, ctx);
+        _close(src);
+        return cookie.num;
+    }
+
+    if ( cookie.num > 0 || hlt_enum_equal(src->type, Hilti_IOSrc_PcapOffline, excpt, ctx) )
+        // For a trace, zero means we're done.
+        return cookie.num;
+
+    // No packet this time.
+    hlt_set_exception(excpt, &hlt_exception_would_block, 0, ctx);
+    return 0;
+}
+
+int64_t hlt_iosrc_read_batch(hlt_iosrc* src, int8_t keep_link_layer, hlt_packet* pkts, int64_t max, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    return _read_batch(src, keep_link_layer, 0, pkts, max, excpt, ctx);
+}
+
+int64_t __hlt_iosrc_read_batch_ref(hlt_iosrc* src, int8_t keep_link_layer, hlt_packet* pkts, int64_t max, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    return _read_batch(src, keep_link_layer, 1, pkts, max, excpt, ctx);
+}
+
 void hlt_iosrc_close(hlt_iosrc* src, hlt_exception** excpt, hlt_execution_context* ctx)
 {
-    pcap_close(src->handle);
-    src->handle = 0;
+    _close(src);
 }
 
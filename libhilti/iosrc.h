@@ -27,11 +27,14 @@
 /// The type of an IOSource as one of the Hilti::IOSrc constants.
 typedef hlt_enum hlt_iosrc_type;
 
+struct __hlt_iosrc_trace;
+
 struct __hlt_iosrc {
     __hlt_gchdr __gchdr;    // Header for memory management.
     hlt_iosrc_type type;  // Hilti_PktSrc_PcapLive or Hilti_PktSrc_PcapOffline.
     hlt_string iface;     // The name of the interface.
     void* handle;         // A kind-specific handle.
+    struct __hlt_iosrc_trace* trace; // Trace file we read directly from memory, or null if going through *handle*.
 };
 
 /// tuple<time, ref<bytes>>
@@ -57,6 +60,9 @@ extern hlt_iosrc* hlt_iosrc_new_live(hlt_string interface, hlt_exception** excpt
 ///
 /// interface: The name of the trace file.
 ///
+/// Note: If the file is in the classic PCAP format, the source maps it into
+/// memory and reads packets from there directly, bypassing libpcap.
+///
 /// Raises: IOError if there is a problem opening the the interface for monitoring.
 extern hlt_iosrc* hlt_iosrc_new_offline(hlt_string interface, hlt_exception** excpt, hlt_execution_context* ctx);
 
@@ -71,13 +77,41 @@ extern hlt_iosrc* hlt_iosrc_new_offline(hlt_string interface, hlt_exception** ex
 ///
 /// Returns: A tuple <hlt_time, hlt_bytes*> in which the time is the
 /// packet's timestamp, and the ``bytes`` object is the packet's content. If
-/// the source is permanenly exhausted, the ``bytes`` pointer will be null.
+/// the source is permanently exhausted, the ``bytes`` pointer will be null.
 ///
 /// Raises: IOError if there are any errors other than those described
 /// above, including encountering an unsupported link-layer header if
 /// *keep_link_layer* is disabled.
 extern hlt_packet hlt_iosrc_read_try(hlt_iosrc* src, int8_t keep_link_layer, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Reads a batch of packets from a PCAP source. This is more efficient than
+/// calling ~~hlt_iosrc_read_try repeatedly, in particular for offline
+/// sources. If no packet is currently available, raises a WouldBlock
+/// exception if there might be some at a later time.
+///
+/// src: The packet source.
+///
+/// keep_link_layer: If not true, any link layer headers are stripped.
+///
+/// pkts: Array to store up to *max* packets into. As with
+/// ~~hlt_iosrc_read_try, the ``bytes`` objects stored are not referenced
+/// yet; callers keeping them across a safepoint need to do so.
+///
+/// max: The maximum number of packets to read.
+///
+/// Returns: The number of packets stored into *pkts*. If the source is
+/// permanently exhausted, returns zero.
+///
+/// Raises: IOError as with ~~hlt_iosrc_read_try. Packets read before the
+/// error occurred remain stored in *pkts*, and the return value counts them.
+extern int64_t hlt_iosrc_read_batch(hlt_iosrc* src, int8_t keep_link_layer, hlt_packet* pkts, int64_t max, hlt_exception** excpt, hlt_execution_context* ctx);
+
+/// Like ~~hlt_iosrc_read_batch, but stores the packets' ``bytes`` objects
+/// with reference count +1, passing ownership to the caller. They don't
+/// enter the current thread's null buffer, so that they can be passed on to
+/// another thread.
+extern int64_t __hlt_iosrc_read_batch_ref(hlt_iosrc* src, int8_t keep_link_layer, hlt_packet* pkts, int64_t max, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Closes a live PCAP packet source. Any attempt to read further packets
 /// will result in an IOSrcError exception.
 ///
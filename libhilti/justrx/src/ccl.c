@@ -410,11 +410,63 @@ int ccl_is_epsilon(jrx_ccl* ccl)
     return !ccl->ranges;
 }
 
+// Joins neighbouring and overlapping ranges into single ones. The CCL keeps
+// matching the same characters.
+void ccl_compact(jrx_ccl* ccl)
+{
+    if ( ! ccl->ranges || set_char_range_size(ccl->ranges) < 2 )
+        return;
+
+    set_char_range* nranges = set_char_range_create(0);
+
+    jrx_char_range cur = { 0, 0 };
+    int have = 0;
+
+    // Ranges are sorted by their beginning.
+    set_for_each(char_range, ccl->ranges, r) {
+        if ( r.begin >= r.end )
+            continue;
+
+        if ( have && r.begin <= cur.end ) {
+            if ( r.end > cur.end )
+                cur.end = r.end;
+
+            continue;
+        }
+
+        if ( have )
+            set_char_range_insert(nranges, cur);
+
+        cur = r;
+        have = 1;
+    }
+
+    if ( have )
+        set_char_range_insert(nranges, cur);
+
+    set_char_range_delete(ccl->ranges);
+    ccl->ranges = nranges;
+}
+
 jrx_ccl* ccl_group_add(jrx_ccl_group* group, jrx_ccl* ccl)
 {
     return _ccl_group_add_to(group, _ccl_copy(ccl));
 }
 
+// Adds a CCL under a given ID, without looking for an existing equal one.
+// This is for restoring a group exactly as it was. The CCL takes ownership
+// of the ranges, which are NULL for an epsilon transition.
+jrx_ccl* ccl_group_restore(jrx_ccl_group* group, jrx_ccl_id id, jrx_assertion assertions, set_char_range* ranges)
+{
+    jrx_ccl* ccl = _ccl_create_epsilon();
+    ccl->id = id;
+    ccl->group = group;
+    ccl->assertions = assertions;
+    ccl->ranges = ranges;
+    vec_ccl_set(group->ccls, id, ccl);
+    return ccl;
+}
+
 void ccl_group_disambiguate(jrx_ccl_group* group)
 {
     int changed;
@@ -60,6 +60,7 @@ extern jrx_ccl* ccl_any(jrx_ccl_group* group);
 extern jrx_ccl* ccl_negate(jrx_ccl* ccl);
 extern jrx_ccl* ccl_add_assertions(jrx_ccl* ccl, jrx_assertion assertions);
 extern jrx_ccl* ccl_join(jrx_ccl* ccl1, jrx_ccl* ccl2);
+extern void ccl_compact(jrx_ccl* ccl);
 
 extern int ccl_is_empty(jrx_ccl* ccl);
 extern int ccl_is_epsilon(jrx_ccl* ccl);
@@ -69,6 +70,7 @@ extern jrx_ccl_group* ccl_group_create();
 extern void ccl_group_delete(jrx_ccl_group* group);
 extern void ccl_group_print(jrx_ccl_group* group, FILE* file);
 extern jrx_ccl* ccl_group_add(jrx_ccl_group* group, jrx_ccl* ccl);
+extern jrx_ccl* ccl_group_restore(jrx_ccl_group* group, jrx_ccl_id id, jrx_assertion assertions, set_char_range* ranges);
 
 extern void ccl_group_disambiguate(jrx_ccl_group* group);
 
@@ -33,51 +33,68 @@ static int _ccl_match(jrx_ccl* ccl, jrx_char cp, jrx_char *previous, jrx_asserti
     return 0;
 }
 
-int jrx_match_state_advance_min(jrx_match_state* ms, jrx_char cp, jrx_assertion assertions)
+// Moves the match state over to the successor state.
+static inline int _transition(jrx_match_state* ms, jrx_dfa_state_id succ_id, jrx_char cp)
 {
-    jrx_dfa_state* state = dfa_get_state(ms->dfa, ms->state);
+    ++ms->offset;
 
-    if ( ! state )
-        return 0;
+    jrx_dfa_state* succ_state = dfa_get_state(ms->dfa, succ_id);
+
+    ms->state = succ_id;
+    ms->previous = cp;
 
     if ( ms->dfa->options & JRX_OPTION_DEBUG )
-        fprintf(stderr, "> in state #%d with input symbol %d and assertions %d ", ms->state, cp, assertions);
+        fprintf(stderr, "-> found transition, new state is #%d", succ_id);
+
+    if ( succ_state->accepts ) {
+        jrx_accept_id aid = vec_dfa_accept_get(succ_state->accepts, 0).aid;
+
+        if ( ms->dfa->options & JRX_OPTION_DEBUG )
+            fprintf(stderr, " (accepting with ID %d)\n", aid);
+
+        // Accepting.
+        return aid;
+    }
 
-    vec_for_each(dfa_transition, state->trans, trans) {
-        jrx_ccl* ccl = vec_ccl_get(ms->dfa->ccls->ccls, trans.ccl);
+    else {
+        if ( ms->dfa->options & JRX_OPTION_DEBUG )
+            fputs("\n", stderr);
 
-        if ( ! _ccl_match(ccl, cp, ms->offset == 0 ? &ms->previous : 0, assertions) )
-            // Doesn't match.
-            continue;
+        // Partial match.
+        return -1;
+    }
+}
 
-        ++ms->offset;
+int jrx_match_state_advance_min(jrx_match_state* ms, jrx_char cp, jrx_assertion assertions)
+{
+    dfa_cache_check(ms->dfa, ms->state);
 
-        // Found transition.
-        jrx_dfa_state_id succ_id = trans.succ;
-        jrx_dfa_state* succ_state = dfa_get_state(ms->dfa, succ_id);
+    jrx_dfa_state* state = dfa_get_state(ms->dfa, ms->state);
 
-        ms->state = succ_id;
-        ms->previous = cp;
+    if ( ! state )
+        return 0;
 
-        if ( ms->dfa->options & JRX_OPTION_DEBUG )
-            fprintf(stderr, "-> found transition, new state is #%d", succ_id);
+    if ( ms->dfa->options & JRX_OPTION_DEBUG )
+        fprintf(stderr, "> in state #%d with input symbol %d and assertions %d ", ms->state, cp, assertions);
 
-        if ( succ_state->accepts ) {
-            jrx_accept_id aid = vec_dfa_accept_get(succ_state->accepts, 0).aid;
+    if ( state->table && cp < 256 ) {
+        // Fast path: look up the successor directly by the byte class.
+        jrx_dfa_state_id succ_id = state->table[ms->dfa->byte_classes[cp]];
 
-            if ( ms->dfa->options & JRX_OPTION_DEBUG )
-                fprintf(stderr, " (accepting with ID %d)\n", aid);
+        if ( succ_id != JRX_DFA_NO_STATE )
+            return _transition(ms, succ_id, cp);
+    }
 
-            // Accepting.
-            return aid;
-        }
+    else {
+        vec_for_each(dfa_transition, state->trans, trans) {
+            jrx_ccl* ccl = vec_ccl_get(ms->dfa->ccls->ccls, trans.ccl);
 
-        else {
-            if ( ms->dfa->options & JRX_OPTION_DEBUG )
-                fputs("\n", stderr);
+            if ( ! _ccl_match(ccl, cp, ms->offset == 0 ? &ms->previous : 0, assertions) )
+                // Doesn't match.
+                continue;
 
-            // Partial match.
-            return -1;
+            // Found transition.
+            return _transition(ms, trans.succ, cp);
         }
     }
 
@@ -99,4 +116,3 @@ int jrx_match_state_advance_min(jrx_match_state* ms, jrx_char cp, jrx_assertion
 
     return 0;
 }
-
@@ -76,6 +76,10 @@ static void _update_tags(jrx_match_state* ms, vec_tag_op* tops)
     if ( ! tops )
         return;
 
+    if ( ms->dfa->options & JRX_OPTION_NO_CAPTURE )
+        // Nobody is going to look at the tags.
+        return;
+
     int oldct = ms->current_tags;
     int newct = 1 - oldct;
 
@@ -177,12 +181,14 @@ jrx_match_state* jrx_match_state_init(const jrx_regex_t *preg, jrx_offset begin,
     ms->previous = 0;
     ms->dfa = dfa;
     ms->state = dfa->initial;
+    ms->pinned = JRX_DFA_NO_STATE;
     ms->current_tags = 0;
     ms->acc = -1;
     ms->tags1 = 0;
     ms->tags2 = 0;
     ms->tags1_size = 0;
     ms->tags2_size = 0;
+    ms->consumed = 0;
 
     if ( (dfa->options & JRX_OPTION_STD_MATCHER) ) {
         ms->accepts = set_match_accept_create(0);
@@ -201,7 +207,10 @@ jrx_match_state* jrx_match_state_init(const jrx_regex_t *preg, jrx_offset begin,
 
 void jrx_match_state_done(jrx_match_state* ms)
 {
-    if ( ms->dfa->options & JRX_OPTION_NO_CAPTURE )
+    dfa_state_unpin(ms->dfa, ms->pinned);
+    ms->pinned = JRX_DFA_NO_STATE;
+
+    if ( ! ms->accepts )
         return;
 
     set_for_each(match_accept, ms->accepts, acc) {
@@ -210,6 +219,7 @@ void jrx_match_state_done(jrx_match_state* ms)
     }
 
     set_match_accept_delete(ms->accepts);
+    ms->accepts = 0;
 
     free(ms->tags1);
     free(ms->tags2);
@@ -232,6 +242,8 @@ static void print_accept_set(set_match_accept* s)
 
 int jrx_match_state_advance(jrx_match_state* ms, jrx_char cp, jrx_assertion assertions)
 {
+    dfa_cache_check(ms->dfa, ms->state);
+
     jrx_dfa_state* state = dfa_get_state(ms->dfa, ms->state);
 
     if ( ! state )
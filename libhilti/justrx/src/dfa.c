@@ -20,6 +20,16 @@ static jrx_dfa* _dfa_create()
     dfa->max_capture = -1;
     dfa->max_tag = -1;
     dfa->nfa = 0;
+    dfa->num_byte_classes = 0;
+    dfa->cache_limit = 0;
+    dfa->cache_size = 0;
+    dfa->cache_hits = 0;
+    dfa->cache_misses = 0;
+    dfa->cache_flushes = 0;
+    dfa->pins = vec_dfa_pin_create(0);
+    dfa->free_ids = vec_dfa_state_id_create(0);
+    dfa->lock = 0;
+    dfa->retired = 0;
 
     return dfa;
 }
@@ -32,6 +42,7 @@ static jrx_dfa_state* _dfa_state_create()
 
     dstate->accepts = 0;
     dstate->trans = vec_dfa_transition_create(0);
+    dstate->table = 0;
     return dstate;
 }
 
@@ -56,15 +67,91 @@ static void _dfa_state_delete(jrx_dfa_state* state)
         vec_dfa_accept_delete(state->accepts);
     }
 
+    if ( state->table )
+        free(state->table);
+
     free(state);
 }
 
+// Returns the approximate memory used by a state's set of NFA states.
+static uint64_t _dfa_state_elem_size(set_dfa_state_elem* dstate)
+{
+    return sizeof(set_dfa_state_elem) + set_dfa_state_elem_size(dstate) * sizeof(dfa_state_elem);
+}
+
+// Returns the approximate memory used by a computed state.
+static uint64_t _dfa_state_size(jrx_dfa* dfa, jrx_dfa_state* state)
+{
+    uint64_t size = sizeof(jrx_dfa_state) + vec_dfa_transition_size(state->trans) * sizeof(jrx_dfa_transition);
+
+    vec_for_each(dfa_transition, state->trans, trans) {
+        if ( trans.tops )
+            size += vec_tag_op_size(trans.tops) * sizeof(jrx_tag_op);
+    }
+
+    if ( state->accepts )
+        size += vec_dfa_accept_size(state->accepts) * sizeof(jrx_dfa_accept);
+
+    if ( state->table )
+        size += dfa->num_byte_classes * sizeof(jrx_dfa_state_id);
+
+    return size;
+}
+
+// Makes room for another state in a shared DFA. Other threads may be
+// reading the array of states without locking, so rather than reallocating
+// it, we copy it over and keep the old one around until the DFA goes away.
+// Readers still seeing the old array may miss states computed later, which
+// sends them to dfa_get_state()'s locked path.
+static void _dfa_grow_states(jrx_dfa* dfa)
+{
+    vec_dfa_state* states = dfa->states;
+
+    if ( states->size < states->max )
+        return;
+
+    jrx_dfa_state_id nmax = states->max * 2;
+    jrx_dfa_state** elems = (jrx_dfa_state**) calloc(nmax, sizeof(jrx_dfa_state*));
+    memcpy(elems, states->elems, states->max * sizeof(jrx_dfa_state*));
+
+    if ( ! dfa->retired )
+        dfa->retired = vec_dfa_retired_create(0);
+
+    vec_dfa_retired_append(dfa->retired, states->elems);
+
+    __atomic_store_n(&states->elems, elems, __ATOMIC_RELEASE);
+    __atomic_store_n(&states->max, nmax, __ATOMIC_RELEASE);
+}
+
+// Stores a state once computed. For shared DFAs, this publishes it to other
+// threads.
+static void _dfa_set_state(jrx_dfa* dfa, jrx_dfa_state_id id, jrx_dfa_state* state)
+{
+    if ( dfa->lock )
+        __atomic_store_n(&dfa->states->elems[id], state, __ATOMIC_RELEASE);
+    else
+        vec_dfa_state_set(dfa->states, id, state);
+}
+
 static jrx_dfa_state_id reserve_dfastate_id(jrx_dfa* dfa, set_dfa_state_elem* dstate)
 {
-    jrx_dfa_state_id id = vec_dfa_state_append(dfa->states, 0);
-    vec_dfa_state_elem_append(dfa->state_elems, 0);
+    jrx_dfa_state_id id;
+    vec_dfa_state_id* free_ids = dfa->free_ids;
+
+    if ( free_ids->size )
+        // Reuse an ID released by flushing.
+        id = free_ids->elems[--free_ids->size];
+
+    else {
+        if ( dfa->lock )
+            _dfa_grow_states(dfa);
+
+        id = vec_dfa_state_append(dfa->states, 0);
+        vec_dfa_state_elem_append(dfa->state_elems, 0);
+    }
 
     assert(dstate);
+    dfa->cache_size += _dfa_state_elem_size(dstate);
 
     int ret;
     khiter_t k = kh_put(dfa_state_elem, dfa->hstates, *dstate, &ret);
@@ -169,6 +256,100 @@ static set_dfa_state_elem* transition_with(jrx_nfa_context* ctx, jrx_dfa* dfa, s
     return ndstate;
 }
 
+static int _ccl_contains(jrx_ccl* ccl, jrx_char cp)
+{
+    if ( ! ccl->ranges )
+        return 0;
+
+    set_for_each(char_range, ccl->ranges, r) {
+        if ( cp >= r.begin && cp < r.end )
+            return 1;
+    }
+
+    return 0;
+}
+
+// Partitions the codepoints < 256 into classes so that all members of a
+// class are matched by exactly the same set of CCLs. We only do this if no
+// CCL carries assertions, as the minimal matcher can then decide
+// transitions by looking at the codepoint alone.
+static void _dfa_compute_byte_classes(jrx_dfa* dfa)
+{
+    dfa->num_byte_classes = 0;
+
+    vec_for_each(ccl, dfa->ccls->ccls, ccl) {
+        if ( ccl && ccl->assertions )
+            return;
+    }
+
+    memset(dfa->byte_classes, 0, sizeof(dfa->byte_classes));
+    int num_classes = 1;
+
+    vec_for_each(ccl, dfa->ccls->ccls, ccl2) {
+        if ( ccl_is_empty(ccl2) )
+            continue;
+
+        // Refine the current partition by splitting each class into the
+        // members inside and outside of the CCL.
+        int16_t split[256 * 2];
+        memset(split, -1, sizeof(split));
+
+        int num_new = 0;
+        int cp;
+
+        for ( cp = 0; cp < 256; cp++ ) {
+            int idx = dfa->byte_classes[cp] * 2 + _ccl_contains(ccl2, cp);
+
+            if ( split[idx] < 0 )
+                split[idx] = num_new++;
+
+            dfa->byte_classes[cp] = split[idx];
+        }
+
+        num_classes = num_new;
+    }
+
+    dfa->num_byte_classes = num_classes;
+}
+
+// Builds the state's successor table. For each byte class, we record the
+// successor of the first transition taking a representative of the class,
+// which is what the minimal matcher would pick when iterating over them.
+static jrx_dfa_state_id* _dfa_state_table(jrx_dfa* dfa, vec_dfa_transition* transitions)
+{
+    if ( ! dfa->num_byte_classes )
+        return 0;
+
+    jrx_dfa_state_id* table = (jrx_dfa_state_id*) malloc(dfa->num_byte_classes * sizeof(jrx_dfa_state_id));
+    if ( ! table )
+        return 0;
+
+    int8_t done[256];
+    memset(done, 0, sizeof(done));
+
+    int cp;
+    for ( cp = 0; cp < 256; cp++ ) {
+        uint8_t class = dfa->byte_classes[cp];
+
+        if ( done[class] )
+            continue;
+
+        done[class] = 1;
+        table[class] = JRX_DFA_NO_STATE;
+
+        vec_for_each(dfa_transition, transitions, trans) {
+            jrx_ccl* ccl = vec_ccl_get(dfa->ccls->ccls, trans.ccl);
+
+            if ( _ccl_contains(ccl, cp) ) {
+                table[class] = trans.succ;
+                break;
+            }
+        }
+    }
+
+    return table;
+}
+
 static jrx_dfa_state sentinel; // Value is irrelevant.
 
 int dfa_state_compute(jrx_nfa_context* ctx, jrx_dfa* dfa, jrx_dfa_state_id id, set_dfa_state_elem* dstate, int recurse)
@@ -180,7 +361,7 @@ int dfa_state_compute(jrx_nfa_context* ctx, jrx_dfa* dfa, jrx_dfa_state_id id, s
     // We set the pointer for the state we are currently computing to a dummy
     // value as an indicator that we're already working on it, to abort
     // recursion when we get to it again.
-    vec_dfa_state_set(dfa->states, id, &sentinel);
+    _dfa_set_state(dfa, id, &sentinel);
     //vec_dfa_state_elem_set(dfa->state_elems, id, 0);
 
     // Determine the transitions for all CCLs.
@@ -248,6 +429,7 @@ int dfa_state_compute(jrx_nfa_context* ctx, jrx_dfa* dfa, jrx_dfa_state_id id, s
         vec_dfa_transition_delete(dfastate->trans);
 
     dfastate->trans = transitions;
+    dfastate->table = _dfa_state_table(dfa, transitions);
 
     // Add accepts.
     vec_dfa_accept* accepts = 0;
@@ -280,27 +462,523 @@ int dfa_state_compute(jrx_nfa_context* ctx, jrx_dfa* dfa, jrx_dfa_state_id id, s
 
     dfastate->accepts = accepts;
 
-    vec_dfa_state_set(dfa->states, id, dfastate);
+    _dfa_set_state(dfa, id, dfastate);
+    dfa->cache_size += _dfa_state_size(dfa, dfastate);
     return 1;
 }
 
+// Returns a state if computed already. For shared DFAs, this may run
+// concurrently with another thread computing states; see _dfa_grow_states().
+static inline jrx_dfa_state* _dfa_lookup_state(jrx_dfa* dfa, jrx_dfa_state_id id)
+{
+    if ( ! dfa->lock )
+        return vec_dfa_state_get(dfa->states, id);
+
+    // The array gets published before its size.
+    jrx_dfa_state_id max = __atomic_load_n(&dfa->states->max, __ATOMIC_ACQUIRE);
+    jrx_dfa_state** elems = __atomic_load_n(&dfa->states->elems, __ATOMIC_ACQUIRE);
+
+    return id < max ? __atomic_load_n(&elems[id], __ATOMIC_ACQUIRE) : 0;
+}
+
 jrx_dfa_state* dfa_get_state(jrx_dfa* dfa, jrx_dfa_state_id id)
 {
-    jrx_dfa_state* state = vec_dfa_state_get(dfa->states, id);
+    if ( id == JRX_DFA_NO_STATE )
+        return 0;
+
+    jrx_dfa_state* state = _dfa_lookup_state(dfa, id);
+
+    if ( state && state != &sentinel ) {
+        if ( ! dfa->lock )
+            // Not counted when shared, to avoid contention.
+            ++dfa->cache_hits;
 
-    if ( state )
         return state;
+    }
+
+    if ( dfa->lock ) {
+        pthread_mutex_lock(dfa->lock);
+
+        // Another thread may have computed it in the meantime.
+        state = vec_dfa_state_get(dfa->states, id);
+
+        if ( state && state != &sentinel ) {
+            pthread_mutex_unlock(dfa->lock);
+            return state;
+        }
+    }
+
+    ++dfa->cache_misses;
 
     set_dfa_state_elem* dstate = vec_dfa_state_elem_get(dfa->state_elems, id);
+
+    if ( ! dstate && id == dfa->initial )
+        // Only needed after flushing.
+        dstate = dfa->initial_dstate;
+
     assert(dstate);
 
     dfa_state_compute(dfa->nfa->ctx, dfa, id, dstate, 0);
 
     state = vec_dfa_state_get(dfa->states, id);
     assert(state);
+
+    if ( dfa->lock )
+        pthread_mutex_unlock(dfa->lock);
+
     return state;
 }
 
+// Prepares a DFA for being used by multiple threads concurrently. Matching
+// only reads states, except for computing missing ones, which we serialize
+// through a lock. Flushing states isn't possible anymore, so the cache limit
+// gets disabled. This must be called while only a single thread has access
+// to the DFA.
+void dfa_share(jrx_dfa* dfa)
+{
+    if ( dfa->lock )
+        return;
+
+    dfa->lock = (pthread_mutex_t*) malloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(dfa->lock, 0);
+    dfa->cache_limit = 0;
+}
+
+// Largest number of states per input position that we track when computing
+// a prefilter.
+#define PREFILTER_MAX_STATES 64
+
+// Computes masks for a bit-parallel prefilter over the first bytes of any
+// match: bit j of masks[b] is set if byte b may appear at position j. We stop
+// at the first position where a match may already end, where any byte could
+// follow, or where we would have to track too many states. Returns the
+// number of positions covered, which is zero if there's nothing to filter
+// on.
+int dfa_prefilter(jrx_dfa* dfa, uint8_t* masks, int max_len)
+{
+    jrx_dfa_state_id level[PREFILTER_MAX_STATES];
+    jrx_dfa_state_id next[PREFILTER_MAX_STATES];
+    int num_level = 1;
+
+    memset(masks, 0, 256);
+
+    // We rely on the transitions depending only on the input bytes.
+    if ( ! dfa->num_byte_classes || max_len > 8 )
+        return 0;
+
+    level[0] = dfa->initial;
+
+    int len;
+    for ( len = 0; len < max_len && num_level; len++ ) {
+        int i;
+
+        // Once a match may end here, the following bytes aren't required
+        // anymore.
+        for ( i = 0; i < num_level; i++ ) {
+            if ( dfa_get_state(dfa, level[i])->accepts )
+                return len;
+        }
+
+        uint8_t bytes[256];
+        memset(bytes, 0, sizeof(bytes));
+
+        int num_bytes = 0;
+        int num_next = 0;
+        int overflow = 0;
+
+        for ( i = 0; i < num_level; i++ ) {
+            jrx_dfa_state* state = dfa_get_state(dfa, level[i]);
+
+            vec_for_each(dfa_transition, state->trans, trans) {
+                jrx_ccl* ccl = vec_ccl_get(dfa->ccls->ccls, trans.ccl);
+                int taken = 0;
+
+                // The matcher sees the input as signed chars.
+                int b;
+                for ( b = 0; b < 256; b++ ) {
+                    if ( ! _ccl_contains(ccl, (jrx_char)(signed char)b) )
+                        continue;
+
+                    taken = 1;
+
+                    if ( ! bytes[b] ) {
+                        bytes[b] = 1;
+                        ++num_bytes;
+                    }
+                }
+
+                if ( ! taken )
+                    continue;
+
+                int j;
+                for ( j = 0; j < num_next; j++ ) {
+                    if ( next[j] == trans.succ )
+                        break;
+                }
+
+                if ( j < num_next )
+                    continue;
+
+                if ( num_next < PREFILTER_MAX_STATES )
+                    next[num_next++] = trans.succ;
+                else
+                    overflow = 1;
+            }
+        }
+
+        if ( num_bytes == 256 )
+            // Doesn't filter anything.
+            return len;
+
+        int b;
+        for ( b = 0; b < 256; b++ ) {
+            if ( bytes[b] )
+                masks[b] |= (1 << len);
+        }
+
+        if ( overflow )
+            return len + 1;
+
+        memcpy(level, next, num_next * sizeof(jrx_dfa_state_id));
+        num_level = num_next;
+    }
+
+    return len;
+}
+
+// Returns true if two states accept in the same way for the minimal
+// matcher, which only looks at the first accept.
+static int _dfa_accepts_equal(vec_dfa_accept* a1, vec_dfa_accept* a2)
+{
+    if ( ! a1 || ! a2 )
+        return a1 == a2;
+
+    return vec_dfa_accept_get(a1, 0).aid == vec_dfa_accept_get(a2, 0).aid;
+}
+
+// The signature of a state during minimization consists of its current block
+// plus, for each of its transitions, the CCL and the successor's block.
+// States with the same signature stay in the same block.
+static khint_t _dfa_signature_hash(jrx_dfa* dfa, jrx_dfa_state_id id, jrx_dfa_state_id* block)
+{
+    jrx_dfa_state* state = vec_dfa_state_get(dfa->states, id);
+    khint_t hash = block[id];
+
+    vec_for_each(dfa_transition, state->trans, trans)
+        hash = (((hash << 4) ^ (hash >> 28)) + (trans.ccl * 31 + block[trans.succ]));
+
+    return hash;
+}
+
+static int _dfa_signature_equal(jrx_dfa* dfa, jrx_dfa_state_id id1, jrx_dfa_state_id id2, jrx_dfa_state_id* block)
+{
+    if ( block[id1] != block[id2] )
+        return 0;
+
+    vec_dfa_transition* trans1 = vec_dfa_state_get(dfa->states, id1)->trans;
+    vec_dfa_transition* trans2 = vec_dfa_state_get(dfa->states, id2)->trans;
+
+    if ( vec_dfa_transition_size(trans1) != vec_dfa_transition_size(trans2) )
+        return 0;
+
+    uint32_t i;
+    for ( i = 0; i < vec_dfa_transition_size(trans1); i++ ) {
+        jrx_dfa_transition t1 = vec_dfa_transition_get(trans1, i);
+        jrx_dfa_transition t2 = vec_dfa_transition_get(trans2, i);
+
+        if ( t1.ccl != t2.ccl || block[t1.succ] != block[t2.succ] )
+            return 0;
+    }
+
+    return 1;
+}
+
+// Splits the blocks of all states by their signatures. The new blocks are
+// numbered in the order of their smallest state ID. Returns the number of
+// blocks.
+static jrx_dfa_state_id _dfa_refine(jrx_dfa* dfa, jrx_dfa_state_id* block, jrx_dfa_state_id* nblock)
+{
+    jrx_dfa_state_id n = vec_dfa_state_size(dfa->states);
+
+    khint_t slots = 2;
+    while ( slots < 2 * n )
+        slots *= 2;
+
+    // Open addressing, storing the first state of each block plus one.
+    jrx_dfa_state_id* reps = (jrx_dfa_state_id*) calloc(slots, sizeof(jrx_dfa_state_id));
+    jrx_dfa_state_id count = 0;
+
+    jrx_dfa_state_id id;
+    for ( id = 0; id < n; id++ ) {
+        khint_t k = _dfa_signature_hash(dfa, id, block) & (slots - 1);
+
+        while ( reps[k] && ! _dfa_signature_equal(dfa, reps[k] - 1, id, block) )
+            k = (k + 1) & (slots - 1);
+
+        if ( reps[k] )
+            nblock[id] = nblock[reps[k] - 1];
+
+        else {
+            reps[k] = id + 1;
+            nblock[id] = count++;
+        }
+    }
+
+    free(reps);
+    return count;
+}
+
+// Returns true if the DFA is complete and used with the minimal matcher.
+// The latter ignores tags, so that states differing only in them can be
+// merged.
+static int _dfa_is_minimizable(jrx_dfa* dfa)
+{
+    if ( dfa->options & JRX_OPTION_STD_MATCHER )
+        return 0;
+
+    vec_for_each(dfa_state, dfa->states, state) {
+        if ( ! state || state == &sentinel )
+            return 0;
+    }
+
+    return 1;
+}
+
+// Merges a state's transitions leading to the same successor into one, with
+// the union of their CCLs. That's only valid if no CCL carries assertions,
+// as otherwise the order of transitions matters.
+static void _dfa_state_join_transitions(jrx_dfa* dfa, jrx_dfa_state* state)
+{
+    vec_dfa_transition* ntrans = vec_dfa_transition_create(0);
+
+    vec_for_each(dfa_transition, state->trans, trans) {
+        int joined = 0;
+
+        uint32_t i;
+        for ( i = 0; i < vec_dfa_transition_size(ntrans); i++ ) {
+            jrx_dfa_transition t = vec_dfa_transition_get(ntrans, i);
+
+            if ( t.succ != trans.succ )
+                continue;
+
+            jrx_ccl* ccl1 = vec_ccl_get(dfa->ccls->ccls, t.ccl);
+            jrx_ccl* ccl2 = vec_ccl_get(dfa->ccls->ccls, trans.ccl);
+            t.ccl = ccl_join(ccl1, ccl2)->id;
+            vec_dfa_transition_set(ntrans, i, t);
+            joined = 1;
+            break;
+        }
+
+        if ( ! joined )
+            vec_dfa_transition_append(ntrans, trans);
+    }
+
+    vec_dfa_transition_delete(state->trans);
+    state->trans = ntrans;
+}
+
+// Merges all states of a complete DFA that behave the same, using partition
+// refinement: we start with blocks of states accepting the same way and then
+// split them by successor blocks until nothing changes anymore. Afterwards,
+// transitions to the same successor get merged and the DFA drops its sets of
+// NFA states, which aren't needed anymore once all states are computed.
+//
+// The result is deterministic, so that two DFAs built from the same patterns
+// continue to agree on their state IDs.
+//
+// Returns the new number of states, or zero if the DFA can't be minimized.
+int dfa_minimize(jrx_dfa* dfa)
+{
+    if ( ! _dfa_is_minimizable(dfa) )
+        return 0;
+
+    jrx_dfa_state_id n = vec_dfa_state_size(dfa->states);
+
+    if ( ! n )
+        return 0;
+
+    jrx_dfa_state_id* block = (jrx_dfa_state_id*) malloc(n * sizeof(jrx_dfa_state_id));
+    jrx_dfa_state_id* nblock = (jrx_dfa_state_id*) malloc(n * sizeof(jrx_dfa_state_id));
+
+    // Initial partition by accepts.
+    jrx_dfa_state_id count = 0;
+
+    jrx_dfa_state_id id;
+    for ( id = 0; id < n; id++ ) {
+        vec_dfa_accept* accepts = vec_dfa_state_get(dfa->states, id)->accepts;
+
+        jrx_dfa_state_id other;
+        for ( other = 0; other < id; other++ ) {
+            if ( _dfa_accepts_equal(accepts, vec_dfa_state_get(dfa->states, other)->accepts) )
+                break;
+        }
+
+        block[id] = (other < id ? block[other] : count++);
+    }
+
+    // Refine until stable. Blocks only ever get split, so an unchanged
+    // count means we're done.
+    while ( 1 ) {
+        jrx_dfa_state_id ncount = _dfa_refine(dfa, block, nblock);
+        jrx_dfa_state_id* tmp = block;
+        block = nblock;
+        nblock = tmp;
+
+        if ( ncount == count )
+            break;
+
+        count = ncount;
+    }
+
+    free(nblock);
+
+    int old_trans = 0;
+    int new_trans = 0;
+
+    // Keep the first state of each block, with its successors renumbered.
+    vec_dfa_state* nstates = vec_dfa_state_create(count);
+
+    for ( id = 0; id < n; id++ ) {
+        jrx_dfa_state* state = vec_dfa_state_get(dfa->states, id);
+        old_trans += vec_dfa_transition_size(state->trans);
+
+        if ( vec_dfa_state_get(nstates, block[id]) ) {
+            _dfa_state_delete(state);
+            continue;
+        }
+
+        uint32_t i;
+        for ( i = 0; i < vec_dfa_transition_size(state->trans); i++ ) {
+            jrx_dfa_transition trans = vec_dfa_transition_get(state->trans, i);
+            trans.succ = block[trans.succ];
+
+            if ( trans.tops ) {
+                // Not used by the minimal matcher.
+                vec_tag_op_delete(trans.tops);
+                trans.tops = 0;
+            }
+
+            vec_dfa_transition_set(state->trans, i, trans);
+        }
+
+        if ( state->table ) {
+            uint16_t c;
+            for ( c = 0; c < dfa->num_byte_classes; c++ ) {
+                if ( state->table[c] != JRX_DFA_NO_STATE )
+                    state->table[c] = block[state->table[c]];
+            }
+
+            // Tables exist only if no CCL carries assertions.
+            _dfa_state_join_transitions(dfa, state);
+        }
+
+        new_trans += vec_dfa_transition_size(state->trans);
+        vec_dfa_state_set(nstates, block[id], state);
+    }
+
+    dfa->initial = block[dfa->initial];
+    free(block);
+
+    vec_dfa_state_delete(dfa->states);
+    dfa->states = nstates;
+
+    vec_for_each(ccl, dfa->ccls->ccls, ccl)
+        ccl_compact(ccl);
+
+    // Freeze the DFA; there's nothing left to compute lazily.
+    vec_for_each(dfa_state_elem, dfa->state_elems, state_elem) {
+        if ( state_elem )
+            set_dfa_state_elem_delete(state_elem);
+    }
+
+    vec_dfa_state_elem_delete(dfa->state_elems);
+    dfa->state_elems = vec_dfa_state_elem_create(0);
+    kh_clear(dfa_state_elem, dfa->hstates);
+
+    dfa->options &= ~JRX_OPTION_LAZY;
+    dfa->cache_limit = 0;
+    dfa->cache_size = 0;
+    dfa->free_ids->size = 0;
+
+    vec_for_each(dfa_state, dfa->states, nstate)
+        dfa->cache_size += _dfa_state_size(dfa, nstate);
+
+    if ( dfa->options & JRX_OPTION_DEBUG )
+        fprintf(stderr, "minimized DFA from %d states with %d transitions to %d states with %d transitions\n",
+                n, old_trans, count, new_trans);
+
+    return count;
+}
+
+// Discards all computed states so that they get recomputed on demand. This
+// works like RE2's cache flushing, except that we keep the IDs of states
+// that may still be in use so that we don't need to track down their users:
+// the initial state, the one passed in, and all states pinned by suspended
+// match states. All other IDs get released for reuse.
+void dfa_cache_flush(jrx_dfa* dfa, jrx_dfa_state_id keep)
+{
+    if ( dfa->options & JRX_OPTION_DEBUG )
+        fprintf(stderr, "flushing DFA cache (%llu bytes)\n", (unsigned long long)dfa->cache_size);
+
+    dfa->cache_size = 0;
+
+    jrx_dfa_state_id id;
+    for ( id = 0; id < vec_dfa_state_size(dfa->states); id++ ) {
+        jrx_dfa_state* state = vec_dfa_state_get(dfa->states, id);
+
+        if ( state ) {
+            _dfa_state_delete(state);
+            vec_dfa_state_set(dfa->states, id, 0);
+        }
+
+        set_dfa_state_elem* dstate = vec_dfa_state_elem_get(dfa->state_elems, id);
+
+        if ( ! dstate )
+            // The initial state or an unused ID.
+            continue;
+
+        if ( id == keep || vec_dfa_pin_get(dfa->pins, id) ) {
+            dfa->cache_size += _dfa_state_elem_size(dstate);
+            continue;
+        }
+
+        khiter_t k = kh_get(dfa_state_elem, dfa->hstates, *dstate);
+        if ( k != kh_end(dfa->hstates) )
+            kh_del(dfa_state_elem, dfa->hstates, k);
+
+        set_dfa_state_elem_delete(dstate);
+        vec_dfa_state_elem_set(dfa->state_elems, id, 0);
+        vec_dfa_state_id_append(dfa->free_ids, id);
+    }
+
+    dfa->cache_size += _dfa_state_elem_size(dfa->initial_dstate);
+    ++dfa->cache_flushes;
+}
+
+void dfa_state_pin(jrx_dfa* dfa, jrx_dfa_state_id id)
+{
+    if ( id == JRX_DFA_NO_STATE )
+        return;
+
+    uint32_t pins = vec_dfa_pin_get(dfa->pins, id);
+
+    // Wrapping around would let a cache flush release the state.
+    assert(pins < UINT32_MAX);
+
+    vec_dfa_pin_set(dfa->pins, id, pins + 1);
+}
+
+void dfa_state_unpin(jrx_dfa* dfa, jrx_dfa_state_id id)
+{
+    if ( id == JRX_DFA_NO_STATE )
+        return;
+
+    uint32_t pins = vec_dfa_pin_get(dfa->pins, id);
+
+    if ( pins > 0 )
+        vec_dfa_pin_set(dfa->pins, id, pins - 1);
+}
+
 jrx_dfa* dfa_from_nfa(jrx_nfa* nfa)
 {
     jrx_dfa* dfa = _dfa_create();
@@ -329,6 +1007,8 @@ jrx_dfa* dfa_from_nfa(jrx_nfa* nfa)
     // Make them disjunct.
     ccl_group_disambiguate(dfa->ccls);
 
+    _dfa_compute_byte_classes(dfa);
+
     // Create the initial state.
     set_dfa_state_elem* initial = set_dfa_state_elem_create(0);
     dfa_state_elem ielem = { nfa->initial->id, 0 };
@@ -378,6 +1058,21 @@ void dfa_delete(jrx_dfa* dfa)
     vec_dfa_state_elem_delete(dfa->state_elems);
 
     vec_dfa_state_delete(dfa->states);
+
+    if ( dfa->retired ) {
+        vec_for_each(dfa_retired, dfa->retired, elems)
+            free(elems);
+
+        vec_dfa_retired_delete(dfa->retired);
+    }
+
+    if ( dfa->lock ) {
+        pthread_mutex_destroy(dfa->lock);
+        free(dfa->lock);
+    }
+
+    vec_dfa_pin_delete(dfa->pins);
+    vec_dfa_state_id_delete(dfa->free_ids);
     kh_destroy(dfa_state_elem, dfa->hstates);
     ccl_group_delete(dfa->ccls);
 
@@ -402,6 +1097,286 @@ jrx_dfa* dfa_compile(const char* pattern, int len, jrx_option options, int8_t nm
     return dfa;
 }
 
+// We serialize everything as native 32-bit integers. Optional vectors and
+// sets are prefixed with their size, or with NO_VALUE if they don't exist.
+#define NO_VALUE UINT32_MAX
+
+void dfa_buffer_put(dfa_buffer* buf, uint32_t v)
+{
+    if ( buf->len + sizeof(v) > buf->max ) {
+        buf->max = buf->max ? buf->max * 2 : 1024;
+        buf->data = (uint8_t*) realloc(buf->data, buf->max);
+    }
+
+    memcpy(buf->data + buf->len, &v, sizeof(v));
+    buf->len += sizeof(v);
+}
+
+uint32_t dfa_buffer_get(dfa_buffer* buf)
+{
+    uint32_t v;
+
+    if ( buf->error || buf->len + sizeof(v) > buf->max ) {
+        buf->error = 1;
+        return 0;
+    }
+
+    memcpy(&v, buf->data + buf->len, sizeof(v));
+    buf->len += sizeof(v);
+    return v;
+}
+
+// Reads the number of elements that follow, each taking at least min_words
+// values. Flags an error if there can't be that many left.
+static uint32_t _dfa_buffer_get_count(dfa_buffer* buf, uint32_t min_words)
+{
+    uint32_t n = dfa_buffer_get(buf);
+
+    if ( n != NO_VALUE && n > (buf->max - buf->len) / (min_words * sizeof(uint32_t)) )
+        buf->error = 1;
+
+    return buf->error ? 0 : n;
+}
+
+static void _dfa_put_tag_ops(dfa_buffer* buf, vec_tag_op* tops)
+{
+    if ( ! tops ) {
+        dfa_buffer_put(buf, NO_VALUE);
+        return;
+    }
+
+    dfa_buffer_put(buf, vec_tag_op_size(tops));
+
+    vec_for_each(tag_op, tops, top)
+        dfa_buffer_put(buf, top.told | (top.tnew << 8) | ((uint8_t)top.tag << 16));
+}
+
+static vec_tag_op* _dfa_get_tag_ops(dfa_buffer* buf)
+{
+    uint32_t n = _dfa_buffer_get_count(buf, 1);
+
+    if ( n == NO_VALUE || buf->error )
+        return 0;
+
+    vec_tag_op* tops = vec_tag_op_create(n);
+
+    uint32_t i;
+    for ( i = 0; i < n; i++ ) {
+        uint32_t v = dfa_buffer_get(buf);
+        jrx_tag_op top = { v & 0xff, (v >> 8) & 0xff, (int8_t)((v >> 16) & 0xff) };
+        vec_tag_op_append(tops, top);
+    }
+
+    return tops;
+}
+
+// Appends a binary representation of the DFA to the buffer, from which
+// dfa_deserialize() can restore it without the NFA. That requires all states
+// to have been computed; returns false if they aren't. The restored DFA
+// won't be lazy anymore, and doesn't need tables to be stored as it
+// recomputes them.
+int dfa_serialize(jrx_dfa* dfa, dfa_buffer* buf)
+{
+    vec_for_each(dfa_state, dfa->states, state) {
+        if ( ! state || state == &sentinel )
+            return 0;
+    }
+
+    dfa_buffer_put(buf, dfa->options & ~JRX_OPTION_LAZY);
+    dfa_buffer_put(buf, (uint8_t)dfa->nmatch);
+    dfa_buffer_put(buf, (uint8_t)dfa->max_tag);
+    dfa_buffer_put(buf, (uint8_t)dfa->max_capture);
+    dfa_buffer_put(buf, dfa->initial);
+    _dfa_put_tag_ops(buf, dfa->initial_ops);
+
+    dfa_buffer_put(buf, dfa->num_byte_classes);
+
+    if ( dfa->num_byte_classes ) {
+        // Four classes per value.
+        int cp;
+        for ( cp = 0; cp < 256; cp += 4 ) {
+            uint32_t v;
+            memcpy(&v, &dfa->byte_classes[cp], sizeof(v));
+            dfa_buffer_put(buf, v);
+        }
+    }
+
+    dfa_buffer_put(buf, vec_ccl_size(dfa->ccls->ccls));
+
+    vec_for_each(ccl, dfa->ccls->ccls, ccl) {
+        if ( ! ccl ) {
+            dfa_buffer_put(buf, NO_VALUE);
+            continue;
+        }
+
+        dfa_buffer_put(buf, ccl->assertions);
+
+        if ( ! ccl->ranges ) {
+            dfa_buffer_put(buf, NO_VALUE);
+            continue;
+        }
+
+        dfa_buffer_put(buf, set_char_range_size(ccl->ranges));
+
+        set_for_each(char_range, ccl->ranges, r) {
+            dfa_buffer_put(buf, r.begin);
+            dfa_buffer_put(buf, r.end);
+        }
+    }
+
+    dfa_buffer_put(buf, vec_dfa_state_size(dfa->states));
+
+    vec_for_each(dfa_state, dfa->states, dstate) {
+        if ( dstate->accepts ) {
+            dfa_buffer_put(buf, vec_dfa_accept_size(dstate->accepts));
+
+            vec_for_each(dfa_accept, dstate->accepts, acc) {
+                dfa_buffer_put(buf, acc.final_assertions);
+                dfa_buffer_put(buf, (uint16_t)acc.aid);
+                dfa_buffer_put(buf, acc.tid);
+                _dfa_put_tag_ops(buf, acc.final_ops);
+            }
+        }
+        else
+            dfa_buffer_put(buf, NO_VALUE);
+
+        dfa_buffer_put(buf, vec_dfa_transition_size(dstate->trans));
+
+        vec_for_each(dfa_transition, dstate->trans, trans) {
+            dfa_buffer_put(buf, trans.ccl);
+            dfa_buffer_put(buf, trans.succ);
+            _dfa_put_tag_ops(buf, trans.tops);
+        }
+    }
+
+    return 1;
+}
+
+// Restores a DFA from the buffer's current position. Returns NULL if the
+// data turns out to be invalid.
+jrx_dfa* dfa_deserialize(dfa_buffer* buf)
+{
+    jrx_dfa* dfa = _dfa_create();
+    if ( ! dfa )
+        return 0;
+
+    dfa->ccls = ccl_group_create();
+
+    dfa->options = dfa_buffer_get(buf);
+    dfa->nmatch = (int8_t)dfa_buffer_get(buf);
+    dfa->max_tag = (int8_t)dfa_buffer_get(buf);
+    dfa->max_capture = (int8_t)dfa_buffer_get(buf);
+    dfa->initial = dfa_buffer_get(buf);
+    dfa->initial_ops = _dfa_get_tag_ops(buf);
+
+    dfa->num_byte_classes = dfa_buffer_get(buf);
+
+    if ( dfa->num_byte_classes > 256 )
+        buf->error = 1;
+
+    if ( dfa->num_byte_classes ) {
+        int cp;
+        for ( cp = 0; cp < 256; cp += 4 ) {
+            uint32_t v = dfa_buffer_get(buf);
+            memcpy(&dfa->byte_classes[cp], &v, sizeof(v));
+        }
+
+        for ( cp = 0; cp < 256; cp++ ) {
+            if ( dfa->byte_classes[cp] >= dfa->num_byte_classes )
+                buf->error = 1;
+        }
+    }
+
+    uint32_t nccls = _dfa_buffer_get_count(buf, 1);
+
+    if ( nccls == NO_VALUE || nccls > (jrx_ccl_id)-1 )
+        buf->error = 1;
+
+    jrx_ccl_id id;
+    for ( id = 0; id < nccls && ! buf->error; id++ ) {
+        uint32_t assertions = dfa_buffer_get(buf);
+
+        if ( assertions == NO_VALUE )
+            continue;
+
+        uint32_t nranges = _dfa_buffer_get_count(buf, 2);
+        set_char_range* ranges = 0;
+
+        if ( nranges != NO_VALUE ) {
+            ranges = set_char_range_create(nranges);
+
+            uint32_t i;
+            for ( i = 0; i < nranges; i++ ) {
+                jrx_char_range r;
+                r.begin = dfa_buffer_get(buf);
+                r.end = dfa_buffer_get(buf);
+                set_char_range_insert(ranges, r);
+            }
+        }
+
+        ccl_group_restore(dfa->ccls, id, assertions, ranges);
+    }
+
+    uint32_t nstates = _dfa_buffer_get_count(buf, 2);
+
+    if ( nstates == NO_VALUE || dfa->initial >= nstates )
+        buf->error = 1;
+
+    jrx_dfa_state_id sid;
+    for ( sid = 0; sid < nstates && ! buf->error; sid++ ) {
+        jrx_dfa_state* dstate = _dfa_state_create();
+        vec_dfa_state_set(dfa->states, sid, dstate);
+
+        uint32_t naccepts = _dfa_buffer_get_count(buf, 4);
+
+        if ( naccepts != NO_VALUE ) {
+            dstate->accepts = vec_dfa_accept_create(naccepts);
+
+            uint32_t i;
+            for ( i = 0; i < naccepts; i++ ) {
+                jrx_dfa_accept acc;
+                acc.final_assertions = dfa_buffer_get(buf);
+                acc.aid = (jrx_accept_id)dfa_buffer_get(buf);
+                acc.tid = dfa_buffer_get(buf);
+                acc.final_ops = _dfa_get_tag_ops(buf);
+                acc.tags = 0;
+                vec_dfa_accept_append(dstate->accepts, acc);
+            }
+        }
+
+        uint32_t ntrans = _dfa_buffer_get_count(buf, 3);
+
+        if ( ntrans == NO_VALUE )
+            buf->error = 1;
+
+        uint32_t i;
+        for ( i = 0; i < ntrans && ! buf->error; i++ ) {
+            jrx_dfa_transition trans;
+            uint32_t ccl = dfa_buffer_get(buf);
+            trans.succ = dfa_buffer_get(buf);
+            trans.tops = _dfa_get_tag_ops(buf);
+            trans.ccl = ccl;
+
+            if ( ccl >= nccls || ! vec_ccl_get(dfa->ccls->ccls, ccl) || trans.succ >= nstates )
+                buf->error = 1;
+
+            vec_dfa_transition_append(dstate->trans, trans);
+        }
+    }
+
+    if ( buf->error ) {
+        dfa_delete(dfa);
+        return 0;
+    }
+
+    vec_for_each(dfa_state, dfa->states, state)
+        state->table = _dfa_state_table(dfa, state->trans);
+
+    return dfa;
+}
+
+#undef NO_VALUE
+
 static void _vec_tag_op_print(vec_tag_op* tops, FILE* file)
 {
     if ( ! tops ) {
@@ -456,6 +1431,7 @@ void dfa_print(jrx_dfa* dfa, FILE* file)
     fprintf(file, "options %d\n", dfa->options);
     fprintf(file, "max tag %d\n", dfa->max_tag);
     fprintf(file, "max capture %d\n", dfa->max_capture);
+    fprintf(file, "byte classes %d\n", dfa->num_byte_classes);
 
     fprintf(file, "initial tag ops are ");
     _vec_tag_op_print(dfa->initial_ops, file);
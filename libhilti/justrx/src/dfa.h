@@ -3,6 +3,8 @@
 #ifndef JRX_DFA_H
 #define JRX_DFA_H
 
+#include <pthread.h>
+
 #include "jrx-intern.h"
 #include "set.h"
 #include "khash.h"
@@ -71,10 +73,14 @@ DECLARE_VECTOR(dfa_accept, jrx_dfa_accept, uint32_t);
 typedef struct {
     vec_dfa_accept* accepts;    // Accepts for this state.
     vec_dfa_transition* trans; // Transitions out of this state.
+    jrx_dfa_state_id* table;   // Successors indexed by byte class (JRX_DFA_NO_STATE if none), or NULL if the DFA has no byte classes.
 } jrx_dfa_state;
 
 DECLARE_VECTOR(dfa_state, jrx_dfa_state*, jrx_dfa_state_id);
 DECLARE_VECTOR(dfa_state_elem, set_dfa_state_elem*, jrx_dfa_state_id);
+DECLARE_VECTOR(dfa_state_id, jrx_dfa_state_id, uint32_t);
+DECLARE_VECTOR(dfa_pin, uint32_t, jrx_dfa_state_id);
+DECLARE_VECTOR(dfa_retired, jrx_dfa_state**, uint32_t);
 
 typedef struct jrx_dfa {
     jrx_option options;       // Options specified for compilation.
@@ -89,14 +95,53 @@ typedef struct jrx_dfa {
     hash_dfa_state* hstates;  // Hash of states indexed by set of NFA states.
     jrx_ccl_group *ccls;      // CCLs for the DFA.
     jrx_nfa* nfa;             // The underlying NFA.
+    uint16_t num_byte_classes; // Number of byte classes; zero if tables aren't used.
+    uint8_t byte_classes[256]; // Maps codepoints < 256 to their byte class.
+    uint64_t cache_limit;     // Approx. memory states may use before we flush them; zero for no limit.
+    uint64_t cache_size;      // Approx. memory currently used by states.
+    uint64_t cache_hits;      // Number of state lookups finding the state computed.
+    uint64_t cache_misses;    // Number of state lookups having to compute the state.
+    uint64_t cache_flushes;   // Number of times we have flushed the states.
+    vec_dfa_pin* pins;        // Number of suspended match states per state ID.
+    vec_dfa_state_id* free_ids; // IDs released by flushing, available for reuse.
+    pthread_mutex_t* lock;    // Serializes computing states once shared across threads; NULL if not shared.
+    vec_dfa_retired* retired; // Replaced arrays of states that other threads may still be reading.
 } jrx_dfa;
 
+// A buffer for serializing DFAs into, and for reading them back from.
+typedef struct {
+    uint8_t* data; // The serialized data.
+    size_t len;    // When writing, the number of bytes written; when reading, the current position.
+    size_t max;    // When writing, the number of bytes allocated; when reading, the size of the data.
+    int error;     // Set when reading finds the data truncated or inconsistent.
+} dfa_buffer;
+
 
 extern jrx_dfa* dfa_compile(const char* pattern, int len, jrx_option options, int8_t nmatch, const char** errmsg);
 extern jrx_dfa* dfa_from_nfa(jrx_nfa* nfa);
 extern int dfa_state_compute(jrx_nfa_context* ctx, jrx_dfa* dfa, jrx_dfa_state_id id, set_dfa_state_elem* dstate, int recurse);
 extern jrx_dfa_state* dfa_get_state(jrx_dfa* dfa, jrx_dfa_state_id id);
+extern int dfa_minimize(jrx_dfa* dfa);
+extern int dfa_prefilter(jrx_dfa* dfa, uint8_t* masks, int max_len);
 extern void dfa_delete(jrx_dfa* dfa);
+extern void dfa_share(jrx_dfa* dfa);
+extern void dfa_cache_flush(jrx_dfa* dfa, jrx_dfa_state_id keep);
+extern void dfa_state_pin(jrx_dfa* dfa, jrx_dfa_state_id id);
+extern void dfa_state_unpin(jrx_dfa* dfa, jrx_dfa_state_id id);
 extern void dfa_print(jrx_dfa* dfa, FILE* file);
+extern void dfa_buffer_put(dfa_buffer* buf, uint32_t v);
+extern uint32_t dfa_buffer_get(dfa_buffer* buf);
+extern int dfa_serialize(jrx_dfa* dfa, dfa_buffer* buf);
+extern jrx_dfa* dfa_deserialize(dfa_buffer* buf);
+
+// Flushes the DFA's states if they exceed the cache limit. This must only
+// be called when nobody holds on to pointers to any states, and the caller
+// passes in the one state ID it is currently working with. Other users'
+// states must be pinned.
+static inline void dfa_cache_check(jrx_dfa* dfa, jrx_dfa_state_id keep)
+{
+    if ( dfa->cache_limit && dfa->cache_size > dfa->cache_limit )
+        dfa_cache_flush(dfa, keep);
+}
 
 #endif
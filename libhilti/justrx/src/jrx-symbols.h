@@ -0,0 +1,167 @@
+// $Id$
+//
+// Renames all external symbols if JRX_SYMBOL_PREFIX is defined. This allows
+// to link a second copy of the library into a binary that already has one
+// (e.g., the HILTI compiler, which links the runtime's copy as well but needs
+// its own for compiling regexps at compile-time).
+
+#ifndef JRX_SYMBOLS_H
+#define JRX_SYMBOLS_H
+
+#ifdef JRX_SYMBOL_PREFIX
+
+#define __JRX_CONCAT2(a, b) a##b
+#define __JRX_CONCAT(a, b) __JRX_CONCAT2(a, b)
+#define __JRX_SYMBOL(s) __JRX_CONCAT(JRX_SYMBOL_PREFIX, s)
+
+// jrx.c
+#define jrx_can_transition __JRX_SYMBOL(jrx_can_transition)
+#define jrx_current_accept __JRX_SYMBOL(jrx_current_accept)
+#define jrx_dfa_num_states __JRX_SYMBOL(jrx_dfa_num_states)
+#define jrx_dfa_state_accept __JRX_SYMBOL(jrx_dfa_state_accept)
+#define jrx_dfa_state_can_transition __JRX_SYMBOL(jrx_dfa_state_can_transition)
+#define jrx_dfa_state_successor __JRX_SYMBOL(jrx_dfa_state_successor)
+#define jrx_num_groups __JRX_SYMBOL(jrx_num_groups)
+#define jrx_prefilter_pending __JRX_SYMBOL(jrx_prefilter_pending)
+#define jrx_prefilter_scan __JRX_SYMBOL(jrx_prefilter_scan)
+#define jrx_regcomp __JRX_SYMBOL(jrx_regcomp)
+#define jrx_regerror __JRX_SYMBOL(jrx_regerror)
+#define jrx_regexec __JRX_SYMBOL(jrx_regexec)
+#define jrx_regexec_partial __JRX_SYMBOL(jrx_regexec_partial)
+#define jrx_regfree __JRX_SYMBOL(jrx_regfree)
+#define jrx_reggroups __JRX_SYMBOL(jrx_reggroups)
+#define jrx_regset_add __JRX_SYMBOL(jrx_regset_add)
+#define jrx_regset_cache_stats __JRX_SYMBOL(jrx_regset_cache_stats)
+#define jrx_regset_compute_states __JRX_SYMBOL(jrx_regset_compute_states)
+#define jrx_regset_deserialize __JRX_SYMBOL(jrx_regset_deserialize)
+#define jrx_regset_finalize __JRX_SYMBOL(jrx_regset_finalize)
+#define jrx_regset_has_assertions __JRX_SYMBOL(jrx_regset_has_assertions)
+#define jrx_regset_init __JRX_SYMBOL(jrx_regset_init)
+#define jrx_regset_is_compilable __JRX_SYMBOL(jrx_regset_is_compilable)
+#define jrx_regset_matches_empty __JRX_SYMBOL(jrx_regset_matches_empty)
+#define jrx_regset_prefilter __JRX_SYMBOL(jrx_regset_prefilter)
+#define jrx_regset_reverse __JRX_SYMBOL(jrx_regset_reverse)
+#define jrx_regset_serialize __JRX_SYMBOL(jrx_regset_serialize)
+#define jrx_regset_set_cache_limit __JRX_SYMBOL(jrx_regset_set_cache_limit)
+#define jrx_regset_set_native_matcher __JRX_SYMBOL(jrx_regset_set_native_matcher)
+#define jrx_regset_share __JRX_SYMBOL(jrx_regset_share)
+#define jrx_reverse_exec __JRX_SYMBOL(jrx_reverse_exec)
+#define jrx_reverse_init __JRX_SYMBOL(jrx_reverse_init)
+
+// ccl.c
+#define ccl_add_assertions __JRX_SYMBOL(ccl_add_assertions)
+#define ccl_any __JRX_SYMBOL(ccl_any)
+#define ccl_compact __JRX_SYMBOL(ccl_compact)
+#define ccl_do_intersect __JRX_SYMBOL(ccl_do_intersect)
+#define ccl_empty __JRX_SYMBOL(ccl_empty)
+#define ccl_epsilon __JRX_SYMBOL(ccl_epsilon)
+#define ccl_from_range __JRX_SYMBOL(ccl_from_range)
+#define ccl_from_std_ccl __JRX_SYMBOL(ccl_from_std_ccl)
+#define ccl_group_add __JRX_SYMBOL(ccl_group_add)
+#define ccl_group_create __JRX_SYMBOL(ccl_group_create)
+#define ccl_group_delete __JRX_SYMBOL(ccl_group_delete)
+#define ccl_group_disambiguate __JRX_SYMBOL(ccl_group_disambiguate)
+#define ccl_group_print __JRX_SYMBOL(ccl_group_print)
+#define ccl_group_restore __JRX_SYMBOL(ccl_group_restore)
+#define ccl_is_empty __JRX_SYMBOL(ccl_is_empty)
+#define ccl_is_epsilon __JRX_SYMBOL(ccl_is_epsilon)
+#define ccl_join __JRX_SYMBOL(ccl_join)
+#define ccl_negate __JRX_SYMBOL(ccl_negate)
+#define ccl_print __JRX_SYMBOL(ccl_print)
+
+// dfa.c
+#define dfa_cache_flush __JRX_SYMBOL(dfa_cache_flush)
+#define dfa_compile __JRX_SYMBOL(dfa_compile)
+#define dfa_buffer_get __JRX_SYMBOL(dfa_buffer_get)
+#define dfa_buffer_put __JRX_SYMBOL(dfa_buffer_put)
+#define dfa_delete __JRX_SYMBOL(dfa_delete)
+#define dfa_deserialize __JRX_SYMBOL(dfa_deserialize)
+#define dfa_from_nfa __JRX_SYMBOL(dfa_from_nfa)
+#define dfa_get_state __JRX_SYMBOL(dfa_get_state)
+#define dfa_minimize __JRX_SYMBOL(dfa_minimize)
+#define dfa_prefilter __JRX_SYMBOL(dfa_prefilter)
+#define dfa_share __JRX_SYMBOL(dfa_share)
+#define dfa_print __JRX_SYMBOL(dfa_print)
+#define dfa_serialize __JRX_SYMBOL(dfa_serialize)
+#define dfa_state_compute __JRX_SYMBOL(dfa_state_compute)
+#define dfa_state_pin __JRX_SYMBOL(dfa_state_pin)
+#define dfa_state_unpin __JRX_SYMBOL(dfa_state_unpin)
+
+// dfa-interpreter-*.c
+#define jrx_match_state_advance __JRX_SYMBOL(jrx_match_state_advance)
+#define jrx_match_state_advance_min __JRX_SYMBOL(jrx_match_state_advance_min)
+#define jrx_match_state_copy_tags __JRX_SYMBOL(jrx_match_state_copy_tags)
+#define jrx_match_state_done __JRX_SYMBOL(jrx_match_state_done)
+#define jrx_match_state_init __JRX_SYMBOL(jrx_match_state_init)
+
+// jlocale.c
+#define local_ccl_blank __JRX_SYMBOL(local_ccl_blank)
+#define local_ccl_digit __JRX_SYMBOL(local_ccl_digit)
+#define local_ccl_lower __JRX_SYMBOL(local_ccl_lower)
+#define local_ccl_upper __JRX_SYMBOL(local_ccl_upper)
+#define local_ccl_word __JRX_SYMBOL(local_ccl_word)
+
+// nfa.c
+#define _nfa_state_follow_epsilons __JRX_SYMBOL(_nfa_state_follow_epsilons)
+#define nfa_alternative __JRX_SYMBOL(nfa_alternative)
+#define nfa_compile __JRX_SYMBOL(nfa_compile)
+#define nfa_compile_add __JRX_SYMBOL(nfa_compile_add)
+#define nfa_concat __JRX_SYMBOL(nfa_concat)
+#define nfa_context_create __JRX_SYMBOL(nfa_context_create)
+#define nfa_context_delete __JRX_SYMBOL(nfa_context_delete)
+#define nfa_create __JRX_SYMBOL(nfa_create)
+#define nfa_delete __JRX_SYMBOL(nfa_delete)
+#define nfa_empty __JRX_SYMBOL(nfa_empty)
+#define nfa_from_ccl __JRX_SYMBOL(nfa_from_ccl)
+#define nfa_iterate __JRX_SYMBOL(nfa_iterate)
+#define nfa_print __JRX_SYMBOL(nfa_print)
+#define nfa_remove_epsilons __JRX_SYMBOL(nfa_remove_epsilons)
+#define nfa_reverse __JRX_SYMBOL(nfa_reverse)
+#define nfa_set_accept __JRX_SYMBOL(nfa_set_accept)
+#define nfa_set_capture __JRX_SYMBOL(nfa_set_capture)
+#define nfa_state_print __JRX_SYMBOL(nfa_state_print)
+
+// util.c
+#define jrx_expand_escape __JRX_SYMBOL(jrx_expand_escape)
+#define jrx_internal_error __JRX_SYMBOL(jrx_internal_error)
+
+// Generated parser and scanner (prefix "RE").
+#define REerror __JRX_SYMBOL(REerror)
+#define REparse __JRX_SYMBOL(REparse)
+#define RElex __JRX_SYMBOL(RElex)
+#define RElex_init __JRX_SYMBOL(RElex_init)
+#define RElex_init_extra __JRX_SYMBOL(RElex_init_extra)
+#define RElex_destroy __JRX_SYMBOL(RElex_destroy)
+#define RErestart __JRX_SYMBOL(RErestart)
+#define RE_create_buffer __JRX_SYMBOL(RE_create_buffer)
+#define RE_delete_buffer __JRX_SYMBOL(RE_delete_buffer)
+#define RE_flush_buffer __JRX_SYMBOL(RE_flush_buffer)
+#define RE_switch_to_buffer __JRX_SYMBOL(RE_switch_to_buffer)
+#define REpush_buffer_state __JRX_SYMBOL(REpush_buffer_state)
+#define REpop_buffer_state __JRX_SYMBOL(REpop_buffer_state)
+#define RE_scan_buffer __JRX_SYMBOL(RE_scan_buffer)
+#define RE_scan_string __JRX_SYMBOL(RE_scan_string)
+#define RE_scan_bytes __JRX_SYMBOL(RE_scan_bytes)
+#define REget_debug __JRX_SYMBOL(REget_debug)
+#define REset_debug __JRX_SYMBOL(REset_debug)
+#define REget_extra __JRX_SYMBOL(REget_extra)
+#define REset_extra __JRX_SYMBOL(REset_extra)
+#define REget_in __JRX_SYMBOL(REget_in)
+#define REset_in __JRX_SYMBOL(REset_in)
+#define REget_out __JRX_SYMBOL(REget_out)
+#define REset_out __JRX_SYMBOL(REset_out)
+#define REget_leng __JRX_SYMBOL(REget_leng)
+#define REget_text __JRX_SYMBOL(REget_text)
+#define REget_lineno __JRX_SYMBOL(REget_lineno)
+#define REset_lineno __JRX_SYMBOL(REset_lineno)
+#define REget_column __JRX_SYMBOL(REget_column)
+#define REset_column __JRX_SYMBOL(REset_column)
+#define REget_lval __JRX_SYMBOL(REget_lval)
+#define REset_lval __JRX_SYMBOL(REset_lval)
+#define REalloc __JRX_SYMBOL(REalloc)
+#define RErealloc __JRX_SYMBOL(RErealloc)
+#define REfree __JRX_SYMBOL(REfree)
+
+#endif
+
+#endif
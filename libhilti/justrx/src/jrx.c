@@ -100,12 +100,15 @@ static int _regexec_partial_std(const jrx_regex_t *preg, const char *buffer, uns
             assertions |= last;
 
         if ( jrx_match_state_advance(ms, *p++, assertions) == 0 ) {
+            ms->consumed = p - buffer;
             jrx_match_accept acc = _pick_accept(ms->accepts);
             return acc.aid ? acc.aid : 0;
         }
 
     }
 
+    ms->consumed = p - buffer;
+
     if ( ! find_partial_matches && jrx_can_transition(ms) && ! (preg->cflags & REG_FIRST_MATCH) )
         return -1;
 
@@ -135,6 +138,7 @@ static int _regexec_partial_min(const jrx_regex_t *preg, const char *buffer, uns
         jrx_accept_id rc = jrx_match_state_advance_min(ms, *p++, assertions);
 
         if ( ! rc ) {
+            ms->consumed = p - buffer;
             ms->offset = eo;
             return ms->acc > 0 ? ms->acc : 0;
         }
@@ -143,11 +147,14 @@ static int _regexec_partial_min(const jrx_regex_t *preg, const char *buffer, uns
             eo = ms->offset;
             ms->acc = rc;
 
-            if ( preg->cflags & REG_FIRST_MATCH || ! jrx_can_transition(ms) )
+            if ( preg->cflags & REG_FIRST_MATCH || ! jrx_can_transition(ms) ) {
+                ms->consumed = p - buffer;
                 return ms->acc;
+            }
         }
     }
 
+    ms->consumed = p - buffer;
     ms->offset = eo;
 
     if ( ! find_partial_matches && jrx_can_transition(ms) )
@@ -169,6 +176,12 @@ void jrx_regset_init(jrx_regex_t *preg, int nmatch, int cflags)
     preg->nfa = 0;
     preg->dfa = 0;
     preg->errmsg = 0;
+    preg->native = 0;
+    preg->prefilter_len = 0;
+    preg->prefilter = 0;
+    preg->rnfa = 0;
+    preg->rdfa = 0;
+    preg->refcnt = 0;
 }
 
 int jrx_regset_add(jrx_regex_t *preg, const char *pattern, unsigned int len)
@@ -198,6 +211,10 @@ int jrx_regset_finalize(jrx_regex_t *preg)
     preg->dfa = dfa;
     preg->re_nsub = dfa->max_capture;
 
+    if ( ! (dfa->options & JRX_OPTION_LAZY) )
+        // All states have been computed already.
+        dfa_minimize(dfa);
+
     return REG_OK;
 }
 
@@ -221,11 +238,26 @@ int jrx_regexec_partial(const jrx_regex_t *preg, const char *buffer, unsigned in
 {
     int rc = 0;
 
+    if ( preg->native )
+        return (*preg->native)(ms, buffer, len, find_partial_matches);
+
+    // While we're suspended, flushing the DFA's states must not release
+    // our current one.
+    if ( ms->dfa->cache_limit ) {
+        dfa_state_unpin(ms->dfa, ms->pinned);
+        ms->pinned = JRX_DFA_NO_STATE;
+    }
+
     if ( preg->cflags & REG_STD_MATCHER )
         rc = _regexec_partial_std(preg, buffer, len, first, last, ms, find_partial_matches);
     else
         rc = _regexec_partial_min(preg, buffer, len, first, last, ms, find_partial_matches);
 
+    if ( ms->dfa->cache_limit && ms->state != JRX_DFA_NO_STATE ) {
+        dfa_state_pin(ms->dfa, ms->state);
+        ms->pinned = ms->state;
+    }
+
     return rc;
 }
 
@@ -293,11 +325,28 @@ int jrx_regexec(const jrx_regex_t *preg, const char *string, size_t nmatch, jrx_
 
 void jrx_regfree(jrx_regex_t *preg)
 {
+    if ( preg->refcnt ) {
+        if ( __atomic_sub_fetch(preg->refcnt, 1, __ATOMIC_SEQ_CST) > 0 )
+            // Still in use by others.
+            return;
+
+        free(preg->refcnt);
+    }
+
     if ( preg->nfa )
         nfa_delete(preg->nfa);
 
     if ( preg->dfa )
         dfa_delete(preg->dfa);
+
+    if ( preg->prefilter )
+        free(preg->prefilter);
+
+    if ( preg->rdfa )
+        dfa_delete(preg->rdfa);
+
+    if ( preg->rnfa )
+        nfa_delete(preg->rnfa);
 }
 
 size_t jrx_regerror(int errcode, const jrx_regex_t *preg, char *errbuf, size_t errbuf_size)
@@ -342,7 +391,8 @@ int jrx_num_groups(jrx_regex_t *preg)
 
 int jrx_can_transition(jrx_match_state* ms)
 {
-    jrx_dfa_state* state = vec_dfa_state_get(ms->dfa->states, ms->state);
+    // The state may need recomputing if it has been flushed.
+    jrx_dfa_state* state = dfa_get_state(ms->dfa, ms->state);
 
     if ( ! state ) {
         if ( ms->dfa->options & JRX_OPTION_DEBUG )
@@ -373,3 +423,379 @@ int jrx_current_accept(jrx_match_state* ms)
         return state->accepts ? vec_dfa_accept_get(state->accepts, 0).aid : 0;
     }
 }
+
+int jrx_regset_is_compilable(const jrx_regex_t *preg)
+{
+    jrx_dfa* dfa = preg->dfa;
+
+    if ( ! dfa || (dfa->options & (JRX_OPTION_STD_MATCHER | JRX_OPTION_DEBUG)) )
+        return 0;
+
+    // Byte classes are only computed if no CCL carries assertions.
+    return dfa->num_byte_classes > 0;
+}
+
+int jrx_regset_has_assertions(const jrx_regex_t *preg)
+{
+    if ( ! preg->nfa )
+        // Without the NFA we can't tell, so we err on the safe side.
+        return 1;
+
+    // Assertions always come with a CCL, including epsilon ones that turn
+    // into final assertions of accepts.
+    vec_for_each(ccl, preg->nfa->ctx->ccls->ccls, ccl) {
+        if ( ccl && ccl->assertions )
+            return 1;
+    }
+
+    return 0;
+}
+
+int jrx_regset_matches_empty(const jrx_regex_t *preg)
+{
+    jrx_dfa* dfa = preg->dfa;
+
+    // Accepting right away means that the empty input matches, possibly
+    // depending on assertions.
+    jrx_dfa_state* state = dfa_get_state(dfa, dfa->initial);
+    return state && state->accepts;
+}
+
+// Computes all states of a DFA. Returns false if there are more than
+// max_states (if not zero).
+static int _compute_all_states(jrx_dfa* dfa, int max_states)
+{
+    // A state receives its ID when it's first reached from a computed one.
+    // Computing them in the order of their IDs thus gets us all of them, and
+    // the resulting numbering doesn't depend on any input seen so far.
+    jrx_dfa_state_id id;
+    for ( id = 0; id < vec_dfa_state_size(dfa->states); id++ ) {
+        if ( max_states && id >= max_states )
+            return 0;
+
+        dfa_get_state(dfa, id);
+    }
+
+    return 1;
+}
+
+// Returns the number of states, or -1 if there are more than max_states (if
+// not zero). Once all states are computed, the DFA gets minimized, so the
+// final number may be less than what max_states checks.
+int jrx_regset_compute_states(jrx_regex_t *preg, int max_states)
+{
+    jrx_dfa* dfa = preg->dfa;
+
+    if ( ! _compute_all_states(dfa, max_states) )
+        return -1;
+
+    dfa_minimize(dfa);
+    return vec_dfa_state_size(dfa->states);
+}
+
+void jrx_regset_set_native_matcher(jrx_regex_t *preg, jrx_native_matcher matcher)
+{
+    preg->native = matcher;
+}
+
+int jrx_dfa_num_states(const jrx_regex_t *preg)
+{
+    return vec_dfa_state_size(preg->dfa->states);
+}
+
+jrx_accept_id jrx_dfa_state_accept(const jrx_regex_t *preg, jrx_dfa_state_id state)
+{
+    jrx_dfa_state* dstate = dfa_get_state(preg->dfa, state);
+    return dstate->accepts ? vec_dfa_accept_get(dstate->accepts, 0).aid : 0;
+}
+
+int jrx_dfa_state_can_transition(const jrx_regex_t *preg, jrx_dfa_state_id state)
+{
+    jrx_dfa_state* dstate = dfa_get_state(preg->dfa, state);
+    return vec_dfa_transition_size(dstate->trans) != 0;
+}
+
+static jrx_dfa_state_id _successor(jrx_dfa* dfa, jrx_dfa_state* dstate, jrx_char cp)
+{
+    vec_for_each(dfa_transition, dstate->trans, trans) {
+        jrx_ccl* ccl = vec_ccl_get(dfa->ccls->ccls, trans.ccl);
+
+        if ( ! ccl->ranges )
+            continue;
+
+        set_for_each(char_range, ccl->ranges, r) {
+            if ( cp >= r.begin && cp < r.end )
+                return trans.succ;
+        }
+    }
+
+    return JRX_DFA_NO_STATE;
+}
+
+jrx_dfa_state_id jrx_dfa_state_successor(const jrx_regex_t *preg, jrx_dfa_state_id state, jrx_char cp)
+{
+    return _successor(preg->dfa, dfa_get_state(preg->dfa, state), cp);
+}
+
+// Longest prefix the prefilter covers; limited by the width of its state.
+#define PREFILTER_MAX_LEN 8
+
+// Returns the prefilter's length, which is zero if the regexp doesn't lend
+// itself to prefiltering.
+int jrx_regset_prefilter(jrx_regex_t *preg)
+{
+    jrx_dfa* dfa = preg->dfa;
+
+    if ( preg->prefilter || ! dfa || (dfa->options & JRX_OPTION_STD_MATCHER) )
+        return preg->prefilter_len;
+
+    uint8_t* masks = (uint8_t*) malloc(256);
+    if ( ! masks )
+        return 0;
+
+    int len = dfa_prefilter(dfa, masks, PREFILTER_MAX_LEN);
+
+    if ( ! len ) {
+        free(masks);
+        return 0;
+    }
+
+    preg->prefilter = masks;
+    preg->prefilter_len = len;
+    return len;
+}
+
+// Returns the index of the byte completing the first candidate, or -1 if
+// there's none in the buffer. The state must be initialized to zero before
+// scanning the first chunk.
+int jrx_prefilter_scan(const jrx_regex_t *preg, uint8_t* state, const char* buffer, unsigned int len)
+{
+    const uint8_t* masks = preg->prefilter;
+    uint8_t found = (1 << (preg->prefilter_len - 1));
+    uint8_t d = *state;
+
+    unsigned int i;
+    for ( i = 0; i < len; i++ ) {
+        d = ((d << 1) | 1) & masks[(uint8_t)buffer[i]];
+
+        if ( d & found ) {
+            *state = d;
+            return i;
+        }
+    }
+
+    *state = d;
+    return -1;
+}
+
+// Returns the number of trailing bytes seen by the scan that may still start
+// a match.
+int jrx_prefilter_pending(const jrx_regex_t *preg, uint8_t state)
+{
+    int n;
+    for ( n = preg->prefilter_len - 1; n > 0; n-- ) {
+        if ( state & (1 << (n - 1)) )
+            return n;
+    }
+
+    return 0;
+}
+
+// Accept IDs of the reverse DFA.
+#define REVERSE_MATCH 1
+#define REVERSE_PREFIX 2
+
+// Returns true if a reverse DFA is available.
+int jrx_regset_reverse(jrx_regex_t *preg)
+{
+    if ( preg->rdfa )
+        return 1;
+
+    if ( ! (preg->dfa && preg->nfa) || (preg->dfa->options & JRX_OPTION_STD_MATCHER) )
+        return 0;
+
+    jrx_nfa* rnfa = nfa_reverse(preg->nfa, REVERSE_MATCH, REVERSE_PREFIX);
+
+    if ( ! rnfa )
+        return 0;
+
+    jrx_dfa* rdfa = dfa_from_nfa(rnfa);
+
+    if ( ! rdfa ) {
+        nfa_delete(rnfa);
+        return 0;
+    }
+
+    preg->rnfa = rnfa;
+    preg->rdfa = rdfa;
+    return 1;
+}
+
+void jrx_reverse_init(const jrx_regex_t *preg, jrx_reverse_state* rs)
+{
+    rs->state = preg->rdfa->initial;
+    rs->offset = 0;
+    rs->match = -1;
+    rs->prefix = -1;
+}
+
+void jrx_reverse_exec(const jrx_regex_t *preg, const char* buffer, unsigned int len, jrx_reverse_state* rs)
+{
+    jrx_dfa* dfa = preg->rdfa;
+    jrx_dfa_state_id state = rs->state;
+
+    const char* p;
+    for ( p = buffer + len; p > buffer; ) {
+        dfa_cache_check(dfa, state);
+
+        jrx_char cp = (uint8_t)*--p;
+        jrx_dfa_state* dstate = dfa_get_state(dfa, state);
+        jrx_dfa_state_id succ = JRX_DFA_NO_STATE;
+
+        if ( dstate->table && cp < 256 )
+            succ = dstate->table[dfa->byte_classes[cp]];
+
+        else {
+            // Same as the minimal matcher; there are no assertions here.
+            succ = _successor(dfa, dstate, cp);
+        }
+
+        // The implicit ".*" means we can always continue.
+        assert(succ != JRX_DFA_NO_STATE);
+
+        state = succ;
+        ++rs->offset;
+
+        jrx_dfa_state* nstate = dfa_get_state(dfa, state);
+
+        if ( ! nstate->accepts )
+            continue;
+
+        vec_for_each(dfa_accept, nstate->accepts, acc) {
+            if ( acc.aid == REVERSE_MATCH )
+                rs->match = rs->offset;
+
+            if ( acc.aid == REVERSE_PREFIX )
+                rs->prefix = rs->offset;
+        }
+    }
+
+    rs->state = state;
+}
+
+void jrx_regset_set_cache_limit(jrx_regex_t *preg, uint64_t bytes)
+{
+    // A native matcher relies on the forward DFA's state IDs.
+    if ( preg->dfa && (preg->dfa->options & JRX_OPTION_LAZY) && ! preg->native && ! preg->dfa->lock )
+        preg->dfa->cache_limit = bytes;
+
+    if ( preg->rdfa && (preg->rdfa->options & JRX_OPTION_LAZY) && ! preg->rdfa->lock )
+        preg->rdfa->cache_limit = bytes;
+}
+
+void jrx_regset_cache_stats(const jrx_regex_t *preg, jrx_cache_stats* stats)
+{
+    stats->hits = stats->misses = stats->flushes = 0;
+
+    jrx_dfa* dfas[] = { preg->dfa, preg->rdfa };
+
+    int i;
+    for ( i = 0; i < 2; i++ ) {
+        if ( ! dfas[i] )
+            continue;
+
+        stats->hits += dfas[i]->cache_hits;
+        stats->misses += dfas[i]->cache_misses;
+        stats->flushes += dfas[i]->cache_flushes;
+    }
+}
+
+void jrx_regset_share(jrx_regex_t *dst, jrx_regex_t *src)
+{
+    if ( ! src->refcnt ) {
+        src->refcnt = (int*) malloc(sizeof(int));
+        *src->refcnt = 1;
+
+        if ( src->dfa )
+            dfa_share(src->dfa);
+
+        if ( src->rdfa )
+            dfa_share(src->rdfa);
+    }
+
+    __atomic_add_fetch(src->refcnt, 1, __ATOMIC_SEQ_CST);
+    *dst = *src;
+}
+
+// Identifies serialized regexps. The magic number also won't match if the
+// data has been written with a different byte order.
+#define SERIALIZE_MAGIC 0x4a525844 // "JRXD"
+
+// Must be bumped whenever the serialization format changes.
+#define SERIALIZE_VERSION 1
+
+void* jrx_regset_serialize(jrx_regex_t *preg, int max_states, size_t* len)
+{
+    if ( ! preg->dfa || jrx_regset_compute_states(preg, max_states) < 0 )
+        return 0;
+
+    if ( preg->rdfa && ! _compute_all_states(preg->rdfa, max_states) )
+        // Without the reverse DFA, restoring would lose functionality.
+        return 0;
+
+    dfa_buffer buf = { 0, 0, 0, 0 };
+    dfa_buffer_put(&buf, SERIALIZE_MAGIC);
+    dfa_buffer_put(&buf, SERIALIZE_VERSION);
+    dfa_buffer_put(&buf, preg->cflags);
+    dfa_buffer_put(&buf, preg->nmatch);
+    dfa_buffer_put(&buf, preg->re_nsub);
+    dfa_buffer_put(&buf, preg->rdfa != 0);
+
+    int ok = dfa_serialize(preg->dfa, &buf);
+
+    if ( ok && preg->rdfa )
+        ok = dfa_serialize(preg->rdfa, &buf);
+
+    if ( ! ok ) {
+        free(buf.data);
+        return 0;
+    }
+
+    *len = buf.len;
+    return buf.data;
+}
+
+int jrx_regset_deserialize(jrx_regex_t *preg, const void* data, size_t len)
+{
+    dfa_buffer buf = { (uint8_t*)data, 0, len, 0 };
+
+    if ( dfa_buffer_get(&buf) != SERIALIZE_MAGIC ||
+         dfa_buffer_get(&buf) != SERIALIZE_VERSION ||
+         dfa_buffer_get(&buf) != preg->cflags ||
+         (int)dfa_buffer_get(&buf) != preg->nmatch )
+        return REG_BADPAT;
+
+    int re_nsub = dfa_buffer_get(&buf);
+    int have_rdfa = dfa_buffer_get(&buf);
+
+    jrx_dfa* dfa = dfa_deserialize(&buf);
+    jrx_dfa* rdfa = 0;
+
+    if ( dfa && have_rdfa )
+        rdfa = dfa_deserialize(&buf);
+
+    if ( ! dfa || (have_rdfa && ! rdfa) || buf.len != buf.max ) {
+        if ( dfa )
+            dfa_delete(dfa);
+
+        if ( rdfa )
+            dfa_delete(rdfa);
+
+        return REG_BADPAT;
+    }
+
+    preg->dfa = dfa;
+    preg->rdfa = rdfa;
+    preg->re_nsub = re_nsub;
+    return REG_OK;
+}
@@ -8,6 +8,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "jrx-symbols.h"
+
 // Predefined types.
 typedef uint32_t jrx_char;         ///< A single codepoint.
 typedef int32_t jrx_offset;        ///< Offset in input stream.
@@ -16,6 +18,9 @@ typedef uint32_t jrx_nfa_state_id; // ID for an NFA state.
 typedef uint32_t jrx_dfa_state_id; // ID for a DFA state.
 typedef uint16_t jrx_ccl_id;       // ID for a CCL.
 
+// DFA state ID signaling that there's no such state.
+static const jrx_dfa_state_id JRX_DFA_NO_STATE = UINT32_MAX;
+
 typedef uint16_t jrx_assertion; ///< Type for zero-width assertions.
 static const jrx_assertion JRX_ASSERTION_NONE = 0;
 static const jrx_assertion JRX_ASSERTION_BOL = 1 << 1; ///< Beginning of line.
@@ -40,6 +45,7 @@ struct jrx_match_state {
     jrx_offset begin;         // Offset of first cp; will be added to pmatch.
     struct jrx_dfa* dfa;      // The DFA we're matching with.
     jrx_dfa_state_id state;   // Current state.
+    jrx_dfa_state_id pinned;  // State pinned while suspended, or JRX_DFA_NO_STATE.
     jrx_char previous;        // Previous code point seen (valid iff offset > 0)
 
     // The following are only used with the full matcher.
@@ -52,8 +58,15 @@ struct jrx_match_state {
 
     // The following are only used with the minimal matcher.
     jrx_accept_id acc;
+
+    unsigned int consumed;    ///< Number of bytes the last jrx_regexec_partial() call processed.
 };
 
+/// Signature of a matcher compiled into native code from a regexp's DFA.
+/// Calling it must be equivalent to running jrx_regexec_partial() with the
+/// regexp it was compiled from. See jrx_regset_set_native_matcher().
+typedef int (*jrx_native_matcher)(jrx_match_state* ms, const char* buffer, unsigned int len, int find_partial_matches);
+
 typedef struct {
     size_t re_nsub;            ///< Number of capture expressions in regular expression (POSIX).
 
@@ -62,8 +75,30 @@ typedef struct {
     struct jrx_nfa* nfa;       // Compiled NFA, or NULL.
     struct jrx_dfa* dfa;       // Compiled DFA, or NULL.
     const char* errmsg;        // Most recent error message, or NULL if none.
+    jrx_native_matcher native; // Native matcher to use instead of interpreting the DFA, or NULL.
+    int prefilter_len;         // Number of leading bytes the prefilter checks; zero if none.
+    uint8_t* prefilter;        // Prefilter masks indexed by byte, or NULL.
+    struct jrx_nfa* rnfa;      // Reverse NFA for locating the start of matches, or NULL.
+    struct jrx_dfa* rdfa;      // Reverse DFA for locating the start of matches, or NULL.
+    int* refcnt;               // Number of regexps sharing the compiled form, or NULL if not shared.
 } jrx_regex_t;
 
+/// State for running a regexp's reverse DFA over input from its end towards
+/// its beginning.
+typedef struct {
+    jrx_dfa_state_id state; // Current state.
+    jrx_offset offset;      // Number of bytes consumed so far.
+    jrx_offset match;       // Bytes consumed when last passing the start of a match, or -1.
+    jrx_offset prefix;      // Bytes consumed when last passing the start of a partial match, or -1.
+} jrx_reverse_state;
+
+/// Statistics about a regexp's lazily computed DFA states.
+typedef struct {
+    uint64_t hits;    ///< Number of state lookups finding the state computed.
+    uint64_t misses;  ///< Number of state lookups having to compute the state.
+    uint64_t flushes; ///< Number of times the states have been discarded.
+} jrx_cache_stats;
+
 typedef jrx_offset regoff_t;
 
 typedef struct jrx_regmatch_t {
@@ -137,7 +172,88 @@ extern int jrx_regexec_partial(const jrx_regex_t *preg, const char *buffer, unsi
 extern int jrx_reggroups(const jrx_regex_t *preg, jrx_match_state* ms, size_t nmatch, jrx_regmatch_t pmatch[]);
 extern int jrx_num_groups(jrx_regex_t *preg);
 extern int jrx_can_transition(jrx_match_state* ms);
+extern int jrx_current_accept(jrx_match_state* ms);
 extern jrx_match_state* jrx_match_state_init(const jrx_regex_t *preg, jrx_offset begin, jrx_match_state* ms);
 extern void jrx_match_state_done(jrx_match_state* ms);
 
+// Interface for compiling a regexp's DFA into native code. That's possible
+// for regexps using the minimal matcher as long as they don't need any
+// assertions. The compiler computes all DFA states with
+// jrx_regset_compute_states(), which also minimizes the DFA, and then
+// generates code from the jrx_dfa_state_*() information. At run-time, the
+// same regexp gets compiled again, and after calling
+// jrx_regset_compute_states() as well, the state IDs match so that the
+// native matcher can be installed with jrx_regset_set_native_matcher().
+extern int jrx_regset_is_compilable(const jrx_regex_t *preg);
+extern int jrx_regset_compute_states(jrx_regex_t *preg, int max_states);
+extern void jrx_regset_set_native_matcher(jrx_regex_t *preg, jrx_native_matcher matcher);
+extern int jrx_dfa_num_states(const jrx_regex_t *preg);
+extern jrx_accept_id jrx_dfa_state_accept(const jrx_regex_t *preg, jrx_dfa_state_id state);
+extern int jrx_dfa_state_can_transition(const jrx_regex_t *preg, jrx_dfa_state_id state);
+extern jrx_dfa_state_id jrx_dfa_state_successor(const jrx_regex_t *preg, jrx_dfa_state_id state, jrx_char cp);
+
+// Properties of a finalized regexp's patterns, for callers choosing between
+// matching strategies. jrx_regset_has_assertions() returns true if any of
+// the patterns uses assertions, such as anchors or word boundaries; it
+// returns true as well if that can't be determined because the regexp has
+// been deserialized. jrx_regset_matches_empty() returns true if any of the
+// patterns may match the empty input.
+extern int jrx_regset_has_assertions(const jrx_regex_t *preg);
+extern int jrx_regset_matches_empty(const jrx_regex_t *preg);
+
+// Interface for skipping ahead to candidate match positions when searching
+// with the minimal matcher. jrx_regset_prefilter() derives a set of possible
+// bytes for each of the first positions of any match. The scan then runs a
+// shift-and over the input, carrying its state across calls to support
+// chunked input, and reports where the first prefilter_len bytes of a match
+// may end. Everything not reported is guaranteed not to start a match,
+// except for the trailing jrx_prefilter_pending() bytes that may still do
+// so if more input follows.
+extern int jrx_regset_prefilter(jrx_regex_t *preg);
+extern int jrx_prefilter_scan(const jrx_regex_t *preg, uint8_t* state, const char* buffer, unsigned int len);
+extern int jrx_prefilter_pending(const jrx_regex_t *preg, uint8_t state);
+
+// Interface for locating the leftmost match of the minimal matcher in
+// linear time. jrx_regset_reverse() builds a DFA for the reversed patterns
+// with an implicit ".*". jrx_reverse_exec() runs it over chunks of input
+// passed in reverse order, processing each from its end to its beginning.
+// Afterwards, the state tells where the leftmost match starts, from where
+// the minimal matcher can then find its end; or, if there's no match,
+// whether more input could still lead to one.
+extern int jrx_regset_reverse(jrx_regex_t *preg);
+extern void jrx_reverse_init(const jrx_regex_t *preg, jrx_reverse_state* rs);
+extern void jrx_reverse_exec(const jrx_regex_t *preg, const char* buffer, unsigned int len, jrx_reverse_state* rs);
+
+// Interface for bounding the memory of lazily computed DFAs. Once the
+// states exceed the limit, they get discarded and then recomputed as input
+// requires them again. Match states suspended in between keep their place.
+// The limit applies only to regexps compiled with REG_LAZY. If a native
+// matcher has been installed, it applies only to the reverse DFA.
+extern void jrx_regset_set_cache_limit(jrx_regex_t *preg, uint64_t bytes);
+extern void jrx_regset_cache_stats(const jrx_regex_t *preg, jrx_cache_stats* stats);
+
+// Interface for using a compiled regexp from multiple threads. After
+// jrx_regset_share(), both regexps use the same compiled form, and each
+// thread can match with its own jrx_match_state concurrently. DFA states
+// computed lazily by one thread become available to all of them. The
+// source must be finalized, including any of the preparations above, and
+// no other thread may be using it yet when it's shared for the first time.
+// Each copy must be released with jrx_regfree(). Shared regexps aren't
+// subject to the cache limit, and don't count cache hits.
+extern void jrx_regset_share(jrx_regex_t *dst, jrx_regex_t *src);
+
+// Interface for precompiling regexps. jrx_regset_serialize() computes all
+// states of a finalized regexp's DFAs, including the reverse one if built,
+// and returns them in a binary format, allocated with malloc(). It returns
+// NULL if any of the DFAs has more than max_states (if not zero). The
+// forward DFA ends up as with jrx_regset_compute_states(), so a native
+// matcher built from the same patterns applies to it as well.
+// jrx_regset_deserialize() restores the DFAs into a regexp that has been
+// initialized with the same nmatch and cflags, in place of adding patterns
+// and finalizing. It returns REG_BADPAT if the data doesn't fit, including
+// when it comes from a different version of the library; the caller can
+// then compile the patterns normally.
+extern void* jrx_regset_serialize(jrx_regex_t *preg, int max_states, size_t* len);
+extern int jrx_regset_deserialize(jrx_regex_t *preg, const void* data, size_t len);
+
 #endif
@@ -439,6 +439,126 @@ void nfa_remove_epsilons(jrx_nfa* nfa)
     }
 }
 
+static void _nfa_state_add_accept(jrx_nfa_state* state, jrx_accept_id aid)
+{
+    if ( ! state->accepts )
+        state->accepts = vec_nfa_accept_create(0);
+
+    jrx_nfa_accept acc = { 0, aid, 0 };
+    vec_nfa_accept_append(state->accepts, acc);
+}
+
+// Adds all transitions of one state to another one.
+static void _nfa_state_add_all_trans(jrx_nfa_state* state, jrx_nfa_state* other)
+{
+    vec_for_each(nfa_transition, other->trans, trans) {
+        jrx_nfa_transition ntrans = { trans.ccl, trans.succ, 0 };
+        vec_nfa_transition_append(state->trans, ntrans);
+    }
+}
+
+// Returns true if we can build a reverse NFA for the given one.
+static int _nfa_is_reversible(jrx_nfa* nfa, set_nfa_state_id* closure)
+{
+    jrx_nfa_context* ctx = nfa->ctx;
+
+    if ( nfa->initial_tags || nfa->initial->accepts )
+        return 0;
+
+    set_for_each(nfa_state_id, closure, nid) {
+        jrx_nfa_state* state = vec_nfa_state_get(ctx->states, nid);
+
+        if ( state->accepts ) {
+            vec_for_each(nfa_accept, state->accepts, acc) {
+                if ( acc.assertions || acc.tags )
+                    return 0;
+            }
+        }
+
+        vec_for_each(nfa_transition, state->trans, trans) {
+            jrx_ccl* ccl = vec_ccl_get(ctx->ccls->ccls, trans.ccl);
+
+            if ( trans.tags || ccl->assertions || ccl_is_epsilon(ccl) )
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+jrx_nfa* nfa_reverse(jrx_nfa* nfa, jrx_accept_id match, jrx_accept_id prefix)
+{
+    jrx_nfa_context* ctx = nfa->ctx;
+
+    set_nfa_state_id* closure = set_nfa_state_id_create(0);
+    _nfa_state_closure(ctx, nfa->initial, closure);
+
+    if ( ! _nfa_is_reversible(nfa, closure) ) {
+        set_nfa_state_id_delete(closure);
+        return 0;
+    }
+
+    // We build two reversed copies of the NFA. Running backwards, the first
+    // accepts at the start of any match. The second accepts at the start of
+    // any input that the original NFA can consume from its initial state
+    // without getting stuck, i.e., the start of a partial match.
+    vec_nfa_state* mstates = vec_nfa_state_create(0);
+    vec_nfa_state* pstates = vec_nfa_state_create(0);
+
+    set_for_each(nfa_state_id, closure, nid) {
+        vec_nfa_state_set(mstates, nid, _nfa_state_create(ctx));
+        vec_nfa_state_set(pstates, nid, _nfa_state_create(ctx));
+    }
+
+    set_for_each(nfa_state_id, closure, snid) {
+        jrx_nfa_state* state = vec_nfa_state_get(ctx->states, snid);
+        jrx_nfa_state* mstate = vec_nfa_state_get(mstates, snid);
+        jrx_nfa_state* pstate = vec_nfa_state_get(pstates, snid);
+
+        vec_for_each(nfa_transition, state->trans, trans) {
+            jrx_ccl* ccl = vec_ccl_get(ctx->ccls->ccls, trans.ccl);
+            _nfa_state_add_trans(vec_nfa_state_get(mstates, trans.succ), mstate, 0, ccl);
+            _nfa_state_add_trans(vec_nfa_state_get(pstates, trans.succ), pstate, 0, ccl);
+        }
+
+        if ( state == nfa->initial ) {
+            _nfa_state_add_accept(mstate, match);
+            _nfa_state_add_accept(pstate, prefix);
+        }
+    }
+
+    // Matches may end anywhere, so the first copy gets an implicit ".*" in
+    // front of the accepting states it starts in.
+    jrx_nfa_state* mloop = _nfa_state_create(ctx);
+    _nfa_state_add_trans(mloop, mloop, 0, ccl_any(ctx->ccls));
+
+    // The input may end in any state for a partial match, so the initial
+    // state combines that with all states of the second copy.
+    jrx_nfa_state* initial = _nfa_state_create(ctx);
+
+    set_for_each(nfa_state_id, closure, anid) {
+        jrx_nfa_state* state = vec_nfa_state_get(ctx->states, anid);
+
+        if ( state->accepts )
+            _nfa_state_add_all_trans(mloop, vec_nfa_state_get(mstates, anid));
+
+        _nfa_state_add_all_trans(initial, vec_nfa_state_get(pstates, anid));
+    }
+
+    _nfa_state_add_all_trans(initial, mloop);
+
+    vec_nfa_state_delete(mstates);
+    vec_nfa_state_delete(pstates);
+    set_nfa_state_id_delete(closure);
+
+    jrx_nfa* rnfa = nfa_create(ctx, initial, initial);
+
+    if ( ctx->options & JRX_OPTION_DEBUG )
+        nfa_print(rnfa, stderr);
+
+    return rnfa;
+}
+
 static jrx_nfa* _nfa_compile_pattern(jrx_nfa_context* ctx, const char* pattern, int len, const char** errmsg)
 {
     yyscan_t scanner;
@@ -134,6 +134,20 @@ extern jrx_nfa* nfa_iterate(jrx_nfa* nfa, int min, int max);
 
 extern void nfa_remove_epsilons(jrx_nfa* nfa);
 
+/// Builds an NFA that matches the given one's language in reverse, for
+/// running it from the end of the input towards its beginning. The new NFA
+/// shares the context of the original one. It accepts with ID *match* at
+/// all positions where a match of the original NFA starts, and with ID
+/// *prefix* at all positions from where the original NFA could consume the
+/// rest of the input without getting stuck.
+///
+/// \param nfa The NFA to reverse. Its epsilon transitions must have been
+/// removed.
+///
+/// \return The reverse NFA, or NULL if the NFA uses tags or assertions, or
+/// matches the empty string, which we don't support.
+extern jrx_nfa* nfa_reverse(jrx_nfa* nfa, jrx_accept_id match, jrx_accept_id prefix);
+
 // Compile a single pattern.
 extern jrx_nfa* nfa_compile(const char* pattern, int len, jrx_option options, int8_t nmatch, const char** errmsg);
 
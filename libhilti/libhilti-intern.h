@@ -50,11 +50,14 @@
 #include "timer.h"
 #include "map_set.h"
 #include "iosrc.h"
+#include "dispatcher.h"
 #include "context.h"
 #include "globals.h"
 #include "cmdqueue.h"
 #include "file.h"
 #include "profiler.h"
+#include "fprof.h"
+#include "pgo.h"
 #include "classifier.h"
 #include "hutil.h"
 #include "clone.h"
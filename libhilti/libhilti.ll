@@ -146,6 +146,9 @@
 %hlt.channel = type {};
 %hlt.blockable = type {};
 
+; When changing this, adapt __hlt_fprof_frame in fprof.h.
+%hlt.fprof_frame = type { i64, i64, i64, i8* }
+
 ;;; libhilti functions that don't fit the normal calling conventions.
 
 declare i1 @__hlt_type_equal(%hlt.type_info*, %hlt.type_info*)
@@ -160,6 +163,9 @@ declare i8*  @__hlt_object_new(%hlt.type_info*, i64, i8*, %hlt.execution_context
 
 declare void @__hlt_memory_safepoint(%hlt.execution_context*, i8*)
 
+declare void @__hlt_fprof_enter(i64*, i8*, %hlt.fprof_frame*)
+declare void @__hlt_fprof_leave(%hlt.fprof_frame*)
+
 declare %hlt.blockable* @__hlt_object_blockable(%hlt.type_info*, i8*, %hlt.exception**, %hlt.execution_context*)
 
 declare void @__hlt_debug_print(i8*, i8*)
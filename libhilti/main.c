@@ -27,6 +27,7 @@ static void usage(const char* prog)
            "  -h| --help           Show usage information.\n"
            "  -t| --threads <num>  Number of worker threads; zero disables. [Default: 2.]\n"
            "  -P| --profile        Activate profiling support.\n"
+           "  -A| --profile-aggr   Activate profiling support, aggregating intervals in memory.\n"
            "\n", prog);
 
     exit(1);
@@ -35,6 +36,7 @@ static void usage(const char* prog)
 static struct option long_options[] = {
     {"threads", required_argument, 0, 't'},
     {"profile", no_argument, 0, 'P'},
+    {"profile-aggr", no_argument, 0, 'A'},
     {0, 0, 0, 0}
 };
 
@@ -100,13 +102,14 @@ int __libhilti_main(int argc, char **argv)
 
     int threads = 2;
     int profiling = 0;
+    int profiling_aggregate = 0;
 
     // Reset getopt() in case some has already called it (e.g., if we're
     // running JIT).
     hlt_reset_getopt();
 
     while ( 1 ) {
-        char c = getopt_long (argc, argv, "ht:P", long_options, 0);
+        char c = getopt_long (argc, argv, "ht:PA", long_options, 0);
 
         if ( c == -1 )
             break;
@@ -120,6 +123,11 @@ int __libhilti_main(int argc, char **argv)
             profiling = 1;
             break;
 
+          case 'A':
+            profiling = 1;
+            profiling_aggregate = 1;
+            break;
+
           default:
             usage(argv[0]);
         }
@@ -131,6 +139,7 @@ int __libhilti_main(int argc, char **argv)
     hlt_config cfg = *hlt_config_get();
     cfg.num_workers = threads;
     cfg.profiling = profiling;
+    cfg.profiling_aggregate = profiling_aggregate;
     hlt_config_set(&cfg);
 
     hlt_init();
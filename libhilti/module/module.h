@@ -14,5 +14,6 @@ extern void hilti_abort(hlt_exception** excpt);
 extern void hilti_sleep(double secs, hlt_exception** excpt, hlt_execution_context* ctx); // Doesn't yield!
 extern void hilti_wait_for_threads();
 extern void hilti_terminate(hlt_exception** excpt, hlt_execution_context* ctx);
+extern void hilti_dispatch_packets(const hlt_type_info* type, void* obj, hlt_callable* func, int8_t in_order, hlt_exception** excpt, hlt_execution_context* ctx);
 
 #endif
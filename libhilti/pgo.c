@@ -0,0 +1,134 @@
+// Profile-guided optimization.
+//
+// The counters themselves live in the generated code; all we do is keep
+// track of them and write them out at the end.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pgo.h"
+#include "globals.h"
+#include "config.h"
+#include "debug.h"
+#include "hutil.h"
+#include "memory_.h"
+
+// One set of functions registered with __hlt_pgo_register().
+typedef struct __hlt_pgo_table {
+    __hlt_pgo_function* funcs;
+    uint64_t size;
+    struct __hlt_pgo_table* next;
+} __hlt_pgo_table;
+
+static void fatal_error(const char* msg)
+{
+    fprintf(stderr, "libhilti pgo: %s\n", msg);
+    exit(1);
+}
+
+static inline void acquire_lock()
+{
+    if ( pthread_mutex_lock(&__hlt_globals()->pgo_lock) != 0 )
+        fatal_error("cannot lock mutex");
+}
+
+static inline void release_lock()
+{
+    if ( pthread_mutex_unlock(&__hlt_globals()->pgo_lock) != 0 )
+        fatal_error("cannot unlock mutex");
+}
+
+void __hlt_pgo_register(__hlt_pgo_function* funcs, uint64_t n)
+{
+    __hlt_global_state* globals = __hlt_globals();
+
+    acquire_lock();
+
+    for ( __hlt_pgo_table* t = globals->pgo_tables; t; t = t->next ) {
+        if ( t->funcs == funcs ) {
+            release_lock();
+            return;
+        }
+    }
+
+    __hlt_pgo_table* t = hlt_malloc(sizeof(__hlt_pgo_table));
+    t->funcs = funcs;
+    t->size = n;
+    t->next = globals->pgo_tables;
+    globals->pgo_tables = t;
+
+    release_lock();
+
+    DBG_LOG("hilti-pgo", "registered %" PRIu64 " instrumented functions", n);
+}
+
+void hlt_pgo_dump()
+{
+    __hlt_global_state* globals = __hlt_globals();
+
+    acquire_lock();
+
+    if ( ! globals->pgo_tables ) {
+        release_lock();
+        return;
+    }
+
+    const char* fname = hlt_config_get()->pgo_profile_out;
+    FILE* out = fopen(fname, "w");
+
+    if ( ! out ) {
+        fprintf(stderr, "libhilti pgo: cannot open %s\n", fname);
+        release_lock();
+        return;
+    }
+
+    fprintf(out, "# HILTI PGO profile\n");
+    fprintf(out, "#\n");
+    fprintf(out, "# function checksum size counters...\n");
+
+    for ( __hlt_pgo_table* t = globals->pgo_tables; t; t = t->next ) {
+        for ( uint64_t i = 0; i < t->size; i++ ) {
+            __hlt_pgo_function* f = &t->funcs[i];
+
+            fprintf(out, "%s %" PRIu64 " %" PRIu64, f->name, f->checksum, f->size);
+
+            for ( uint64_t j = 0; j < f->size; j++ )
+                fprintf(out, " %" PRIu64, __atomic_load_n(&f->counters[j], __ATOMIC_RELAXED));
+
+            fprintf(out, "\n");
+        }
+    }
+
+    fclose(out);
+
+    release_lock();
+
+    DBG_LOG("hilti-pgo", "wrote PGO profile to %s", fname);
+}
+
+void __hlt_pgo_init()
+{
+    if ( pthread_mutex_init(&__hlt_globals()->pgo_lock, 0) != 0 )
+        fatal_error("cannot init mutex");
+}
+
+void __hlt_pgo_done()
+{
+    __hlt_global_state* globals = __hlt_globals();
+
+    hlt_pgo_dump();
+
+    __hlt_pgo_table* t = globals->pgo_tables;
+
+    while ( t ) {
+        __hlt_pgo_table* next = t->next;
+        hlt_free(t);
+        t = next;
+    }
+
+    globals->pgo_tables = 0;
+
+    if ( pthread_mutex_destroy(&globals->pgo_lock) != 0 )
+        fatal_error("cannot destroy mutex");
+}
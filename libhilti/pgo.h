@@ -0,0 +1,49 @@
+///
+/// Run-time support for profile-guided optimization.
+///
+/// When compiled with Options::pgo_instrument, the generated code counts
+/// entries into each HILTI function as well as the outcomes of all its
+/// conditional branches, and registers the counters with
+/// __hlt_pgo_register() at startup. At termination, we write them to
+/// config.pgo_profile_out, from where the compiler can read them back via
+/// Options::pgo_profile.
+///
+/// The profile is a text file with one line per function:
+///
+///     <function> <checksum> <n> <counter 1> ... <counter n>
+///
+/// Lines starting with ``#`` are comments. Profiles of multiple runs can be
+/// concatenated; the compiler sums them up.
+///
+
+#ifndef LIBHILTI_PGO_H
+#define LIBHILTI_PGO_H
+
+#include <stdint.h>
+
+/// The counters of one instrumented function. The code generator creates
+/// these statically; when changing this, adapt
+/// codegen::ProfileGuidance::instrument().
+typedef struct {
+    const char* name;     /// The function's name.
+    uint64_t checksum;    /// Identifies the layout of the counters.
+    uint64_t size;        /// The number of counters.
+    uint64_t* counters;   /// The counters. The generated code updates them without synchronization.
+} __hlt_pgo_function;
+
+/// Registers the counters of a set of instrumented functions. Registering
+/// the same set multiple times has no effect.
+///
+/// funcs: The array of functions.
+///
+/// n: The number of entries in *funcs*.
+extern void __hlt_pgo_register(__hlt_pgo_function* funcs, uint64_t n);
+
+/// Writes out the current counters of all registered functions. The
+/// counters keep accumulating afterwards.
+extern void hlt_pgo_dump();
+
+extern void __hlt_pgo_init();
+extern void __hlt_pgo_done();
+
+#endif
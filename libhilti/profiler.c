@@ -5,18 +5,33 @@
 //     Counters:        heap, alloced.
 //     Snapshot types:  wall, cycles.
 //
-// TODO: The PAPI profiling is performed on native threads, not HILTI virtual
-// threads. That will mess the numbers up quite a bit when used with a
-// threaded HILTI program, however it's unclear whether that can be fixed.
+// TODO: The hardware counters are measured on native threads, not HILTI
+// virtual threads. That will mess the numbers up quite a bit when used with
+// a threaded HILTI program, however it's unclear whether that can be fixed.
+//
+// Hardware counters come either from PAPI or, on Linux, directly from
+// perf_event_open(), as selected by config.profiling_counters. With the
+// latter, each native thread opens its own counters on first use, which we
+// then read with rdpmc where the kernel permits, and with read() otherwise.
 //
 // TODO: We don't have 64-bit ntohl() yet, so we store the profiles just in
 // host format.
+//
+// In aggregation mode, we don't write out individual records but collect
+// each tag's start/stop intervals in per-thread memory, writing out one
+// HLT_PROFILER_SUMMARY record per tag every config.profiling_flush_interval
+// seconds, all in a single batch. Doing so avoids both the I/O and the
+// getrusage() calls on the hot path.
 
 #include <fcntl.h>
 #include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "profiler.h"
 #include "globals.h"
+#include "config.h"
 #include "debug.h"
 #include "hutil.h"
 #include "utf8proc.h"
@@ -34,6 +49,24 @@ typedef hlt_hash khint_t;
 
 #endif
 
+#ifdef __linux__
+# include <linux/perf_event.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+#endif
+
+// The hardware counters we record.
+#define NUM_COUNTERS 4
+#define COUNTER_CYCLES        0
+#define COUNTER_INSTRUCTIONS  1
+#define COUNTER_MISSES        2
+#define COUNTER_BRANCH_MISSES 3
+
+// Sources for the hardware counters.
+#define COUNTERS_NONE 0
+#define COUNTERS_PAPI 1
+#define COUNTERS_PERF 2
+
 typedef struct {
     hlt_string tag;           // The hash tag.
     hlt_timer_mgr* tmgr;      // Timer manager attached.
@@ -45,12 +78,29 @@ typedef struct {
     uint64_t time;            // Timer mgr time at beginning.
     uint64_t wall;            // Wall time at beginning.
     uint64_t updates;         // Number of update calls so far.
-    uint64_t cycles;          // Cycle counter at beginning.
-    uint64_t cache;           // Cache state at beginning.
+    uint64_t counters[NUM_COUNTERS]; // Hardware counters at beginning.
     uint64_t heap;            // Heap size at beginning.
+    uint64_t allocs;          // Allocation counter at beginning (aggregation mode only).
     uint64_t user;            // Value of user counter currently.
+
+    struct __hlt_profiler_aggr* aggr; // The tag's aggregated intervals in aggregation mode, or null.
 } __hlt_profiler;
 
+// The intervals of one tag aggregated so far in aggregation mode.
+typedef struct __hlt_profiler_aggr {
+    hlt_string tag;           // The tag.
+    uint64_t count;           // Number of intervals. Fields from here on get reset with each summary.
+    uint64_t wall;            // Total wall time.
+    uint64_t cycles;          // Total cycles.
+    uint64_t misses;          // Total cache misses.
+    uint64_t instructions;    // Total instructions.
+    uint64_t branch_misses;   // Total branch misses.
+    uint64_t allocs;          // Total number of allocations.
+    uint64_t updates;         // Total number of updates.
+    uint64_t user;            // Total of user counters.
+    uint64_t hist[HLT_PROFILER_HIST_BUCKETS]; // Intervals by wall time.
+} __hlt_profiler_aggr;
+
 typedef struct __kh_table_t {
     // These are used by khash and copied from there (see README.HILTI).
     khint_t n_buckets, size, n_occupied, upper_bound;
@@ -59,8 +109,18 @@ typedef struct __kh_table_t {
     __hlt_profiler **vals;
 } kh_table_t;
 
+typedef struct __kh_aggr_t {
+    // These are used by khash and copied from there (see README.HILTI).
+    khint_t n_buckets, size, n_occupied, upper_bound;
+    uint32_t *flags;
+    hlt_string *keys;
+    __hlt_profiler_aggr **vals;
+} kh_aggr_t;
+
 struct __hlt_profiler_state {
     kh_table_t *profilers;     // Active profilers.
+    kh_aggr_t *aggrs;          // Aggregated intervals per tag in aggregation mode, or null.
+    hlt_time last_flush;       // Wall time of writing the last summaries in aggregation mode.
     int fd;                    // Output file.
 };
 
@@ -77,6 +137,7 @@ static inline int8_t __kh_string_equal_func(hlt_string tag1, hlt_string tag2, co
 }
 
 KHASH_INIT(table, hlt_string, __hlt_profiler*, 1, __kh_string_hash_func, __kh_string_equal_func)
+KHASH_INIT(aggr, hlt_string, __hlt_profiler_aggr*, 1, __kh_string_hash_func, __kh_string_equal_func)
 
 #ifdef HAVE_PAPI
 
@@ -160,6 +221,163 @@ error:
 
 #endif
 
+#ifdef __linux__
+
+// The counters of one native thread.
+typedef struct {
+    int fds[NUM_COUNTERS];                            // File descriptors, or -1 if not available.
+    struct perf_event_mmap_page* pages[NUM_COUNTERS]; // Mapped pages for rdpmc, or null.
+} __hlt_perf_counters;
+
+static const uint64_t perf_events[NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static void done_perf_thread(void* arg)
+{
+    __hlt_perf_counters* pc = (__hlt_perf_counters*)arg;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    for ( int i = 0; i < NUM_COUNTERS; i++ ) {
+        if ( pc->pages[i] )
+            munmap(pc->pages[i], page_size);
+
+        if ( pc->fds[i] >= 0 )
+            close(pc->fds[i]);
+    }
+
+    hlt_free(pc);
+}
+
+static __hlt_perf_counters* init_perf_thread()
+{
+    __hlt_perf_counters* pc = hlt_malloc(sizeof(__hlt_perf_counters));
+    long page_size = sysconf(_SC_PAGESIZE);
+    int available = 0;
+
+    for ( int i = 0; i < NUM_COUNTERS; i++ ) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = perf_events[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        // Count this thread on any CPU.
+        pc->fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        pc->pages[i] = 0;
+
+        if ( pc->fds[i] < 0 ) {
+            DBG_LOG("hilti-profiler", "perf: cannot open counter %d, %s", i, strerror(errno));
+            continue;
+        }
+
+        ++available;
+
+        void* page = mmap(0, page_size, PROT_READ, MAP_SHARED, pc->fds[i], 0);
+
+        if ( page != MAP_FAILED )
+            pc->pages[i] = (struct perf_event_mmap_page*)page;
+    }
+
+    if ( ! available )
+        DBG_LOG("hilti-profiler", "perf: no counters available (check /proc/sys/kernel/perf_event_paranoid)");
+
+    return pc;
+}
+
+static inline uint64_t read_perf_counter(int fd, struct perf_event_mmap_page* page)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if ( page ) {
+        // See the comments on struct perf_event_mmap_page in the kernel's
+        // header for how this works.
+        uint32_t seq;
+        uint64_t count;
+        int8_t ok;
+
+        do {
+            seq = page->lock;
+            __asm__ __volatile__("" ::: "memory");
+
+            uint32_t idx = page->index;
+            count = page->offset;
+            ok = (page->cap_user_rdpmc && idx);
+
+            if ( ok ) {
+                uint32_t lo, hi;
+                __asm__ __volatile__("rdpmc" : "=a" (lo), "=d" (hi) : "c" (idx - 1));
+
+                int shift = 64 - page->pmc_width;
+                int64_t pmc = (int64_t)(((uint64_t)hi << 32) | lo);
+                count += (pmc << shift) >> shift;
+            }
+
+            __asm__ __volatile__("" ::: "memory");
+        } while ( page->lock != seq );
+
+        if ( ok )
+            return count;
+
+        // Not currently on a hardware counter, or rdpmc disabled.
+    }
+#endif
+
+    uint64_t count = 0;
+
+    if ( read(fd, &count, sizeof(count)) != sizeof(count) )
+        return 0;
+
+    return count;
+}
+
+static void read_perf(uint64_t* cnts)
+{
+    __hlt_perf_counters* pc = pthread_getspecific(__hlt_globals()->perf_key);
+
+    if ( ! pc ) {
+        pc = init_perf_thread();
+        pthread_setspecific(__hlt_globals()->perf_key, pc);
+    }
+
+    for ( int i = 0; i < NUM_COUNTERS; i++ )
+        cnts[i] = (pc->fds[i] >= 0 ? read_perf_counter(pc->fds[i], pc->pages[i]) : 0);
+}
+
+#endif
+
+// Reads the current hardware counters, setting those unavailable to zero.
+static void read_counters(uint64_t* cnts)
+{
+    for ( int i = 0; i < NUM_COUNTERS; i++ )
+        cnts[i] = 0;
+
+    switch ( __hlt_globals()->profiler_counters ) {
+#ifdef HAVE_PAPI
+     case COUNTERS_PAPI: {
+         long_long papi[PAPI_NUM_EVENTS];
+         read_papi(papi);
+         cnts[COUNTER_CYCLES] = papi[0];
+         cnts[COUNTER_MISSES] = papi[1];
+         break;
+     }
+#endif
+
+#ifdef __linux__
+     case COUNTERS_PERF:
+        read_perf(cnts);
+        break;
+#endif
+
+     default:
+        break;
+    }
+}
+
 inline static void _safe_write(const void* data, int len, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     assert(ctx->pstate->fd >= 0);
@@ -311,15 +529,14 @@ static void write_record(int8_t rtype, __hlt_profiler* p, hlt_exception** excpt,
     rec.heap = hlt_hton64(hlt_util_memory_usage());
     rec.user = hlt_hton64(p->user);
 
-#ifdef HAVE_PAPI
-    long_long cnts[PAPI_NUM_EVENTS];
-    read_papi(cnts);
-    rec.cycles = (rtype != HLT_PROFILER_START) ? hlt_hton64(cnts[0] - p->cycles) : 0;
-    rec.misses = (rtype != HLT_PROFILER_START) ? hlt_hton64(cnts[1] - p->cache) : 0;
-#else
-    rec.cycles = hlt_hton64(0);
-    rec.misses = hlt_hton64(0);
-#endif
+    uint64_t cnts[NUM_COUNTERS];
+    read_counters(cnts);
+
+    int start = (rtype == HLT_PROFILER_START);
+    rec.cycles = start ? 0 : hlt_hton64(cnts[COUNTER_CYCLES] - p->counters[COUNTER_CYCLES]);
+    rec.misses = start ? 0 : hlt_hton64(cnts[COUNTER_MISSES] - p->counters[COUNTER_MISSES]);
+    rec.instructions = start ? 0 : hlt_hton64(cnts[COUNTER_INSTRUCTIONS] - p->counters[COUNTER_INSTRUCTIONS]);
+    rec.branch_misses = start ? 0 : hlt_hton64(cnts[COUNTER_BRANCH_MISSES] - p->counters[COUNTER_BRANCH_MISSES]);
 
     rec.type = rtype;
 
@@ -327,7 +544,7 @@ static void write_record(int8_t rtype, __hlt_profiler* p, hlt_exception** excpt,
     _safe_write(&rec, sizeof(rec), excpt, ctx);
 }
 
-static int read_record(int fd, char* tag, hlt_profiler_record* rec)
+static int read_record(int fd, char* tag, hlt_profiler_record* rec, hlt_profiler_summary* summary)
 {
     int ret = read_tag(fd, tag);
 
@@ -344,14 +561,43 @@ static int read_record(int fd, char* tag, hlt_profiler_record* rec)
     rec->updates = hlt_ntoh64(rec->updates);;
     rec->cycles = hlt_ntoh64(rec->cycles);
     rec->misses = hlt_ntoh64(rec->misses);
+    rec->instructions = hlt_ntoh64(rec->instructions);
+    rec->branch_misses = hlt_ntoh64(rec->branch_misses);
     rec->alloced = hlt_ntoh64(rec->alloced);
     rec->heap = hlt_ntoh64(rec->heap);
     rec->user = hlt_ntoh64(rec->user);
 
+    if ( rec->type != HLT_PROFILER_SUMMARY )
+        return 1;
+
+    // Read the histogram's non-zero buckets.
+    uint16_t n = 0;
+    if ( _safe_read(fd, &n, sizeof(n)) <= 0 )
+        return -1;
+
+    if ( summary )
+        memset(summary, 0, sizeof(hlt_profiler_summary));
+
+    for ( n = hlt_ntoh16(n); n; n-- ) {
+        uint16_t bucket = 0;
+        uint64_t count = 0;
+
+        if ( _safe_read(fd, &bucket, sizeof(bucket)) <= 0 || _safe_read(fd, &count, sizeof(count)) <= 0 )
+            return -1;
+
+        bucket = hlt_ntoh16(bucket);
+
+        if ( bucket >= HLT_PROFILER_HIST_BUCKETS )
+            return -1;
+
+        if ( summary )
+            summary->hist[bucket] = hlt_ntoh64(count);
+    }
+
     return 1;
 }
 
-static void output_record(__hlt_profiler* p, int8_t record_type, hlt_exception** excpt, hlt_execution_context* ctx)
+static void open_output(hlt_exception** excpt, hlt_execution_context* ctx)
 {
     if ( ctx->pstate->fd < 0 ) {
         // Output file not yet opened.
@@ -377,6 +623,160 @@ static void output_record(__hlt_profiler* p, int8_t record_type, hlt_exception**
         if ( excpt && hlt_check_exception(excpt) )
             return;
         }
+}
+
+static inline uint64_t num_allocs()
+{
+#ifdef DEBUG
+    return __hlt_globals()->num_allocs;
+#else
+    return 0;
+#endif
+}
+
+static __hlt_profiler_aggr* get_aggr(hlt_string tag, hlt_execution_context* ctx)
+{
+    kh_aggr_t* aggrs = ctx->pstate->aggrs;
+
+    khiter_t i = kh_get_aggr(aggrs, tag, 0);
+
+    if ( i != kh_end(aggrs) )
+        return kh_value(aggrs, i);
+
+    __hlt_profiler_aggr* a = hlt_calloc(1, sizeof(__hlt_profiler_aggr));
+    a->tag = tag;
+    GC_CCTOR(a->tag, hlt_string, ctx);
+
+    int ret;
+    i = kh_put_aggr(aggrs, a->tag, &ret, 0);
+    kh_value(aggrs, i) = a;
+
+    return a;
+}
+
+// Writes out summaries of all tags having intervals aggregated since the
+// last time, and resets them.
+static void write_summaries(hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    kh_aggr_t* aggrs = ctx->pstate->aggrs;
+    uint64_t cwall = hlt_time_wall(excpt, ctx);
+
+    ctx->pstate->last_flush = cwall;
+
+    // Compute an upper bound for the size of the batch.
+    size_t max = 0;
+
+    for ( khiter_t i = kh_begin(aggrs); i != kh_end(aggrs); i++ ) {
+        if ( kh_exist(aggrs, i) && kh_value(aggrs, i)->count )
+            max += sizeof(int8_t) + kh_value(aggrs, i)->tag->len + sizeof(hlt_profiler_record)
+                + sizeof(uint16_t) + HLT_PROFILER_HIST_BUCKETS * (sizeof(uint16_t) + sizeof(uint64_t));
+    }
+
+    if ( ! max )
+        return;
+
+    open_output(excpt, ctx);
+
+    if ( excpt && hlt_check_exception(excpt) )
+        return;
+
+    int8_t* buffer = hlt_malloc(max);
+    int8_t* b = buffer;
+    uint64_t heap = hlt_util_memory_usage();
+
+    for ( khiter_t i = kh_begin(aggrs); i != kh_end(aggrs); i++ ) {
+        if ( ! (kh_exist(aggrs, i) && kh_value(aggrs, i)->count) )
+            continue;
+
+        __hlt_profiler_aggr* a = kh_value(aggrs, i);
+
+        int8_t len = a->tag->len;
+        *b++ = len;
+        memcpy(b, &a->tag->bytes, len);
+        b += len;
+
+        hlt_profiler_record rec;
+        rec.ctime = hlt_hton64(cwall);
+        rec.cwall = hlt_hton64(cwall);
+        rec.time = hlt_hton64(a->count);
+        rec.wall = hlt_hton64(a->wall);
+        rec.updates = hlt_hton64(a->updates);
+        rec.cycles = hlt_hton64(a->cycles);
+        rec.misses = hlt_hton64(a->misses);
+        rec.instructions = hlt_hton64(a->instructions);
+        rec.branch_misses = hlt_hton64(a->branch_misses);
+        rec.alloced = hlt_hton64(a->allocs);
+        rec.heap = hlt_hton64(heap);
+        rec.user = hlt_hton64(a->user);
+        rec.type = HLT_PROFILER_SUMMARY;
+        memcpy(b, &rec, sizeof(rec));
+        b += sizeof(rec);
+
+        int8_t* nb = b;
+        uint16_t n = 0;
+        b += sizeof(n);
+
+        for ( int j = 0; j < HLT_PROFILER_HIST_BUCKETS; j++ ) {
+            if ( ! a->hist[j] )
+                continue;
+
+            uint16_t bucket = hlt_hton16(j);
+            uint64_t count = hlt_hton64(a->hist[j]);
+            memcpy(b, &bucket, sizeof(bucket));
+            b += sizeof(bucket);
+            memcpy(b, &count, sizeof(count));
+            b += sizeof(count);
+            ++n;
+        }
+
+        n = hlt_hton16(n);
+        memcpy(nb, &n, sizeof(n));
+
+        memset(&a->count, 0, sizeof(__hlt_profiler_aggr) - offsetof(__hlt_profiler_aggr, count));
+    }
+
+    _safe_write(buffer, b - buffer, excpt, ctx);
+    hlt_free(buffer);
+}
+
+static void aggregate_record(__hlt_profiler* p, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    __hlt_profiler_aggr* a = p->aggr;
+    uint64_t cwall = hlt_time_wall(excpt, ctx);
+    uint64_t wall = cwall - p->wall;
+
+    ++a->count;
+    a->wall += wall;
+    a->allocs += num_allocs() - p->allocs;
+    a->updates += p->updates;
+    a->user += p->user;
+    ++a->hist[hlt_profiler_hist_bucket(wall)];
+
+    uint64_t cnts[NUM_COUNTERS];
+    read_counters(cnts);
+    a->cycles += cnts[COUNTER_CYCLES] - p->counters[COUNTER_CYCLES];
+    a->instructions += cnts[COUNTER_INSTRUCTIONS] - p->counters[COUNTER_INSTRUCTIONS];
+    a->misses += cnts[COUNTER_MISSES] - p->counters[COUNTER_MISSES];
+    a->branch_misses += cnts[COUNTER_BRANCH_MISSES] - p->counters[COUNTER_BRANCH_MISSES];
+
+    if ( cwall - ctx->pstate->last_flush >= hlt_config_get()->profiling_flush_interval * 1e9 )
+        write_summaries(excpt, ctx);
+}
+
+static void output_record(__hlt_profiler* p, int8_t record_type, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( p->aggr ) {
+        // We record only complete intervals.
+        if ( record_type == HLT_PROFILER_STOP )
+            aggregate_record(p, excpt, ctx);
+
+        return;
+    }
+
+    open_output(excpt, ctx);
+
+    if ( excpt && hlt_check_exception(excpt) )
+        return;
 
     write_record(record_type, p, excpt, ctx);
 }
@@ -393,7 +793,7 @@ static void install_timer(__hlt_profiler* p, hlt_exception** excpt, hlt_executio
     GC_DTOR(p->timer, hlt_timer, ctx); // Not memory-managed on our end.
 }
 
-void __hlt_profiler_state_delete(__hlt_profiler_state* state)
+void __hlt_profiler_state_delete(__hlt_profiler_state* state, hlt_execution_context* ctx)
 {
     for ( khiter_t i = kh_begin(state->profilers); i != kh_end(state->profilers); i++ ) {
         if ( kh_exist(state->profilers, i) )
@@ -403,7 +803,31 @@ void __hlt_profiler_state_delete(__hlt_profiler_state* state)
     kh_destroy_table(state->profilers);
     hlt_free(state->profilers);
 
-    close(state->fd);
+    if ( state->aggrs ) {
+        // Write out what we have left.
+        hlt_exception* excpt = 0;
+        write_summaries(&excpt, ctx);
+
+        if ( excpt ) {
+            GC_DTOR(excpt, hlt_exception, ctx);
+        }
+
+        for ( khiter_t i = kh_begin(state->aggrs); i != kh_end(state->aggrs); i++ ) {
+            if ( ! kh_exist(state->aggrs, i) )
+                continue;
+
+            __hlt_profiler_aggr* a = kh_value(state->aggrs, i);
+            GC_DTOR(a->tag, hlt_string, ctx);
+            hlt_free(a);
+        }
+
+        kh_destroy_aggr(state->aggrs);
+        hlt_free(state->aggrs);
+    }
+
+    if ( state->fd >= 0 )
+        close(state->fd);
+
     hlt_free(state);
 }
 
@@ -427,16 +851,51 @@ void hlt_profiler_timer_expire(hlt_string tag, hlt_exception** excpt, hlt_execut
 void __hlt_profiler_init()
 {
     __hlt_globals()->profiling_enabled = hlt_config_get()->profiling;
+    __hlt_globals()->profiler_counters = COUNTERS_NONE;
 
+    if ( ! __hlt_globals()->profiling_enabled )
+        return;
+
+    const char* counters = hlt_config_get()->profiling_counters;
+
+    if ( strcmp(counters, "papi") == 0 ) {
 #ifdef HAVE_PAPI
-    if ( __hlt_globals()->profiling_enabled )
         init_papi();
+
+        if ( __hlt_globals()->papi_available )
+            __hlt_globals()->profiler_counters = COUNTERS_PAPI;
+#else
+        DBG_LOG("hilti-profiler", "PAPI: not compiled in");
 #endif
+    }
+
+    else if ( strcmp(counters, "perf") == 0 ) {
+#ifdef __linux__
+        if ( pthread_key_create(&__hlt_globals()->perf_key, done_perf_thread) == 0 )
+            __hlt_globals()->profiler_counters = COUNTERS_PERF;
+#else
+        DBG_LOG("hilti-profiler", "perf: only supported on Linux");
+#endif
+    }
 }
 
 void __hlt_profiler_done()
 {
     __hlt_globals()->profiling_enabled = 0;
+
+#ifdef __linux__
+    if ( __hlt_globals()->profiler_counters == COUNTERS_PERF ) {
+        // The key's destructor doesn't run for the main thread.
+        __hlt_perf_counters* pc = pthread_getspecific(__hlt_globals()->perf_key);
+
+        if ( pc )
+            done_perf_thread(pc);
+
+        pthread_key_delete(__hlt_globals()->perf_key);
+    }
+#endif
+
+    __hlt_globals()->profiler_counters = COUNTERS_NONE;
 }
 
 void hlt_profiler_start(hlt_string tag, hlt_enum style, uint64_t param, hlt_timer_mgr* tmgr, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -447,6 +906,8 @@ void hlt_profiler_start(hlt_string tag, hlt_enum style, uint64_t param, hlt_time
     if ( ! ctx->pstate ) {
         ctx->pstate = hlt_malloc(sizeof(__hlt_profiler_state));
         ctx->pstate->profilers = kh_init(table);
+        ctx->pstate->aggrs = hlt_config_get()->profiling_aggregate ? kh_init(aggr) : 0;
+        ctx->pstate->last_flush = hlt_time_wall(excpt, ctx);
         ctx->pstate->fd = -1;
     }
 
@@ -476,19 +937,13 @@ void hlt_profiler_start(hlt_string tag, hlt_enum style, uint64_t param, hlt_time
         p->style = style;
         p->param = param;
 
+        p->aggr = ctx->pstate->aggrs ? get_aggr(tag, ctx) : 0;
         p->time = hlt_timer_mgr_current(p->tmgr, excpt, ctx);
         p->wall = hlt_time_wall(excpt, ctx);
-        p->heap = hlt_util_memory_usage();
+        p->heap = p->aggr ? 0 : hlt_util_memory_usage();
+        p->allocs = num_allocs();
 
-#ifdef HAVE_PAPI
-        long_long cnts[PAPI_NUM_EVENTS];
-        read_papi(cnts);
-        p->cycles = cnts[0];
-        p->cache = cnts[1];
-#else
-        p->cycles = 0;
-        p->cache = 0;
-#endif
+        read_counters(p->counters);
 
         p->level = 1;
         p->updates = 0;
@@ -633,9 +1088,9 @@ int hlt_profiler_file_open(const char* fname, time_t* t)
     return fd;
 }
 
-int hlt_profiler_file_read(int fd, char* tag, hlt_profiler_record* record)
+int hlt_profiler_file_read(int fd, char* tag, hlt_profiler_record* record, hlt_profiler_summary* summary)
 {
-    return read_record(fd, tag, record);
+    return read_record(fd, tag, record, summary);
 }
 
 void hlt_profiler_file_close(int fd)
@@ -14,7 +14,7 @@ extern void hlt_profiler_start(hlt_string tag, hlt_enum style, uint64_t param, h
 extern void hlt_profiler_update(hlt_string tag, uint64_t user_delta, hlt_exception** excpt, hlt_execution_context* ctx);
 extern void hlt_profiler_stop(hlt_string tag, hlt_exception** excpt, hlt_execution_context* ctx);
 
-extern void __hlt_profiler_state_delete(__hlt_profiler_state* state);
+extern void __hlt_profiler_state_delete(__hlt_profiler_state* state, hlt_execution_context* ctx);
 
 extern void __hlt_profiler_init();
 extern void __hlt_profiler_done();
@@ -27,12 +27,13 @@ extern void hlt_profiler_timer_expire(hlt_string tag, hlt_exception** excpt, hlt
 
 ////// Support for reading the profiling output.
 
-static const uint64_t HLT_PROFILER_VERSION = 1; // File format version.
+static const uint64_t HLT_PROFILER_VERSION = 2; // File format version.
 
 static const uint8_t  HLT_PROFILER_START    = 1;  // profiler.start
 static const uint8_t  HLT_PROFILER_UPDATE   = 2;  // profiler.update
 static const uint8_t  HLT_PROFILER_SNAPSHOT = 3;  // Snapshot condition triggered.
 static const uint8_t  HLT_PROFILER_STOP     = 4;  // profiler.stop
+static const uint8_t  HLT_PROFILER_SUMMARY  = 5;  // Aggregated intervals, followed by a histogram.
 
 // One profile record.
 typedef struct {
@@ -43,6 +44,8 @@ typedef struct {
     uint64_t updates;  // Number of update calls.
     uint64_t cycles;   // CPU cycles/
     uint64_t misses;   // Cache misses so far.
+    uint64_t instructions;  // Instructions retired.
+    uint64_t branch_misses; // Branch mispredictions.
     uint64_t alloced;  // Heap change.
     uint64_t heap;     // Memory allocated (RSS).
     uint64_t user;     // Value of user's counter.
@@ -51,8 +54,39 @@ typedef struct {
 
 static const int HLT_PROFILER_MAX_TAG_LENGTH = 256;
 
+// Number of buckets in a histogram of interval wall times. Values below 8
+// nsecs get a bucket each, larger ones 8 buckets per power of two.
+#define HLT_PROFILER_HIST_BUCKETS 496
+
+// The histogram following a HLT_PROFILER_SUMMARY record. The record itself
+// carries the totals of all intervals (start to stop) aggregated since the
+// previous summary for the same tag, with *ctime*/*cwall* giving the time of
+// writing and *time* the number of intervals.
+typedef struct {
+    uint64_t hist[HLT_PROFILER_HIST_BUCKETS]; // Number of intervals per bucket.
+} hlt_profiler_summary;
+
+// Returns the histogram bucket for an interval's wall time.
+static inline int hlt_profiler_hist_bucket(uint64_t wall)
+{
+    if ( wall < 8 )
+        return wall;
+
+    int msb = 63 - __builtin_clzll(wall);
+    return (msb - 2) * 8 + ((wall >> (msb - 3)) & 7);
+}
+
+// Returns the smallest wall time falling into a histogram bucket.
+static inline uint64_t hlt_profiler_hist_value(int bucket)
+{
+    if ( bucket < 8 )
+        return bucket;
+
+    return (uint64_t)(8 + bucket % 8) << (bucket / 8 - 1);
+}
+
 extern int hlt_profiler_file_open(const char* fname, time_t* t);
-extern int hlt_profiler_file_read(int fd, char* tag, hlt_profiler_record* record); // This returns ASCII.
+extern int hlt_profiler_file_read(int fd, char* tag, hlt_profiler_record* record, hlt_profiler_summary* summary); // This returns ASCII.
 extern void hlt_profiler_file_close(int fd);
 
 #endif
@@ -5,6 +5,8 @@
 #include "regexp.h"
 #include "string_.h"
 #include "memory_.h"
+#include "config.h"
+#include "debug.h"
 #include "autogen/hilti-hlt.h"
 
 struct __hlt_regexp {
@@ -12,7 +14,11 @@ struct __hlt_regexp {
     int32_t num; // Number of patterns in set.
     hlt_string* patterns;
     hlt_regexp_flags flags;
+    jrx_native_matcher native; // Matcher generated by the compiler, or null.
+    const void* precompiled; // Serialized DFAs generated by the compiler, or null.
+    int64_t precompiled_len; // Size of the serialized DFAs.
     jrx_regex_t regexp;
+    jrx_regex_t* nosub; // Capture-free version for locating matches, or null if not available.
 };
 
 struct __hlt_match_token_state {
@@ -41,8 +47,8 @@ static inline int _cflags(hlt_regexp_flags flags)
     return cflags | ((cflags & REG_NOSUB) ? REG_ANCHOR : 0);
 }
 
-// patter not net ref'ed.
-static void _compile_one(hlt_regexp* re, hlt_string pattern, int idx, int re_refed, hlt_exception** excpt, hlt_execution_context* ctx)
+// Adds a pattern to a jrx regexp.
+static void _add_pattern(jrx_regex_t* regexp, hlt_string pattern, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     // FIXME: For now, the pattern must contain only ASCII characters.
     hlt_bytes* p = hlt_string_encode(pattern, Hilti_Charset_ASCII, excpt, ctx);
@@ -54,11 +60,114 @@ static void _compile_one(hlt_regexp* re, hlt_string pattern, int idx, int re_ref
     int8_t* praw = hlt_bytes_to_raw(tmp, plen, p, excpt, ctx);
     assert(praw);
 
-    if ( jrx_regset_add(&re->regexp, (const char*)praw, plen) != 0 ) {
+    if ( jrx_regset_add(regexp, (const char*)praw, plen) != 0 )
         hlt_set_exception(excpt, &hlt_exception_pattern_error, pattern, ctx);
+}
+
+// Loads the compiler's precompiled DFAs if we have them. Returns false if
+// they can't be used, in which case the caller needs to compile the
+// patterns.
+static int _load_precompiled(hlt_regexp* re)
+{
+    if ( ! re->precompiled )
+        return 0;
+
+    // This fails if the data comes from a different version of justrx.
+    return jrx_regset_deserialize(&re->regexp, re->precompiled, re->precompiled_len) == REG_OK;
+}
+
+// For regexps capturing subgroups, compiles the patterns once more without
+// them. We then locate matches with the minimal matcher, and need the
+// standard matcher only for extracting groups from the part of the input
+// that matches. That doesn't work if the patterns use assertions, which the
+// minimal matcher doesn't support, or may match the empty input, which it
+// doesn't report.
+static void _compile_nosub(hlt_regexp* re, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    // Without REG_FIRST_MATCH, we get the same leftmost-longest match as
+    // the standard matcher.
+    jrx_regex_t* nosub = hlt_malloc(sizeof(jrx_regex_t));
+    jrx_regset_init(nosub, -1, _cflags(re->flags | HLT_REGEXP_NOSUB) & ~REG_FIRST_MATCH);
+
+    for ( int i = 0; i < re->num; i++ ) {
+        _add_pattern(nosub, re->patterns[i], excpt, ctx);
+
+        if ( hlt_check_exception(excpt) ) {
+            jrx_regfree(nosub);
+            hlt_free(nosub);
+            return;
+        }
+    }
+
+    jrx_regset_finalize(nosub);
+
+    if ( jrx_regset_has_assertions(nosub) || jrx_regset_matches_empty(nosub) ) {
+        jrx_regfree(nosub);
+        hlt_free(nosub);
         return;
     }
 
+    jrx_regset_prefilter(nosub);
+    jrx_regset_reverse(nosub);
+    jrx_regset_set_cache_limit(nosub, hlt_config_get()->regexp_cache_size);
+
+    re->nosub = nosub;
+}
+
+// Finalizes compilation and switches over to the compiler-generated matcher,
+// if we have one.
+static void _finalize(hlt_regexp* re, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    int loaded = _load_precompiled(re);
+
+    if ( ! loaded ) {
+        if ( re->precompiled ) {
+            // We skipped adding the patterns in anticipation of the
+            // precompiled DFAs.
+            for ( int i = 0; i < re->num; i++ ) {
+                _add_pattern(&re->regexp, re->patterns[i], excpt, ctx);
+
+                if ( hlt_check_exception(excpt) )
+                    return;
+            }
+        }
+
+        jrx_regset_finalize(&re->regexp);
+    }
+
+    if ( re->native ) {
+        // The compiler has checked that computing all states is feasible.
+        // Doing so gets us the same state IDs that the native code uses;
+        // precompiled DFAs come with all states computed already.
+        if ( ! loaded )
+            jrx_regset_compute_states(&re->regexp, 0);
+
+        jrx_regset_set_native_matcher(&re->regexp, re->native);
+    }
+
+    // Must come after the native matcher as these may compute further
+    // states.
+    jrx_regset_prefilter(&re->regexp);
+    jrx_regset_reverse(&re->regexp);
+
+    jrx_regset_set_cache_limit(&re->regexp, hlt_config_get()->regexp_cache_size);
+
+    if ( ! (re->regexp.cflags & REG_NOSUB) )
+        _compile_nosub(re, excpt, ctx);
+}
+
+// patter not net ref'ed.
+static void _compile_one(hlt_regexp* re, hlt_string pattern, int idx, int re_refed, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    // With precompiled DFAs, we need the pattern only if they turn out
+    // unusable; _finalize() adds it then.
+    if ( ! re->precompiled ) {
+        _add_pattern(&re->regexp, pattern, excpt, ctx);
+
+        if ( hlt_check_exception(excpt) )
+            return;
+    }
+
     if ( ! re_refed )
         GC_CCTOR(pattern, hlt_string, ctx);
 
@@ -74,6 +183,11 @@ void hlt_regexp_dtor(hlt_type_info* ti, hlt_regexp* re, hlt_execution_context* c
 
     if ( re->num > 0 )
         jrx_regfree(&re->regexp);
+
+    if ( re->nosub ) {
+        jrx_regfree(re->nosub);
+        hlt_free(re->nosub);
+    }
 }
 
 void hlt_match_token_state_dtor(hlt_type_info* ti, hlt_match_token_state* t, hlt_execution_context* ctx)
@@ -90,6 +204,10 @@ static inline void _hlt_regexp_init(hlt_regexp* re, hlt_regexp_flags flags, hlt_
     re->num = 0;
     re->patterns = 0;
     re->flags = flags;
+    re->native = 0;
+    re->precompiled = 0;
+    re->precompiled_len = 0;
+    re->nosub = 0;
 }
 
 hlt_regexp* hlt_regexp_new(hlt_regexp_flags flags, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -111,27 +229,38 @@ void hlt_regexp_clone_init(void* dstp, const hlt_type_info* ti, void* srcp, __hl
 
     dst->num = src->num;
     dst->flags = src->flags;
+    dst->native = src->native;
+    dst->precompiled = src->precompiled;
+    dst->precompiled_len = src->precompiled_len;
+    dst->nosub = 0;
     dst->patterns = hlt_malloc(src->num * sizeof(hlt_string));
 
     for ( int i = 0; i < src->num; i++ )
         __hlt_clone(&dst->patterns[i], &hlt_type_info_hlt_string, &src->patterns[i], cstate, excpt, ctx);
 
-    // TODO: Figure out a way to reuse the compiled regexp. Need to make that
-    // thread-safe though.
+    if ( ! src->num ) {
+        jrx_regset_init(&dst->regexp, -1, _cflags(dst->flags));
+        return;
+    }
 
-    jrx_regset_init(&dst->regexp, -1, _cflags(dst->flags));
+    // Rather than compiling the patterns again, we share the compiled form.
+    // justrx takes care of threads computing further DFA states
+    // concurrently.
+    jrx_regset_share(&dst->regexp, &src->regexp);
 
-    for ( int idx = 0; idx < dst->num; idx++ ) {
-        hlt_string pattern = dst->patterns[idx];
-        _compile_one(dst, pattern, idx, 1, excpt, ctx);
+    if ( src->nosub ) {
+        dst->nosub = hlt_malloc(sizeof(jrx_regex_t));
+        jrx_regset_share(dst->nosub, src->nosub);
     }
-
-    jrx_regset_finalize(&dst->regexp);
 }
 
 static void _hlt_regexp_new_from_regexp_init(hlt_regexp* dst, hlt_regexp* other, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     dst->flags = other->flags;
+    dst->native = 0; // Compiled for the other's flags.
+    dst->precompiled = 0;
+    dst->precompiled_len = 0;
+    dst->nosub = 0;
     dst->num = other->num;
     dst->patterns = hlt_malloc(dst->num * sizeof(hlt_string));
     jrx_regset_init(&dst->regexp, -1, _cflags(dst->flags));
@@ -144,7 +273,7 @@ static void _hlt_regexp_new_from_regexp_init(hlt_regexp* dst, hlt_regexp* other,
             return;
     }
 
-    jrx_regset_finalize(&dst->regexp);
+    _finalize(dst, excpt, ctx);
 }
 
 hlt_regexp* hlt_regexp_new_from_regexp(hlt_regexp* other, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -154,6 +283,27 @@ hlt_regexp* hlt_regexp_new_from_regexp(hlt_regexp* other, hlt_exception** excpt,
     return re;
 }
 
+void hlt_regexp_set_native_matcher(hlt_regexp* re, void* matcher, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( re->num != 0 ) {
+        hlt_set_exception(excpt, &hlt_exception_value_error, 0, ctx);
+        return;
+    }
+
+    re->native = (jrx_native_matcher)matcher;
+}
+
+void hlt_regexp_set_precompiled(hlt_regexp* re, void* data, int64_t len, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    if ( re->num != 0 || len <= 0 ) {
+        hlt_set_exception(excpt, &hlt_exception_value_error, 0, ctx);
+        return;
+    }
+
+    re->precompiled = data;
+    re->precompiled_len = len;
+}
+
 void hlt_regexp_compile(hlt_regexp* re, const hlt_string pattern, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     if ( re->num != 0 ) {
@@ -169,7 +319,7 @@ void hlt_regexp_compile(hlt_regexp* re, const hlt_string pattern, hlt_exception*
     if ( hlt_check_exception(excpt) )
 	return;
 
-    jrx_regset_finalize(&re->regexp);
+    _finalize(re, excpt, ctx);
 }
 
 void hlt_regexp_compile_set(hlt_regexp* re, hlt_list* patterns, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -198,7 +348,7 @@ void hlt_regexp_compile_set(hlt_regexp* re, hlt_list* patterns, hlt_exception**
         idx++;
     }
 
-    jrx_regset_finalize(&re->regexp);
+    _finalize(re, excpt, ctx);
 }
 
 hlt_string hlt_regexp_to_string(const hlt_type_info* type, const void* obj, int32_t options, __hlt_pointer_stack* seen, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -260,11 +410,91 @@ hlt_vector *hlt_regexp_string_groups(hlt_regexp* re, const hlt_string s, hlt_exc
 
 // Bytes versions.
 
+// Advances the prefilter to the next offset where a match may start and
+// returns that offset. Once the input is exhausted, returns the offset of
+// the trailing bytes that could still start a match if more data followed,
+// and turns prefiltering off so that the caller checks them one by one.
+//
+// end not yet ref'ed.
+static hlt_bytes_size _prefilter_next(jrx_regex_t* regexp, uint8_t* pstate,
+                                      hlt_iterator_bytes* scan, hlt_bytes_size* scan_offset,
+                                      const hlt_iterator_bytes end, int8_t* prefilter,
+                                      hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    hlt_bytes_block block;
+    void* cookie = 0;
+    hlt_bytes_size consumed = 0;
+
+    do {
+        cookie = hlt_bytes_iterate_raw(&block, cookie, *scan, end, excpt, ctx);
+
+        int block_len = block.end - block.start;
+        int i = jrx_prefilter_scan(regexp, pstate, (const char*)block.start, block_len);
+
+        if ( i >= 0 ) {
+            consumed += i + 1;
+            *scan = hlt_iterator_bytes_incr_by(*scan, consumed, excpt, ctx);
+            *scan_offset += consumed;
+            return *scan_offset - regexp->prefilter_len;
+        }
+
+        consumed += block_len;
+
+    } while ( cookie );
+
+    *scan = end;
+    *scan_offset += consumed;
+    *prefilter = 0;
+
+    return *scan_offset - jrx_prefilter_pending(regexp, *pstate);
+}
+
+// Locates the leftmost match by running the regexp's reverse DFA over all
+// of the input. Returns the offset where the match starts, or -1 if there's
+// none. In the latter case, sets partial to 1 if more input could still lead
+// to a match.
+//
+// begin/end not yet ref'ed.
+static hlt_bytes_size _search_reverse(jrx_regex_t* regexp, const hlt_iterator_bytes begin, const hlt_iterator_bytes end,
+                                      int8_t* partial, hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    hlt_bytes_block block;
+    void* cookie = 0;
+    int num_blocks = 0;
+
+    // Blocks are linked only forward, so we collect them first.
+    do {
+        cookie = hlt_bytes_iterate_raw(&block, cookie, begin, end, excpt, ctx);
+        ++num_blocks;
+    } while ( cookie );
+
+    hlt_bytes_block* blocks = hlt_malloc(num_blocks * sizeof(hlt_bytes_block));
+
+    int i = 0;
+    cookie = 0;
+
+    do {
+        cookie = hlt_bytes_iterate_raw(&block, cookie, begin, end, excpt, ctx);
+        blocks[i++] = block;
+    } while ( cookie );
+
+    jrx_reverse_state rs;
+    jrx_reverse_init(regexp, &rs);
+
+    for ( i = num_blocks - 1; i >= 0; i-- )
+        jrx_reverse_exec(regexp, (const char*)blocks[i].start, blocks[i].end - blocks[i].start, &rs);
+
+    hlt_free(blocks);
+
+    *partial = (rs.prefix >= 0);
+    return rs.match >= 0 ? rs.offset - rs.match : -1;
+}
+
 // Searches for the regexp at arbitrary starting positions and returns the
 // first match.
 //
 // begin/end not yet ref'ed.
-static jrx_accept_id _search_pattern(hlt_regexp* re, jrx_match_state* ms,
+static jrx_accept_id _search_pattern(jrx_regex_t* regexp, jrx_match_state* ms,
                                      const hlt_iterator_bytes begin, const hlt_iterator_bytes end,
                                      jrx_offset* so, jrx_offset* eo,
                                      int do_anchor, int find_partial_matches,
@@ -290,9 +520,14 @@ static jrx_accept_id _search_pattern(hlt_regexp* re, jrx_match_state* ms,
     // transitions possible after processing the last bytes). In this case,
     // the function returns -1 as if there wasn't any match yet.
 
-    // FIXME: In (2), we might be doing a bit more comparisions than with an
-    // implicit .*, and the manual loop also adds a bit overhead. That seems
-    // worth it but should reevaluate the trade-off later.
+    // In (2), restarting the matcher at each position may take quadratic
+    // time in the worst case. To reduce the number of starting positions,
+    // we use the regexp's prefilter if it has one. It tells us which bytes
+    // a match may begin with, and we only start the matcher at offsets where
+    // the input fits those. Beyond that, once we have fed the matcher more
+    // than a few times the input's size, we switch over to locating the
+    // leftmost match with the regexp's reverse DFA, which takes a single
+    // pass, and then run the matcher just from there.
 
     hlt_bytes_block block;
     jrx_assertion first = JRX_ASSERTION_BOL | JRX_ASSERTION_BOD;
@@ -303,29 +538,62 @@ static jrx_accept_id _search_pattern(hlt_regexp* re, jrx_match_state* ms,
     hlt_bytes_size offset = 0;
     int block_len = 0;
     int bytes_seen = 0;
+    int match_end = 0;
 
     hlt_iterator_bytes cur = begin;
 
-    int8_t stdmatcher = ! (re->regexp.cflags & REG_NOSUB);
+    int8_t stdmatcher = ! (regexp->cflags & REG_NOSUB);
+
+    assert( (! do_anchor) || (regexp->cflags & REG_NOSUB));
+
+    int8_t prefilter = (! stdmatcher) && (! do_anchor) && regexp->prefilter_len > 0;
+    uint8_t pstate = 0;
+    hlt_iterator_bytes scan = begin;
+    hlt_bytes_size scan_offset = 0;
 
-    assert( (! do_anchor) || (re->regexp.cflags & REG_NOSUB));
+    // How many bytes we feed the matcher before trying the reverse DFA; -1
+    // for never.
+    int64_t budget = -1;
+    int64_t bytes_fed = 0;
+
+    if ( (! stdmatcher) && (! do_anchor) && regexp->rdfa )
+        budget = 4 * hlt_iterator_bytes_diff(begin, end, excpt, ctx) + 256;
 
     if ( hlt_iterator_bytes_eq(cur, end, excpt, ctx) ) {
         // Nothing to do, but still need to init the match state.
-        jrx_match_state_init(&re->regexp, offset, ms);
+        jrx_match_state_init(regexp, offset, ms);
         return -1;
     }
 
     while ( acc <= 0 && ! hlt_iterator_bytes_eq(cur, end, excpt, ctx) ) {
 
+        if ( prefilter ) {
+            hlt_bytes_size next = _prefilter_next(regexp, &pstate, &scan, &scan_offset, end, &prefilter, excpt, ctx);
+
+            if ( next > offset ) {
+                cur = hlt_iterator_bytes_incr_by(cur, next - offset, excpt, ctx);
+                offset = next;
+                first = 0;
+
+                if ( hlt_iterator_bytes_eq(cur, end, excpt, ctx) ) {
+                    // No candidates left.
+                    if ( ! need_msdone )
+                        jrx_match_state_init(regexp, offset, ms);
+
+                    break;
+                }
+            }
+        }
+
         if ( need_msdone )
             jrx_match_state_done(ms);
 
         need_msdone = 1;
         cookie = 0;
         bytes_seen = 0;
+        match_end = 0;
 
-        jrx_match_state_init(&re->regexp, offset, ms);
+        jrx_match_state_init(regexp, offset, ms);
 
         while ( 1 ) {
             cookie = hlt_bytes_iterate_raw(&block, cookie, cur, end, excpt, ctx);
@@ -342,15 +610,33 @@ static jrx_accept_id _search_pattern(hlt_regexp* re, jrx_match_state* ms,
             print_bytes_raw((const char*)block.start, block_len, excpt, ctx);
             fprintf(stderr, "|\n");
 #endif
-            jrx_accept_id rc = jrx_regexec_partial(&re->regexp, (const char*)block.start, block_len, first, last, ms, fpm);
+            if ( ! stdmatcher )
+                // The minimal matcher reports where its latest accept ended
+                // only relative to where each call starts, so we track that
+                // across blocks ourselves.
+                ms->offset = bytes_seen + 1;
+
+            jrx_accept_id rc = jrx_regexec_partial(regexp, (const char*)block.start, block_len, first, last, ms, fpm);
+            // Only charge what the matcher looked at; it usually gives up
+            // long before the end of the block.
+            bytes_fed += ms->consumed;
+
+            if ( ! stdmatcher && ms->offset > bytes_seen + 1 )
+                // Accepted within this block.
+                match_end = ms->offset - 1;
 
 #ifdef _DEBUG_MATCHING
             fprintf(stderr, "rc=%d ms->offset=%d\n", rc, ms->offset);
 #endif
 
-            if ( rc == 0 )
-                // No further match.
-                return acc;
+            if ( rc == 0 ) {
+                if ( stdmatcher || do_anchor )
+                    // No further match.
+                    return acc;
+
+                // No match at this starting position, try the next.
+                break;
+            }
 
             if ( rc > 0 ) {
                 // Match.
@@ -362,17 +648,12 @@ static jrx_accept_id _search_pattern(hlt_regexp* re, jrx_match_state* ms,
                 if ( ! stdmatcher ) {
                     if ( so )
                         *so = offset;
-                    if ( eo ) {
-                        // FIXME: The match_state intializes the offset with
-                        // 1. Not sure why right now but changing that would
-                        // probably break other things we adjust that here
-                        // for the calculation.
-                        *eo = offset + ms->offset - 1;
-                    }
+                    if ( eo )
+                        *eo = offset + match_end;
                 }
                 else if ( so || eo ) {
                     jrx_regmatch_t pmatch;
-                    jrx_reggroups(&re->regexp, ms, 1, &pmatch);
+                    jrx_reggroups(regexp, ms, 1, &pmatch);
 
                     if ( so )
                         *so = pmatch.rm_so;
@@ -402,11 +683,56 @@ static jrx_accept_id _search_pattern(hlt_regexp* re, jrx_match_state* ms,
 
         offset++;
         first = 0;
+
+        if ( budget >= 0 && bytes_fed > budget && ! hlt_iterator_bytes_eq(cur, end, excpt, ctx) ) {
+            DBG_LOG("hilti-regexp", "search exceeded its budget at offset %" PRId64 ", running reverse DFA", offset);
+
+            int8_t partial = 0;
+            hlt_bytes_size start = _search_reverse(regexp, begin, end, &partial, excpt, ctx);
+
+            budget = -1;
+
+            if ( start < 0 ) {
+                // No match anywhere.
+                if ( partial )
+                    acc = -1;
+
+                break;
+            }
+
+            // We've already ruled out all earlier positions.
+            assert(start >= offset);
+
+            cur = hlt_iterator_bytes_incr_by(cur, start - offset, excpt, ctx);
+            offset = start;
+            prefilter = 0;
+        }
     }
 
     return acc;
 }
 
+// Searches for the first match, using the capture-free version of the regexp
+// if we have one.
+//
+// begin/end not yet ref'ed.
+static jrx_accept_id _search_nosub(hlt_regexp* re, const hlt_iterator_bytes begin, const hlt_iterator_bytes end,
+                                   jrx_offset* so, jrx_offset* eo,
+                                   hlt_exception** excpt, hlt_execution_context* ctx)
+{
+    jrx_match_state ms;
+    jrx_regex_t* regexp = re->nosub ? re->nosub : &re->regexp;
+    jrx_accept_id acc = _search_pattern(regexp, &ms, begin, end, so, eo, 0, 1, excpt, ctx);
+    jrx_match_state_done(&ms);
+
+    if ( re->nosub && acc <= 0 )
+        // With its implicit ".*", the standard matcher always considers
+        // more input as potentially matching.
+        acc = -1;
+
+    return acc;
+}
+
 int32_t hlt_regexp_bytes_find(hlt_regexp* re, const hlt_iterator_bytes begin, const hlt_iterator_bytes end, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     if ( ! re->num ) {
@@ -414,10 +740,7 @@ int32_t hlt_regexp_bytes_find(hlt_regexp* re, const hlt_iterator_bytes begin, co
         return 0;
     }
 
-    jrx_match_state ms;
-    jrx_accept_id acc = _search_pattern(re, &ms, begin, end, 0, 0, 0, 1, excpt, ctx);
-    jrx_match_state_done(&ms);
-    return acc;
+    return _search_nosub(re, begin, end, 0, 0, excpt, ctx);
 }
 
 hlt_regexp_span hlt_regexp_bytes_span(hlt_regexp* re, const hlt_iterator_bytes begin, const hlt_iterator_bytes end, hlt_exception** excpt, hlt_execution_context* ctx)
@@ -431,9 +754,7 @@ hlt_regexp_span hlt_regexp_bytes_span(hlt_regexp* re, const hlt_iterator_bytes b
 
     jrx_offset so = -1;
     jrx_offset eo = -1;
-    jrx_match_state ms;
-    result.rc = _search_pattern(re, &ms, begin, end, &so, &eo, 0, 1, excpt, ctx);
-    jrx_match_state_done(&ms);
+    result.rc = _search_nosub(re, begin, end, &so, &eo, excpt, ctx);
 
     if ( result.rc > 0 ) {
         result.span.begin = hlt_iterator_bytes_incr_by(begin, so, excpt, ctx);
@@ -470,8 +791,38 @@ hlt_vector *hlt_regexp_bytes_groups(hlt_regexp* re, const hlt_iterator_bytes beg
 
     jrx_offset so = -1;
     jrx_offset eo = -1;
+    jrx_offset base = 0;
     jrx_match_state ms;
-    int8_t rc = _search_pattern(re, &ms, begin, end, &so, &eo, 0, 1, excpt, ctx);
+    int8_t rc = 0;
+
+    if ( re->nosub ) {
+        // Locate the match first, then run the standard matcher only over
+        // that part of the input to extract the groups.
+        if ( _search_nosub(re, begin, end, &so, &eo, excpt, ctx) <= 0 )
+            return vec;
+
+        hlt_iterator_bytes mbegin = hlt_iterator_bytes_incr_by(begin, so, excpt, ctx);
+        hlt_iterator_bytes mend = hlt_iterator_bytes_incr_by(mbegin, eo - so, excpt, ctx);
+
+        jrx_offset mso = -1;
+        jrx_offset meo = -1;
+        rc = _search_pattern(&re->regexp, &ms, mbegin, mend, &mso, &meo, 0, 1, excpt, ctx);
+
+        if ( rc > 0 && mso == 0 && meo == eo - so )
+            base = so;
+
+        else {
+            // The standard matcher's tags don't always settle on the
+            // leftmost-longest match. If it picked something else within
+            // the match, we stay with what it finds across all the input
+            // for consistency.
+            jrx_match_state_done(&ms);
+            rc = 0;
+        }
+    }
+
+    if ( rc <= 0 )
+        rc = _search_pattern(&re->regexp, &ms, begin, end, &so, &eo, 0, 1, excpt, ctx);
 
     if ( rc > 0 ) {
         _set_group(vec, begin, 0, so, eo, excpt, ctx);
@@ -485,7 +836,7 @@ hlt_vector *hlt_regexp_bytes_groups(hlt_regexp* re, const hlt_iterator_bytes beg
 
         for ( int i = 1; i < num_groups; i++ ) {
             if ( pmatch[i].rm_so >= 0 )
-                _set_group(vec, begin, i, pmatch[i].rm_so, pmatch[i].rm_eo, excpt, ctx);
+                _set_group(vec, begin, i, base + pmatch[i].rm_so, base + pmatch[i].rm_eo, excpt, ctx);
         }
     }
 
@@ -587,6 +938,26 @@ static void _match_token_finish(hlt_match_token_state* state, jrx_offset* eo,
    jrx_match_state_done(&state->ms);
 }
 
+hlt_regexp_stats hlt_regexp_statistics(hlt_regexp* re)
+{
+    jrx_cache_stats cs;
+    jrx_regset_cache_stats(&re->regexp, &cs);
+
+    hlt_regexp_stats stats;
+    stats.hits = cs.hits;
+    stats.misses = cs.misses;
+    stats.flushes = cs.flushes;
+
+    if ( re->nosub ) {
+        jrx_regset_cache_stats(re->nosub, &cs);
+        stats.hits += cs.hits;
+        stats.misses += cs.misses;
+        stats.flushes += cs.flushes;
+    }
+
+    return stats;
+}
+
 hlt_regexp_match_token hlt_regexp_bytes_match_token(hlt_regexp* re, const hlt_iterator_bytes begin, const hlt_iterator_bytes end, hlt_exception** excpt, hlt_execution_context* ctx)
 {
     if ( ! re->num ) {
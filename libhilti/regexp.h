@@ -37,6 +37,13 @@ typedef struct {
     hlt_iterator_bytes end;
 } hlt_regexp_match_token;
 
+/// Statistics about the DFA states a regexp computes lazily while matching.
+typedef struct {
+    uint64_t hits;    /// Number of state lookups finding the state already computed (not counted once shared across threads).
+    uint64_t misses;  /// Number of state lookups having to compute the state.
+    uint64_t flushes; /// Number of times the states have been discarded for exceeding ~~hlt_config.regexp_cache_size.
+} hlt_regexp_stats;
+
 /// Instantiates a new Regexp instance.
 ///
 /// flags: The compilation flags for the regexp.
@@ -58,6 +65,37 @@ extern hlt_regexp* hlt_regexp_new(hlt_regexp_flags flags, hlt_exception** excpt,
 /// Returns: The new Regexp instance.
 extern hlt_regexp* hlt_regexp_new_from_regexp(hlt_regexp* other, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Installs a matcher that the HILTI compiler has generated from the DFA
+/// of the patterns that will subsequently be compiled into the regexp. The
+/// generated code will then be used instead of interpreting the DFA.
+///
+/// re: The regexp instance, which must not have any patterns compiled yet.
+///
+/// matcher: A function of type ``jrx_native_matcher``.
+///
+/// excpt: &
+///
+/// Raises: ~~hlt_exception_value_error - If a pattern was already compiled into *re*.
+extern void hlt_regexp_set_native_matcher(hlt_regexp* re, void* matcher, hlt_exception** excpt, hlt_execution_context* ctx);
+
+/// Installs DFAs that the HILTI compiler has precomputed for the patterns
+/// that will subsequently be compiled into the regexp, as returned by
+/// ``jrx_regset_serialize``. Compiling then loads them instead of building
+/// the DFAs at run-time. If the data turns out unusable, e.g., because it
+/// comes from a different version of the regexp library, compiling falls
+/// back to building the DFAs from the patterns.
+///
+/// re: The regexp instance, which must not have any patterns compiled yet.
+///
+/// data: The serialized DFAs. They must remain valid for the lifetime of the process.
+///
+/// len: The size of *data*.
+///
+/// excpt: &
+///
+/// Raises: ~~hlt_exception_value_error - If a pattern was already compiled into *re*, or *len* isn't positive.
+extern void hlt_regexp_set_precompiled(hlt_regexp* re, void* data, int64_t len, hlt_exception** excpt, hlt_execution_context* ctx);
+
 /// Compiles a pattern.
 ///
 /// re: The regexp instance to compile the pattern into. An already compiled
@@ -173,6 +211,10 @@ extern hlt_vector *hlt_regexp_string_groups(hlt_regexp* re, hlt_string s, hlt_ex
 /// The index 0 corresponds to the whole expression, index 1 to the first
 /// subexpression etc. If not match is found, the returned vector is empty.
 ///
+/// Note: Unless the pattern uses assertions or may match the empty input,
+/// the match is located without tracking subexpressions first, which then
+/// get extracted from just the matching bytes.
+///
 /// Raises: ~~hlt_exception_value_error - If no pattern has been compiled for *re* yet.
 ///
 /// Todo: This function does not yet support sets as compiled via ~~hlt_regexp_compile_set.
@@ -193,6 +235,15 @@ hlt_string hlt_regexp_to_string(const hlt_type_info* type, const void* obj, int3
 /// the caller, who needs to call hlt_free() once done.
 char* hlt_regexp_to_asciiz(hlt_regexp* re, hlt_exception** excpt, hlt_execution_context* ctx);
 
+/// Returns statistics about the DFA states a regexp has computed so far.
+///
+/// re: The regexp.
+///
+/// \hlt_c.
+///
+/// Returns: The statistics.
+extern hlt_regexp_stats hlt_regexp_statistics(hlt_regexp* re);
+
 /// TODO: Document.
 extern hlt_regexp_match_token hlt_regexp_bytes_match_token(hlt_regexp* re, const hlt_iterator_bytes begin, const hlt_iterator_bytes end, hlt_exception** excpt, hlt_execution_context* ctx);
 
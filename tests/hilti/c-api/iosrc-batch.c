@@ -0,0 +1,58 @@
+/*
+
+@TEST-EXEC:  cp %DIR/../iosrc/trace.pcap .
+@TEST-EXEC:  hilti-build -v %INPUT -o a.out
+@TEST-EXEC:  ./a.out >output 2>&1
+@TEST-EXEC:  btest-diff output
+
+*/
+
+#include <stdio.h>
+
+#include <libhilti.h>
+
+int main()
+{
+    hlt_init();
+
+    hlt_execution_context* ctx = hlt_global_execution_context();
+    hlt_exception* e = 0;
+
+    hlt_string fname = hlt_string_from_asciiz("trace.pcap", &e, ctx);
+    hlt_iosrc* src = hlt_iosrc_new_offline(fname, &e, ctx);
+
+    hlt_packet pkts[4];
+    int64_t total = 0;
+
+    while ( 1 ) {
+        int64_t n = hlt_iosrc_read_batch(src, 0, pkts, 4, &e, ctx);
+
+        if ( e ) {
+            printf("exception\n");
+            return 1;
+        }
+
+        if ( ! n )
+            break;
+
+        printf("batch of %ld:", n);
+
+        int64_t i;
+        for ( i = 0; i < n; i++ )
+            printf(" %ld", hlt_bytes_len(pkts[i].data, &e, ctx));
+
+        printf("\n");
+        total += n;
+    }
+
+    printf("total %ld\n", total);
+
+    hlt_iosrc_read_batch(src, 0, pkts, 4, &e, ctx);
+    printf("%s\n", e ? "exception" : "no-exception");
+
+    hlt_iosrc_close(src, &e, ctx);
+    hlt_iosrc_read_batch(src, 0, pkts, 4, &e, ctx);
+    printf("%s\n", e ? "exception" : "no-exception");
+
+    return 0;
+}
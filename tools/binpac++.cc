@@ -35,6 +35,7 @@ static struct option long_options[] = {
     { "optimize", no_argument, 0, 'O' },
     { "add-stdlibs", no_argument, 0, 's' },
     { "compose", no_argument, 0, 'c' },
+    { "report-times", required_argument, 0, 'R' },
     { 0, 0, 0, 0 }
 };
 
@@ -61,6 +62,7 @@ void usage()
             "  -l | --llvm           Output the final LLVM code.\n"
             "  -O | --optimize       Optimize generated code (for -l         [Default: off].\n"
             "  -P | --prototypes     Generate C API prototypes for generated module.\n"
+            "  -R | --report-times <file> Write time and memory per compilation pass as JSON to <file> ('-' for stderr).\n"
             "  -s | --add-stdlibs    Add standard HILTI runtime libraries (for -l).\n"
             "  -t | --type <t>       Type of code to generate: parse/compose/both [Default: parse].\n"
             "\n";
@@ -88,7 +90,7 @@ int main(int argc, char** argv)
     options->generate_composers = false;
 
     while ( true ) {
-        int c = getopt_long(argc, argv, "AcCdD:o:nOPWlspI:vht:", long_options, 0);
+        int c = getopt_long(argc, argv, "AcCdD:o:nOPWlspI:vht:R:", long_options, 0);
 
         if ( c < 0 )
             break;
@@ -177,6 +179,10 @@ int main(int argc, char** argv)
 
             break;
 
+         case 'R':
+            options->report_times = optarg;
+            break;
+
          case 'h':
             usage();
             return 0;
@@ -233,6 +239,7 @@ int main(int argc, char** argv)
 
         if ( output_prototypes ) {
             ctx->hiltiContext()->generatePrototypes(hilti_module, out);
+            ctx->hiltiContext()->writeTimesReport();
             return 0;
         }
 
@@ -272,6 +279,7 @@ int main(int argc, char** argv)
             return 1;
         }
 
+        ctx->hiltiContext()->writeTimesReport();
         return 0;
     }
 
@@ -280,5 +288,6 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    ctx->hiltiContext()->writeTimesReport();
     return 0;
 }
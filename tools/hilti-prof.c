@@ -1,13 +1,25 @@
 //
-// Converts a HILTI profiling file into readable output.
+// Converts a HILTI profiling file into readable output. With -m, merges the
+// intervals of any number of files into one summary per tag instead.
 
 #include <libhilti.h>
 
 int optPretty = 1;
 
+// Intervals merged for one tag.
+typedef struct {
+    char* tag;
+    hlt_profiler_record totals; // With the number of intervals in *time*.
+    hlt_profiler_summary summary;
+} Merged;
+
+static Merged* merged = 0;
+static int num_merged = 0;
+
 static void usage()
 {
     fprintf(stderr, "hilti-prof <hlt-prof.dat>\n");
+    fprintf(stderr, "hilti-prof -m <hlt-prof.dat> [<hlt-prof.dat> ...]\n");
     exit(1);
 }
 
@@ -26,6 +38,8 @@ static void printHeader(time_t t)
         "alloced "
         "heap "
         "user "
+        "instructions "
+        "branch_misses "
         "\n",
         stdout
         );
@@ -50,6 +64,9 @@ static const char* fmtType(int8_t type)
 
       case HLT_PROFILER_STOP:
         return "E";
+
+      case HLT_PROFILER_SUMMARY:
+        return "A";
     }
 
     fprintf(stderr, "unknown snapshot type %d\n", type);
@@ -58,12 +75,164 @@ static const char* fmtType(int8_t type)
 
 static void printRecord(const char* tag, const hlt_profiler_record* rec)
 {
-    printf("%" PRIu64 " %" PRIu64 " %s %s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
-           rec->ctime, rec->cwall, tag, fmtType(rec->type), rec->time, rec->wall, rec->updates, rec->cycles, rec->misses, rec->alloced, rec->heap, rec->user);
+    printf("%" PRIu64 " %" PRIu64 " %s %s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+           rec->ctime, rec->cwall, tag, fmtType(rec->type), rec->time, rec->wall, rec->updates, rec->cycles, rec->misses, rec->alloced, rec->heap, rec->user,
+           rec->instructions, rec->branch_misses);
+}
+
+static Merged* lookupMerged(const char* tag)
+{
+    for ( int i = 0; i < num_merged; i++ ) {
+        if ( strcmp(merged[i].tag, tag) == 0 )
+            return &merged[i];
+    }
+
+    merged = realloc(merged, (num_merged + 1) * sizeof(Merged));
+
+    if ( ! merged ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    Merged* m = &merged[num_merged++];
+    memset(m, 0, sizeof(Merged));
+    m->tag = strdup(tag);
+    return m;
+}
+
+// Folds a record into the merged intervals. Summaries are added up, and
+// stop records count as a single interval each. Other records don't
+// describe complete intervals and are skipped.
+static void mergeRecord(const char* tag, const hlt_profiler_record* rec, const hlt_profiler_summary* summary)
+{
+    if ( rec->type != HLT_PROFILER_SUMMARY && rec->type != HLT_PROFILER_STOP )
+        return;
+
+    Merged* m = lookupMerged(tag);
+
+    m->totals.time += (rec->type == HLT_PROFILER_SUMMARY ? rec->time : 1);
+    m->totals.wall += rec->wall;
+    m->totals.updates += rec->updates;
+    m->totals.cycles += rec->cycles;
+    m->totals.misses += rec->misses;
+    m->totals.instructions += rec->instructions;
+    m->totals.branch_misses += rec->branch_misses;
+    m->totals.alloced += rec->alloced;
+    m->totals.user += rec->user;
+
+    if ( rec->type == HLT_PROFILER_SUMMARY ) {
+        for ( int i = 0; i < HLT_PROFILER_HIST_BUCKETS; i++ )
+            m->summary.hist[i] += summary->hist[i];
+    }
+
+    else
+        ++m->summary.hist[hlt_profiler_hist_bucket(rec->wall)];
+}
+
+// Returns the smallest wall time such that at least a fraction *q* of the
+// intervals took no longer than that, to the resolution of the histogram.
+static uint64_t quantile(const Merged* m, double q)
+{
+    uint64_t need = (uint64_t)(q * m->totals.time + 0.5);
+    uint64_t seen = 0;
+
+    for ( int i = 0; i < HLT_PROFILER_HIST_BUCKETS; i++ ) {
+        seen += m->summary.hist[i];
+
+        if ( seen && seen >= need )
+            return hlt_profiler_hist_value(i);
+    }
+
+    return 0;
+}
+
+static int cmpMerged(const void* a, const void* b)
+{
+    uint64_t wa = ((const Merged*)a)->totals.wall;
+    uint64_t wb = ((const Merged*)b)->totals.wall;
+
+    if ( wa != wb )
+        return wa > wb ? -1 : 1;
+
+    return strcmp(((const Merged*)a)->tag, ((const Merged*)b)->tag);
+}
+
+static void printMerged()
+{
+    qsort(merged, num_merged, sizeof(Merged), cmpMerged);
+
+    fputs("#! "
+        "tag "
+        "count "
+        "wall "
+        "mean "
+        "p50 "
+        "p99 "
+        "updates "
+        "cycles "
+        "misses "
+        "allocs "
+        "user "
+        "instructions "
+        "branch_misses "
+        "\n",
+        stdout
+        );
+
+    for ( int i = 0; i < num_merged; i++ ) {
+        const Merged* m = &merged[i];
+        const hlt_profiler_record* r = &m->totals;
+
+        printf("%s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+               m->tag, r->time, r->wall, r->time ? r->wall / r->time : 0, quantile(m, 0.5), quantile(m, 0.99),
+               r->updates, r->cycles, r->misses, r->alloced, r->user, r->instructions, r->branch_misses);
+    }
+}
+
+static int mergeFile(const char* fname)
+{
+    int fd = hlt_profiler_file_open(fname, 0);
+
+    if ( fd < 0 ) {
+        fprintf(stderr, "error opening input file %s\n", fname);
+        return 0;
+    }
+
+    char tag[HLT_PROFILER_MAX_TAG_LENGTH];
+    hlt_profiler_record rec;
+    hlt_profiler_summary summary;
+
+    while ( 1 ) {
+        int ret = hlt_profiler_file_read(fd, tag, &rec, &summary);
+
+        if ( ret == 0 )
+            // Eof.
+            break;
+
+        if ( ret < 0 ) {
+            perror("cannot read profiler record");
+            return 0;
+        }
+
+        mergeRecord(tag, &rec, &summary);
+    }
+
+    hlt_profiler_file_close(fd);
+    return 1;
 }
 
 int main(int argc, char** argv)
 {
+    if ( argc >= 3 && strcmp(argv[1], "-m") == 0 ) {
+        for ( int i = 2; i < argc; i++ ) {
+            if ( ! mergeFile(argv[i]) )
+                return 1;
+        }
+
+        printMerged();
+        return 0;
+    }
+
     if ( argc != 2 )
         usage();
 
@@ -82,7 +251,7 @@ int main(int argc, char** argv)
 
     while ( 1 ) {
 
-        int ret = hlt_profiler_file_read(fd, tag, &rec);
+        int ret = hlt_profiler_file_read(fd, tag, &rec, 0);
 
         if ( ret == 0 )
             // Eof.
@@ -38,10 +38,18 @@ static struct option long_options[] = {
     { "output",  required_argument, 0, 'o' },
     { "version", no_argument, 0, 'v' },
     { "profile", no_argument, 0, 'F' },
+    { "profile-functions", no_argument, 0, 'f' },
+    { "pgo-instrument", no_argument, 0, 'g' },
+    { "pgo-profile", required_argument, 0, 'u' },
     { "jit", no_argument, 0, 'j' },
+    { "jit-symbols", required_argument, 0, 'J' },
+    { "tiered", no_argument, 0, 't' },
     { "opt", required_argument, 0, 'O' },
     { "add-stdlibs", no_argument, 0, 's' },
     { "disable-linker", no_argument, 0, 'C' },
+    { "report-times", required_argument, 0, 'R' },
+    { "jobs", required_argument, 0, 'T' },
+    { "module-cache", required_argument, 0, 'k' },
     { 0, 0, 0, 0 }
 };
 
@@ -49,6 +57,8 @@ void usage()
 {
     auto dbglist = hilti::Options().cgDebugLabels();
     auto dbgstr = util::strjoin(dbglist.begin(), dbglist.end(), "/");
+    auto symlist = hilti::Options().jitSymbolLabels();
+    auto symstr = util::strjoin(symlist.begin(), symlist.end(), "/");
 
     cerr << "Usage: " << Name << " [options] <inputs> [ - <options for JIT main()> ]\n"
             "\n"
@@ -61,10 +71,15 @@ void usage()
             "  -d | --debug          Debug level. Each time increases level. [Default: 0]\n"
             "  -D | --cgdebug <type> Debug output during code generation; type can be " << dbgstr << ".\n"
             "  -F | --profile        Profile level. Each time increases level. [Default: 0]\n"
+            "  -f | --profile-functions Instrument all functions for function-level profiling.\n"
+            "  -g | --pgo-instrument Instrument all functions to record a profile for PGO into hlt-pgo.prof.\n"
+            "  -u | --pgo-profile <file> Use a profile recorded with -g to guide optimization.\n"
             "  -h | --help           Print usage information.\n"
             "  -l | --llvm           Output the final LLVM assembly.\n"
 #ifndef HILTIC_NO_JIT
             "  -j | --jit            JIT the final LLVM bitcode to native code and execute main().\n"
+            "  -J | --jit-symbols <type> Announce JITed functions to external tools; type can be " << symstr << ".\n"
+            "  -t | --tiered         With -j and -O, start unoptimized and optimize hot functions in the background.\n"
 #endif
             "  -s | --add-stdlibs    Add standard HILTI runtime libraries (implied with -j).\n"
             "  -L | --llvm-always    Like -l, but don't verify correctness first.\n"
@@ -77,6 +92,9 @@ void usage()
             "  -W | --print-always   Like -p, but don't verify correctness first.\n"
             "  -I | --import <dir>   Search library files in <dir>. Can be given multiple times.\n"
             "  -C | --disable-linker Don't run code through the custom HILTI linker; can only be used with one module.\n"
+            "  -R | --report-times <file> Write time and memory per compilation pass as JSON to <file> ('-' for stderr).\n"
+            "  -T | --jobs <n>       Generate code for multiple modules with <n> threads; 0 for one per core. [Default: 1]\n"
+            "  -k | --module-cache <dir> Cache compiled modules in <dir> and reuse them across runs.\n"
             "  -v | --version        Print version information.\n"
             "\n";
 }
@@ -123,7 +141,7 @@ llvm::Module* loadLLVM(const string& path)
     return module;
 }
 
-llvm::Module* compileHILTI(std::shared_ptr<hilti::CompilerContext> ctx, string path)
+shared_ptr<hilti::Module> loadHILTI(std::shared_ptr<hilti::CompilerContext> ctx, string path)
 {
     auto module = ctx->loadModule(path);
 
@@ -133,6 +151,13 @@ llvm::Module* compileHILTI(std::shared_ptr<hilti::CompilerContext> ctx, string p
     if ( dump_ast )
         ctx->dump(module, cerr);
 
+    return module;
+}
+
+llvm::Module* compileHILTI(std::shared_ptr<hilti::CompilerContext> ctx, string path)
+{
+    auto module = loadHILTI(ctx, path);
+
     if ( output_hilti ) {
         ofstream out;
         openOutputStream(out, output);
@@ -198,6 +223,9 @@ bool runJIT(shared_ptr<hilti::CompilerContext> ctx, llvm::Module* module, std::l
     if ( ! libmain )
         error(0, "internal error: no __libhilti_main in compiled module");
 
+    // Report only on compilation, not on running the code.
+    ctx->writeTimesReport();
+
     // Create argv[] for the main() function we'll call.
     int argc = jitargs.size() + 1;
     const char *argv[argc + 1];
@@ -222,7 +250,7 @@ int main(int argc, char** argv)
     shared_ptr<hilti::Options> options = std::make_shared<hilti::Options>();
 
     while ( true ) {
-        int c = getopt_long(argc, argv, "AdD:hjpcFPWbClLsVo:OvI:", long_options, 0);
+        int c = getopt_long(argc, argv, "AdD:hjJ:tpcFfgu:PWbClLsVo:OvI:R:T:k:", long_options, 0);
 
         if ( c < 0 )
             break;
@@ -245,6 +273,14 @@ int main(int argc, char** argv)
             options->cg_debug.insert(optarg);
             break;
 
+         case 'J':
+            options->jit_symbols.insert(optarg);
+            break;
+
+         case 't':
+            options->tiered = true;
+            break;
+
          case 'o':
             output = optarg;
             break;
@@ -298,6 +334,30 @@ int main(int argc, char** argv)
             ++options->profile;
             break;
 
+         case 'f':
+            options->profile_functions = true;
+            break;
+
+         case 'g':
+            options->pgo_instrument = true;
+            break;
+
+         case 'u':
+            options->pgo_profile = optarg;
+            break;
+
+         case 'T':
+            options->jobs = atoi(optarg);
+            break;
+
+         case 'R':
+            options->report_times = optarg;
+            break;
+
+         case 'k':
+            options->module_cache = optarg;
+            break;
+
          case 'j':
             options->jit = true;
             add_stdlibs = true;
@@ -372,11 +432,22 @@ int main(int argc, char** argv)
 
     auto ctx = std::make_shared<hilti::CompilerContext>(options);
 
+    // With multiple jobs, we compile all HILTI modules at once at the end,
+    // leaving a null placeholder here for now to keep their order.
+    bool batch = (options->jobs != 1 && ! (output_hilti || output_llvm_individually || output_prototypes));
+    std::list<shared_ptr<hilti::Module>> hilti_modules;
+
     // Go through input files and prepare LLVM modules.
     for ( auto input : inputs ) {
 
         llvm::Module* module = 0;
 
+        if ( util::endsWith(input, ".hlt") && batch ) {
+            hilti_modules.push_back(loadHILTI(ctx, input));
+            modules.push_back(nullptr);
+            continue;
+        }
+
         if ( util::endsWith(input, ".hlt") )
             module = compileHILTI(ctx, input);
 
@@ -398,9 +469,25 @@ int main(int argc, char** argv)
             modules.push_back(module);
     }
 
-    if ( output_hilti || output_llvm_individually || output_prototypes )
+    if ( output_hilti || output_llvm_individually || output_prototypes ) {
         // Done.
+        ctx->writeTimesReport();
         return 0;
+    }
+
+    if ( hilti_modules.size() ) {
+        auto compiled = ctx->compile(hilti_modules);
+
+        if ( compiled.empty() )
+            error("", "Aborting due to code generation error.");
+
+        for ( auto& m : modules ) {
+            if ( ! m ) {
+                m = compiled.front();
+                compiled.pop_front();
+            }
+        }
+    }
 
     if ( modules.size() == 0 )
         error("", "Nothing to link.");
@@ -433,5 +520,7 @@ int main(int argc, char** argv)
     if ( output_bitcode )
         ctx->writeBitcode(linked_module, out);
 
+    ctx->writeTimesReport();
+
     return 0;
 }
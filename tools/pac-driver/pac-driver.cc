@@ -118,6 +118,9 @@ static void usage(const char* prog)
     fprintf(stderr, "    -D <type>     Debug output during code generation; type can be %s\n", dbgstr.c_str());
     fprintf(stderr, "    -O            Optimize generated code.             [Default: off].\n");
     fprintf(stderr, "    -C            Use module cache.                    [Default: off].\n");
+    fprintf(stderr, "    -F            Instrument functions for function-level profiling.\n");
+    fprintf(stderr, "    -G            Instrument functions to record a PGO profile into hlt-pgo.prof.\n");
+    fprintf(stderr, "    -u <file>     Use a profile recorded with -G to guide optimization.\n");
 #endif
     fprintf(stderr, "\n");
 
@@ -574,7 +577,7 @@ int main(int argc, char** argv)
 #endif
 
     char ch;
-    while ((ch = getopt(argc, argv, "i:p:t:v:s:dOBhD:UlTPgCI:e:m:c")) != -1) {
+    while ((ch = getopt(argc, argv, "i:p:t:v:s:dOBhD:UlTPgCFGu:I:e:m:c")) != -1) {
 
         switch (ch) {
 
@@ -660,6 +663,18 @@ int main(int argc, char** argv)
          case 'C':
             options->module_cache = ".cache";
             break;
+
+         case 'F':
+            options->profile_functions = true;
+            break;
+
+         case 'G':
+            options->pgo_instrument = true;
+            break;
+
+         case 'u':
+            options->pgo_profile = optarg;
+            break;
 #endif
 
           case 'h':
@@ -2,6 +2,7 @@
 #include <algorithm>
 
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <execinfo.h>
 
@@ -407,6 +408,20 @@ double util::currentTime()
     return double(tv.tv_sec) + double(tv.tv_usec) / 1e6;
 }
 
+uint64_t util::maxResidentSetSize()
+{
+    struct rusage ru;
+
+    if ( getrusage(RUSAGE_SELF, &ru) < 0 )
+        return 0;
+
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024; // Bytes.
+#else
+    return ru.ru_maxrss;
+#endif
+}
+
 std::string util::toIdentifier(const string& s, bool ensure_non_keyword)
 {
     static char const* const hex = "0123456789abcdef";
@@ -147,6 +147,9 @@ extern string toIdentifier(const string& s, bool ensure_non_keyword = false);
 /// Returns the curren time in seconds since the epoch.
 extern double currentTime();
 
+/// Returns the peak resident set size of the process so far, in kilobytes.
+extern uint64_t maxResidentSetSize();
+
 extern bool pathExists(const string& path);
 extern bool pathIsFile(const string& path);
 extern bool pathIsDir(const string& path);